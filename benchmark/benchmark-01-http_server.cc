@@ -20,8 +20,9 @@ int main(int argc, char ** argv)
 	size_t pollers;
 	unsigned short port;
 	size_t length;
+	size_t affinity = COMM_HANDLER_SHARED;
 
-	if (parse_args(argc, argv, pollers, port, length) != 3)
+	if (parse_args(argc, argv, pollers, port, length, affinity) < 3)
 	{
 		return -1;
 	}
@@ -31,6 +32,7 @@ int main(int argc, char ** argv)
 
 	WFGlobalSettings settings = GLOBAL_SETTINGS_DEFAULT;
 	settings.poller_threads = pollers;
+	settings.handler_affinity = affinity;
 	WORKFLOW_library_init(&settings);
 
 	const std::string content = make_content(length);
@@ -0,0 +1,109 @@
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <workflow/msgqueue.h>
+
+#include "util/args.h"
+
+struct message
+{
+	void * link;
+	size_t value;
+};
+
+static double run(msgqueue_t * queue, size_t producers, size_t consumers,
+				  size_t count)
+{
+	std::vector<std::thread> threads;
+	std::vector<message> messages(producers * count);
+	std::vector<size_t> sums(consumers);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < consumers; i++)
+	{
+		threads.emplace_back([queue, &sums, i]
+		{
+			message * msg;
+
+			while ((msg = static_cast<message *>(msgqueue_get(queue))) != NULL)
+			{
+				sums[i] += msg->value;
+			}
+		});
+	}
+
+	std::vector<std::thread> puts;
+	for (size_t i = 0; i < producers; i++)
+	{
+		puts.emplace_back([queue, &messages, i, count]
+		{
+			for (size_t j = 0; j < count; j++)
+			{
+				message * msg = &messages[i * count + j];
+
+				msg->value = 1;
+				msgqueue_put(msg, queue);
+			}
+		});
+	}
+
+	for (auto & t : puts)
+	{
+		t.join();
+	}
+
+	msgqueue_set_nonblock(queue);
+	for (auto & t : threads)
+	{
+		t.join();
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	size_t total = 0;
+
+	for (size_t sum : sums)
+	{
+		total += sum;
+	}
+
+	if (total != producers * count)
+	{
+		std::fprintf(stderr, "lost messages: %zu of %zu\n",
+					 producers * count - total, producers * count);
+	}
+
+	return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char ** argv)
+{
+	size_t producers;
+	size_t consumers;
+	size_t count;
+	size_t maxlen = 4096;
+
+	if (parse_args(argc, argv, producers, consumers, count, maxlen) < 3)
+	{
+		std::fprintf(stderr, "Usage: %s <producers> <consumers> "
+					 "<count per producer> [maxlen]\n", argv[0]);
+		return -1;
+	}
+
+	msgqueue_t * queue;
+	double sec;
+
+	queue = msgqueue_create(maxlen, 0);
+	sec = run(queue, producers, consumers, count);
+	msgqueue_destroy(queue);
+	std::printf("two-list  %10.0f msgs/s\n", producers * count / sec);
+
+	queue = msgqueue_create_lockfree(maxlen, 0);
+	sec = run(queue, producers, consumers, count);
+	msgqueue_destroy(queue);
+	std::printf("lock-free %10.0f msgs/s\n", producers * count / sec);
+
+	return 0;
+}
@@ -0,0 +1,62 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include <workflow/WFGlobal.h>
+#include <workflow/WFTaskFactory.h>
+#include <workflow/WFFacilities.h>
+
+#include "util/args.h"
+
+int main(int argc, char ** argv)
+{
+	size_t engine;
+	size_t threads;
+	size_t queues;
+	size_t count;
+
+	if (parse_args(argc, argv, engine, threads, queues, count) != 4)
+	{
+		std::fprintf(stderr, "Usage: %s <engine> <threads> <queues> <count>\n"
+					 "  engine: 0 for thrdpool, 1 for work stealing\n",
+					 argv[0]);
+		return -1;
+	}
+
+	struct WFGlobalSettings settings = GLOBAL_SETTINGS_DEFAULT;
+	settings.compute_engine = static_cast<int>(engine);
+	settings.compute_threads = static_cast<int>(threads);
+	WORKFLOW_library_init(&settings);
+
+	std::atomic<size_t> sum(0);
+	WFFacilities::WaitGroup wait_group(static_cast<int>(count));
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < count; i++)
+	{
+		std::string name = "queue" + std::to_string(i % queues);
+		WFGoTask * task = WFTaskFactory::create_go_task(name, [&sum]
+		{
+			sum++;
+		});
+
+		task->set_callback([&wait_group](WFGoTask *)
+		{
+			wait_group.done();
+		});
+		task->start();
+	}
+
+	wait_group.wait();
+	auto end = std::chrono::steady_clock::now();
+	double sec = std::chrono::duration<double>(end - start).count();
+
+	if (sum != count)
+	{
+		std::fprintf(stderr, "lost tasks: %zu of %zu\n", count - sum, count);
+	}
+
+	std::printf("%10.0f tasks/s\n", count / sec);
+	return 0;
+}
@@ -0,0 +1,137 @@
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <workflow/poller.h>
+
+#include "util/args.h"
+
+static void callback(struct poller_result * res, void *)
+{
+	poller_free_result(res);
+}
+
+static void * event(void *)
+{
+	return NULL;
+}
+
+template <typename F>
+static double ns_per_op(size_t count, F && f)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < count; i++)
+	{
+		f(i);
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / count;
+}
+
+static void run(const std::vector<int> & fds, size_t max_open_files,
+				int timer_wheel)
+{
+	struct poller_params params = {
+		.max_open_files		=	max_open_files,
+		.create_message		=	NULL,
+		.partial_written	=	NULL,
+		.callback			=	callback,
+		.context			=	NULL,
+		.backend			=	POLLER_BACKEND_DEFAULT,
+		.timer_wheel		=	timer_wheel,
+		.busy_poll			=	0
+	};
+	poller_t * poller = poller_create(&params);
+
+	if (!poller || poller_start(poller) < 0)
+	{
+		std::perror("poller");
+		std::exit(1);
+	}
+
+	// Keep-alive style timeouts: mixed, from 1 to 60 seconds.
+	std::mt19937 rng(42);
+	std::uniform_int_distribution<int> timeout(1000, 60000);
+	std::vector<int> order(fds);
+	size_t n = fds.size();
+
+	double add = ns_per_op(n, [&](size_t i)
+	{
+		struct poller_data data = { };
+
+		data.operation = PD_OP_EVENT;
+		data.fd = fds[i];
+		data.event = event;
+		poller_add(&data, timeout(rng), poller);
+	});
+
+	std::shuffle(order.begin(), order.end(), rng);
+	double reset = ns_per_op(n, [&](size_t i)
+	{
+		poller_set_timeout(order[i], timeout(rng), poller);
+	});
+
+	std::shuffle(order.begin(), order.end(), rng);
+	double del = ns_per_op(n, [&](size_t i)
+	{
+		poller_del(order[i], poller);
+	});
+
+	poller_stop(poller);
+	poller_destroy(poller);
+	std::printf("%-6s add %7.1f ns  set_timeout %7.1f ns  del %7.1f ns\n",
+				timer_wheel ? "wheel" : "rbtree", add, reset, del);
+}
+
+int main(int argc, char ** argv)
+{
+	size_t count;
+
+	if (parse_args(argc, argv, count) != 1)
+	{
+		std::fprintf(stderr, "Usage: %s <timers>\n", argv[0]);
+		return -1;
+	}
+
+	// One eventfd per timer. Raise the soft limit as far as allowed.
+	struct rlimit rl;
+
+	getrlimit(RLIMIT_NOFILE, &rl);
+	rl.rlim_cur = std::min<rlim_t>(rl.rlim_max, count + 64);
+	setrlimit(RLIMIT_NOFILE, &rl);
+	if (count + 64 > rl.rlim_cur)
+	{
+		count = rl.rlim_cur - 64;
+		std::fprintf(stderr, "fd limit: only %zu timers\n", count);
+	}
+
+	std::vector<int> fds(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		fds[i] = eventfd(0, EFD_NONBLOCK);
+		if (fds[i] < 0)
+		{
+			std::perror("eventfd");
+			return 1;
+		}
+	}
+
+	run(fds, rl.rlim_cur, 0);
+	run(fds, rl.rlim_cur, 1);
+
+	for (int fd : fds)
+	{
+		close(fd);
+	}
+
+	return 0;
+}
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <workflow/WFGlobal.h>
+#include <workflow/WFHttpServer.h>
+#include <workflow/WFTaskFactory.h>
+#include <workflow/WFFacilities.h>
+
+#include "util/args.h"
+
+static double percentile(const std::vector<double> & sorted, double p)
+{
+	size_t index = static_cast<size_t>(p * (sorted.size() - 1));
+	return sorted[index];
+}
+
+int main(int argc, char ** argv)
+{
+	size_t busy_poll = 0, count = 0;
+
+	if (parse_args(argc, argv, busy_poll, count) != 2 || count == 0)
+	{
+		std::fprintf(stderr, "Usage: %s <busy_poll> <count>\n"
+					 "  busy_poll: microseconds a poller spins, 0 for none\n",
+					 argv[0]);
+		return -1;
+	}
+
+	struct WFGlobalSettings settings = GLOBAL_SETTINGS_DEFAULT;
+	settings.poller_busy_poll = static_cast<int>(busy_poll);
+	WORKFLOW_library_init(&settings);
+
+	WFHttpServer server([](WFHttpTask * task)
+	{
+		task->get_resp()->append_output_body_nocopy("pong", 4);
+	});
+
+	if (server.start(AF_INET, "127.0.0.1", 0) < 0)
+	{
+		std::perror("server start");
+		return 1;
+	}
+
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof addr;
+
+	server.get_listen_addr((struct sockaddr *)&addr, &addrlen);
+	std::string url = "http://127.0.0.1:" +
+					  std::to_string(ntohs(addr.sin_port)) + "/";
+
+	// Ping-pong: one request at a time on a kept-alive connection.
+	std::vector<double> latency;
+	latency.reserve(count);
+	for (size_t i = 0; i < count + count / 10; i++)
+	{
+		WFFacilities::WaitGroup wait_group(1);
+		WFHttpTask * task = WFTaskFactory::create_http_task(url, 0, 0,
+			[&wait_group](WFHttpTask *)
+		{
+			wait_group.done();
+		});
+
+		auto start = std::chrono::steady_clock::now();
+		task->start();
+		wait_group.wait();
+		auto end = std::chrono::steady_clock::now();
+
+		// The first tenth warms up connections and caches.
+		if (i >= count / 10)
+			latency.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+	}
+
+	server.stop();
+	std::sort(latency.begin(), latency.end());
+	std::printf("busy_poll %zu us  p50 %7.1f us  p99 %7.1f us  p999 %7.1f us\n",
+				busy_poll, percentile(latency, 0.5), percentile(latency, 0.99),
+				percentile(latency, 0.999));
+	return 0;
+}
@@ -0,0 +1,172 @@
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include <workflow/WFGlobal.h>
+#include <workflow/WFTaskFactory.h>
+#include <workflow/WFFacilities.h>
+
+#include "util/args.h"
+
+static constexpr size_t BLOCK_SIZE = 4096;
+static constexpr size_t FILE_BLOCKS = 64 * 1024;	// 256MB
+
+struct reader
+{
+	int fd;
+	void * buf;
+	std::mt19937_64 rng;
+	size_t remaining;
+	std::atomic<size_t> * errors;
+	WFFacilities::WaitGroup * wait_group;
+	double max_start_us;
+};
+
+static void next_read(reader * r);
+
+static void read_callback(WFFileIOTask * task)
+{
+	reader * r = static_cast<reader *>(task->user_data);
+
+	if (task->get_state() != WFT_STATE_SUCCESS ||
+		task->get_retval() != static_cast<long>(BLOCK_SIZE))
+	{
+		++*r->errors;
+	}
+
+	if (--r->remaining == 0)
+		r->wait_group->done();
+	else
+		next_read(r);
+}
+
+static void next_read(reader * r)
+{
+	off_t offset = static_cast<off_t>(r->rng() % FILE_BLOCKS * BLOCK_SIZE);
+	WFFileIOTask * task = WFTaskFactory::create_pread_task(r->fd, r->buf,
+														   BLOCK_SIZE, offset,
+														   read_callback);
+
+	task->user_data = r;
+
+	// With aio, a buffered read that misses the page cache blocks here.
+	auto start = std::chrono::steady_clock::now();
+	task->start();
+	auto end = std::chrono::steady_clock::now();
+	r->max_start_us = std::max(r->max_start_us,
+		std::chrono::duration<double, std::micro>(end - start).count());
+}
+
+static int prepare_file(const char * path)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	void * block = nullptr;
+	struct stat st;
+
+	if (fd < 0 || fstat(fd, &st) < 0)
+		return -1;
+
+	if (st.st_size < static_cast<off_t>(FILE_BLOCKS * BLOCK_SIZE))
+	{
+		if (posix_memalign(&block, BLOCK_SIZE, BLOCK_SIZE) != 0)
+			return -1;
+
+		std::fill_n(static_cast<char *>(block), BLOCK_SIZE, 'x');
+		for (size_t i = 0; i < FILE_BLOCKS; i++)
+		{
+			if (pwrite(fd, block, BLOCK_SIZE, i * BLOCK_SIZE) != BLOCK_SIZE)
+				return -1;
+		}
+
+		std::free(block);
+		fsync(fd);
+	}
+
+	// Start every run with a cold page cache.
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	return close(fd);
+}
+
+int main(int argc, char ** argv)
+{
+	const char * path = nullptr;
+	size_t backend = 0;
+	size_t direct = 0;
+	size_t concurrency = 0;
+	size_t count = 0;
+
+	if (parse_args(argc, argv, path, backend, direct, concurrency, count) != 5
+		|| concurrency == 0 || count == 0)
+	{
+		std::fprintf(stderr, "Usage: %s <file> <backend> <direct> <concurrency> <count>\n"
+					 "  backend: 0 for aio, 1 for io_uring\n"
+					 "  direct: 1 to open the file with O_DIRECT\n",
+					 argv[0]);
+		return -1;
+	}
+
+	if (prepare_file(path) < 0)
+	{
+		std::perror(path);
+		return 1;
+	}
+
+	struct WFGlobalSettings settings = GLOBAL_SETTINGS_DEFAULT;
+	settings.fio_backend = static_cast<int>(backend);
+	WORKFLOW_library_init(&settings);
+
+	int fd = open(path, O_RDONLY | (direct ? O_DIRECT : 0));
+	if (fd < 0)
+	{
+		std::perror(path);
+		return 1;
+	}
+
+	std::atomic<size_t> errors(0);
+	WFFacilities::WaitGroup wait_group(static_cast<int>(concurrency));
+	reader * readers = new reader[concurrency];
+
+	for (size_t i = 0; i < concurrency; i++)
+	{
+		readers[i].fd = fd;
+		if (posix_memalign(&readers[i].buf, BLOCK_SIZE, BLOCK_SIZE) != 0)
+			abort();
+
+		readers[i].rng.seed(i);
+		readers[i].remaining = (count + concurrency - 1) / concurrency;
+		readers[i].errors = &errors;
+		readers[i].wait_group = &wait_group;
+		readers[i].max_start_us = 0;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < concurrency; i++)
+		next_read(&readers[i]);
+
+	wait_group.wait();
+	auto end = std::chrono::steady_clock::now();
+
+	double max_start_us = 0;
+	for (size_t i = 0; i < concurrency; i++)
+	{
+		max_start_us = std::max(max_start_us, readers[i].max_start_us);
+		std::free(readers[i].buf);
+	}
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+	size_t total = concurrency * ((count + concurrency - 1) / concurrency);
+
+	std::printf("%s %s  %10.0f reads/s  max start %8.1f us  errors %zu\n",
+				backend ? "io_uring" : "aio     ", direct ? "direct  " : "buffered",
+				total / seconds, max_start_us, errors.load());
+
+	delete []readers;
+	close(fd);
+	return 0;
+}
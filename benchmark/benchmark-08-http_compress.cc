@@ -0,0 +1,144 @@
+#include <sys/resource.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+#include <workflow/WFHttpServer.h>
+#include <workflow/WFTaskFactory.h>
+#include <workflow/WFFacilities.h>
+#include <workflow/HttpUtil.h>
+
+#include "util/args.h"
+
+// Compression level of every round; -2 sends the body uncompressed.
+static const int LEVELS[] = { -2, 1, 6, 9 };
+
+static std::string make_body(size_t size)
+{
+	static const char * const words[] = {
+		"id", "name", "status", "active", "price", "count", "tags",
+		"created", "updated", "owner", "region", "type", "value",
+	};
+	std::mt19937_64 rng(0);
+	std::string body("[");
+
+	// JSON records, about as compressible as a typical API response.
+	while (body.size() < size)
+	{
+		body += "{\"";
+		body += words[rng() % 13];
+		body += "\":";
+		body += std::to_string(rng() % 100000);
+		body += ",\"";
+		body += words[rng() % 13];
+		body += "\":\"";
+		body += words[rng() % 13];
+		body += "-";
+		body += std::to_string(rng() % 1000);
+		body += "\"},";
+	}
+
+	body.resize(size - 1);
+	body += "]";
+	return body;
+}
+
+static double cpu_seconds()
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+		   (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+int main(int argc, char ** argv)
+{
+	unsigned short port = 0;
+	size_t body_kb = 0;
+	size_t count = 0;
+
+	if (parse_args(argc, argv, port, body_kb, count) != 3
+		|| body_kb == 0 || count == 0)
+	{
+		std::fprintf(stderr, "Usage: %s <port> <body KB> <count>\n", argv[0]);
+		return -1;
+	}
+
+	std::string body = make_body(body_kb * 1024);
+	WFHttpServer server([&body](WFHttpTask * task) {
+		protocol::HttpResponse * resp = task->get_resp();
+		const char * uri = task->get_req()->get_request_uri();
+		int level = std::atoi(std::strchr(uri, '=') + 1);
+
+		resp->append_output_body_nocopy(body.data(), body.size());
+		if (level >= -1)
+			resp->compress_output_body(HTTP_ENCODING_GZIP, level);
+	});
+
+	if (server.start(port) < 0)
+	{
+		std::perror("server start");
+		return 1;
+	}
+
+	std::printf("body %zu bytes, %zu requests per level\n", body.size(), count);
+	for (int level : LEVELS)
+	{
+		std::string url = "http://127.0.0.1:" + std::to_string(port) +
+						  "/?level=" + std::to_string(level);
+		size_t wire_bytes = 0;
+		size_t errors = 0;
+		WFFacilities::WaitGroup wait_group(1);
+		SeriesWork * series;
+
+		auto callback = [&](WFHttpTask * task) {
+			protocol::HttpResponse * resp = task->get_resp();
+			protocol::HttpHeaderCursor cursor(resp);
+			std::string length;
+			const void * data;
+			size_t size;
+
+			if (task->get_state() != WFT_STATE_SUCCESS ||
+				!resp->get_parsed_body(&data, &size) || size != body.size())
+			{
+				errors++;
+			}
+			else if (cursor.find("Content-Length", length))
+				wire_bytes += std::strtoul(length.c_str(), NULL, 10);
+		};
+
+		series = Workflow::create_series_work(WFTaskFactory::create_empty_task(),
+			[&wait_group](const SeriesWork *) { wait_group.done(); });
+		for (size_t i = 0; i < count; i++)
+		{
+			WFHttpTask * task = WFTaskFactory::create_http_task(url, 0, 0,
+																callback);
+
+			task->get_req()->set_decompress_response(true);
+			series->push_back(task);
+		}
+
+		double cpu_start = cpu_seconds();
+		auto start = std::chrono::steady_clock::now();
+
+		series->start();
+		wait_group.wait();
+
+		auto end = std::chrono::steady_clock::now();
+		double cpu = cpu_seconds() - cpu_start;
+		double seconds = std::chrono::duration<double>(end - start).count();
+
+		std::printf("%-8s  wire %8.1f KB/req  ratio %5.2f  cpu %8.1f us/req  %8.0f req/s  errors %zu\n",
+					level < -1 ? "identity" : ("gzip " + std::to_string(level)).c_str(),
+					wire_bytes / 1024.0 / count,
+					(double)body.size() * count / (wire_bytes ? wire_bytes : 1),
+					cpu * 1e6 / count, count / seconds, errors);
+	}
+
+	server.stop();
+	return 0;
+}
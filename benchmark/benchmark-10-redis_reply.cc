@@ -0,0 +1,137 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include <workflow/redis_parser.h>
+#include <workflow/RedisMessage.h>
+
+#include "util/args.h"
+
+using protocol::RedisValue;
+using protocol::RedisReplyView;
+
+// As many elements as a large MGET, HGETALL or LRANGE reply.
+static const size_t ELEMENTS = 10000;
+
+static const int ROUNDS = 5;
+
+// An array reply of 'n' bulk strings of 'size' bytes, every tenth one nil.
+static std::string make_reply(size_t n, size_t size)
+{
+	std::string reply = "*" + std::to_string(n) + "\r\n";
+
+	for (size_t i = 0; i < n; i++)
+	{
+		if (i % 10 == 9)
+			reply += "$-1\r\n";
+		else
+		{
+			reply += "$" + std::to_string(size) + "\r\n";
+			reply += std::string(size, 'a' + i % 26) + "\r\n";
+		}
+	}
+
+	return reply;
+}
+
+static double elapsed(std::chrono::steady_clock::time_point start)
+{
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+// Parse the reply 'count' times, and read every element of it both by a copy
+// into RedisValue and by RedisReplyView. Return the bytes read, which must be
+// the same for both.
+static size_t read(const std::string & data, size_t count,
+				   double & parse_ns, double & copy_ns, double & view_ns)
+{
+	size_t copied = 0;
+	size_t viewed = 0;
+
+	parse_ns = copy_ns = view_ns = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		redis_parser_t parser;
+		size_t size = data.size();
+
+		auto start = std::chrono::steady_clock::now();
+		redis_parser_init(&parser);
+		if (redis_parser_append_message(data.data(), &size, &parser) != 1)
+		{
+			redis_parser_deinit(&parser);
+			return 0;
+		}
+
+		parse_ns += elapsed(start);
+
+		start = std::chrono::steady_clock::now();
+		{
+			RedisValue value;
+
+			value.set(&parser.reply);
+			for (size_t j = 0; j < value.arr_size(); j++)
+			{
+				if (value[j].is_string())
+					copied += value[j].string_view()->size();
+			}
+		}
+
+		copy_ns += elapsed(start);
+
+		start = std::chrono::steady_clock::now();
+		for (RedisReplyView element : RedisReplyView(&parser.reply))
+		{
+			if (element.is_string())
+				viewed += element.string_size();
+		}
+
+		view_ns += elapsed(start);
+		redis_parser_deinit(&parser);
+	}
+
+	return copied == viewed ? copied : 0;
+}
+
+static void run(const char * name, const std::string & data, size_t count)
+{
+	double best_parse = 0;
+	double best_copy = 0;
+	double best_view = 0;
+	size_t bytes = 0;
+
+	// The best of a few rounds, which is the least disturbed by other work.
+	for (int round = 0; round < ROUNDS; round++)
+	{
+		double parse_ns, copy_ns, view_ns;
+
+		bytes = read(data, count, parse_ns, copy_ns, view_ns);
+		if (round == 0 || parse_ns < best_parse)
+			best_parse = parse_ns;
+		if (round == 0 || copy_ns < best_copy)
+			best_copy = copy_ns;
+		if (round == 0 || view_ns < best_view)
+			best_view = view_ns;
+	}
+
+	std::printf("%-8s %8zu bytes  parse %8.1f us  copy %8.1f us  view %8.1f us  %s\n",
+				name, data.size(), best_parse / count / 1e3,
+				best_copy / count / 1e3, best_view / count / 1e3,
+				bytes ? "ok" : "mismatch");
+}
+
+int main(int argc, char ** argv)
+{
+	size_t count = 0;
+
+	if (parse_args(argc, argv, count) != 1 || count == 0)
+	{
+		std::fprintf(stderr, "Usage: %s <count>\n", argv[0]);
+		return -1;
+	}
+
+	// Keys or short values, and cached objects.
+	run("small", make_reply(ELEMENTS, 16), count);
+	run("large", make_reply(ELEMENTS, 512), count);
+	return 0;
+}
@@ -143,6 +143,26 @@ static bool __has_next_name(const DnsParams::dns_params *p,
 	return false;
 }
 
+static bool __server_failed(const DnsResponse *resp)
+{
+	int rcode = resp->get_rcode();
+
+	return rcode == DNS_RCODE_SERVER_FAILURE ||
+		   rcode == DNS_RCODE_NOT_IMPLEMENTED ||
+		   rcode == DNS_RCODE_REFUSED;
+}
+
+static bool __name_failed(const DnsResponse *resp)
+{
+	int rcode = resp->get_rcode();
+
+	return rcode == DNS_RCODE_FORMAT_ERROR ||
+		   rcode == DNS_RCODE_NAME_ERROR ||
+		   resp->get_ancount() == 0;
+}
+
+/* With an extra question, the name fails only if both replies fail, and so
+ * does the server. */
 static void __callback_internal(WFDnsTask *task, const DnsParams& params,
 								struct DnsStatus& s)
 {
@@ -150,16 +170,14 @@ static void __callback_internal(WFDnsTask *task, const DnsParams& params,
 	int state = task->get_state();
 	DnsRequest *req = task->get_req();
 	DnsResponse *resp = task->get_resp();
+	const DnsResponse *extra = resp->get_extra();
 	const auto *p = params.get_params();
-	int rcode = resp->get_rcode();
 
 	bool try_next_server = state != WFT_STATE_SUCCESS ||
-						   rcode == DNS_RCODE_SERVER_FAILURE ||
-						   rcode == DNS_RCODE_NOT_IMPLEMENTED ||
-						   rcode == DNS_RCODE_REFUSED;
-	bool try_next_name = rcode == DNS_RCODE_FORMAT_ERROR ||
-						 rcode == DNS_RCODE_NAME_ERROR ||
-						 resp->get_ancount() == 0;
+						   (__server_failed(resp) &&
+							(!extra || __server_failed(extra)));
+	bool try_next_name = __name_failed(resp) &&
+						 (!extra || __name_failed(extra));
 
 	if (try_next_server)
 	{
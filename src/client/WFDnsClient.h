@@ -27,7 +27,7 @@
 class WFDnsClient
 {
 public:
-	WFDnsClient() : params(NULL) { }
+	WFDnsClient() : params(NULL), single_request(false) { }
 	virtual ~WFDnsClient() { }
 
 	int init(const std::string& url);
@@ -38,9 +38,15 @@ public:
 	WFDnsTask *create_dns_task(const std::string& name,
 							   dns_callback_t callback);
 
+	/* Like the single-request option of resolv.conf, the resolver asks A
+	 * and AAAA of a name in two tasks, instead of both in one. */
+	void set_single_request(bool single) { this->single_request = single; }
+	bool is_single_request() const { return this->single_request; }
+
 private:
 	void *params;
 	std::atomic<size_t> id;
+	bool single_request;
 };
 
 #endif
@@ -0,0 +1,263 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <utility>
+#include "URIParser.h"
+#include "RedisMessage.h"
+#include "WFTaskFactory.h"
+#include "WFRedisCluster.h"
+
+using namespace protocol;
+
+struct WFRedisCluster::SlotMap
+{
+	std::mutex mutex;
+	ParsedURI uri;
+	std::vector<std::pair<std::string, std::string>> nodes;
+	std::vector<uint16_t> slots;	/* index of the node plus 1 */
+	size_t next;
+	bool refreshing;
+};
+
+/* CRC16-CCITT (XModem), the one of Redis Cluster. */
+static uint16_t __crc16(const char *buf, size_t len)
+{
+	uint16_t crc = 0;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		crc ^= (uint16_t)(unsigned char)buf[i] << 8;
+		for (int j = 0; j < 8; j++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+}
+
+int WFRedisCluster::get_slot(const std::string& key)
+{
+	size_t start = key.find('{');
+	size_t end;
+
+	if (start != std::string::npos)
+	{
+		end = key.find('}', start + 1);
+		if (end != std::string::npos && end != start + 1)
+			return __crc16(key.c_str() + start + 1, end - start - 1) &
+				   (SLOTS - 1);
+	}
+
+	return __crc16(key.c_str(), key.size()) & (SLOTS - 1);
+}
+
+int WFRedisCluster::get_slot(const RedisRequest *req)
+{
+	std::vector<std::string> params;
+	std::string command;
+
+	if (!req->get_command(command) || !req->get_params(params))
+		return -1;
+
+	if (strcasecmp(command.c_str(), "EVAL") == 0 ||
+		strcasecmp(command.c_str(), "EVALSHA") == 0)
+	{
+		if (params.size() < 3 || atoi(params[1].c_str()) <= 0)
+			return -1;
+
+		return get_slot(params[2]);
+	}
+
+	if (params.empty())
+		return -1;
+
+	return get_slot(params[0]);
+}
+
+WFRedisCluster::WFRedisCluster() :
+	map_(new SlotMap)
+{
+	map_->next = 0;
+	map_->refreshing = false;
+}
+
+int WFRedisCluster::init(const std::string& url)
+{
+	ParsedURI uri;
+
+	if (URIParser::parse(url, uri) >= 0)
+	{
+		this->uri_ = uri;
+		map_->mutex.lock();
+		map_->uri = std::move(uri);
+		map_->mutex.unlock();
+		this->refresh();
+		return 0;
+	}
+	else if (uri.state == URI_STATE_INVALID)
+		errno = EINVAL;
+
+	return -1;
+}
+
+bool WFRedisCluster::get_node(int slot, std::string& host, std::string& port)
+{
+	std::lock_guard<std::mutex> lock(map_->mutex);
+	uint16_t index;
+
+	if (!map_->slots.empty())
+	{
+		index = map_->slots[slot];
+		if (index > 0)
+		{
+			host = map_->nodes[index - 1].first;
+			port = map_->nodes[index - 1].second;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* [[start, end, [host, port, ...], replicas...], ...] */
+static bool __parse_slots(const redis_reply_t *reply, const char *default_host,
+						  std::vector<std::pair<std::string, std::string>>& nodes,
+						  std::vector<uint16_t>& slots)
+{
+	const redis_reply_t *range;
+	const redis_reply_t *node;
+	std::string host;
+	std::string port;
+	size_t index;
+
+	if (reply->type != REDIS_REPLY_TYPE_ARRAY)
+		return false;
+
+	slots.assign(WFRedisCluster::SLOTS, 0);
+	for (size_t i = 0; i < reply->elements; i++)
+	{
+		range = reply->element[i];
+		if (range->type != REDIS_REPLY_TYPE_ARRAY || range->elements < 3 ||
+			range->element[0]->type != REDIS_REPLY_TYPE_INTEGER ||
+			range->element[1]->type != REDIS_REPLY_TYPE_INTEGER ||
+			range->element[0]->integer < 0 ||
+			range->element[1]->integer >= WFRedisCluster::SLOTS ||
+			range->element[0]->integer > range->element[1]->integer)
+			return false;
+
+		node = range->element[2];
+		if (node->type != REDIS_REPLY_TYPE_ARRAY || node->elements < 2 ||
+			node->element[0]->type != REDIS_REPLY_TYPE_STRING ||
+			node->element[1]->type != REDIS_REPLY_TYPE_INTEGER)
+			return false;
+
+		/* An empty host is the one that was asked. */
+		if (node->element[0]->len > 0)
+			host.assign(node->element[0]->str, node->element[0]->len);
+		else
+			host = default_host;
+
+		port = std::to_string(node->element[1]->integer);
+		for (index = 0; index < nodes.size(); index++)
+		{
+			if (nodes[index].first == host && nodes[index].second == port)
+				break;
+		}
+
+		if (index == nodes.size())
+			nodes.emplace_back(host, port);
+
+		for (long long j = range->element[0]->integer;
+			 j <= range->element[1]->integer; j++)
+			slots[j] = index + 1;
+	}
+
+	return true;
+}
+
+void WFRedisCluster::refresh()
+{
+	std::shared_ptr<SlotMap> map = map_;
+	ParsedURI uri;
+	std::string url;
+	size_t n;
+
+	map->mutex.lock();
+	if (map->refreshing || !map->uri.scheme || !map->uri.host)
+	{
+		map->mutex.unlock();
+		return;
+	}
+
+	/* The seed node and the known nodes are asked in turn. */
+	uri = map->uri;
+	n = map->next++ % (map->nodes.size() + 1);
+	if (n > 0)
+	{
+		const auto& node = map->nodes[n - 1];
+
+		url = uri.scheme;
+		url += "://";
+		if (node.first.find(':') != std::string::npos)
+			url += "[" + node.first + "]:" + node.second;
+		else
+			url += node.first + ":" + node.second;
+
+		ParsedURI node_uri;
+		URIParser::parse(url, node_uri);
+		std::swap(node_uri.host, uri.host);
+		std::swap(node_uri.port, uri.port);
+	}
+
+	map->refreshing = true;
+	map->mutex.unlock();
+
+	/* The map is kept by the task, which may outlive the cluster. */
+	std::string host = uri.host;
+	auto&& cb = [map, host](WFRedisTask *task)
+	{
+		const redis_reply_t *reply = task->get_resp()->result_ptr();
+		std::vector<std::pair<std::string, std::string>> nodes;
+		std::vector<uint16_t> slots;
+		bool succ;
+
+		succ = (task->get_state() == WFT_STATE_SUCCESS &&
+				__parse_slots(reply, host.c_str(), nodes, slots));
+
+		std::lock_guard<std::mutex> lock(map->mutex);
+		if (succ)
+		{
+			map->nodes = std::move(nodes);
+			map->slots = std::move(slots);
+		}
+
+		map->refreshing = false;
+	};
+
+	WFRedisTask *task = WFTaskFactory::create_redis_task(uri, 0, std::move(cb));
+
+	task->get_req()->set_request("CLUSTER", {"SLOTS"});
+	task->start();
+}
+
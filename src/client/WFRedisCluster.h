@@ -0,0 +1,69 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef _WFREDISCLUSTER_H_
+#define _WFREDISCLUSTER_H_
+
+#include <string>
+#include <memory>
+#include "URIParser.h"
+#include "RedisMessage.h"
+#include "WFTaskFactory.h"
+
+// Thread safety: YES
+class WFRedisCluster
+{
+public:
+	/* example: redis://:password@127.0.0.1:7000
+	 * Any node of the cluster. The slot map is fetched from it. */
+	int init(const std::string& url);
+
+	void deinit() { }
+
+public:
+	/* The task is sent to the node that owns the slot of its key, which is
+	 * the first parameter, or the first key of EVAL and EVALSHA. MOVED and
+	 * ASK are followed, and a MOVED or a failure refreshes the slot map. */
+	WFRedisTask *create_redis_task(int retry_max, redis_callback_t callback);
+
+	/* Fetch the slot map again. Only one fetch is on the way at a time. */
+	void refresh();
+
+public:
+	enum { SLOTS = 16384 };
+
+	/* CRC16 of the key, or of its {hash tag}, as Redis Cluster does. */
+	static int get_slot(const std::string& key);
+
+	/* -1 if the request has no key. */
+	static int get_slot(const protocol::RedisRequest *req);
+
+private:
+	struct SlotMap;
+
+	bool get_node(int slot, std::string& host, std::string& port);
+
+	std::shared_ptr<SlotMap> map_;
+	ParsedURI uri_;
+
+	friend class ComplexRedisClusterTask;
+
+public:
+	WFRedisCluster();
+};
+
+#endif
+
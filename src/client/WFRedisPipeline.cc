@@ -0,0 +1,87 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <errno.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <utility>
+#include "URIParser.h"
+#include "WFRedisPipeline.h"
+
+#define REDIS_PIPELINE_BATCH_MAX	128
+
+WFRedisPipeline::WFRedisPipeline(int connections) :
+	running_(0),
+	connections_(connections > 0 ? connections : 1)
+{
+}
+
+int WFRedisPipeline::init(const std::string& url)
+{
+	ParsedURI uri;
+
+	if (URIParser::parse(url, uri) >= 0)
+	{
+		this->uri_ = std::move(uri);
+		return 0;
+	}
+	else if (uri.state == URI_STATE_INVALID)
+		errno = EINVAL;
+
+	return -1;
+}
+
+void WFRedisPipeline::take(std::vector<Member>& batch)
+{
+	size_t n = queue_.size();
+
+	if (n > REDIS_PIPELINE_BATCH_MAX)
+		n = REDIS_PIPELINE_BATCH_MAX;
+
+	batch.assign(queue_.begin(), queue_.begin() + n);
+	queue_.erase(queue_.begin(), queue_.begin() + n);
+}
+
+bool WFRedisPipeline::get(SubTask *task, WFConditional *cond,
+						  std::vector<Member>& batch)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	queue_.push_back({task, cond});
+	if (running_ >= connections_)
+		return false;
+
+	running_++;
+	take(batch);
+	return true;
+}
+
+/* Called when a batch is finished. */
+bool WFRedisPipeline::next(std::vector<Member>& batch)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (queue_.empty())
+	{
+		running_--;
+		return false;
+	}
+
+	take(batch);
+	return true;
+}
+
@@ -0,0 +1,73 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef _WFREDISPIPELINE_H_
+#define _WFREDISPIPELINE_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include "URIParser.h"
+#include "WFTask.h"
+#include "WFTaskFactory.h"
+
+// Thread safety: YES
+// The pipeline must outlive all the tasks created by it.
+class WFRedisPipeline
+{
+public:
+	/* example: redis://:password@127.0.0.1:6379/3 */
+	int init(const std::string& url);
+
+	void deinit() { }
+
+public:
+	/* The requests of the tasks that are waiting are sent together as one
+	 * batch, and at most 'connections' batches are on the way at a time.
+	 * So many tasks share a few connections, and the replies are given back
+	 * in order. A task has no retry and never follows MOVED or ASK. A task
+	 * without any command fails with EINVAL. */
+	WFRedisTask *create_redis_task(redis_callback_t callback);
+
+private:
+	struct Member
+	{
+		SubTask *task;
+		WFConditional *cond;
+	};
+
+	/* Return true if the caller should start a batch of 'batch'. */
+	bool get(SubTask *task, WFConditional *cond, std::vector<Member>& batch);
+	bool next(std::vector<Member>& batch);
+	void take(std::vector<Member>& batch);
+
+private:
+	std::mutex mutex_;
+	std::deque<Member> queue_;
+	int running_;
+	int connections_;
+	ParsedURI uri_;
+
+	friend class ComplexRedisPipelineTask;
+
+public:
+	WFRedisPipeline(int connections);
+};
+
+#endif
+
@@ -66,6 +66,8 @@ CommMessageOut *ComplexDnsTask::message_out()
 	resp->set_request_name(req->get_question_name());
 	req->set_single_packet(type == TT_UDP);
 	resp->set_single_packet(type == TT_UDP);
+	if (req->get_extra_question_type() != 0)
+		resp->set_extra_request_id(req->get_extra_id());
 
 	return this->WFClientTask::message_out();
 }
@@ -136,9 +138,11 @@ bool ComplexDnsTask::finish_once()
 bool ComplexDnsTask::need_redirect()
 {
 	DnsResponse *client_resp = this->get_resp();
+	const DnsResponse *extra = client_resp->get_extra();
 	TransportType type = this->get_transport_type();
 
-	if (type == TT_UDP && client_resp->get_tc() == 1)
+	if (type == TT_UDP &&
+		(client_resp->get_tc() == 1 || (extra && extra->get_tc() == 1)))
 	{
 		this->set_transport_type(TT_TCP);
 		return true;
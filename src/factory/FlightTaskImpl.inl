@@ -0,0 +1,169 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <errno.h>
+#include <string>
+#include <utility>
+#include "WFTask.h"
+#include "WFTaskFactory.h"
+#include "WFSingleFlight.h"
+
+/* A complex client task of type TASK that shares its request with the other
+ * tasks of the same key in a WFSingleFlight. RESULT holds a copy of the final
+ * response of the leader, made by save_result() and read by load_result(). */
+template<class TASK, class RESULT>
+class ComplexFlightTask : public TASK
+{
+public:
+	template<class... ARGS>
+	ComplexFlightTask(WFSingleFlight *flight, const std::string& key,
+					  ARGS&&... args):
+		TASK(std::forward<ARGS>(args)...),
+		flight_key_(key),
+		flight_(flight),
+		flight_state_(FLIGHT_STATE_INIT)
+	{ }
+
+protected:
+	virtual void dispatch();
+	virtual SubTask *done();
+	virtual bool finish_once();
+
+protected:
+	virtual void save_result(RESULT& result) = 0;
+	virtual bool load_result(const RESULT& result) = 0;
+
+	/* Called once before the first request. Returns true if the task does
+	 * not send it, like when it waits for the leader of its key. */
+	virtual bool join();
+
+	/* Called by the leader with its final result. */
+	virtual void land();
+
+protected:
+	std::string flight_key_;
+
+private:
+	enum
+	{
+		FLIGHT_STATE_INIT,
+		FLIGHT_STATE_LEADER,
+		FLIGHT_STATE_WAITING,
+		FLIGHT_STATE_SHARED,
+		FLIGHT_STATE_DONE,
+	};
+
+	WFSingleFlight *flight_;
+	int flight_state_;
+};
+
+template<class TASK, class RESULT>
+bool ComplexFlightTask<TASK, RESULT>::join()
+{
+	WFConditional *cond = flight_->join(flight_key_, this);
+
+	if (cond)
+	{
+		series_of(this)->push_front(cond);
+		flight_state_ = FLIGHT_STATE_WAITING;
+		return true;
+	}
+
+	flight_state_ = FLIGHT_STATE_LEADER;
+	return false;
+}
+
+/* The leader hands its final result to the waiting tasks. */
+template<class TASK, class RESULT>
+void ComplexFlightTask<TASK, RESULT>::land()
+{
+	ComplexFlightTask<TASK, RESULT> *task;
+	RESULT result;
+
+	if (this->state == WFT_STATE_SUCCESS)
+		this->save_result(result);
+
+	for (const auto& waiter : flight_->land(flight_key_))
+	{
+		task = static_cast<ComplexFlightTask<TASK, RESULT> *>(waiter.task);
+		task->state = this->state;
+		task->error = this->error;
+		task->timeout_reason = this->timeout_reason;
+		if (this->state == WFT_STATE_SUCCESS && !task->load_result(result))
+		{
+			task->state = WFT_STATE_SYS_ERROR;
+			task->error = errno;
+		}
+
+		task->disable_retry();
+		waiter.cond->signal(NULL);
+	}
+}
+
+template<class TASK, class RESULT>
+void ComplexFlightTask<TASK, RESULT>::dispatch()
+{
+	if (flight_state_ == FLIGHT_STATE_INIT &&
+		this->state == WFT_STATE_UNDEFINED)
+	{
+		flight_state_ = FLIGHT_STATE_DONE;
+		if (this->join())
+		{
+			this->subtask_done();
+			return;
+		}
+	}
+	else if (flight_state_ == FLIGHT_STATE_SHARED)
+	{
+		this->subtask_done();
+		return;
+	}
+
+	this->TASK::dispatch();
+}
+
+template<class TASK, class RESULT>
+SubTask *ComplexFlightTask<TASK, RESULT>::done()
+{
+	if (flight_state_ == FLIGHT_STATE_WAITING)
+	{
+		flight_state_ = FLIGHT_STATE_SHARED;
+		return series_of(this)->pop();
+	}
+
+	return this->TASK::done();
+}
+
+template<class TASK, class RESULT>
+bool ComplexFlightTask<TASK, RESULT>::finish_once()
+{
+	if (flight_state_ == FLIGHT_STATE_SHARED)
+		return true;
+
+	/* Like AUTH or SELECT before the user request of redis. */
+	if (!this->TASK::finish_once())
+		return false;
+
+	if (flight_state_ == FLIGHT_STATE_LEADER && !this->redirect_ &&
+		(this->state != WFT_STATE_SYS_ERROR ||
+		 this->retry_times_ >= this->retry_max_))
+	{
+		this->land();
+		flight_state_ = FLIGHT_STATE_DONE;
+	}
+
+	return true;
+}
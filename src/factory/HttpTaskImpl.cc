@@ -31,12 +31,42 @@
 #include "WFGlobal.h"
 #include "HttpUtil.h"
 #include "SSLWrapper.h"
+#include "WFHttpCache.h"
+#include "WFSingleFlight.h"
+#include "FlightTaskImpl.inl"
 
 using namespace protocol;
 
 #define HTTP_KEEPALIVE_DEFAULT	(60 * 1000)
 #define HTTP_KEEPALIVE_MAX		(300 * 1000)
 
+/* Keeps the HTTP/2 state in the context of the real connection. Tasks show
+ * this one to users instead, so the context of users does not collide. */
+class HttpConnection : public WFConnection
+{
+public:
+	http2_conn_t *get_http2_conn() { return &this->h2_conn_; }
+
+private:
+	http2_conn_t h2_conn_;
+
+public:
+	HttpConnection(bool is_server)
+	{
+		http2_conn_init(is_server, &this->h2_conn_);
+	}
+
+	virtual ~HttpConnection()
+	{
+		http2_conn_deinit(&this->h2_conn_);
+	}
+};
+
+static void __http_connection_deleter(void *context)
+{
+	delete (HttpConnection *)context;
+}
+
 /**********Client**********/
 
 class ComplexHttpTask : public WFComplexClientTask<HttpRequest, HttpResponse>
@@ -47,7 +77,9 @@ public:
 					http_callback_t&& callback):
 		WFComplexClientTask(retry_max, std::move(callback)),
 		redirect_max_(redirect_max),
-		redirect_count_(0)
+		redirect_count_(0),
+		is_http2_(false),
+		body_streamed_(false)
 	{
 		HttpRequest *client_req = this->get_req();
 
@@ -61,19 +93,81 @@ protected:
 	virtual int keep_alive_timeout();
 	virtual bool init_success();
 	virtual void init_failed();
+	virtual bool check_request();
 	virtual bool finish_once();
 
+protected:
+	virtual WFConnection *get_connection() const
+	{
+		WFConnection *conn = this->WFComplexClientTask::get_connection();
+
+		if (conn && is_http2_ && conn->get_context())
+			return (HttpConnection *)conn->get_context();
+
+		return conn;
+	}
+
 protected:
 	bool need_redirect(ParsedURI& uri);
 	bool redirect_url(HttpResponse *client_resp, ParsedURI& uri);
 	void set_empty_request();
 	void check_response();
+	http2_conn_t *get_http2_conn();
+
+private:
+	/* HTTP/2 requests share a connection. */
+	virtual bool is_multiplexed() { return is_http2_; }
 
 private:
 	int redirect_max_;
 	int redirect_count_;
+	bool is_http2_;
+	bool body_streamed_;
 };
 
+/* HTTP/2 is used when the request version is set to "HTTP/2.0". Without
+ * ALPN, only for "http://" URLs (h2c with prior knowledge). */
+bool ComplexHttpTask::check_request()
+{
+	HttpRequest *req = this->get_req();
+	const char *version = req->get_http_version();
+
+	is_http2_ = false;
+	if (version && strncmp(version, "HTTP/2", 6) == 0)
+	{
+		if (this->get_transport_type() == TT_TCP)
+		{
+			/* Not to share connections with HTTP/1.x tasks. */
+			this->set_info("http2");
+			is_http2_ = true;
+		}
+		else
+			req->set_http_version("HTTP/1.1");
+	}
+
+	return true;
+}
+
+http2_conn_t *ComplexHttpTask::get_http2_conn()
+{
+	WFConnection *conn = this->WFComplexClientTask::get_connection();
+	HttpConnection *http_conn = (HttpConnection *)conn->get_context();
+
+	if (!http_conn)
+	{
+		http_conn = new HttpConnection(false);
+		if (http2_conn_enable(http_conn->get_http2_conn()) < 0)
+		{
+			delete http_conn;
+			return NULL;
+		}
+
+		conn->set_context(http_conn, __http_connection_deleter);
+	}
+
+	return http_conn->get_http2_conn();
+}
+
 CommMessageOut *ComplexHttpTask::message_out()
 {
 	HttpRequest *req = this->get_req();
@@ -154,6 +248,26 @@ CommMessageOut *ComplexHttpTask::message_out()
 		//if (this->keep_alive_timeo < 0 || this->keep_alive_timeo > HTTP_KEEPALIVE_MAX)
 	}
 
+	if (req->is_decompress_response() && http_encoding_accepted())
+	{
+		HttpHeaderCursor req_cursor(req);
+
+		header.name = "Accept-Encoding";
+		header.name_len = strlen("Accept-Encoding");
+		if (!req_cursor.find(&header))
+			req->add_header_pair("Accept-Encoding", http_encoding_accepted());
+	}
+
+	if (is_http2_)
+	{
+		http2_conn_t *h2_conn = this->get_http2_conn();
+
+		if (!h2_conn)
+			return NULL;
+
+		req->set_http2_conn(h2_conn);
+	}
+
 	//req->set_header_pair("Accept", "*/*");
 	return this->WFComplexClientTask::message_out();
 }
@@ -165,6 +279,22 @@ CommMessageIn *ComplexHttpTask::message_in()
 	if (strcmp(this->get_req()->get_method(), HttpMethodHead) == 0)
 		resp->parse_zero_body();
 
+	/* Frames of the stream are given to the response of the task. */
+	if (is_http2_)
+	{
+		resp->set_http2_conn(this->get_http2_conn());
+		resp->set_http2_stream(this->get_req()->get_http2_stream());
+	}
+
+	resp->set_decompress(this->get_req()->is_decompress_response());
+	if (this->get_req()->get_response_body_sink())
+	{
+		resp->set_body_sink([this](const void *buf, size_t size) {
+			body_streamed_ = true;
+			return this->get_req()->get_response_body_sink()(buf, size);
+		});
+	}
+
 	return this->WFComplexClientTask::message_in();
 }
 
@@ -338,8 +468,8 @@ bool ComplexHttpTask::need_redirect(ParsedURI& uri)
 void ComplexHttpTask::check_response()
 {
 	HttpResponse *resp = this->get_resp();
+	bool ended = resp->end_parsing();
 
-	resp->end_parsing();
 	if (this->state == WFT_STATE_SYS_ERROR && this->error == ECONNRESET)
 	{
 		/* Servers can end the message by closing the connection. */
@@ -348,10 +478,19 @@ void ComplexHttpTask::check_response()
 			!resp->is_chunked() &&
 			!resp->has_content_length_header())
 		{
-			this->state = WFT_STATE_SUCCESS;
-			this->error = 0;
+			if (ended)
+			{
+				this->state = WFT_STATE_SUCCESS;
+				this->error = 0;
+			}
+			else
+				this->error = errno;
 		}
 	}
+
+	/* A body that has gone to the sink can not be taken back. */
+	if (this->state != WFT_STATE_SUCCESS && body_streamed_)
+		this->disable_retry();
 }
 
 bool ComplexHttpTask::finish_once()
@@ -437,6 +576,7 @@ protected:
 	virtual CommMessageIn *message_in();
 	virtual int keep_alive_timeout();
 	virtual bool init_success();
+	virtual bool check_request();
 	virtual bool finish_once();
 
 protected:
@@ -609,6 +749,18 @@ int ComplexHttpProxyTask::keep_alive_timeout()
 	return this->ComplexHttpTask::keep_alive_timeout();
 }
 
+bool ComplexHttpProxyTask::check_request()
+{
+	HttpRequest *req = this->get_req();
+	const char *version = req->get_http_version();
+
+	/* HTTP/2 is not sent through proxies. */
+	if (version && strncmp(version, "HTTP/2", 6) == 0)
+		req->set_http_version("HTTP/1.1");
+
+	return true;
+}
+
 bool ComplexHttpProxyTask::init_success()
 {
 	if (!uri_.scheme || strcasecmp(uri_.scheme, "http") != 0)
@@ -745,6 +897,138 @@ bool ComplexHttpProxyTask::finish_once()
 	return true;
 }
 
+/*******Single Flight Client*******/
+
+class ComplexHttpFlightTask : public ComplexFlightTask<ComplexHttpTask,
+													   std::string>
+{
+public:
+	ComplexHttpFlightTask(WFSingleFlight *flight,
+						  const std::string& key,
+						  int redirect_max,
+						  int retry_max,
+						  http_callback_t&& callback):
+		ComplexFlightTask(flight, key, redirect_max, retry_max,
+						  std::move(callback))
+	{ }
+
+protected:
+	virtual void save_result(std::string& message)
+	{
+		HttpUtil::save_response(&this->resp, message);
+	}
+
+	virtual bool load_result(const std::string& message)
+	{
+		return HttpUtil::load_response(message, &this->resp);
+	}
+};
+
+/*******Cache Client*******/
+
+class ComplexHttpCacheTask : public ComplexHttpFlightTask
+{
+public:
+	ComplexHttpCacheTask(WFHttpCache *cache,
+						 int redirect_max,
+						 int retry_max,
+						 http_callback_t&& callback):
+		ComplexHttpFlightTask(&cache->flight_, "", redirect_max, retry_max,
+							  std::move(callback)),
+		cache_(cache),
+		handle_(NULL),
+		reload_(false),
+		served_(false),
+		redirected_(false)
+	{ }
+
+protected:
+	virtual bool finish_once();
+	virtual bool join();
+	virtual void land();
+
+private:
+	WFHttpCache *cache_;
+	const WFHttpCache::Handle *handle_;
+	bool reload_;
+	bool served_;
+	bool redirected_;
+};
+
+/* A fresh response is served at once. Otherwise the task joins the flight of
+ * its URL, and only the leader may revalidate a stale response. */
+bool ComplexHttpCacheTask::join()
+{
+	HttpRequest *req = this->get_req();
+	int ret;
+
+	if (!WFHttpCache::get_key(req, uri_, flight_key_, &reload_))
+		return false;
+
+	ret = cache_->get(flight_key_, reload_, &handle_);
+	if (ret == WFHttpCache::HTTP_CACHE_FRESH)
+	{
+		served_ = WFHttpCache::serve(handle_, &this->resp);
+		cache_->release(handle_);
+		handle_ = NULL;
+		if (served_)
+		{
+			this->state = WFT_STATE_SUCCESS;
+			this->error = 0;
+			return true;
+		}
+	}
+
+	if (this->ComplexHttpFlightTask::join())
+	{
+		if (handle_)
+		{
+			cache_->release(handle_);
+			handle_ = NULL;
+		}
+
+		return true;
+	}
+
+	if (ret == WFHttpCache::HTTP_CACHE_STALE)
+		WFHttpCache::add_validators(handle_, req);
+
+	return false;
+}
+
+/* The cache is updated before the waiting tasks get the response, so that
+ * a 304 is replaced by the cached one. */
+void ComplexHttpCacheTask::land()
+{
+	HttpResponse *resp = NULL;
+
+	if (this->state == WFT_STATE_SUCCESS && !redirected_)
+		resp = this->get_resp();
+
+	cache_->update(flight_key_, handle_, resp);
+	if (handle_)
+	{
+		cache_->release(handle_);
+		handle_ = NULL;
+	}
+
+	this->ComplexHttpFlightTask::land();
+}
+
+bool ComplexHttpCacheTask::finish_once()
+{
+	if (served_)
+		return true;
+
+	this->ComplexHttpFlightTask::finish_once();
+
+	/* The response of a redirected request is not for this URL. */
+	if (this->redirect_)
+		redirected_ = true;
+
+	return true;
+}
+
 /**********Client Factory**********/
 
 WFHttpTask *WFTaskFactory::create_http_task(const std::string& url,
@@ -813,6 +1097,73 @@ WFHttpTask *WFTaskFactory::create_http_task(const ParsedURI& uri,
 	return task;
 }
 
+WFHttpTask *WFHttpCache::create_http_task(const std::string& url,
+										  int redirect_max,
+										  int retry_max,
+										  http_callback_t callback)
+{
+	auto *task = new ComplexHttpCacheTask(this,
+										  redirect_max,
+										  retry_max,
+										  std::move(callback));
+	ParsedURI uri;
+
+	URIParser::parse(url, uri);
+	task->init(std::move(uri));
+	task->set_keep_alive(HTTP_KEEPALIVE_DEFAULT);
+	return task;
+}
+
+WFHttpTask *WFHttpCache::create_http_task(const ParsedURI& uri,
+										  int redirect_max,
+										  int retry_max,
+										  http_callback_t callback)
+{
+	auto *task = new ComplexHttpCacheTask(this,
+										  redirect_max,
+										  retry_max,
+										  std::move(callback));
+
+	task->init(uri);
+	task->set_keep_alive(HTTP_KEEPALIVE_DEFAULT);
+	return task;
+}
+
+/* Keys of different protocols do not meet. */
+WFHttpTask *WFSingleFlight::create_http_task(const std::string& key,
+											 const std::string& url,
+											 int redirect_max,
+											 int retry_max,
+											 http_callback_t callback)
+{
+	auto *task = new ComplexHttpFlightTask(this, "http\n" + key,
+										   redirect_max,
+										   retry_max,
+										   std::move(callback));
+	ParsedURI uri;
+
+	URIParser::parse(url, uri);
+	task->init(std::move(uri));
+	task->set_keep_alive(HTTP_KEEPALIVE_DEFAULT);
+	return task;
+}
+
+WFHttpTask *WFSingleFlight::create_http_task(const std::string& key,
+											 const ParsedURI& uri,
+											 int redirect_max,
+											 int retry_max,
+											 http_callback_t callback)
+{
+	auto *task = new ComplexHttpFlightTask(this, "http\n" + key,
+										   redirect_max,
+										   retry_max,
+										   std::move(callback));
+
+	task->init(uri);
+	task->set_keep_alive(HTTP_KEEPALIVE_DEFAULT);
+	return task;
+}
+
 /**********Server**********/
 
 class WFHttpServerTask : public WFServerTask<HttpRequest, HttpResponse>
@@ -822,14 +1173,32 @@ public:
 					 std::function<void (WFHttpTask *)>& process):
 		WFServerTask(service, WFGlobal::get_scheduler(), process),
 		req_is_alive_(false),
-		req_has_keep_alive_header_(false)
+		req_has_keep_alive_header_(false),
+		req_accept_encoding_(HTTP_ENCODING_IDENTITY),
+		req_is_http2_(false),
+		header_pushed_(false)
 	{}
 
+	virtual int push_chunk(const void *buf, size_t size);
+
 protected:
+	virtual WFConnection *get_connection() const
+	{
+		WFConnection *conn = this->WFServerTask::get_connection();
+
+		if (conn)
+			return (HttpConnection *)conn->get_context();
+
+		return NULL;
+	}
+
+	virtual CommMessageIn *message_in();
+
 	virtual void handle(int state, int error)
 	{
 		if (state == WFT_STATE_TOREPLY)
 		{
+			req_is_http2_ = this->req.is_http2();
 			req_is_alive_ = this->req.is_keep_alive();
 			if (req_is_alive_ && this->req.has_keep_alive_header())
 			{
@@ -845,6 +1214,18 @@ protected:
 											header.value_len);
 				}
 			}
+
+			HttpHeaderCursor req_cursor(&this->req);
+			struct HttpMessageHeader header;
+
+			header.name = "Accept-Encoding";
+			header.name_len = strlen("Accept-Encoding");
+			if (req_cursor.find(&header))
+			{
+				req_accept_encoding_ =
+					http_encoding_accept((const char *)header.value,
+										 header.value_len);
+			}
 		}
 
 		this->WFServerTask::handle(state, error);
@@ -852,18 +1233,50 @@ protected:
 
 	virtual CommMessageOut *message_out();
 
+private:
+	void prepare_status();
+	void prepare_connection();
+
 private:
 	bool req_is_alive_;
 	bool req_has_keep_alive_header_;
+	int req_accept_encoding_;
+	bool req_is_http2_;
+	bool header_pushed_;
 	std::string req_keep_alive_;
 };
 
-CommMessageOut *WFHttpServerTask::message_out()
+/* Every connection has an HttpConnection, for the HTTP/2 state if a client
+ * begins with the HTTP/2 preface. */
+CommMessageIn *WFHttpServerTask::message_in()
+{
+	WFConnection *conn = (WFConnection *)this->CommSession::get_connection();
+	HttpConnection *http_conn = (HttpConnection *)conn->get_context();
+
+	if (!http_conn)
+	{
+		http_conn = new HttpConnection(true);
+		conn->set_context(http_conn, __http_connection_deleter);
+	}
+
+	this->req.set_http2_conn(http_conn->get_http2_conn());
+	return this->WFServerTask::message_in();
+}
+
+void WFHttpServerTask::prepare_status()
 {
 	HttpResponse *resp = this->get_resp();
-	struct HttpMessageHeader header;
 
-	if (!resp->get_http_version())
+	if (this->req.is_http2())
+	{
+		WFConnection *conn = (WFConnection *)this->CommSession::get_connection();
+		HttpConnection *http_conn = (HttpConnection *)conn->get_context();
+
+		resp->set_http2_conn(http_conn->get_http2_conn());
+		resp->set_http2_stream(this->req.get_http2_stream());
+		resp->set_http_version("HTTP/2.0");
+	}
+	else if (!resp->get_http_version())
 		resp->set_http_version("HTTP/1.1");
 
 	const char *status_code_str = resp->get_status_code();
@@ -878,17 +1291,12 @@ CommMessageOut *WFHttpServerTask::message_out()
 
 		HttpUtil::set_response_status(resp, status_code);
 	}
+}
 
-	if (!resp->is_chunked() && !resp->has_content_length_header())
-	{
-		char buf[32];
-		header.name = "Content-Length";
-		header.name_len = strlen("Content-Length");
-		header.value = buf;
-		header.value_len = sprintf(buf, "%zu", resp->get_output_body_size());
-		resp->add_header(&header);
-	}
-
+void WFHttpServerTask::prepare_connection()
+{
+	HttpResponse *resp = this->get_resp();
+	struct HttpMessageHeader header;
 	bool is_alive;
 
 	if (resp->has_connection_header())
@@ -962,10 +1370,127 @@ CommMessageOut *WFHttpServerTask::message_out()
 
 		resp->add_header(&header);
 	}
+}
 
+CommMessageOut *WFHttpServerTask::message_out()
+{
+	HttpResponse *resp = this->get_resp();
+	struct HttpMessageHeader header;
+
+	/* The header and the chunks before have been pushed. */
+	if (header_pushed_)
+	{
+		if (!resp->set_header_pushed())
+			return NULL;
+
+		return this->WFServerTask::message_out();
+	}
+
+	this->prepare_status();
+	size_t body_size = resp->get_output_body_size();
+
+	if (body_size != 0 && body_size >= resp->get_compress_min_size() &&
+		req_accept_encoding_ != HTTP_ENCODING_IDENTITY &&
+		!resp->is_chunked() && !resp->has_content_length_header())
+	{
+		HttpHeaderCursor resp_cursor(resp);
+
+		header.name = "Content-Encoding";
+		header.name_len = strlen("Content-Encoding");
+		if (!resp_cursor.find(&header) &&
+			resp->compress_output_body(req_accept_encoding_, -1))
+		{
+			resp->add_header_pair("Vary", "Accept-Encoding");
+		}
+	}
+
+	if (!resp->is_chunked() && !resp->has_content_length_header())
+	{
+		char buf[32];
+		header.name = "Content-Length";
+		header.name_len = strlen("Content-Length");
+		header.value = buf;
+		header.value_len = sprintf(buf, "%zu", resp->get_output_body_size());
+		resp->add_header(&header);
+	}
+
+	this->prepare_connection();
 	return this->WFServerTask::message_out();
 }
 
+/* Send a chunk of the response body before the reply. The first one comes
+ * with the header. The chunk is queued and written by the poller. While the
+ * client is too slow to take what is queued, EAGAIN is returned and nothing
+ * is taken, so the data never piles up in memory. */
+int WFHttpServerTask::push_chunk(const void *buf, size_t size)
+{
+	HttpResponse *resp = this->get_resp();
+	struct HttpMessageHeader header;
+	std::string data;
+	char line[32];
+	int ret;
+
+	if (req_is_http2_)
+	{
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	if (this->state != WFT_STATE_TOREPLY)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (!header_pushed_)
+	{
+		this->prepare_status();
+		if (!resp->is_chunked())
+			resp->add_header_pair("Transfer-Encoding", "chunked");
+
+		this->prepare_connection();
+		data.append(resp->get_http_version());
+		data.append(" ");
+		data.append(resp->get_status_code());
+		data.append(" ");
+		data.append(resp->get_reason_phrase());
+		data.append("\r\n");
+
+		HttpHeaderCursor cursor(resp);
+
+		while (cursor.next(&header))
+		{
+			data.append((const char *)header.name, header.name_len);
+			data.append(": ");
+			data.append((const char *)header.value, header.value_len);
+			data.append("\r\n");
+		}
+
+		data.append("\r\n");
+	}
+
+	/* A chunk of size 0 would end the body. */
+	if (size != 0)
+	{
+		data.append(line, sprintf(line, "%zx\r\n", size));
+		data.append((const char *)buf, size);
+		data.append("\r\n");
+	}
+
+	ret = this->scheduler->push_async(data.data(), data.size(), this);
+	if (ret < 0)
+	{
+		/* The body is broken. Close the connection instead of replying. */
+		if (errno != EAGAIN)
+			this->noreply();
+
+		return -1;
+	}
+
+	header_pushed_ = true;
+	return size;
+}
+
 /**********Server Factory**********/
 
 WFHttpTask *WFServerTaskFactory::create_http_task(CommService *service,
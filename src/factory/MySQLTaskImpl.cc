@@ -21,12 +21,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <string>
+#include <list>
+#include <utility>
 #include <unordered_map>
 #include <openssl/ssl.h>
 #include <openssl/bio.h>
 #include "WFTaskError.h"
 #include "WFTaskFactory.h"
 #include "MySQLMessage.h"
+#include "MySQLResult.h"
 #include "StringUtil.h"
 #include "mysql_types.h"
 
@@ -34,6 +37,7 @@ using namespace protocol;
 
 #define MYSQL_KEEPALIVE_DEFAULT		(60 * 1000)
 #define MYSQL_KEEPALIVE_TRANSACTION	(3600 * 1000)
+#define MYSQL_STMT_CACHE_MAX		256
 
 /**********Client**********/
 
@@ -99,6 +103,24 @@ private:
 		unsigned char mysql_seqid;
 	};
 
+	/* Prepared statements of a connection, by query. Least recently used
+	 * is in the back, and is closed when a new one needs the room. */
+	struct stmt_info
+	{
+		uint32_t stmt_id;
+		int param_count;
+	};
+
+	struct stmt_cache
+	{
+		using StmtList = std::list<std::pair<std::string, stmt_info>>;
+
+		StmtList list;
+		std::unordered_map<std::string, StmtList::iterator> map;
+	};
+
+	stmt_cache *get_stmt_cache();
+
 private:
 	std::string username_;
 	std::string password_;
@@ -109,12 +131,20 @@ private:
 	int error_;
 	bool is_ssl_;
 	bool is_user_request_;
+	bool stmt_prepare_;
+	bool stmt_error_;
+	bool stmt_param_error_;
+	bool rows_streamed_;
 
 public:
 	ComplexMySQLTask(int retry_max, mysql_callback_t&& callback):
 		WFComplexClientTask(retry_max, std::move(callback)),
 		character_set_(33),
-		is_user_request_(true)
+		is_user_request_(true),
+		stmt_prepare_(false),
+		stmt_error_(false),
+		stmt_param_error_(false),
+		rows_streamed_(false)
 	{}
 };
 
@@ -122,9 +152,13 @@ bool ComplexMySQLTask::check_request()
 {
 	if (this->req.query_is_unset() == false)
 	{
-		if (this->req.get_command() == MYSQL_COM_QUERY)
+		int cmd = this->req.get_command();
+
+		if (cmd == MYSQL_COM_QUERY || cmd == MYSQL_COM_STMT_EXECUTE)
 		{
-			std::string query = this->req.get_query();
+			std::string query = cmd == MYSQL_COM_QUERY ?
+								this->req.get_query() :
+								this->req.get_stmt_query();
 
 			if (strncasecmp(query.c_str(), "USE ", 4) &&
 				strncasecmp(query.c_str(), "SET NAMES ", 10) &&
@@ -195,6 +229,23 @@ int ComplexMySQLTask::init_ssl_connection()
 	return 0;
 }
 
+ComplexMySQLTask::stmt_cache *ComplexMySQLTask::get_stmt_cache()
+{
+	/* The context of the connection is free after auth. */
+	WFConnection *conn = this->get_connection();
+	auto *cache = (stmt_cache *)conn->get_context();
+
+	if (!cache)
+	{
+		cache = new stmt_cache;
+		conn->set_context(cache, [](void *ctx) {
+			delete (stmt_cache *)ctx;
+		});
+	}
+
+	return cache;
+}
+
 CommMessageOut *ComplexMySQLTask::message_out()
 {
 	long long seqid = this->get_seq();
@@ -245,6 +296,8 @@ CommMessageOut *ComplexMySQLTask::message_out()
 	}
 
 	is_user_request_ = true;
+	stmt_prepare_ = false;
+	stmt_error_ = false;
 	if (this->is_fixed_addr())
 	{
 		auto *target = (RouteManager::RouteTarget *)this->get_target();
@@ -263,6 +316,47 @@ CommMessageOut *ComplexMySQLTask::message_out()
 		}
 	}
 
+	if (this->req.get_command() == MYSQL_COM_STMT_EXECUTE)
+	{
+		stmt_cache *cache = get_stmt_cache();
+		const std::string& query = this->req.get_stmt_query();
+		auto it = cache->map.find(query);
+
+		if (it != cache->map.end())
+		{
+			const stmt_info& stmt = it->second->second;
+
+			cache->list.splice(cache->list.begin(), cache->list, it->second);
+			if (stmt.param_count != this->req.get_stmt_param_count())
+			{
+				stmt_param_error_ = true;
+				errno = EINVAL;
+				return NULL;
+			}
+
+			this->req.set_stmt_id(stmt.stmt_id);
+		}
+		else
+		{
+			auto *req = new MySQLPrepareRequest;
+
+			if (cache->list.size() >= MYSQL_STMT_CACHE_MAX)
+			{
+				req->set_close(cache->list.back().second.stmt_id);
+				cache->map.erase(cache->list.back().first);
+				cache->list.pop_back();
+			}
+
+			req->set_prepare(query);
+			is_user_request_ = false;
+			stmt_prepare_ = true;
+			if (is_ssl_)
+				return new MySSLWrapper(req, get_ssl());
+			else
+				return req;
+		}
+	}
+
 	auto *msg = (ProtocolMessage *)this->WFComplexClientTask::message_out();
 	return is_ssl_ ? get_ssl_wrapper(msg) : msg;
 }
@@ -285,10 +379,24 @@ CommMessageIn *ComplexMySQLTask::message_in()
 
 	if (seqid == 1)
 		resp = new MySQLAuthResponse;
+	else if (stmt_prepare_)
+		resp = new MySQLPrepareResponse;
 	else if (seqid == 2 && !is_user_request_)
 		resp = new MySQLResponse;
 	else
+	{
+		this->resp.set_command(this->req.get_command());
+		if (this->req.get_response_row_sink())
+		{
+			this->resp.set_row_sink(this->req.get_response_row_batch(),
+									[this](MySQLResultCursor& cursor) {
+				rows_streamed_ = true;
+				return this->req.get_response_row_sink()(cursor);
+			});
+		}
+
 		resp = (ProtocolMessage *)this->WFComplexClientTask::message_in();
+	}
 
 	if (!is_ssl_)
 		return resp;
@@ -344,6 +452,34 @@ int ComplexMySQLTask::keep_alive_timeout()
 			delete (handshake_ctx *)ctx;
 		});
 	}
+	else if (stmt_prepare_)
+	{
+		auto *msg = (ProtocolMessage *)this->get_message_in();
+		MySQLPrepareResponse *resp;
+
+		if (is_ssl_)
+			resp = (MySQLPrepareResponse *)((MySSLWrapper *)msg)->get_msg();
+		else
+			resp = (MySQLPrepareResponse *)msg;
+
+		if (resp->is_ok_packet())
+		{
+			stmt_cache *cache = get_stmt_cache();
+			const std::string& query = this->req.get_stmt_query();
+
+			cache->list.emplace_front(query, stmt_info{resp->get_stmt_id(),
+													   resp->get_param_count()});
+			cache->map.emplace(query, cache->list.begin());
+		}
+		else
+		{
+			/* Give the error of preparing to the user, like a query. */
+			this->resp = std::move(*resp);
+			stmt_error_ = true;
+		}
+
+		return this->keep_alive_timeo;
+	}
 	else if (!is_user_request_)
 	{
 		if (!is_ssl_ || seqid != 1)
@@ -597,9 +733,22 @@ bool ComplexMySQLTask::finish_once()
 		}
 
 		is_user_request_ = true;
-		return false;
+		if (!stmt_error_ || this->state != WFT_STATE_SUCCESS)
+			return false;
 	}
 
+	/* Parameters that do not match the statement are a user error. */
+	if (stmt_param_error_)
+	{
+		this->state = WFT_STATE_TASK_ERROR;
+		this->error = WFT_ERR_MYSQL_STMT_PARAM_COUNT;
+		this->disable_retry();
+	}
+
+	/* Rows that have gone to the sink can not be taken back. */
+	if (this->state != WFT_STATE_SUCCESS && rows_streamed_)
+		this->disable_retry();
+
 	if (this->is_fixed_addr())
 	{
 		if (this->state != WFT_STATE_SUCCESS || this->keep_alive_timeo == 0)
@@ -18,11 +18,21 @@
            Liu Kai (liukaidx@sogou-inc.com)
 */
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
+#include <vector>
+#include <utility>
+#include <functional>
 #include "WFTaskError.h"
 #include "WFTaskFactory.h"
 #include "StringUtil.h"
+#include "WFSingleFlight.h"
+#include "FlightTaskImpl.inl"
+#include "WFRedisPipeline.h"
+#include "WFRedisCluster.h"
 
 using namespace protocol;
 
@@ -61,16 +71,20 @@ private:
 
 bool ComplexRedisTask::check_request()
 {
+	size_t n = this->req.get_command_count();
 	std::string command;
 
-	if (this->req.get_command(command) &&
-		(strcasecmp(command.c_str(), "AUTH") == 0 ||
-		 strcasecmp(command.c_str(), "SELECT") == 0 ||
-		 strcasecmp(command.c_str(), "ASKING") == 0))
+	for (size_t i = 0; i < n; i++)
 	{
-		this->state = WFT_STATE_TASK_ERROR;
-		this->error = WFT_ERR_REDIS_COMMAND_DISALLOWED;
-		return false;
+		if (this->req.get_command(i, command) &&
+			(strcasecmp(command.c_str(), "AUTH") == 0 ||
+			 strcasecmp(command.c_str(), "SELECT") == 0 ||
+			 strcasecmp(command.c_str(), "ASKING") == 0))
+		{
+			this->state = WFT_STATE_TASK_ERROR;
+			this->error = WFT_ERR_REDIS_COMMAND_DISALLOWED;
+			return false;
+		}
 	}
 
 	return true;
@@ -114,7 +128,11 @@ CommMessageIn *ComplexRedisTask::message_in()
 	RedisResponse *resp = this->get_resp();
 
 	if (is_user_request_)
+	{
 		resp->set_asking(req->is_asking());
+		if (!resp->parse_replies(req->get_command_count()))
+			return NULL;
+	}
 	else
 		resp->set_asking(false);
 
@@ -257,6 +275,267 @@ bool ComplexRedisTask::finish_once()
 	return true;
 }
 
+/*******Single Flight Client*******/
+
+class ComplexRedisFlightTask : public ComplexFlightTask<ComplexRedisTask,
+														RedisValue>
+{
+public:
+	ComplexRedisFlightTask(WFSingleFlight *flight,
+						   const std::string& key,
+						   int retry_max,
+						   redis_callback_t&& callback):
+		ComplexFlightTask(flight, key, retry_max, std::move(callback))
+	{ }
+
+protected:
+	virtual void save_result(RedisValue& value)
+	{
+		this->resp.get_result(value);
+	}
+
+	virtual bool load_result(const RedisValue& value)
+	{
+		return this->resp.set_result(value);
+	}
+};
+
+/*******Pipeline Client*******/
+
+class ComplexRedisPipelineTask : public ComplexRedisTask
+{
+public:
+	ComplexRedisPipelineTask(WFRedisPipeline *pipeline,
+							 redis_callback_t&& callback):
+		ComplexRedisTask(0, std::move(callback)),
+		pipeline_(pipeline),
+		pipeline_state_(PIPELINE_STATE_INIT)
+	{ }
+
+protected:
+	virtual bool check_request();
+	virtual void dispatch();
+	virtual SubTask *done();
+	virtual bool finish_once() { return true; }
+
+private:
+	using Member = WFRedisPipeline::Member;
+
+	static WFRedisTask *create_batch(WFRedisPipeline *pipeline,
+									 std::vector<Member>&& members);
+	static void batch_callback(WFRedisPipeline *pipeline,
+							   const std::vector<Member>& members,
+							   WFRedisTask *batch);
+
+	enum
+	{
+		PIPELINE_STATE_INIT,
+		PIPELINE_STATE_WAITING,
+		PIPELINE_STATE_DONE,
+	};
+
+	WFRedisPipeline *pipeline_;
+	int pipeline_state_;
+};
+
+/* A member without a command has no reply to take from the batch. */
+bool ComplexRedisPipelineTask::check_request()
+{
+	if (this->req.get_command_count() == 0)
+	{
+		this->state = WFT_STATE_SYS_ERROR;
+		this->error = EINVAL;
+		return false;
+	}
+
+	return this->ComplexRedisTask::check_request();
+}
+
+void ComplexRedisPipelineTask::dispatch()
+{
+	std::vector<Member> members;
+	WFConditional *cond;
+
+	if (pipeline_state_ == PIPELINE_STATE_INIT)
+	{
+		pipeline_state_ = PIPELINE_STATE_DONE;
+		if (this->state == WFT_STATE_UNDEFINED && this->check_request())
+		{
+			cond = WFTaskFactory::create_conditional(this);
+			series_of(this)->push_front(cond);
+			pipeline_state_ = PIPELINE_STATE_WAITING;
+			if (pipeline_->get(this, cond, members))
+				create_batch(pipeline_, std::move(members))->start();
+		}
+	}
+
+	this->subtask_done();
+}
+
+SubTask *ComplexRedisPipelineTask::done()
+{
+	if (pipeline_state_ == PIPELINE_STATE_WAITING)
+	{
+		pipeline_state_ = PIPELINE_STATE_DONE;
+		return series_of(this)->pop();
+	}
+
+	return this->ComplexRedisTask::done();
+}
+
+/* The commands of all the members are sent as one batch request. */
+WFRedisTask *
+ComplexRedisPipelineTask::create_batch(WFRedisPipeline *pipeline,
+									   std::vector<Member>&& members)
+{
+	WFRedisTask *batch = WFTaskFactory::create_redis_task(pipeline->uri_, 0,
+														  nullptr);
+	RedisRequest *req = batch->get_req();
+	ComplexRedisPipelineTask *task;
+	std::vector<std::string> params;
+	std::string command;
+	size_t n;
+
+	for (const Member& member : members)
+	{
+		task = static_cast<ComplexRedisPipelineTask *>(member.task);
+		n = task->req.get_command_count();
+		for (size_t i = 0; i < n; i++)
+		{
+			task->req.get_command(i, command);
+			task->req.get_params(i, params);
+			req->add_request(command, params);
+		}
+	}
+
+	batch->set_callback(std::bind(&ComplexRedisPipelineTask::batch_callback,
+								  pipeline, std::move(members),
+								  std::placeholders::_1));
+	return batch;
+}
+
+void ComplexRedisPipelineTask::batch_callback(WFRedisPipeline *pipeline,
+											  const std::vector<Member>& members,
+											  WFRedisTask *batch)
+{
+	redis_reply_t *reply = batch->get_resp()->result_ptr();
+	size_t total = batch->get_req()->get_command_count();
+	int state = batch->get_state();
+	ComplexRedisPipelineTask *task;
+	std::vector<Member> next;
+	RedisValue value;
+	size_t pos = 0;
+	size_t n;
+
+	/* Take the next batch before the members may delete the pipeline. */
+	if (pipeline->next(next))
+		series_of(batch)->push_back(create_batch(pipeline, std::move(next)));
+
+	for (const Member& member : members)
+	{
+		task = static_cast<ComplexRedisPipelineTask *>(member.task);
+		n = task->req.get_command_count();
+		task->state = state;
+		task->error = batch->get_error();
+		task->timeout_reason = batch->get_timeout_reason();
+		if (state == WFT_STATE_SUCCESS)
+		{
+			/* A batch of one command gets the reply itself. */
+			if (total == 1 && n == 1)
+				value.set(reply);
+			else if (n == 1)
+				value.set(reply->element[pos]);
+			else
+			{
+				value.set_array(n);
+				for (size_t i = 0; i < n; i++)
+					value[i].set(reply->element[pos + i]);
+			}
+
+			task->resp.set_result(value);
+		}
+
+		pos += n;
+		member.cond->signal(NULL);
+	}
+}
+
+/*******Cluster Client*******/
+
+class ComplexRedisClusterTask : public ComplexRedisTask
+{
+public:
+	ComplexRedisClusterTask(WFRedisCluster *cluster,
+							int retry_max,
+							redis_callback_t&& callback):
+		ComplexRedisTask(retry_max, std::move(callback)),
+		cluster_(cluster),
+		routed_(false)
+	{ }
+
+protected:
+	virtual void dispatch();
+	virtual bool finish_once();
+
+private:
+	WFRedisCluster *cluster_;
+	bool routed_;
+};
+
+/* Only the first dispatch is routed. Redirects and retries go on. */
+void ComplexRedisClusterTask::dispatch()
+{
+	std::string host;
+	std::string port;
+	int slot;
+
+	if (!routed_ && this->state == WFT_STATE_UNDEFINED)
+	{
+		routed_ = true;
+		slot = WFRedisCluster::get_slot(&this->req);
+		if (slot >= 0)
+		{
+			if (cluster_->get_node(slot, host, port))
+			{
+				char *h = strdup(host.c_str());
+				char *p = strdup(port.c_str());
+
+				if (h && p)
+				{
+					free(uri_.host);
+					free(uri_.port);
+					uri_.host = h;
+					uri_.port = p;
+				}
+				else
+				{
+					free(h);
+					free(p);
+				}
+			}
+			else
+				cluster_->refresh();
+		}
+	}
+
+	this->ComplexRedisTask::dispatch();
+}
+
+bool ComplexRedisClusterTask::finish_once()
+{
+	const redis_reply_t *reply = this->resp.result_ptr();
+
+	if (this->state == WFT_STATE_SYS_ERROR ||
+		(this->state == WFT_STATE_SUCCESS &&
+		 reply->type == REDIS_REPLY_TYPE_ERROR && reply->str &&
+		 strncasecmp(reply->str, "MOVED ", 6) == 0))
+	{
+		cluster_->refresh();
+	}
+
+	return this->ComplexRedisTask::finish_once();
+}
+
 /**********Factory**********/
 
 // redis://:password@host:port/db_num
@@ -286,3 +565,53 @@ WFRedisTask *WFTaskFactory::create_redis_task(const ParsedURI& uri,
 	return task;
 }
 
+/* Keys of different protocols do not meet. */
+WFRedisTask *WFSingleFlight::create_redis_task(const std::string& key,
+											   const std::string& url,
+											   int retry_max,
+											   redis_callback_t callback)
+{
+	auto *task = new ComplexRedisFlightTask(this, "redis\n" + key,
+											retry_max,
+											std::move(callback));
+	ParsedURI uri;
+
+	URIParser::parse(url, uri);
+	task->init(std::move(uri));
+	task->set_keep_alive(REDIS_KEEPALIVE_DEFAULT);
+	return task;
+}
+
+WFRedisTask *WFSingleFlight::create_redis_task(const std::string& key,
+											   const ParsedURI& uri,
+											   int retry_max,
+											   redis_callback_t callback)
+{
+	auto *task = new ComplexRedisFlightTask(this, "redis\n" + key,
+											retry_max,
+											std::move(callback));
+
+	task->init(uri);
+	task->set_keep_alive(REDIS_KEEPALIVE_DEFAULT);
+	return task;
+}
+
+WFRedisTask *WFRedisPipeline::create_redis_task(redis_callback_t callback)
+{
+	auto *task = new ComplexRedisPipelineTask(this, std::move(callback));
+
+	task->init(this->uri_);
+	task->set_keep_alive(REDIS_KEEPALIVE_DEFAULT);
+	return task;
+}
+
+WFRedisTask *WFRedisCluster::create_redis_task(int retry_max,
+											   redis_callback_t callback)
+{
+	auto *task = new ComplexRedisClusterTask(this, retry_max,
+											 std::move(callback));
+
+	task->init(this->uri_);
+	task->set_keep_alive(REDIS_KEEPALIVE_DEFAULT);
+	return task;
+}
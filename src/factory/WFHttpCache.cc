@@ -0,0 +1,493 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <chrono>
+#include <string>
+#include <mutex>
+#include "HttpMessage.h"
+#include "HttpUtil.h"
+#include "WFTaskFactory.h"
+#include "WFHttpCache.h"
+
+using namespace protocol;
+
+#define GET_CURRENT_MS	std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+
+#define HTTP_DATE_MAX	64
+
+struct WFHttpCache::Entry
+{
+	std::string message;
+	std::string etag;
+	std::string last_modified;
+	int64_t lifetime;
+	int64_t expire_time;
+};
+
+void WFHttpCache::EntryDeleter::operator() (Entry *entry) const
+{
+	delete entry;
+}
+
+struct __HttpCachePolicy
+{
+	bool no_store;
+	bool no_cache;
+	bool vary;
+	int64_t max_age;
+	int64_t age;
+	time_t date;
+	time_t expires;
+	std::string etag;
+	std::string last_modified;
+};
+
+static inline bool __name_is(const struct HttpMessageHeader *header,
+							 const char *name)
+{
+	size_t len = strlen(name);
+
+	return header->name_len == len &&
+		   strncasecmp((const char *)header->name, name, len) == 0;
+}
+
+/* Returns the next element of a comma separated list, without the spaces
+ * around it. */
+static const char *__next_token(const char **p, const char *end, size_t *len)
+{
+	const char *token = *p;
+	const char *q;
+
+	while (token < end && (*token == ' ' || *token == '\t' || *token == ','))
+		token++;
+
+	if (token == end)
+		return NULL;
+
+	q = token;
+	while (q < end && *q != ',')
+		q++;
+
+	*p = q;
+	while (q > token && (q[-1] == ' ' || q[-1] == '\t'))
+		q--;
+
+	*len = q - token;
+	return token;
+}
+
+static int64_t __parse_seconds(const char *p, size_t len)
+{
+	int64_t sec = 0;
+	size_t i;
+
+	if (len >= 2 && p[0] == '"' && p[len - 1] == '"')
+	{
+		p++;
+		len -= 2;
+	}
+
+	if (len == 0)
+		return -1;
+
+	for (i = 0; i < len; i++)
+	{
+		if (p[i] < '0' || p[i] > '9')
+			return -1;
+
+		/* Larger than 68 years is as good as forever. */
+		if (sec < INT32_MAX)
+			sec = sec * 10 + p[i] - '0';
+	}
+
+	return sec;
+}
+
+/* IMF-fixdate only, like "Sun, 06 Nov 1994 08:49:37 GMT". Any other date,
+ * including "0" in Expires, is in the past. */
+static time_t __parse_date(const char *p, size_t len)
+{
+	char buf[HTTP_DATE_MAX];
+	struct tm tm = { };
+	const char *end;
+
+	if (len >= HTTP_DATE_MAX)
+		return 0;
+
+	memcpy(buf, p, len);
+	buf[len] = '\0';
+	end = strptime(buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	if (!end || *end != '\0')
+		return 0;
+
+	return timegm(&tm);
+}
+
+static void __parse_cache_control(const char *p, size_t len,
+								  struct __HttpCachePolicy *policy)
+{
+	const char *end = p + len;
+	const char *token;
+	size_t n;
+
+	while ((token = __next_token(&p, end, &n)) != NULL)
+	{
+		if (n == 8 && strncasecmp(token, "no-store", 8) == 0)
+			policy->no_store = true;
+		else if (n >= 8 && strncasecmp(token, "no-cache", 8) == 0 &&
+				 (n == 8 || token[8] == '='))
+			policy->no_cache = true;
+		else if (n > 8 && strncasecmp(token, "max-age=", 8) == 0)
+			policy->max_age = __parse_seconds(token + 8, n - 8);
+	}
+}
+
+/* Only Vary of Accept-Encoding is supported, which is a part of the key. */
+static bool __parse_vary(const char *p, size_t len)
+{
+	const char *end = p + len;
+	const char *token;
+	size_t n;
+
+	while ((token = __next_token(&p, end, &n)) != NULL)
+	{
+		if (n != 15 || strncasecmp(token, "accept-encoding", 15) != 0)
+			return true;
+	}
+
+	return false;
+}
+
+static void __get_policy(const HttpMessage *msg,
+						 struct __HttpCachePolicy *policy)
+{
+	HttpHeaderCursor cursor(msg);
+	struct HttpMessageHeader header;
+	const char *value;
+	size_t len;
+
+	policy->no_store = false;
+	policy->no_cache = false;
+	policy->vary = false;
+	policy->max_age = -1;
+	policy->age = 0;
+	policy->date = -1;
+	policy->expires = -1;
+
+	while (cursor.next(&header))
+	{
+		value = (const char *)header.value;
+		len = header.value_len;
+		if (__name_is(&header, "Cache-Control"))
+			__parse_cache_control(value, len, policy);
+		else if (__name_is(&header, "Pragma"))
+		{
+			if (len == 8 && strncasecmp(value, "no-cache", 8) == 0)
+				policy->no_cache = true;
+		}
+		else if (__name_is(&header, "Expires"))
+			policy->expires = __parse_date(value, len);
+		else if (__name_is(&header, "Date"))
+			policy->date = __parse_date(value, len);
+		else if (__name_is(&header, "Age"))
+			policy->age = __parse_seconds(value, len);
+		else if (__name_is(&header, "ETag"))
+			policy->etag.assign(value, len);
+		else if (__name_is(&header, "Last-Modified"))
+			policy->last_modified.assign(value, len);
+		else if (__name_is(&header, "Vary"))
+			policy->vary = policy->vary || __parse_vary(value, len);
+	}
+
+	if (policy->age < 0)
+		policy->age = 0;
+}
+
+/* Freshness lifetime in milliseconds. Returns false if the server does not
+ * give one, and the response has to be revalidated every time. */
+static bool __get_lifetime(const struct __HttpCachePolicy *policy,
+						   int64_t *lifetime)
+{
+	int64_t sec;
+
+	if (policy->no_cache)
+		sec = 0;
+	else if (policy->max_age >= 0)
+		sec = policy->max_age;
+	else if (policy->expires >= 0)
+	{
+		if (policy->date > 0)
+			sec = policy->expires - policy->date;
+		else
+			sec = policy->expires - time(NULL);
+	}
+	else
+	{
+		*lifetime = 0;
+		return false;
+	}
+
+	sec -= policy->age;
+	*lifetime = sec > 0 ? sec * 1000 : 0;
+	return true;
+}
+
+static bool __status_storable(int code)
+{
+	switch (code)
+	{
+	case 200:
+	case 203:
+	case 204:
+	case 300:
+	case 404:
+	case 405:
+	case 410:
+	case 414:
+	case 501:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+bool WFHttpCache::get_key(const HttpRequest *req, const ParsedURI& uri,
+						  std::string& key, bool *reload)
+{
+	HttpHeaderCursor cursor(req);
+	struct HttpMessageHeader header;
+	struct __HttpCachePolicy policy;
+	std::string encoding;
+
+	if (strcasecmp(req->get_method(), HttpMethodGet) != 0 ||
+		req->get_response_body_sink())
+		return false;
+
+	policy.no_store = false;
+	policy.no_cache = false;
+	policy.max_age = -1;
+
+	while (cursor.next(&header))
+	{
+		if (__name_is(&header, "Authorization") ||
+			__name_is(&header, "Range") ||
+			__name_is(&header, "If-Match") ||
+			__name_is(&header, "If-None-Match") ||
+			__name_is(&header, "If-Modified-Since") ||
+			__name_is(&header, "If-Unmodified-Since") ||
+			__name_is(&header, "If-Range"))
+			return false;
+
+		if (__name_is(&header, "Cache-Control"))
+		{
+			__parse_cache_control((const char *)header.value,
+								  header.value_len, &policy);
+		}
+		else if (__name_is(&header, "Pragma"))
+		{
+			if (header.value_len == 8 &&
+				strncasecmp((const char *)header.value, "no-cache", 8) == 0)
+				policy.no_cache = true;
+		}
+		else if (__name_is(&header, "Accept-Encoding"))
+			encoding.assign((const char *)header.value, header.value_len);
+	}
+
+	if (policy.no_store)
+		return false;
+
+	key = uri.scheme ? uri.scheme : "http";
+	key += "://";
+	if (uri.host)
+		key += uri.host;
+	if (uri.port)
+	{
+		key += ':';
+		key += uri.port;
+	}
+	if (uri.path && *uri.path)
+		key += uri.path;
+	else
+		key += '/';
+	if (uri.query)
+	{
+		key += '?';
+		key += uri.query;
+	}
+
+	/* Decompressed bodies are kept as they are, so not shared with others. */
+	key += '\n';
+	key += encoding;
+	key += req->is_decompress_response() ? "\n1" : "\n0";
+	*reload = policy.no_cache || policy.max_age == 0;
+	return true;
+}
+
+/* Stale entries are returned only if they can be revalidated. */
+int WFHttpCache::get(const std::string& key, bool reload,
+					 const Handle **handle)
+{
+	int64_t cur_time = GET_CURRENT_MS;
+	std::lock_guard<std::mutex> lock(mutex_);
+	const Handle *h = cache_.get(key);
+
+	if (h && !reload && cur_time < h->value->expire_time)
+	{
+		stats_.hits++;
+		*handle = h;
+		return HTTP_CACHE_FRESH;
+	}
+
+	if (h && (!h->value->etag.empty() || !h->value->last_modified.empty()))
+	{
+		*handle = h;
+		return HTTP_CACHE_STALE;
+	}
+
+	if (h)
+		cache_.release(h);
+
+	return HTTP_CACHE_MISS;
+}
+
+/* Called with the final response, or NULL if the task failed. A 304 for a
+ * stale entry is replaced by the entry. */
+void WFHttpCache::update(const std::string& key, const Handle *handle,
+						 HttpResponse *resp)
+{
+	struct __HttpCachePolicy policy;
+	const char *code = NULL;
+	bool explicit_lifetime = false;
+	int64_t lifetime = 0;
+	Entry *entry;
+
+	if (resp)
+	{
+		code = resp->get_status_code();
+		__get_policy(resp, &policy);
+		explicit_lifetime = __get_lifetime(&policy, &lifetime);
+	}
+
+	if (code && handle && strcmp(code, "304") == 0)
+	{
+		entry = handle->value;
+		if (serve(handle, resp))
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if (explicit_lifetime)
+				entry->lifetime = lifetime;
+
+			entry->expire_time = GET_CURRENT_MS + entry->lifetime;
+			stats_.revalidated++;
+			return;
+		}
+	}
+
+	if (!code || !__status_storable(atoi(code)) ||
+		policy.no_store || policy.vary ||
+		(!explicit_lifetime && policy.etag.empty() &&
+		 policy.last_modified.empty()))
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stats_.misses++;
+		return;
+	}
+
+	entry = new Entry;
+	if (!HttpUtil::save_response(resp, entry->message))
+	{
+		delete entry;
+		entry = NULL;
+	}
+	else
+	{
+		entry->etag = std::move(policy.etag);
+		entry->last_modified = std::move(policy.last_modified);
+		entry->lifetime = lifetime;
+		entry->expire_time = GET_CURRENT_MS + lifetime;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	stats_.misses++;
+	if (entry)
+		cache_.release(cache_.put(key, entry));
+}
+
+void WFHttpCache::release(const Handle *handle)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	cache_.release(handle);
+}
+
+bool WFHttpCache::serve(const Handle *handle, HttpResponse *resp)
+{
+	return HttpUtil::load_response(handle->value->message, resp);
+}
+
+void WFHttpCache::add_validators(const Handle *handle, HttpRequest *req)
+{
+	const Entry *entry = handle->value;
+
+	if (!entry->etag.empty())
+		req->set_header_pair("If-None-Match", entry->etag);
+
+	if (!entry->last_modified.empty())
+		req->set_header_pair("If-Modified-Since", entry->last_modified);
+}
+
+struct WFHttpCacheStats WFHttpCache::get_stats()
+{
+	size_t coalesced = flight_.get_stats().shared;
+	std::lock_guard<std::mutex> lock(mutex_);
+	struct WFHttpCacheStats stats = stats_;
+
+	stats.coalesced = coalesced;
+	return stats;
+}
+
+double WFHttpCache::get_hit_ratio()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	size_t hits = stats_.hits + stats_.revalidated;
+	size_t total = hits + stats_.misses;
+
+	return total ? (double)hits / total : 0.0;
+}
+
+void WFHttpCache::clear()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	cache_.prune();
+}
+
+WFHttpCache::WFHttpCache(size_t max_entries)
+{
+	cache_.set_max_size(max_entries);
+	stats_ = { };
+}
+
+WFHttpCache::~WFHttpCache()
+{
+}
+
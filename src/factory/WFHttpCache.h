@@ -0,0 +1,116 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef _WFHTTPCACHE_H_
+#define _WFHTTPCACHE_H_
+
+#include <stddef.h>
+#include <string>
+#include <mutex>
+#include "URIParser.h"
+#include "LRUCache.h"
+#include "HttpMessage.h"
+#include "WFTask.h"
+#include "WFTaskFactory.h"
+#include "WFSingleFlight.h"
+
+struct WFHttpCacheStats
+{
+	size_t hits;		/* fresh responses served without a request */
+	size_t revalidated;	/* stale responses confirmed by a 304 */
+	size_t misses;		/* requests answered by the server */
+	size_t coalesced;	/* requests that waited for the same one */
+};
+
+// Thread safety: YES
+// The cache must outlive all the tasks created by it.
+class WFHttpCache
+{
+public:
+	/* The tasks are the same as the ones of WFTaskFactory, except that GET
+	 * requests may be answered from the cache, following Cache-Control,
+	 * Expires, ETag and Last-Modified of the responses. A stale response
+	 * is revalidated with If-None-Match or If-Modified-Since, and a 304 is
+	 * replaced by the cached response. Requests for a URL that is being
+	 * fetched wait for that response instead of sending another one, and
+	 * get a copy of it even if it is not cacheable.
+	 * Requests with Authorization, Range, a body sink or conditions of
+	 * their own always go to the server. */
+	WFHttpTask *create_http_task(const std::string& url,
+								 int redirect_max,
+								 int retry_max,
+								 http_callback_t callback);
+
+	WFHttpTask *create_http_task(const ParsedURI& uri,
+								 int redirect_max,
+								 int retry_max,
+								 http_callback_t callback);
+
+public:
+	struct WFHttpCacheStats get_stats();
+
+	/* Share of the cacheable requests answered with a cached response. */
+	double get_hit_ratio();
+
+	/* Entries that are being served stay till they are released. */
+	void clear();
+
+private:
+	enum
+	{
+		HTTP_CACHE_MISS		=	0,
+		HTTP_CACHE_STALE	=	1,
+		HTTP_CACHE_FRESH	=	2,
+	};
+
+	struct Entry;
+
+	class EntryDeleter
+	{
+	public:
+		void operator() (Entry *entry) const;
+	};
+
+	using Handle = LRUHandle<std::string, Entry *>;
+
+	static bool get_key(const protocol::HttpRequest *req,
+						const ParsedURI& uri,
+						std::string& key, bool *reload);
+
+	int get(const std::string& key, bool reload, const Handle **handle);
+	void update(const std::string& key, const Handle *handle,
+				protocol::HttpResponse *resp);
+	void release(const Handle *handle);
+
+	static bool serve(const Handle *handle, protocol::HttpResponse *resp);
+	static void add_validators(const Handle *handle,
+							   protocol::HttpRequest *req);
+
+private:
+	std::mutex mutex_;
+	LRUCache<std::string, Entry *, EntryDeleter> cache_;
+	struct WFHttpCacheStats stats_;
+	WFSingleFlight flight_;
+
+	friend class ComplexHttpCacheTask;
+
+public:
+	WFHttpCache(size_t max_entries);
+	~WFHttpCache();
+};
+
+#endif
+
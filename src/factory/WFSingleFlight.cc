@@ -0,0 +1,63 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include "WFTask.h"
+#include "WFTaskFactory.h"
+#include "WFSingleFlight.h"
+
+WFConditional *WFSingleFlight::join(const std::string& key, SubTask *task)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = flights_.find(key);
+
+	if (it == flights_.end())
+	{
+		flights_[key];
+		stats_.flights++;
+		return NULL;
+	}
+
+	WFConditional *cond = WFTaskFactory::create_conditional(task);
+
+	it->second.push_back({task, cond});
+	stats_.shared++;
+	return cond;
+}
+
+std::vector<WFSingleFlight::Waiter> WFSingleFlight::land(const std::string& key)
+{
+	std::vector<Waiter> waiters;
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = flights_.find(key);
+
+	if (it != flights_.end())
+	{
+		waiters = std::move(it->second);
+		flights_.erase(it);
+	}
+
+	return waiters;
+}
+
+struct WFSingleFlightStats WFSingleFlight::get_stats()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return stats_;
+}
+
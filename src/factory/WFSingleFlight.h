@@ -0,0 +1,94 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef _WFSINGLEFLIGHT_H_
+#define _WFSINGLEFLIGHT_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include "URIParser.h"
+#include "WFTask.h"
+#include "WFTaskFactory.h"
+
+struct WFSingleFlightStats
+{
+	size_t flights;		/* requests sent */
+	size_t shared;		/* tasks that got the response of another */
+};
+
+// Thread safety: YES
+// The object must outlive all the tasks created by it.
+class WFSingleFlight
+{
+public:
+	/* Tasks of the same key that run at the same time share one request.
+	 * The first task sends its request, and the others wait for it without
+	 * blocking a thread. Then each of them gets a copy of the response,
+	 * with the state and the error of the first task. Requests of the same
+	 * key are supposed to be the same, and only the first one is sent. */
+	WFHttpTask *create_http_task(const std::string& key,
+								 const std::string& url,
+								 int redirect_max,
+								 int retry_max,
+								 http_callback_t callback);
+
+	WFHttpTask *create_http_task(const std::string& key,
+								 const ParsedURI& uri,
+								 int redirect_max,
+								 int retry_max,
+								 http_callback_t callback);
+
+	WFRedisTask *create_redis_task(const std::string& key,
+								   const std::string& url,
+								   int retry_max,
+								   redis_callback_t callback);
+
+	WFRedisTask *create_redis_task(const std::string& key,
+								   const ParsedURI& uri,
+								   int retry_max,
+								   redis_callback_t callback);
+
+public:
+	struct WFSingleFlightStats get_stats();
+
+private:
+	struct Waiter
+	{
+		SubTask *task;
+		WFConditional *cond;
+	};
+
+	/* Returns NULL to the first task of a key, which sends the request. */
+	WFConditional *join(const std::string& key, SubTask *task);
+	std::vector<Waiter> land(const std::string& key);
+
+private:
+	std::mutex mutex_;
+	std::unordered_map<std::string, std::vector<Waiter>> flights_;
+	struct WFSingleFlightStats stats_;
+
+	template<class TASK, class RESULT>
+	friend class ComplexFlightTask;
+
+public:
+	WFSingleFlight() : stats_() { }
+};
+
+#endif
+
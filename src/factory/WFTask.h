@@ -274,6 +274,13 @@ public:
 		return this->scheduler->push(buf, size, this);
 	}
 
+	/* For HTTP server tasks only. See WFHttpServer.h. */
+	virtual int push_chunk(const void *buf, size_t size)
+	{
+		errno = ENOTSUP;
+		return -1;
+	}
+
 public:
 	void set_callback(std::function<void (WFNetworkTask<REQ, RESP> *)> cb)
 	{
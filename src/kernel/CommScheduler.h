@@ -111,6 +111,11 @@ private:
 class CommScheduler
 {
 public:
+	int init(const struct CommParams *params)
+	{
+		return this->comm.init(params);
+	}
+
 	int init(size_t poller_threads, size_t handler_threads)
 	{
 		return this->comm.init(poller_threads, handler_threads);
@@ -149,6 +154,11 @@ public:
 		return this->comm.push(buf, size, session);
 	}
 
+	int push_async(const void *buf, size_t size, CommSession *session)
+	{
+		return this->comm.push_async(buf, size, session);
+	}
+
 	int bind(CommService *service)
 	{
 		return this->comm.bind(service);
@@ -28,15 +28,33 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 #include <openssl/ssl.h>
 #include <openssl/bio.h>
+#include <atomic>
 #include "list.h"
 #include "msgqueue.h"
 #include "thrdpool.h"
 #include "poller.h"
 #include "mpoller.h"
+#include "slab.h"
 #include "Communicator.h"
 
+struct CommHandlerQueue
+{
+	msgqueue_t *msgqueue;
+	Communicator *comm;
+	int cpu;
+	int hold_output;
+};
+
+/* The queue of current handler thread, for increase_handler_thread(). */
+static thread_local struct CommHandlerQueue *__handler_queue;
+
+/* Of a handler thread that merges output, the connections whose output it
+ * holds till it has no more results at hand. */
+static thread_local struct list_head *__held_output;
+
 struct CommConnEntry
 {
 	struct list_head list;
@@ -54,16 +72,77 @@ struct CommConnEntry
 	int state;
 	int error;
 	int ref;
+	int dgram;
+	int write_iovcnt;
 	struct iovec *write_iov;
 	SSL *ssl;
 	CommSession *session;
 	CommTarget *target;
 	CommService *service;
 	mpoller_t *mpoller;
-	/* Connection entry's mutex is for client session only. */
+	/* A multiplexed connection has 'nmux' sessions waiting: for replies
+	 * in 'mux_list' if a client, or for reply() if a server. Sessions
+	 * complete go to 'done_list' till their results are handled. */
+	int mux;
+	int nmux;
+	int mux_max;
+	struct list_head mux_list;
+	struct list_head done_list;
+	SleepSession *mux_timer;
+	/* What a multiplexed connection sends is queued, and the poller writes
+	 * it through 'out_fd', a dup of sockfd, so that no thread waits for
+	 * the socket. 'out_buf' takes the bytes that come while the ones of
+	 * 'out_data' are being written. After one write fails, all do. A
+	 * handler thread may hold 'out_buf' back, linked by 'out_list'. */
+	int out_fd;
+	int out_error;
+	int out_paused;
+	struct list_head *out_held;
+	struct list_head out_list;
+	struct iovec out_iov;
+	char *out_data;
+	size_t out_len;
+	char *out_buf;
+	size_t out_size;
+	/* Of a server, the mutex is for multiplexed connection only. */
 	pthread_mutex_t mutex;
+	/* Of a client, the message that the poller reads the connection with,
+	 * for the sessions that take turns to receive. */
+	poller_message_t mux_msg;
 };
 
+/* Connection entries and short write vectors come from slabs, so that a
+ * request on a kept-alive connection costs no malloc() here. */
+#define WRITE_IOV_SLAB_MAX		16
+
+static slab_t *__conn_entry_slab;
+static slab_t *__write_iov_slab;
+static pthread_once_t __slab_once = PTHREAD_ONCE_INIT;
+
+static void __create_slabs()
+{
+	__conn_entry_slab = slab_create("comm_conn_entry",
+									sizeof (struct CommConnEntry));
+	__write_iov_slab = slab_create("comm_write_iov",
+								   WRITE_IOV_SLAB_MAX * sizeof (struct iovec));
+}
+
+static inline struct iovec *__alloc_write_iov(int cnt)
+{
+	if (cnt <= WRITE_IOV_SLAB_MAX)
+		return (struct iovec *)slab_alloc(__write_iov_slab);
+
+	return (struct iovec *)malloc(cnt * sizeof (struct iovec));
+}
+
+static inline void __free_write_iov(struct iovec *iov, int cnt)
+{
+	if (cnt <= WRITE_IOV_SLAB_MAX)
+		slab_free(iov, __write_iov_slab);
+	else
+		free(iov);
+}
+
 static inline int __set_fd_nonblock(int fd)
 {
 	int flags = fcntl(fd, F_GETFL);
@@ -100,6 +179,54 @@ static int __bind_and_listen(int sockfd, const struct sockaddr *addr,
 	return listen(sockfd, SOMAXCONN);
 }
 
+#ifdef SO_REUSEPORT
+static inline int __set_reuse_port(int sockfd)
+{
+	int reuse = 1;
+
+	return setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof (int));
+}
+
+/* Open a listener of the same type and protocol as 'sockfd', on the same
+ * address. 'sockfd' must have SO_REUSEPORT set before it was bound. */
+static int __reuse_port_listen(int sockfd)
+{
+	struct sockaddr_storage ss;
+	socklen_t len = sizeof (struct sockaddr_storage);
+	socklen_t optlen = sizeof (int);
+	int protocol = 0;
+	int type;
+	int fd;
+
+	if (getsockname(sockfd, (struct sockaddr *)&ss, &len) < 0 ||
+		getsockopt(sockfd, SOL_SOCKET, SO_TYPE, &type, &optlen) < 0)
+		return -1;
+
+#ifdef SO_PROTOCOL
+	optlen = sizeof (int);
+	if (getsockopt(sockfd, SOL_SOCKET, SO_PROTOCOL, &protocol, &optlen) < 0)
+		return -1;
+#endif
+
+	fd = socket(ss.ss_family, type, protocol);
+	if (fd >= 0)
+	{
+		if (__set_fd_nonblock(fd) >= 0 && __set_reuse_port(fd) >= 0)
+		{
+			if (bind(fd, (struct sockaddr *)&ss, len) >= 0 &&
+				listen(fd, SOMAXCONN) >= 0)
+			{
+				return fd;
+			}
+		}
+
+		close(fd);
+	}
+
+	return -1;
+}
+#endif
+
 static int __create_ssl(SSL_CTX *ssl_ctx, struct CommConnEntry *entry)
 {
 	BIO *bio = BIO_new_socket(entry->sockfd, BIO_NOCLOSE);
@@ -109,6 +236,8 @@ static int __create_ssl(SSL_CTX *ssl_ctx, struct CommConnEntry *entry)
 		entry->ssl = SSL_new(ssl_ctx);
 		if (entry->ssl)
 		{
+			/* A write retried by the poller gathers into another buffer. */
+			SSL_set_mode(entry->ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 			SSL_set_bio(entry->ssl, bio, bio);
 			return 0;
 		}
@@ -119,7 +248,9 @@ static int __create_ssl(SSL_CTX *ssl_ctx, struct CommConnEntry *entry)
 	return -1;
 }
 
-#define SSL_WRITE_BUFSIZE	8192
+/* The largest plaintext of a TLS record. Must be the same as in poller.c,
+ * so that the poller retries a write with the same data. */
+#define SSL_WRITE_BUFSIZE	16384
 
 static int __ssl_writev(SSL *ssl, const struct iovec vectors[], int cnt)
 {
@@ -149,6 +280,242 @@ static int __ssl_writev(SSL *ssl, const struct iovec vectors[], int cnt)
 	return SSL_write(ssl, buf, p - buf);
 }
 
+#ifndef IOV_MAX
+# ifdef UIO_MAXIOV
+#  define IOV_MAX	UIO_MAXIOV
+# else
+#  define IOV_MAX	1024
+# endif
+#endif
+
+/* Number of vectors before the first file range, at most IOV_MAX. */
+static int __iov_count(const struct iovec vectors[], int cnt)
+{
+	int i;
+
+	if (cnt > IOV_MAX)
+		cnt = IOV_MAX;
+
+	for (i = 0; i < cnt; i++)
+	{
+		if (POLLER_IOV_FILE(&vectors[i]))
+			break;
+	}
+
+	return i;
+}
+
+/* A connection with more output queued takes no more requests for now. */
+#define CONN_OUTPUT_MAX		(4 * 1024 * 1024)
+
+static inline size_t __output_queued(const struct CommConnEntry *entry)
+{
+	return entry->out_size + entry->out_len;
+}
+
+/* With the entry locked. Start writing the queued output, if not yet. The
+ * node is on the poller of the socket, not to race with its SSL reads. */
+static int __flush_output(int timeout, struct CommConnEntry *entry)
+{
+	struct poller_data data;
+	unsigned int index;
+	int ret;
+
+	if (entry->out_data || entry->out_size == 0)
+		return 0;
+
+	if (entry->out_fd < 0)
+	{
+		entry->out_fd = dup(entry->sockfd);
+		if (entry->out_fd < 0)
+			return -1;
+	}
+
+	entry->out_iov.iov_base = entry->out_buf;
+	entry->out_iov.iov_len = entry->out_size;
+	data.operation = PD_OP_WRITE;
+	data.iovcnt = 1;
+	data.fd = entry->out_fd;
+	data.ssl = entry->ssl;
+	data.context = entry;
+	data.write_iov = &entry->out_iov;
+	data.dgram = 0;
+	index = mpoller_index(entry->sockfd, entry->mpoller);
+	/* Set before adding. partial_written() may look at it at once. */
+	entry->out_data = entry->out_buf;
+	entry->out_len = entry->out_size;
+	__sync_add_and_fetch(&entry->ref, 1);
+	ret = mpoller_add_to(&data, timeout, index, entry->mpoller);
+	if (ret < 0)
+	{
+		__sync_sub_and_fetch(&entry->ref, 1);
+		entry->out_data = NULL;
+		entry->out_len = 0;
+		return -1;
+	}
+
+	entry->out_buf = NULL;
+	entry->out_size = 0;
+	return 0;
+}
+
+/* Held output is written at once past this size. */
+#define CONN_HOLD_MAX		(64 * 1024)
+
+/* With the entry locked. Whether this thread holds the output of the
+ * connection, taking it if no thread does. */
+static int __hold_output(struct CommConnEntry *entry)
+{
+	if (!__held_output)
+		return 0;
+
+	if (!entry->out_held)
+	{
+		__sync_add_and_fetch(&entry->ref, 1);
+		list_add_tail(&entry->out_list, __held_output);
+		entry->out_held = __held_output;
+	}
+
+	return entry->out_held == __held_output;
+}
+
+/* With the entry locked. Without SSL, and with nothing queued or held
+ * before, what the socket takes now is written at once. The rest is copied
+ * to the queue, file ranges read into it. */
+static int __append_output(struct iovec vectors[], int cnt, int timeout,
+						   struct CommConnEntry *entry)
+{
+	const struct poller_file *file;
+	int hold = __hold_output(entry);
+	size_t size = 0;
+	ssize_t n;
+	char *buf;
+	int i;
+
+	if (!hold && !entry->ssl && !entry->out_data && entry->out_size == 0)
+	{
+		n = writev(entry->sockfd, vectors, __iov_count(vectors, cnt));
+		if (n < 0)
+		{
+			if (errno != EAGAIN && errno != EINTR)
+				return -1;
+
+			n = 0;
+		}
+
+		for (i = 0; i < cnt && !POLLER_IOV_FILE(&vectors[i]); i++)
+		{
+			if ((size_t)n < vectors[i].iov_len)
+			{
+				vectors[i].iov_base = (char *)vectors[i].iov_base + n;
+				vectors[i].iov_len -= n;
+				break;
+			}
+
+			n -= vectors[i].iov_len;
+		}
+
+		vectors += i;
+		cnt -= i;
+	}
+
+	for (i = 0; i < cnt; i++)
+	{
+		size += vectors[i].iov_len;
+		if (POLLER_IOV_FILE(&vectors[i]))
+			i++;
+	}
+
+	if (size == 0)
+		return 0;
+
+	buf = (char *)realloc(entry->out_buf, entry->out_size + size);
+	if (!buf)
+		return -1;
+
+	entry->out_buf = buf;
+	buf += entry->out_size;
+	for (i = 0; i < cnt; i++)
+	{
+		if (!POLLER_IOV_FILE(&vectors[i]))
+		{
+			memcpy(buf, vectors[i].iov_base, vectors[i].iov_len);
+			buf += vectors[i].iov_len;
+			continue;
+		}
+
+		file = (const struct poller_file *)vectors[i + 1].iov_base;
+		size = 0;
+		while (size < vectors[i].iov_len)
+		{
+			n = pread(file->fd, buf, vectors[i].iov_len - size,
+					  file->offset + (off_t)(vectors[i + 1].iov_len + size));
+			if (n <= 0)
+			{
+				if (n == 0)
+					errno = EIO;
+
+				return -1;
+			}
+
+			buf += n;
+			size += n;
+		}
+
+		i++;
+	}
+
+	entry->out_size = buf - entry->out_buf;
+	if (hold && entry->out_size < CONN_HOLD_MAX)
+		return 0;
+
+	return __flush_output(timeout, entry);
+}
+
+/* With the entry locked. The queued output is dropped and the connection
+ * is closed. */
+static void __fail_output(int error, struct CommConnEntry *entry)
+{
+	entry->out_error = error;
+	free(entry->out_buf);
+	entry->out_buf = NULL;
+	entry->out_size = 0;
+	if (!entry->service && entry->state == CONN_STATE_RECEIVING)
+	{
+		entry->error = error;
+		entry->state = CONN_STATE_ERROR;
+	}
+
+	mpoller_del(entry->sockfd, entry->mpoller);
+}
+
+/* A connection that fails to send some bytes can send no more. */
+static int __queue_output(struct iovec vectors[], int cnt, int timeout,
+						  struct CommConnEntry *entry)
+{
+	if (entry->out_error)
+	{
+		errno = entry->out_error;
+		return -1;
+	}
+
+	if (__append_output(vectors, cnt, timeout, entry) < 0)
+	{
+		entry->out_error = errno;
+		return -1;
+	}
+
+	return 0;
+}
+
+static inline long long __monotonic_msec()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return 1000LL * now.tv_sec + now.tv_nsec / 1000000;
+}
+
 int CommTarget::init(const struct sockaddr *addr, socklen_t addrlen,
 					 int connect_timeout, int response_timeout)
 {
@@ -189,6 +556,18 @@ int CommMessageIn::feedback(const void *buf, size_t size)
 	struct CommConnEntry *entry = this->entry;
 	int ret;
 
+	/* Queued with what the other sessions send, with the entry locked. */
+	if (entry->mux)
+	{
+		struct iovec vector = { .iov_base = (void *)buf, .iov_len = size, };
+
+		if (__queue_output(&vector, 1, entry->target->response_timeout,
+						   entry) < 0)
+			return -1;
+
+		return size;
+	}
+
 	if (!entry->ssl)
 		return write(entry->sockfd, buf, size);
 
@@ -210,11 +589,77 @@ int CommMessageIn::feedback(const void *buf, size_t size)
 
 void CommMessageIn::renew()
 {
-	CommSession *session = this->entry->session;
+	struct CommConnEntry *entry = this->entry;
+	CommSession *session = entry->session;
+	struct list_head *pos;
+
+	/* No receive timeout of a request of a multiplexed server. */
+	if (entry->mux)
+	{
+		if (!entry->service)
+		{
+			list_for_each(pos, &entry->mux_list)
+			{
+				session = list_entry(pos, CommSession, list);
+				if (session->in == this)
+				{
+					Communicator::renew_deadline(session);
+					break;
+				}
+			}
+		}
+
+		return;
+	}
+
 	session->timeout = -1;
 	session->begin_time.tv_nsec = -1;
 }
 
+int CommMessageIn::pause()
+{
+	struct CommConnEntry *entry = this->entry;
+
+	if (this->paused < 0)
+	{
+		errno = EPERM;
+		return -1;
+	}
+
+	if (mpoller_pause(entry->sockfd, entry->mpoller) < 0)
+		return -1;
+
+	this->paused = 1;
+	return 0;
+}
+
+int CommMessageIn::resume()
+{
+	struct CommConnEntry *entry = this->entry;
+	int timeout;
+
+	if (entry->mux)
+		timeout = entry->service ? -1 : entry->target->response_timeout;
+	else
+		timeout = Communicator::next_timeout(entry->session);
+
+	return mpoller_resume(entry->sockfd, timeout, entry->mpoller);
+}
+
+int CommMessageIn::multiplex()
+{
+	struct CommConnEntry *entry = this->entry;
+
+	if (this->paused < 0 || !entry->service)
+	{
+		errno = EPERM;
+		return -1;
+	}
+
+	entry->mux = 1;
+	return 0;
+}
+
 int CommService::init(const struct sockaddr *bind_addr, socklen_t addrlen,
 					  int listen_timeout, int response_timeout)
 {
@@ -234,6 +679,9 @@ int CommService::init(const struct sockaddr *bind_addr, socklen_t addrlen,
 
 			this->ssl_ctx = NULL;
 			this->ssl_accept_timeout = 0;
+			this->reuse_port = 0;
+			this->reuse_fds = NULL;
+			this->reuse_cnt = 0;
 			return 0;
 		}
 
@@ -311,6 +759,7 @@ private:
 
 private:
 	CommService *service;
+	struct CommConnEntry *entry;
 
 private:
 	virtual int create_connect_fd()
@@ -319,6 +768,7 @@ private:
 		return -1;
 	}
 
+	friend class CommSession;
 	friend class Communicator;
 };
 
@@ -333,7 +783,23 @@ CommSession::~CommSession()
 		return;
 
 	target = this->target;
-	if (this->passive == 1)
+	if (this->passive == 1 && !list_empty(&this->list))
+	{
+		/* No reply to a request of a multiplexed connection. */
+		entry = ((CommServiceTarget *)target)->entry;
+		pthread_mutex_lock(&entry->mutex);
+		list_del(&this->list);
+		pthread_mutex_unlock(&entry->mutex);
+		errno_bak = errno;
+		Communicator::mux_replied(entry, 0, ECONNABORTED);
+		errno = errno_bak;
+		if (__sync_sub_and_fetch(&entry->ref, 1) == 0)
+		{
+			Communicator::release_conn(entry);
+			((CommServiceTarget *)target)->decref();
+		}
+	}
+	else if (this->passive == 1)
 	{
 		pthread_mutex_lock(&target->mutex);
 		if (!list_empty(&target->idle_list))
@@ -404,14 +870,19 @@ int Communicator::first_timeout_recv(CommSession *session)
 void Communicator::release_conn(struct CommConnEntry *entry)
 {
 	delete entry->conn;
-	if (!entry->service)
-		pthread_mutex_destroy(&entry->mutex);
+	delete entry->mux_timer;
+	pthread_mutex_destroy(&entry->mutex);
 
 	if (entry->ssl)
 		SSL_free(entry->ssl);
 
+	free(entry->out_data);
+	free(entry->out_buf);
+	if (entry->out_fd >= 0)
+		close(entry->out_fd);
+
 	close(entry->sockfd);
-	free(entry);
+	slab_free(entry, __conn_entry_slab);
 }
 
 void Communicator::shutdown_service(CommService *service)
@@ -422,34 +893,97 @@ void Communicator::shutdown_service(CommService *service)
 	service->decref();
 }
 
-#ifndef IOV_MAX
-# ifdef UIO_MAXIOV
-#  define IOV_MAX	UIO_MAXIOV
-# else
-#  define IOV_MAX	1024
-# endif
-#endif
+#define DGRAM_BATCH_MAX		16
 
-int Communicator::send_message_sync(struct iovec vectors[], int cnt,
-									struct CommConnEntry *entry)
+/* Send the datagrams apart by POLLER_IOV_DGRAM in one call. Returns the bytes
+ * of the datagrams sent, including none of a partial one. */
+static ssize_t __dgram_writev(int fd, struct iovec vectors[], int cnt)
 {
-	CommSession *session = entry->session;
-	CommService *service;
-	int timeout;
-	ssize_t n;
+	ssize_t n = 0;
 	int i;
+#ifdef __linux__
+	struct mmsghdr msgs[DGRAM_BATCH_MAX];
+	int nmsgs = 0;
+	int ret;
 
-	while (cnt > 0)
+	while (cnt > 0 && nmsgs < DGRAM_BATCH_MAX)
 	{
-		if (!entry->ssl)
-		{
-			n = writev(entry->sockfd, vectors, cnt <= IOV_MAX ? cnt : IOV_MAX);
-			if (n < 0)
-				return errno == EAGAIN ? cnt : -1;
-		}
-		else if (vectors->iov_len > 0)
-		{
-			n = __ssl_writev(entry->ssl, vectors, cnt);
+		for (i = 0; i < cnt && !POLLER_IOV_DGRAM(&vectors[i]); i++)
+			;
+
+		memset(&msgs[nmsgs].msg_hdr, 0, sizeof (struct msghdr));
+		msgs[nmsgs].msg_hdr.msg_iov = vectors;
+		msgs[nmsgs].msg_hdr.msg_iovlen = i;
+		nmsgs++;
+		if (i < cnt)
+			i++;
+
+		vectors += i;
+		cnt -= i;
+	}
+
+	ret = sendmmsg(fd, msgs, nmsgs, 0);
+	if (ret < 0)
+		return -1;
+
+	for (i = 0; i < ret; i++)
+		n += msgs[i].msg_len;
+#else
+	for (i = 0; i < cnt && !POLLER_IOV_DGRAM(&vectors[i]); i++)
+		;
+
+	n = writev(fd, vectors, i);
+#endif
+
+	return n;
+}
+
+int Communicator::send_message_sync(struct iovec vectors[], int cnt,
+									struct CommConnEntry *entry)
+{
+	CommSession *session = entry->session;
+	CommService *service = entry->service;
+	int timeout;
+	ssize_t n;
+	int i;
+
+	/* A reply goes after the bytes pushed and still queued. */
+	if (service)
+	{
+		pthread_mutex_lock(&entry->mutex);
+		if (__output_queued(entry) != 0)
+		{
+			if (__queue_output(vectors, cnt, entry->target->response_timeout,
+							   entry) < 0)
+				cnt = -1;
+			else
+				cnt = 0;
+		}
+
+		pthread_mutex_unlock(&entry->mutex);
+		if (cnt < 0)
+			return -1;
+	}
+
+	/* File ranges are left to the poller. */
+	while (cnt > 0 && !POLLER_IOV_FILE(vectors))
+	{
+		if (entry->dgram)
+		{
+			n = __dgram_writev(entry->sockfd, vectors,
+							   __iov_count(vectors, cnt));
+			if (n < 0)
+				return errno == EAGAIN ? cnt : -1;
+		}
+		else if (!entry->ssl)
+		{
+			n = writev(entry->sockfd, vectors, __iov_count(vectors, cnt));
+			if (n < 0)
+				return errno == EAGAIN ? cnt : -1;
+		}
+		else if (vectors->iov_len > 0)
+		{
+			n = __ssl_writev(entry->ssl, vectors, __iov_count(vectors, cnt));
 			if (n <= 0)
 				return cnt;
 		}
@@ -472,7 +1006,9 @@ int Communicator::send_message_sync(struct iovec vectors[], int cnt,
 		cnt -= i;
 	}
 
-	service = entry->service;
+	if (cnt > 0)
+		return cnt;
+
 	if (service)
 	{
 		__sync_add_and_fetch(&entry->ref, 1);
@@ -528,9 +1064,10 @@ int Communicator::send_message_async(struct iovec vectors[], int cnt,
 	int ret;
 	int i;
 
-	entry->write_iov = (struct iovec *)malloc(cnt * sizeof (struct iovec));
+	entry->write_iov = __alloc_write_iov(cnt);
 	if (entry->write_iov)
 	{
+		entry->write_iovcnt = cnt;
 		for (i = 0; i < cnt; i++)
 			entry->write_iov[i] = vectors[i];
 	}
@@ -540,6 +1077,7 @@ int Communicator::send_message_async(struct iovec vectors[], int cnt,
 	data.operation = PD_OP_WRITE;
 	data.fd = entry->sockfd;
 	data.ssl = entry->ssl;
+	data.dgram = entry->dgram;
 	data.context = entry;
 	data.write_iov = entry->write_iov;
 	data.iovcnt = cnt;
@@ -562,7 +1100,7 @@ int Communicator::send_message_async(struct iovec vectors[], int cnt,
 
 	if (ret < 0)
 	{
-		free(entry->write_iov);
+		__free_write_iov(entry->write_iov, cnt);
 		if (entry->state != CONN_STATE_RECEIVING)
 			return -1;
 	}
@@ -752,13 +1290,130 @@ void Communicator::handle_incoming_reply(struct poller_result *res)
 	}
 }
 
+/* A result of success is of any one of the sessions in 'done_list'. The
+ * session being received is the only one to fail with the connection, for
+ * the ones waiting to reply have their own references of it. */
+void Communicator::handle_mux_request(struct poller_result *res)
+{
+	struct CommConnEntry *entry = (struct CommConnEntry *)res->data.context;
+	CommTarget *target = entry->target;
+	CommSession *session = NULL;
+	int state;
+
+	switch (res->state)
+	{
+	case PR_ST_SUCCESS:
+		pthread_mutex_lock(&entry->mutex);
+		session = list_entry(entry->done_list.next, CommSession, list);
+		list_move_tail(&session->list, &entry->mux_list);
+		pthread_mutex_unlock(&entry->mutex);
+		session->handle(CS_STATE_TOREPLY, 0);
+		return;
+
+	case PR_ST_FINISHED:
+		res->error = ECONNRESET;
+		if (1)
+	case PR_ST_ERROR:
+			state = CS_STATE_ERROR;
+		else
+	case PR_ST_DELETED:
+	case PR_ST_STOPPED:
+			state = CS_STATE_STOPPED;
+
+		pthread_mutex_lock(&target->mutex);
+		switch (entry->state)
+		{
+		case CONN_STATE_KEEPALIVE:
+			pthread_mutex_lock(&entry->service->mutex);
+			if (entry->state == CONN_STATE_KEEPALIVE)
+				list_del(&entry->list);
+			pthread_mutex_unlock(&entry->service->mutex);
+			break;
+
+		case CONN_STATE_IDLE:
+			list_del(&entry->list);
+			break;
+
+		case CONN_STATE_ERROR:
+			res->error = entry->error;
+			state = CS_STATE_ERROR;
+			break;
+		}
+
+		entry->state = CONN_STATE_CLOSING;
+		pthread_mutex_unlock(&target->mutex);
+		if (res->data.message)
+			session = entry->session;
+
+		break;
+	}
+
+	if (session)
+		session->handle(state, res->error);
+
+	if (__sync_sub_and_fetch(&entry->ref, 1) == 0)
+	{
+		this->release_conn(entry);
+		((CommServiceTarget *)target)->decref();
+	}
+}
+
+void Communicator::handle_mux_reply(struct poller_result *res)
+{
+	struct CommConnEntry *entry = (struct CommConnEntry *)res->data.context;
+	CommTarget *target = entry->target;
+	CommSession *session;
+	int keep_alive;
+	int error;
+
+	switch (res->state)
+	{
+	case PR_ST_SUCCESS:
+		pthread_mutex_lock(&entry->mutex);
+		session = list_entry(entry->done_list.next, CommSession, list);
+		list_del(&session->list);
+		keep_alive = (entry->state == CONN_STATE_RECEIVING);
+		error = session->timeout;
+		pthread_mutex_unlock(&entry->mutex);
+		target->release(keep_alive);
+		if (error == 0)
+			session->handle(CS_STATE_SUCCESS, 0);
+		else
+			session->handle(CS_STATE_ERROR, error);
+
+		break;
+
+	case PR_ST_FINISHED:
+		res->error = ECONNRESET;
+		if (1)
+	case PR_ST_ERROR:
+			this->abort_mux_conn(entry, CS_STATE_ERROR, res->error);
+		else
+	case PR_ST_DELETED:
+	case PR_ST_STOPPED:
+			this->abort_mux_conn(entry, CS_STATE_STOPPED, res->error);
+
+		break;
+	}
+
+	if (__sync_sub_and_fetch(&entry->ref, 1) == 0)
+		this->release_conn(entry);
+}
+
 void Communicator::handle_read_result(struct poller_result *res)
 {
 	struct CommConnEntry *entry = (struct CommConnEntry *)res->data.context;
 
 	if (res->state != PR_ST_MODIFIED)
 	{
-		if (entry->service)
+		if (entry->mux)
+		{
+			if (entry->service)
+				this->handle_mux_request(res);
+			else
+				this->handle_mux_reply(res);
+		}
+		else if (entry->service)
 			this->handle_incoming_request(res);
 		else
 			this->handle_incoming_reply(res);
@@ -877,11 +1532,84 @@ void Communicator::handle_request_result(struct poller_result *res)
 	}
 }
 
+/* The queued output is written, or fails to be. The bytes that came in the
+ * meantime are written next, and a server paused by the output reads its
+ * requests again once most of it is gone. */
+void Communicator::handle_output_result(struct poller_result *res)
+{
+	struct CommConnEntry *entry = (struct CommConnEntry *)res->data.context;
+	CommService *service = entry->service;
+	CommTarget *target = entry->target;
+	int error = 0;
+
+	pthread_mutex_lock(&entry->mutex);
+	free(entry->out_data);
+	entry->out_data = NULL;
+	entry->out_len = 0;
+	if (res->state != PR_ST_FINISHED)
+		error = res->error ? res->error : ECONNABORTED;
+	else if (__flush_output(target->response_timeout, entry) < 0)
+		error = errno;
+
+	if (error)
+		__fail_output(error, entry);
+
+	if (entry->out_paused && __output_queued(entry) < CONN_OUTPUT_MAX / 2)
+	{
+		entry->out_paused = 0;
+		if (!error)
+			mpoller_resume(entry->sockfd, -1, this->mpoller);
+	}
+
+	pthread_mutex_unlock(&entry->mutex);
+	if (__sync_sub_and_fetch(&entry->ref, 1) == 0)
+	{
+		this->release_conn(entry);
+		if (service)
+			((CommServiceTarget *)target)->decref();
+	}
+}
+
+/* The handler thread has no more results at hand. The output it held is
+ * written now. */
+void Communicator::flush_held_output(struct list_head *held)
+{
+	struct CommConnEntry *entry;
+	CommService *service;
+	CommTarget *target;
+
+	while (!list_empty(held))
+	{
+		entry = list_entry(held->next, struct CommConnEntry, out_list);
+		service = entry->service;
+		target = entry->target;
+		pthread_mutex_lock(&entry->mutex);
+		list_del(&entry->out_list);
+		entry->out_held = NULL;
+		if (__flush_output(target->response_timeout, entry) < 0)
+			__fail_output(errno, entry);
+
+		pthread_mutex_unlock(&entry->mutex);
+		if (__sync_sub_and_fetch(&entry->ref, 1) == 0)
+		{
+			Communicator::release_conn(entry);
+			if (service)
+				((CommServiceTarget *)target)->decref();
+		}
+	}
+}
+
 void Communicator::handle_write_result(struct poller_result *res)
 {
 	struct CommConnEntry *entry = (struct CommConnEntry *)res->data.context;
 
-	free(entry->write_iov);
+	if (res->data.fd == entry->out_fd)
+	{
+		this->handle_output_result(res);
+		return;
+	}
+
+	__free_write_iov(entry->write_iov, entry->write_iovcnt);
 	if (entry->service)
 		this->handle_reply_result(res);
 	else
@@ -892,29 +1620,52 @@ struct CommConnEntry *Communicator::accept_conn(CommServiceTarget *target,
 												CommService *service)
 {
 	struct CommConnEntry *entry;
-	size_t size;
+	int ret;
 
 	if (__set_fd_nonblock(target->sockfd) >= 0)
 	{
-		size = offsetof(struct CommConnEntry, mutex);
-		entry = (struct CommConnEntry *)malloc(size);
+		entry = (struct CommConnEntry *)slab_alloc(__conn_entry_slab);
 		if (entry)
 		{
-			entry->conn = service->new_connection(target->sockfd);
-			if (entry->conn)
+			ret = pthread_mutex_init(&entry->mutex, NULL);
+			if (ret == 0)
 			{
-				entry->seq = 0;
-				entry->mpoller = this->mpoller;
-				entry->service = service;
-				entry->target = target;
-				entry->ssl = NULL;
-				entry->sockfd = target->sockfd;
-				entry->state = CONN_STATE_CONNECTED;
-				entry->ref = 1;
-				return entry;
+				entry->conn = service->new_connection(target->sockfd);
+				if (entry->conn)
+				{
+					entry->seq = 0;
+					entry->mpoller = this->mpoller;
+					entry->service = service;
+					entry->target = target;
+					target->entry = entry;
+					entry->ssl = NULL;
+					entry->sockfd = target->sockfd;
+					entry->state = CONN_STATE_CONNECTED;
+					entry->ref = 1;
+					entry->dgram = 0;
+					entry->mux = 0;
+					entry->nmux = 0;
+					entry->mux_max = INT_MAX;
+					INIT_LIST_HEAD(&entry->mux_list);
+					INIT_LIST_HEAD(&entry->done_list);
+					entry->mux_timer = NULL;
+					entry->out_fd = -1;
+					entry->out_error = 0;
+					entry->out_paused = 0;
+					entry->out_held = NULL;
+					entry->out_data = NULL;
+					entry->out_len = 0;
+					entry->out_buf = NULL;
+					entry->out_size = 0;
+					return entry;
+				}
+
+				pthread_mutex_destroy(&entry->mutex);
 			}
+			else
+				errno = ret;
 
-			free(entry);
+			slab_free(entry, __conn_entry_slab);
 		}
 	}
 
@@ -926,6 +1677,7 @@ void Communicator::handle_listen_result(struct poller_result *res)
 	CommService *service = (CommService *)res->data.context;
 	struct CommConnEntry *entry;
 	CommServiceTarget *target;
+	unsigned int index;
 	int timeout;
 
 	switch (res->state)
@@ -937,12 +1689,10 @@ void Communicator::handle_listen_result(struct poller_result *res)
 		{
 			if (service->ssl_ctx)
 			{
+				timeout = service->ssl_accept_timeout;
 				if (__create_ssl(service->ssl_ctx, entry) >= 0 &&
 					service->init_ssl(entry->ssl) >= 0)
-				{
 					res->data.operation = PD_OP_SSL_ACCEPT;
-					timeout = service->ssl_accept_timeout;
-				}
 			}
 			else
 			{
@@ -953,10 +1703,14 @@ void Communicator::handle_listen_result(struct poller_result *res)
 
 			if (res->data.operation != PD_OP_LISTEN)
 			{
+				/* Stay on the poller that accepted the connection. */
+				index = mpoller_index(res->data.fd, this->mpoller);
 				res->data.fd = entry->sockfd;
 				res->data.ssl = entry->ssl;
+				res->data.dgram = 0;
 				res->data.context = entry;
-				if (mpoller_add(&res->data, timeout, this->mpoller) >= 0)
+				if (mpoller_add_to(&res->data, timeout, index,
+								   this->mpoller) >= 0)
 				{
 					if (this->stop_flag)
 						mpoller_del(res->data.fd, this->mpoller);
@@ -973,7 +1727,14 @@ void Communicator::handle_listen_result(struct poller_result *res)
 		break;
 
 	case PR_ST_DELETED:
-		this->shutdown_service(service);
+		if (res->data.fd == service->listen_fd)
+			this->shutdown_service(service);
+		else
+		{
+			close(res->data.fd);
+			service->decref();
+		}
+
 		break;
 
 	case PR_ST_ERROR:
@@ -1008,6 +1769,11 @@ void Communicator::handle_connect_result(struct poller_result *res)
 			else
 				ret = -1;
 		}
+		else if (entry->mux)
+		{
+			this->handle_mux_connect(res);
+			break;
+		}
 		else if ((session->out = session->message_out()) != NULL)
 		{
 			ret = this->send_message(entry);
@@ -1049,40 +1815,149 @@ void Communicator::handle_connect_result(struct poller_result *res)
 	case PR_ST_STOPPED:
 			state = CS_STATE_STOPPED;
 
-		target->release(0);
-		session->handle(state, res->error);
+		if (entry->mux)
+			this->abort_mux_conn(entry, state, res->error);
+		else
+		{
+			target->release(0);
+			session->handle(state, res->error);
+		}
+
 		this->release_conn(entry);
 		break;
 	}
 }
 
-void Communicator::handle_ssl_accept_result(struct poller_result *res)
+/* Fail all the sessions of a multiplexed client connection, which has no
+ * node in the poller any more. */
+void Communicator::abort_mux_conn(struct CommConnEntry *entry,
+								  int state, int error)
+{
+	CommTarget *target = entry->target;
+	struct list_head *pos, *tmp;
+	CommSession *session;
+	LIST_HEAD(list);
+
+	pthread_mutex_lock(&target->mutex);
+	pthread_mutex_lock(&entry->mutex);
+	if (entry->state == CONN_STATE_ERROR)
+	{
+		state = CS_STATE_ERROR;
+		error = entry->error;
+	}
+
+	list_del(&entry->list);
+	list_splice_init(&entry->mux_list, &list);
+	entry->nmux = 0;
+	entry->state = CONN_STATE_CLOSING;
+	pthread_mutex_unlock(&entry->mutex);
+	pthread_mutex_unlock(&target->mutex);
+
+	list_for_each_safe(pos, tmp, &list)
+	{
+		session = list_entry(pos, CommSession, list);
+		target->release(0);
+		session->handle(state, error);
+	}
+}
+
+/* Send the requests that came while connecting. The ones that the
+ * connection does not take are requested again afterwards. */
+void Communicator::handle_mux_connect(struct poller_result *res)
 {
 	struct CommConnEntry *entry = (struct CommConnEntry *)res->data.context;
 	CommTarget *target = entry->target;
-	int timeout;
+	struct list_head *pos, *tmp;
+	CommSession *session;
+	LIST_HEAD(retry);
+	int full = 0;
+	int error = 0;
 
-	switch (res->state)
+	pthread_mutex_lock(&entry->mutex);
+	list_for_each_safe(pos, tmp, &entry->mux_list)
+	{
+		session = list_entry(pos, CommSession, list);
+		if (entry->state == CONN_STATE_ERROR ||
+			this->send_mux_request(session, entry) < 0)
+		{
+			if (entry->state != CONN_STATE_ERROR && errno == EAGAIN)
+				full = 1;
+
+			list_move_tail(pos, &retry);
+			entry->nmux--;
+		}
+	}
+
+	if (full)
+		entry->mux_max = entry->nmux;
+
+	if (entry->state != CONN_STATE_ERROR)
 	{
-	case PR_ST_FINISHED:
 		res->data.operation = PD_OP_READ;
 		res->data.message = NULL;
-		timeout = target->response_timeout;
-		if (mpoller_add(&res->data, timeout, this->mpoller) >= 0)
+		if (mpoller_add(&res->data, target->response_timeout,
+						this->mpoller) >= 0)
 		{
+			entry->state = CONN_STATE_RECEIVING;
+			this->arm_mux_timer(entry);
 			if (this->stop_flag)
 				mpoller_del(res->data.fd, this->mpoller);
-			break;
 		}
-
-	case PR_ST_DELETED:
-	case PR_ST_ERROR:
-	case PR_ST_STOPPED:
-		this->release_conn(entry);
-		((CommServiceTarget *)target)->decref();
-		break;
+		else
+		{
+			entry->error = errno;
+			entry->state = CONN_STATE_ERROR;
+		}
 	}
-}
+
+	if (entry->state == CONN_STATE_ERROR)
+		error = entry->error;
+
+	pthread_mutex_unlock(&entry->mutex);
+	if (error)
+	{
+		this->abort_mux_conn(entry, CS_STATE_ERROR, error);
+		this->release_conn(entry);
+	}
+
+	list_for_each_safe(pos, tmp, &retry)
+	{
+		session = list_entry(pos, CommSession, list);
+		if (this->request_mux_conn(session, target) < 0)
+		{
+			target->release(0);
+			session->handle(CS_STATE_ERROR, errno);
+		}
+	}
+}
+
+void Communicator::handle_ssl_accept_result(struct poller_result *res)
+{
+	struct CommConnEntry *entry = (struct CommConnEntry *)res->data.context;
+	CommTarget *target = entry->target;
+	int timeout;
+
+	switch (res->state)
+	{
+	case PR_ST_FINISHED:
+		res->data.operation = PD_OP_READ;
+		res->data.message = NULL;
+		timeout = target->response_timeout;
+		if (mpoller_add(&res->data, timeout, this->mpoller) >= 0)
+		{
+			if (this->stop_flag)
+				mpoller_del(res->data.fd, this->mpoller);
+			break;
+		}
+
+	case PR_ST_DELETED:
+	case PR_ST_ERROR:
+	case PR_ST_STOPPED:
+		this->release_conn(entry);
+		((CommServiceTarget *)target)->decref();
+		break;
+	}
+}
 
 void Communicator::handle_sleep_result(struct poller_result *res)
 {
@@ -1136,13 +2011,51 @@ void Communicator::handle_aio_result(struct poller_result *res)
 	}
 }
 
+static void __bind_thread_cpu(int cpu)
+{
+#ifdef __linux__
+	cpu_set_t cpuset;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	pthread_setaffinity_np(pthread_self(), sizeof (cpu_set_t), &cpuset);
+#endif
+}
+
 void Communicator::handler_thread_routine(void *context)
 {
-	Communicator *comm = (Communicator *)context;
+	struct CommHandlerQueue *queue = (struct CommHandlerQueue *)context;
+	Communicator *comm = queue->comm;
 	struct poller_result *res;
+	struct list_head held;
+
+	if (queue->cpu >= 0)
+		__bind_thread_cpu(queue->cpu);
 
-	while ((res = (struct poller_result *)msgqueue_get(comm->queue)) != NULL)
+	__handler_queue = queue;
+	if (queue->hold_output)
 	{
+		INIT_LIST_HEAD(&held);
+		__held_output = &held;
+	}
+
+	while (1)
+	{
+		res = NULL;
+		if (__held_output && !list_empty(&held))
+		{
+			res = (struct poller_result *)msgqueue_try_get(queue->msgqueue);
+			if (!res)
+				Communicator::flush_held_output(&held);
+		}
+
+		if (!res)
+		{
+			res = (struct poller_result *)msgqueue_get(queue->msgqueue);
+			if (!res)
+				break;
+		}
+
 		switch (res->data.operation)
 		{
 		case PD_OP_READ:
@@ -1170,7 +2083,7 @@ void Communicator::handler_thread_routine(void *context)
 			break;
 		}
 
-		free(res);
+		poller_free_result(res);
 	}
 }
 
@@ -1180,9 +2093,20 @@ int Communicator::append(const void *buf, size_t *size, poller_message_t *msg)
 	struct CommConnEntry *entry = in->entry;
 	CommSession *session = entry->session;
 	int timeout;
+	int paused;
 	int ret;
 
+	if (entry->mux)
+		return Communicator::append_mux(buf, size, in);
+
+	in->paused = 0;
 	ret = in->append(buf, size);
+	paused = in->paused;
+	in->paused = -1;
+	/* A server switched to multiplexing in this append(). */
+	if (entry->mux)
+		return Communicator::mux_appended(ret, in);
+
 	if (ret > 0)
 	{
 		entry->state = CONN_STATE_SUCCESS;
@@ -1199,6 +2123,8 @@ int Communicator::append(const void *buf, size_t *size, poller_message_t *msg)
 			}
 		}
 	}
+	else if (ret == 0 && paused)
+		return ret;
 	else if (ret == 0 && session->timeout != 0)
 	{
 		if (session->begin_time.tv_nsec == -1)
@@ -1214,16 +2140,172 @@ int Communicator::append(const void *buf, size_t *size, poller_message_t *msg)
 	return ret;
 }
 
+/* Replies on a multiplexed server connection are sent in other threads,
+ * with the entry locked, and they share the state of the connection with
+ * append(). While too much of them is waiting for the socket, no more
+ * requests are read. */
+int Communicator::append_mux(const void *buf, size_t *size, CommMessageIn *in)
+{
+	struct CommConnEntry *entry = in->entry;
+	int paused;
+	int ret;
+
+	pthread_mutex_lock(&entry->mutex);
+	in->paused = 0;
+	ret = in->append(buf, size);
+	paused = in->paused;
+	in->paused = -1;
+	if (ret == 0 && !paused && !entry->out_paused &&
+		__output_queued(entry) >= CONN_OUTPUT_MAX)
+	{
+		if (mpoller_pause(entry->sockfd, entry->mpoller) >= 0)
+			entry->out_paused = 1;
+	}
+
+	pthread_mutex_unlock(&entry->mutex);
+	return Communicator::mux_appended(ret, in);
+}
+
+int Communicator::mux_appended(int ret, CommMessageIn *in)
+{
+	struct CommConnEntry *entry = in->entry;
+	CommService *service = entry->service;
+	CommTarget *target = entry->target;
+
+	if (ret <= 0)
+		return ret;
+
+	pthread_mutex_lock(&entry->mutex);
+	list_add_tail(&entry->session->list, &entry->done_list);
+	pthread_mutex_unlock(&entry->mutex);
+	__sync_add_and_fetch(&entry->ref, 1);
+
+	pthread_mutex_lock(&target->mutex);
+	entry->nmux++;
+	if (entry->state == CONN_STATE_KEEPALIVE)
+	{
+		pthread_mutex_lock(&service->mutex);
+		if (entry->state == CONN_STATE_KEEPALIVE)
+		{
+			list_del(&entry->list);
+			entry->state = CONN_STATE_RECEIVING;
+		}
+
+		pthread_mutex_unlock(&service->mutex);
+	}
+
+	if (entry->state == CONN_STATE_RECEIVING)
+	{
+		entry->state = CONN_STATE_IDLE;
+		list_add(&entry->list, &target->idle_list);
+	}
+
+	pthread_mutex_unlock(&target->mutex);
+	mpoller_set_timeout(entry->sockfd, -1, entry->mpoller);
+	return ret;
+}
+
+/* Of a client, the sessions waiting take turns to receive the connection,
+ * for the replies of all. Any of them may fail alone meanwhile. */
+int Communicator::append_mux_reply(const void *buf, size_t *size,
+								   poller_message_t *msg)
+{
+	struct CommConnEntry *entry = list_entry(msg, struct CommConnEntry,
+											 mux_msg);
+	CommTarget *target = entry->target;
+	CommMessageIn *complete;
+	struct list_head *pos;
+	CommSession *session;
+	CommMessageIn *in;
+	int timeout;
+	int paused;
+	int error;
+	int ret;
+
+	pthread_mutex_lock(&entry->mutex);
+	if (list_empty(&entry->mux_list))
+	{
+		pthread_mutex_unlock(&entry->mutex);
+		errno = EBADMSG;
+		return -1;
+	}
+
+	session = list_entry(entry->mux_list.next, CommSession, list);
+	in = session->in;
+	in->paused = 0;
+	ret = in->append(buf, size);
+	paused = in->paused;
+	in->paused = -1;
+	if (ret > 0)
+	{
+		complete = in->get_complete(&error);
+		session = NULL;
+		list_for_each(pos, &entry->mux_list)
+		{
+			session = list_entry(pos, CommSession, list);
+			if (session->in == complete)
+				break;
+
+			session = NULL;
+		}
+
+		if (!session)
+		{
+			pthread_mutex_unlock(&entry->mutex);
+			errno = EBADMSG;
+			return -1;
+		}
+
+		session->timeout = error; /* Reuse session's timeout field. */
+		list_move_tail(&session->list, &entry->done_list);
+		__sync_add_and_fetch(&entry->ref, 1);
+		entry->nmux--;
+		if (entry->nmux > 0)
+			timeout = target->response_timeout;
+		else
+		{
+			/* Idle, it takes as many requests as the peer allows again. */
+			entry->mux_max = INT_MAX;
+			timeout = session->keep_alive_timeout();
+			if (timeout == 0)
+			{
+				mpoller_del(entry->sockfd, entry->mpoller);
+				entry->state = CONN_STATE_CLOSING;
+			}
+		}
+	}
+	else if (ret == 0 && !paused && entry->nmux > 0)
+		timeout = target->response_timeout;
+	else
+		timeout = 0;
+
+	if (timeout != 0)
+		mpoller_set_timeout(entry->sockfd, timeout, entry->mpoller);
+
+	pthread_mutex_unlock(&entry->mutex);
+	return ret;
+}
+
+void *Communicator::get_buffer(size_t *size, poller_message_t *msg)
+{
+	CommMessageIn *in = (CommMessageIn *)msg;
+
+	return in->get_buffer(size);
+}
+
 int Communicator::create_service_session(struct CommConnEntry *entry)
 {
 	CommService *service = entry->service;
 	CommTarget *target = entry->target;
 	CommSession *session;
+	int state = -1;
 	int timeout;
 
 	pthread_mutex_lock(&service->mutex);
 	if (entry->state == CONN_STATE_KEEPALIVE)
 		list_del(&entry->list);
+	else if (entry->state == CONN_STATE_IDLE && entry->mux)
+		state = CONN_STATE_IDLE;
 	else if (entry->state != CONN_STATE_CONNECTED)
 		entry = NULL;
 
@@ -1245,9 +2327,13 @@ int Communicator::create_service_session(struct CommConnEntry *entry)
 		session->out = NULL;
 		session->in = NULL;
 
-		timeout = Communicator::first_timeout_recv(session);
-		mpoller_set_timeout(entry->sockfd, timeout, entry->mpoller);
-		entry->state = CONN_STATE_RECEIVING;
+		/* Other sessions of a multiplexed one are waiting to reply. */
+		if (state != CONN_STATE_IDLE)
+		{
+			timeout = Communicator::first_timeout_recv(session);
+			mpoller_set_timeout(entry->sockfd, timeout, entry->mpoller);
+			entry->state = CONN_STATE_RECEIVING;
+		}
 
 		((CommServiceTarget *)target)->incref();
 		return 0;
@@ -1275,8 +2361,16 @@ poller_message_t *Communicator::create_message(void *context)
 		pthread_mutex_unlock(mutex);
 	}
 
+	if (entry->mux && !entry->service)
+	{
+		entry->mux_msg.append = Communicator::append_mux_reply;
+		entry->mux_msg.get_buffer = NULL;
+		return &entry->mux_msg;
+	}
+
 	if (entry->state == CONN_STATE_CONNECTED ||
-		entry->state == CONN_STATE_KEEPALIVE)
+		entry->state == CONN_STATE_KEEPALIVE ||
+		(entry->state == CONN_STATE_IDLE && entry->mux))
 	{
 		if (Communicator::create_service_session(entry) < 0)
 			return NULL;
@@ -1292,6 +2386,7 @@ poller_message_t *Communicator::create_message(void *context)
 	if (session->in)
 	{
 		session->in->poller_message_t::append = Communicator::append;
+		session->in->poller_message_t::get_buffer = Communicator::get_buffer;
 		session->in->entry = entry;
 	}
 
@@ -1304,6 +2399,15 @@ int Communicator::partial_written(size_t n, void *context)
 	CommSession *session = entry->session;
 	int timeout;
 
+	/* Of a multiplexed connection, only the queued output is written. On
+	 * the others, no reply is written while some output is queued. */
+	if (entry->mux || entry->out_data)
+	{
+		timeout = entry->target->response_timeout;
+		mpoller_set_timeout(entry->out_fd, timeout, entry->mpoller);
+		return 0;
+	}
+
 	timeout = Communicator::next_timeout(session);
 	mpoller_set_timeout(entry->sockfd, timeout, entry->mpoller);
 	return 0;
@@ -1312,7 +2416,19 @@ int Communicator::partial_written(size_t n, void *context)
 void Communicator::callback(struct poller_result *res, void *context)
 {
 	Communicator *comm = (Communicator *)context;
-	msgqueue_put(res, comm->queue);
+	struct CommHandlerQueue *queue = comm->queues;
+	static std::atomic<unsigned int> n(0);
+
+	/* Same as the poller index in mpoller. Timers have no fd. */
+	if (comm->nqueues > 1)
+	{
+		if (res->data.fd >= 0)
+			queue += mpoller_index(res->data.fd, comm->mpoller) % comm->nqueues;
+		else
+			queue += n.fetch_add(1, std::memory_order_relaxed) % comm->nqueues;
+	}
+
+	msgqueue_put(res, queue->msgqueue);
 }
 
 void *Communicator::accept(const struct sockaddr *addr, socklen_t addrlen,
@@ -1339,19 +2455,103 @@ void *Communicator::accept(const struct sockaddr *addr, socklen_t addrlen,
 	return NULL;
 }
 
+static void __assign_cpus(struct CommHandlerQueue *queues, size_t n)
+{
+#ifdef __linux__
+	cpu_set_t cpuset;
+	int cpus[CPU_SETSIZE];
+	int ncpus = 0;
+	size_t i;
+	int cpu;
+
+	if (sched_getaffinity(0, sizeof (cpu_set_t), &cpuset) < 0)
+		return;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (CPU_ISSET(cpu, &cpuset))
+			cpus[ncpus++] = cpu;
+	}
+
+	for (i = 0; i < n && ncpus > 0; i++)
+		queues[i].cpu = cpus[i % ncpus];
+#endif
+}
+
+int Communicator::create_handler_queues(const struct CommParams *params)
+{
+	size_t n = 1;
+	size_t i;
+
+	if (params->handler_affinity != COMM_HANDLER_SHARED)
+		n = params->poller_threads;
+
+	this->queues = (struct CommHandlerQueue *)
+				   malloc(n * sizeof (struct CommHandlerQueue));
+	if (!this->queues)
+		return -1;
+
+	for (i = 0; i < n; i++)
+	{
+		if (params->lockfree_queue)
+			this->queues[i].msgqueue =
+				msgqueue_create_lockfree(4096, sizeof (struct poller_result));
+		else
+			this->queues[i].msgqueue =
+				msgqueue_create(4096, sizeof (struct poller_result));
+
+		if (!this->queues[i].msgqueue)
+			break;
+
+		this->queues[i].comm = this;
+		this->queues[i].cpu = -1;
+		this->queues[i].hold_output = params->coalesce_output;
+	}
+
+	if (i == n)
+	{
+		if (params->handler_affinity == COMM_HANDLER_PER_POLLER_CPU)
+			__assign_cpus(this->queues, n);
+
+		this->nqueues = n;
+		return 0;
+	}
+
+	while (i > 0)
+		msgqueue_destroy(this->queues[--i].msgqueue);
+
+	free(this->queues);
+	return -1;
+}
+
+void Communicator::destroy_handler_queues()
+{
+	size_t i;
+
+	for (i = 0; i < this->nqueues; i++)
+		msgqueue_destroy(this->queues[i].msgqueue);
+
+	free(this->queues);
+}
+
 int Communicator::create_handler_threads(size_t handler_threads)
 {
 	struct thrdpool_task task = {
 		.routine	=	Communicator::handler_thread_routine,
-		.context	=	this
+		.context	=	NULL
 	};
 	size_t i;
 
+	/* Every handler queue needs at least one thread. */
+	if (handler_threads < this->nqueues)
+		handler_threads = this->nqueues;
+
 	this->thrdpool = thrdpool_create(handler_threads, 0);
 	if (this->thrdpool)
 	{
 		for (i = 0; i < handler_threads; i++)
 		{
+			task.context = &this->queues[i % this->nqueues];
 			if (thrdpool_schedule(&task, this->thrdpool) < 0)
 				break;
 		}
@@ -1359,55 +2559,77 @@ int Communicator::create_handler_threads(size_t handler_threads)
 		if (i == handler_threads)
 			return 0;
 
-		msgqueue_set_nonblock(this->queue);
+		for (i = 0; i < this->nqueues; i++)
+			msgqueue_set_nonblock(this->queues[i].msgqueue);
+
 		thrdpool_destroy(NULL, this->thrdpool);
 	}
 
 	return -1;
 }
 
-int Communicator::create_poller(size_t poller_threads)
+int Communicator::create_poller(const struct CommParams *comm_params)
 {
 	struct poller_params params = {
 		.max_open_files		=	(size_t)sysconf(_SC_OPEN_MAX),
 		.create_message		=	Communicator::create_message,
 		.partial_written	=	Communicator::partial_written,
 		.callback			=	Communicator::callback,
-		.context			=	this
+		.context			=	this,
+		.backend			=	comm_params->poller_backend,
+		.timer_wheel		=	comm_params->timer_wheel,
+		.busy_poll			=	comm_params->busy_poll
 	};
+	size_t i;
 
 	if ((ssize_t)params.max_open_files < 0)
 		return -1;
 
-	this->queue = msgqueue_create(4096, sizeof (struct poller_result));
-	if (this->queue)
+	if (this->create_handler_queues(comm_params) >= 0)
 	{
-		this->mpoller = mpoller_create(&params, poller_threads);
+		this->mpoller = mpoller_create(&params, comm_params->poller_threads);
 		if (this->mpoller)
 		{
 			if (mpoller_start(this->mpoller) >= 0)
+			{
+				/* Binding is best-effort. Ignore failures. */
+				for (i = 0; i < this->nqueues; i++)
+				{
+					if (this->queues[i].cpu >= 0)
+						poller_bind_cpu(this->queues[i].cpu,
+										this->mpoller->poller[i]);
+				}
+
 				return 0;
+			}
 
 			mpoller_destroy(this->mpoller);
 		}
 
-		msgqueue_destroy(this->queue);
+		this->destroy_handler_queues();
 	}
 
 	return -1;
 }
 
-int Communicator::init(size_t poller_threads, size_t handler_threads)
+int Communicator::init(const struct CommParams *params)
 {
-	if (poller_threads == 0)
+	if (params->poller_threads == 0)
 	{
 		errno = EINVAL;
 		return -1;
 	}
 
-	if (this->create_poller(poller_threads) >= 0)
+	pthread_once(&__slab_once, __create_slabs);
+	if (!__conn_entry_slab || !__write_iov_slab)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (this->create_poller(params) >= 0)
 	{
-		if (this->create_handler_threads(handler_threads) >= 0)
+		if (this->create_handler_threads(params->handler_threads) >= 0)
 		{
 			this->stop_flag = 0;
 			return 0;
@@ -1415,20 +2637,40 @@ int Communicator::init(size_t poller_threads, size_t handler_threads)
 
 		mpoller_stop(this->mpoller);
 		mpoller_destroy(this->mpoller);
-		msgqueue_destroy(this->queue);
+		this->destroy_handler_queues();
 	}
 
 	return -1;
 }
 
+int Communicator::init(size_t poller_threads, size_t handler_threads)
+{
+	struct CommParams params = {
+		.poller_threads		=	poller_threads,
+		.handler_threads	=	handler_threads,
+		.poller_backend		=	POLLER_BACKEND_DEFAULT,
+		.handler_affinity	=	COMM_HANDLER_SHARED,
+		.timer_wheel		=	0,
+		.busy_poll			=	0,
+		.lockfree_queue		=	0,
+		.coalesce_output	=	0
+	};
+
+	return this->init(&params);
+}
+
 void Communicator::deinit()
 {
+	size_t i;
+
 	this->stop_flag = 1;
 	mpoller_stop(this->mpoller);
-	msgqueue_set_nonblock(this->queue);
+	for (i = 0; i < this->nqueues; i++)
+		msgqueue_set_nonblock(this->queues[i].msgqueue);
+
 	thrdpool_destroy(NULL, this->thrdpool);
 	mpoller_destroy(this->mpoller);
-	msgqueue_destroy(this->queue);
+	this->destroy_handler_queues();
 }
 
 int Communicator::nonblock_connect(CommTarget *target)
@@ -1462,7 +2704,7 @@ struct CommConnEntry *Communicator::launch_conn(CommSession *session,
 	sockfd = this->nonblock_connect(target);
 	if (sockfd >= 0)
 	{
-		entry = (struct CommConnEntry *)malloc(sizeof (struct CommConnEntry));
+		entry = (struct CommConnEntry *)slab_alloc(__conn_entry_slab);
 		if (entry)
 		{
 			ret = pthread_mutex_init(&entry->mutex, NULL);
@@ -1480,6 +2722,21 @@ struct CommConnEntry *Communicator::launch_conn(CommSession *session,
 					entry->sockfd = sockfd;
 					entry->state = CONN_STATE_CONNECTING;
 					entry->ref = 1;
+					entry->dgram = target->is_datagram();
+					entry->mux = 0;
+					entry->nmux = 0;
+					entry->mux_max = INT_MAX;
+					INIT_LIST_HEAD(&entry->mux_list);
+					INIT_LIST_HEAD(&entry->done_list);
+					entry->mux_timer = NULL;
+					entry->out_fd = -1;
+					entry->out_error = 0;
+					entry->out_paused = 0;
+					entry->out_held = NULL;
+					entry->out_data = NULL;
+					entry->out_len = 0;
+					entry->out_buf = NULL;
+					entry->out_size = 0;
 					return entry;
 				}
 
@@ -1488,7 +2745,7 @@ struct CommConnEntry *Communicator::launch_conn(CommSession *session,
 			else
 				errno = ret;
 
-			free(entry);
+			slab_free(entry, __conn_entry_slab);
 		}
 
 		close(sockfd);
@@ -1506,15 +2763,21 @@ int Communicator::request_idle_conn(CommSession *session, CommTarget *target)
 	while (1)
 	{
 		pthread_mutex_lock(&target->mutex);
-		if (!list_empty(&target->idle_list))
+		entry = NULL;
+		list_for_each(pos, &target->idle_list)
 		{
-			pos = target->idle_list.next;
 			entry = list_entry(pos, struct CommConnEntry, list);
+			if (!entry->mux)
+				break;
+
+			entry = NULL;
+		}
+
+		if (entry)
+		{
 			list_del(pos);
 			pthread_mutex_lock(&entry->mutex);
 		}
-		else
-			entry = NULL;
 
 		pthread_mutex_unlock(&target->mutex);
 		if (!entry)
@@ -1558,25 +2821,293 @@ int Communicator::request_new_conn(CommSession *session, CommTarget *target)
 	entry = this->launch_conn(session, target);
 	if (entry)
 	{
-		session->conn = entry->conn;
-		session->seq = entry->seq++;
 		data.operation = PD_OP_CONNECT;
 		data.fd = entry->sockfd;
 		data.ssl = NULL;
+		data.dgram = entry->dgram;
 		data.context = entry;
 		timeout = session->target->connect_timeout;
-		if (mpoller_add(&data, timeout, this->mpoller) >= 0)
-			return 0;
-
-		this->release_conn(entry);
-	}
-
-	return -1;
-}
-
-int Communicator::request(CommSession *session, CommTarget *target)
+		if (!session->is_multiplexed())
+		{
+			session->conn = entry->conn;
+			session->seq = entry->seq++;
+			if (mpoller_add(&data, timeout, this->mpoller) >= 0)
+				return 0;
+		}
+		else
+		{
+			/* Other requests may join it till it is connected. */
+			entry->mux = 1;
+			entry->nmux = 1;
+			session->deadline = -1;
+			list_add_tail(&session->list, &entry->mux_list);
+			pthread_mutex_lock(&target->mutex);
+			if (mpoller_add(&data, timeout, this->mpoller) >= 0)
+			{
+				list_add_tail(&entry->list, &target->idle_list);
+				pthread_mutex_unlock(&target->mutex);
+				return 0;
+			}
+
+			pthread_mutex_unlock(&target->mutex);
+		}
+
+		this->release_conn(entry);
+	}
+
+	return -1;
+}
+
+/* Fails the sessions of a multiplexed client connection whose deadlines
+ * have passed. Every timer added holds a reference of the connection. */
+class Communicator::MuxTimer : public SleepSession
+{
+private:
+	virtual int duration(struct timespec *value)
+	{
+		long long msec = this->expire - __monotonic_msec();
+
+		if (msec < 0)
+			msec = 0;
+
+		value->tv_sec = msec / 1000;
+		value->tv_nsec = msec % 1000 * 1000000;
+		return 0;
+	}
+
+	virtual void handle(int state, int error)
+	{
+		this->comm->expire_mux(this->entry, state);
+	}
+
+public:
+	Communicator *comm;
+	struct CommConnEntry *entry;
+	long long expire;	/* the earliest of the timers added, if known */
+
+public:
+	MuxTimer(Communicator *comm, struct CommConnEntry *entry) :
+		comm(comm), entry(entry), expire(LLONG_MAX)
+	{
+	}
+};
+
+/* A session is given its receive timeout since it is sent, and the response
+ * timeout since its message last received anything, whichever ends first. */
+void Communicator::renew_deadline(CommSession *session)
+{
+	int timeout = session->target->response_timeout;
+	long long deadline = -1;
+	long long end;
+
+	if (timeout >= 0)
+		deadline = __monotonic_msec() + timeout;
+
+	if (session->timeout >= 0)
+	{
+		end = 1000LL * session->begin_time.tv_sec +
+			  session->begin_time.tv_nsec / 1000000 + session->timeout;
+		if (deadline < 0 || end < deadline)
+			deadline = end;
+	}
+
+	session->deadline = deadline;
+}
+
+/* With the entry locked. A timer fires by the earliest deadline of the
+ * sessions waiting, unless one added already does. */
+void Communicator::arm_mux_timer(struct CommConnEntry *entry)
+{
+	MuxTimer *timer = (MuxTimer *)entry->mux_timer;
+	long long expire = LLONG_MAX;
+	struct list_head *pos;
+	CommSession *session;
+
+	list_for_each(pos, &entry->mux_list)
+	{
+		session = list_entry(pos, CommSession, list);
+		if (session->deadline >= 0 && session->deadline < expire)
+			expire = session->deadline;
+	}
+
+	if (expire == LLONG_MAX)
+		return;
+
+	if (!timer)
+	{
+		timer = new MuxTimer(this, entry);
+		entry->mux_timer = timer;
+	}
+
+	if (expire < timer->expire)
+	{
+		timer->expire = expire;
+		__sync_add_and_fetch(&entry->ref, 1);
+		if (this->sleep(timer) < 0)
+		{
+			__sync_sub_and_fetch(&entry->ref, 1);
+			timer->expire = LLONG_MAX;
+		}
+	}
+}
+
+/* The streams of the sessions expired are cancelled, and the connection
+ * goes on with the others. If none is left, the peer is likely stuck, and
+ * the connection is closed. */
+void Communicator::expire_mux(struct CommConnEntry *entry, int state)
+{
+	MuxTimer *timer = (MuxTimer *)entry->mux_timer;
+	CommTarget *target = entry->target;
+	struct list_head *pos, *tmp;
+	CommSession *session;
+	long long now;
+	LIST_HEAD(list);
+
+	pthread_mutex_lock(&entry->mutex);
+	timer->expire = LLONG_MAX;
+	if (state == SS_STATE_COMPLETE && entry->state == CONN_STATE_RECEIVING)
+	{
+		now = __monotonic_msec();
+		list_for_each_safe(pos, tmp, &entry->mux_list)
+		{
+			session = list_entry(pos, CommSession, list);
+			if (session->deadline >= 0 && session->deadline <= now)
+			{
+				session->in->cancel();
+				list_move_tail(pos, &list);
+				entry->nmux--;
+			}
+		}
+
+		if (!list_empty(&list) && entry->nmux == 0)
+		{
+			mpoller_del(entry->sockfd, this->mpoller);
+			entry->state = CONN_STATE_CLOSING;
+		}
+		else
+			this->arm_mux_timer(entry);
+	}
+
+	pthread_mutex_unlock(&entry->mutex);
+	list_for_each_safe(pos, tmp, &list)
+	{
+		session = list_entry(pos, CommSession, list);
+		target->release(1);
+		session->handle(CS_STATE_ERROR, ETIMEDOUT);
+	}
+
+	if (__sync_sub_and_fetch(&entry->ref, 1) == 0)
+		this->release_conn(entry);
+}
+
+/* With the entry locked. Fails with EAGAIN if the connection takes no more
+ * requests. Failing to send breaks the connection but not the session,
+ * which fails later with the other sessions of the connection. */
+int Communicator::send_mux_request(CommSession *session,
+								   struct CommConnEntry *entry)
+{
+	struct iovec vectors[ENCODE_IOV_MAX];
+	CommTarget *target = entry->target;
+	int cnt;
+
+	session->conn = entry->conn;
+	session->seq = entry->seq;
+	session->out = session->message_out();
+	if (!session->out)
+		return -1;
+
+	cnt = session->out->encode(vectors, ENCODE_IOV_MAX);
+	if ((unsigned int)cnt > ENCODE_IOV_MAX)
+	{
+		if (cnt > ENCODE_IOV_MAX)
+			errno = EOVERFLOW;
+		return -1;
+	}
+
+	entry->seq++;
+	if (__queue_output(vectors, cnt, target->response_timeout, entry) >= 0)
+	{
+		session->in = session->message_in();
+		if (session->in)
+		{
+			session->in->entry = entry;
+			session->timeout = session->receive_timeout();
+			clock_gettime(CLOCK_MONOTONIC, &session->begin_time);
+			Communicator::renew_deadline(session);
+			mpoller_set_timeout(entry->sockfd, target->response_timeout,
+								this->mpoller);
+			return 0;
+		}
+	}
+
+	entry->error = errno;
+	mpoller_del(entry->sockfd, this->mpoller);
+	entry->state = CONN_STATE_ERROR;
+	return 0;
+}
+
+/* Join a multiplexed connection that has room for one more request, or
+ * start a new one. */
+int Communicator::request_mux_conn(CommSession *session, CommTarget *target)
+{
+	struct CommConnEntry *entry;
+	struct list_head *pos;
+	int ret;
+
+	while (1)
+	{
+		pthread_mutex_lock(&target->mutex);
+		entry = NULL;
+		list_for_each(pos, &target->idle_list)
+		{
+			entry = list_entry(pos, struct CommConnEntry, list);
+			if (entry->mux)
+			{
+				pthread_mutex_lock(&entry->mutex);
+				if ((entry->state == CONN_STATE_CONNECTING ||
+					 entry->state == CONN_STATE_RECEIVING) &&
+					entry->nmux < entry->mux_max &&
+					__output_queued(entry) < CONN_OUTPUT_MAX)
+					break;
+
+				pthread_mutex_unlock(&entry->mutex);
+			}
+
+			entry = NULL;
+		}
+
+		pthread_mutex_unlock(&target->mutex);
+		if (!entry)
+			return this->request_new_conn(session, target);
+
+		if (entry->state == CONN_STATE_CONNECTING)
+		{
+			session->deadline = -1;
+			ret = 0;
+		}
+		else
+			ret = this->send_mux_request(session, entry);
+
+		if (ret >= 0)
+		{
+			list_add_tail(&session->list, &entry->mux_list);
+			entry->nmux++;
+			if (entry->state == CONN_STATE_RECEIVING)
+				this->arm_mux_timer(entry);
+		}
+		else if (errno == EAGAIN)
+			entry->mux_max = entry->nmux;
+
+		pthread_mutex_unlock(&entry->mutex);
+		if (ret >= 0 || errno != EAGAIN)
+			return ret;
+	}
+}
+
+int Communicator::request(CommSession *session, CommTarget *target)
 {
 	int errno_bak;
+	int ret;
 
 	if (session->passive)
 	{
@@ -1588,14 +3119,18 @@ int Communicator::request(CommSession *session, CommTarget *target)
 	session->target = target;
 	session->out = NULL;
 	session->in = NULL;
-	if (this->request_idle_conn(session, target) < 0)
+	if (session->is_multiplexed())
+		ret = this->request_mux_conn(session, target);
+	else if (this->request_idle_conn(session, target) < 0)
+		ret = this->request_new_conn(session, target);
+	else
+		ret = 0;
+
+	if (ret < 0)
 	{
-		if (this->request_new_conn(session, target) < 0)
-		{
-			session->conn = NULL;
-			session->seq = 0;
-			return -1;
-		}
+		session->conn = NULL;
+		session->seq = 0;
+		return -1;
 	}
 
 	errno = errno_bak;
@@ -1610,6 +3145,10 @@ int Communicator::nonblock_listen(CommService *service)
 	{
 		if (__set_fd_nonblock(sockfd) >= 0)
 		{
+#ifdef SO_REUSEPORT
+			if (service->reuse_port)
+				__set_reuse_port(sockfd);
+#endif
 			if (__bind_and_listen(sockfd, service->bind_addr,
 								  service->addrlen) >= 0)
 			{
@@ -1623,6 +3162,82 @@ int Communicator::nonblock_listen(CommService *service)
 	return -1;
 }
 
+#ifdef SO_REUSEPORT
+int Communicator::create_reuse_port(int sockfd, CommService *service)
+{
+	int n = this->mpoller->nthreads - 1;
+	int *fds;
+	int i;
+
+	service->reuse_fds = NULL;
+	service->reuse_cnt = 0;
+	if (!service->reuse_port || n == 0)
+		return 0;
+
+	fds = (int *)malloc(n * sizeof (int));
+	if (!fds)
+		return -1;
+
+	for (i = 0; i < n; i++)
+	{
+		fds[i] = __reuse_port_listen(sockfd);
+		if (fds[i] < 0)
+			break;
+	}
+
+	if (i == n)
+	{
+		service->reuse_fds = fds;
+		service->reuse_cnt = n;
+		return 0;
+	}
+
+	while (--i >= 0)
+		close(fds[i]);
+
+	free(fds);
+	return -1;
+}
+#else
+int Communicator::create_reuse_port(int sockfd, CommService *service)
+{
+	service->reuse_fds = NULL;
+	service->reuse_cnt = 0;
+	return 0;
+}
+#endif
+
+/* Each listener goes to the poller next to the previous one, so that every
+ * poller accepts. A listener that fails to be added is closed. The service
+ * still works with the others, because the first one has been added. */
+void Communicator::bind_reuse_port(CommService *service)
+{
+	unsigned int index = mpoller_index(service->listen_fd, this->mpoller);
+	struct poller_data data;
+	int n = 0;
+	int i;
+
+	data.operation = PD_OP_LISTEN;
+	data.accept = Communicator::accept;
+	data.context = service;
+	data.result = NULL;
+	for (i = 0; i < service->reuse_cnt; i++)
+	{
+		service->incref();
+		data.fd = service->reuse_fds[i];
+		if (mpoller_add_to(&data, service->listen_timeout, index + i + 1,
+						   this->mpoller) >= 0)
+			service->reuse_fds[n++] = data.fd;
+		else
+		{
+			close(data.fd);
+			service->decref();
+		}
+	}
+
+	service->reuse_cnt = n;
+}
+
 int Communicator::bind(CommService *service)
 {
 	struct poller_data data;
@@ -1631,15 +3246,26 @@ int Communicator::bind(CommService *service)
 	sockfd = this->nonblock_listen(service);
 	if (sockfd >= 0)
 	{
-		service->listen_fd = sockfd;
-		service->ref = 1;
-		data.operation = PD_OP_LISTEN;
-		data.fd = sockfd;
-		data.accept = Communicator::accept;
-		data.context = service;
-		data.result = NULL;
-		if (mpoller_add(&data, service->listen_timeout, this->mpoller) >= 0)
-			return 0;
+		if (this->create_reuse_port(sockfd, service) >= 0)
+		{
+			service->listen_fd = sockfd;
+			service->ref = 1;
+			data.operation = PD_OP_LISTEN;
+			data.fd = sockfd;
+			data.accept = Communicator::accept;
+			data.context = service;
+			data.result = NULL;
+			if (mpoller_add(&data, service->listen_timeout, this->mpoller) >= 0)
+			{
+				this->bind_reuse_port(service);
+				return 0;
+			}
+
+			while (service->reuse_cnt > 0)
+				close(service->reuse_fds[--service->reuse_cnt]);
+
+			free(service->reuse_fds);
+		}
 
 		close(sockfd);
 	}
@@ -1650,13 +3276,27 @@ int Communicator::bind(CommService *service)
 void Communicator::unbind(CommService *service)
 {
 	int errno_bak = errno;
+	int i;
+
+	for (i = 0; i < service->reuse_cnt; i++)
+	{
+		if (mpoller_del(service->reuse_fds[i], this->mpoller) < 0)
+		{
+			close(service->reuse_fds[i]);
+			service->decref();
+		}
+	}
 
+	free(service->reuse_fds);
+	service->reuse_fds = NULL;
+	service->reuse_cnt = 0;
 	if (mpoller_del(service->listen_fd, this->mpoller) < 0)
 	{
 		/* Error occurred on listen_fd or Communicator::deinit() called. */
 		this->shutdown_service(service);
-		errno = errno_bak;
 	}
+
+	errno = errno_bak;
 }
 
 int Communicator::reply_idle_conn(CommSession *session, CommTarget *target)
@@ -1691,6 +3331,101 @@ int Communicator::reply_idle_conn(CommSession *session, CommTarget *target)
 	return ret;
 }
 
+/* A session of a multiplexed server connection replied, or will never if
+ * 'error'. The connection is kept alive for 'timeout' after the last reply,
+ * or closed on error. */
+void Communicator::mux_replied(struct CommConnEntry *entry,
+							   int timeout, int error)
+{
+	CommService *service = entry->service;
+	CommTarget *target = entry->target;
+
+	pthread_mutex_lock(&target->mutex);
+	entry->nmux--;
+	if (entry->state == CONN_STATE_IDLE && (error || entry->nmux == 0))
+	{
+		list_del(&entry->list);
+		if (error)
+		{
+			entry->error = error;
+			mpoller_del(entry->sockfd, entry->mpoller);
+			entry->state = CONN_STATE_ERROR;
+		}
+		else if (timeout != 0)
+		{
+			mpoller_set_timeout(entry->sockfd, timeout, entry->mpoller);
+			pthread_mutex_lock(&service->mutex);
+			if (service->listen_fd >= 0)
+			{
+				entry->state = CONN_STATE_KEEPALIVE;
+				list_add_tail(&entry->list, &service->alive_list);
+			}
+			else
+			{
+				mpoller_del(entry->sockfd, entry->mpoller);
+				entry->state = CONN_STATE_CLOSING;
+			}
+
+			pthread_mutex_unlock(&service->mutex);
+		}
+		else
+		{
+			mpoller_del(entry->sockfd, entry->mpoller);
+			entry->state = CONN_STATE_CLOSING;
+		}
+	}
+
+	pthread_mutex_unlock(&target->mutex);
+}
+
+/* The replies of a multiplexed connection are queued in whole, for the
+ * other sessions may be replying at the same time. */
+void Communicator::reply_mux_conn(CommSession *session,
+								  struct CommConnEntry *entry)
+{
+	struct iovec vectors[ENCODE_IOV_MAX];
+	CommTarget *target = entry->target;
+	int error = 0;
+	int cnt;
+
+	pthread_mutex_lock(&entry->mutex);
+	list_del(&session->list);
+	session->out = session->message_out();
+	if (session->out)
+	{
+		cnt = session->out->encode(vectors, ENCODE_IOV_MAX);
+		if ((unsigned int)cnt > ENCODE_IOV_MAX)
+		{
+			if (cnt > ENCODE_IOV_MAX)
+				errno = EOVERFLOW;
+			error = errno;
+		}
+		else if (__queue_output(vectors, cnt, target->response_timeout,
+								entry) < 0)
+			error = errno;
+	}
+	else
+		error = errno;
+
+	pthread_mutex_unlock(&entry->mutex);
+	if (error)
+	{
+		Communicator::mux_replied(entry, 0, error);
+		session->handle(CS_STATE_ERROR, error);
+	}
+	else
+	{
+		Communicator::mux_replied(entry, session->keep_alive_timeout(), 0);
+		session->handle(CS_STATE_SUCCESS, 0);
+	}
+
+	if (__sync_sub_and_fetch(&entry->ref, 1) == 0)
+	{
+		this->release_conn(entry);
+		((CommServiceTarget *)target)->decref();
+	}
+}
+
 int Communicator::reply(CommSession *session)
 {
 	struct CommConnEntry *entry;
@@ -1707,6 +3442,14 @@ int Communicator::reply(CommSession *session)
 	errno_bak = errno;
 	session->passive = 2;
 	target = session->target;
+	if (!list_empty(&session->list))
+	{
+		entry = ((CommServiceTarget *)target)->entry;
+		this->reply_mux_conn(session, entry);
+		errno = errno_bak;
+		return 0;
+	}
+
 	ret = this->reply_idle_conn(session, target);
 	if (ret < 0)
 		return -1;
@@ -1769,6 +3512,47 @@ int Communicator::push(const void *buf, size_t size, CommSession *session)
 	return ret;
 }
 
+/* The data is queued on the connection, and written by the poller. While
+ * too much is queued, nothing more is taken. */
+int Communicator::push_async(const void *buf, size_t size,
+							 CommSession *session)
+{
+	CommTarget *target = session->target;
+	struct CommConnEntry *entry;
+	struct iovec vector;
+	int ret = -1;
+
+	if (session->passive != 1)
+	{
+		errno = session->passive ? ENOENT : EPERM;
+		return -1;
+	}
+
+	pthread_mutex_lock(&target->mutex);
+	if (!list_empty(&target->idle_list))
+	{
+		entry = list_entry(target->idle_list.next, struct CommConnEntry, list);
+		pthread_mutex_lock(&entry->mutex);
+		if (__output_queued(entry) >= CONN_OUTPUT_MAX)
+			errno = EAGAIN;
+		else
+		{
+			vector.iov_base = (void *)buf;
+			vector.iov_len = size;
+			if (__queue_output(&vector, 1, target->response_timeout,
+							   entry) >= 0)
+				ret = size;
+		}
+
+		pthread_mutex_unlock(&entry->mutex);
+	}
+	else
+		errno = ENOENT;
+
+	pthread_mutex_unlock(&target->mutex);
+	return ret;
+}
+
 int Communicator::sleep(SleepSession *session)
 {
 	struct timespec value;
@@ -1794,14 +3578,22 @@ int Communicator::increase_handler_thread()
 {
 	void *buf = malloc(4 * sizeof (void *));
 
+	/* This thread is going to block. What it holds goes out first. */
+	if (__held_output)
+		Communicator::flush_held_output(__held_output);
+
 	if (buf)
 	{
 		if (thrdpool_increase(this->thrdpool) >= 0)
 		{
 			struct thrdpool_task task = {
 				.routine	=	Communicator::handler_thread_routine,
-				.context	=	this
+				.context	=	this->queues
 			};
+
+			if (__handler_queue && __handler_queue->comm == this)
+				task.context = __handler_queue;
+
 			__thrdpool_schedule(&task, buf, this->thrdpool);
 			return 0;
 		}
@@ -72,6 +72,9 @@ private:
 
 	virtual int init_ssl(SSL *ssl) { return 0; }
 
+	/* True if create_connect_fd() makes a datagram socket. */
+	virtual bool is_datagram() const { return false; }
+
 public:
 	virtual void release(int keep_alive) { }
 
@@ -89,6 +92,7 @@ private:
 
 public:
 	virtual ~CommTarget() { }
+	friend class CommMessageIn;
 	friend class CommSession;
 	friend class Communicator;
 };
@@ -96,6 +100,9 @@ public:
 class CommMessageOut
 {
 private:
+	/* A range of a file may be encoded as two vectors. See POLLER_IOV_FILE
+	 * in poller.h. To a datagram target, several datagrams may be encoded
+	 * apart by POLLER_IOV_DGRAM vectors. */
 	virtual int encode(struct iovec vectors[], int max) = 0;
 
 public:
@@ -108,17 +115,53 @@ class CommMessageIn : private poller_message_t
 private:
 	virtual int append(const void *buf, size_t *size) = 0;
 
+	/* Optionally supply the buffer that the next bytes are read into, so
+	 * that append() finds them in place and needs no copy. The size must
+	 * not exceed the bytes still expected by the message. */
+	virtual void *get_buffer(size_t *size) { return NULL; }
+
 protected:
 	/* Send small packet while receiving. Call only in append(). */
 	virtual int feedback(const void *buf, size_t size);
 
-	/* In append(), reset the begin time of receiving to current time. */
+	/* In append(), reset the begin time of receiving to current time. On a
+	 * multiplexed client connection, only the response timeout of the
+	 * session of this message starts over. */
 	virtual void renew();
 
+	/* In append(), stop reading the connection once append() returns,
+	 * till resume() is called in any thread. No timeout runs while paused.
+	 * Completing the message resumes it too. Fails with EPERM out of
+	 * append(). */
+	virtual int pause();
+	virtual int resume();
+
+	/* Of a server, in append(), make the connection carry the requests of
+	 * many sessions at once, each message completing one of them. The
+	 * replies may go in any order then. Cannot be undone. */
+	virtual int multiplex();
+
+private:
+	/* On a multiplexed client connection, any message receiving may
+	 * complete the message of another session, or fail it alone with
+	 * '*error' set, e.g. when its stream is reset. Returns which one. */
+	virtual CommMessageIn *get_complete(int *error)
+	{
+		*error = 0;
+		return this;
+	}
+
+	/* Of a multiplexed client connection, the session of this message
+	 * fails alone, e.g. when its deadline passes. Called with the
+	 * connection locked. Stop receiving the message. */
+	virtual void cancel() { }
+
 private:
 	struct CommConnEntry *entry;
+	int paused;	/* -1 out of append(). */
 
 public:
+	CommMessageIn() { this->paused = -1; }
 	virtual ~CommMessageIn() { }
 	friend class Communicator;
 };
@@ -139,6 +182,12 @@ private:
 	virtual int first_timeout() { return 0; }	/* for client session only. */
 	virtual void handle(int state, int error) = 0;
 
+	/* For client session only. Send the request on a connection that
+	 * carries the requests of other sessions at the same time. The
+	 * session fails alone when its receive timeout, or the response
+	 * timeout since its message last received anything, passes. */
+	virtual bool is_multiplexed() { return false; }
+
 protected:
 	CommTarget *get_target() const { return this->target; }
 	CommConnection *get_connection() const { return this->conn; }
@@ -157,9 +206,17 @@ private:
 	struct timespec begin_time;
 	int timeout;
 	int passive;
+	struct list_head list;	/* of a multiplexed connection */
+	long long deadline;		/* of a multiplexed client session, in ms */
 
 public:
-	CommSession() { this->passive = 0; }
+	CommSession()
+	{
+		this->passive = 0;
+		INIT_LIST_HEAD(&this->list);
+		this->deadline = -1;
+	}
+
 	virtual ~CommSession();
 	friend class CommMessageIn;
 	friend class Communicator;
@@ -190,6 +247,10 @@ protected:
 
 	SSL_CTX *get_ssl_ctx() const { return this->ssl_ctx; }
 
+	/* Open one SO_REUSEPORT listener per poller thread, so that the kernel
+	 * spreads new connections over all pollers. Set before binding. */
+	void set_reuse_port(int reuse_port) { this->reuse_port = reuse_port; }
+
 private:
 	virtual CommSession *new_session(long long seq, CommConnection *conn) = 0;
 	virtual void handle_stop(int error) { }
@@ -215,6 +276,7 @@ private:
 	int response_timeout;
 	int ssl_accept_timeout;
 	SSL_CTX *ssl_ctx;
+	int reuse_port;
 
 private:
 	void incref();
@@ -223,6 +285,8 @@ private:
 private:
 	int listen_fd;
 	int ref;
+	int *reuse_fds;		/* the listeners other than listen_fd */
+	int reuse_cnt;
 
 private:
 	struct list_head alive_list;
@@ -255,9 +319,32 @@ public:
 # include "IOService_thread.h"
 #endif
 
+/* With COMM_HANDLER_PER_POLLER, each poller thread has its own result queue
+ * and its own handler threads, so the events of one connection are always
+ * handled by the same group of threads. COMM_HANDLER_PER_POLLER_CPU also
+ * binds every poller thread and its handler threads to one CPU. */
+#define COMM_HANDLER_SHARED				0
+#define COMM_HANDLER_PER_POLLER			1
+#define COMM_HANDLER_PER_POLLER_CPU		2
+
+struct CommParams
+{
+	size_t poller_threads;
+	size_t handler_threads;
+	int poller_backend;		/* POLLER_BACKEND_XXX in poller.h */
+	int handler_affinity;	/* COMM_HANDLER_XXX */
+	int timer_wheel;		/* timeouts of connections in a timing wheel */
+	int busy_poll;			/* max microseconds a poller spins before sleeping */
+	int lockfree_queue;		/* result queues by msgqueue_create_lockfree() */
+	int coalesce_output;	/* merged writes to multiplexed connections */
+};
+
+struct CommHandlerQueue;
+
 class Communicator
 {
 public:
+	int init(const struct CommParams *params);
 	int init(size_t poller_threads, size_t handler_threads);
 	void deinit();
 
@@ -266,6 +353,11 @@ public:
 
 	int push(const void *buf, size_t size, CommSession *session);
 
+	/* Same as push(), but all the data is queued and written by the poller,
+	 * followed by the reply. Fails with EAGAIN, taking nothing, while too
+	 * much is queued already. */
+	int push_async(const void *buf, size_t size, CommSession *session);
+
 	int bind(CommService *service);
 	void unbind(CommService *service);
 
@@ -280,24 +372,30 @@ public:
 
 private:
 	struct __mpoller *mpoller;
-	struct __msgqueue *queue;
+	struct CommHandlerQueue *queues;
+	size_t nqueues;
 	struct __thrdpool *thrdpool;
 	int stop_flag;
 
 private:
-	int create_poller(size_t poller_threads);
+	int create_poller(const struct CommParams *params);
+
+	int create_handler_queues(const struct CommParams *params);
+	void destroy_handler_queues();
 
 	int create_handler_threads(size_t handler_threads);
 
 	int nonblock_connect(CommTarget *target);
 	int nonblock_listen(CommService *service);
+	int create_reuse_port(int sockfd, CommService *service);
+	void bind_reuse_port(CommService *service);
 
 	struct CommConnEntry *launch_conn(CommSession *session,
 									  CommTarget *target);
 	struct CommConnEntry *accept_conn(class CommServiceTarget *target,
 									  CommService *service);
 
-	void release_conn(struct CommConnEntry *entry);
+	static void release_conn(struct CommConnEntry *entry);
 
 	void shutdown_service(CommService *service);
 
@@ -315,13 +413,31 @@ private:
 
 	int request_new_conn(CommSession *session, CommTarget *target);
 
+	int send_mux_request(CommSession *session, struct CommConnEntry *entry);
+	int request_mux_conn(CommSession *session, CommTarget *target);
+	void reply_mux_conn(CommSession *session, struct CommConnEntry *entry);
+	void abort_mux_conn(struct CommConnEntry *entry, int state, int error);
+	static void mux_replied(struct CommConnEntry *entry,
+							int timeout, int error);
+
+	class MuxTimer;
+	void arm_mux_timer(struct CommConnEntry *entry);
+	void expire_mux(struct CommConnEntry *entry, int state);
+	static void renew_deadline(CommSession *session);
+
 	void handle_incoming_request(struct poller_result *res);
 	void handle_incoming_reply(struct poller_result *res);
 
+	void handle_mux_request(struct poller_result *res);
+	void handle_mux_reply(struct poller_result *res);
+	void handle_mux_connect(struct poller_result *res);
+
 	void handle_request_result(struct poller_result *res);
 	void handle_reply_result(struct poller_result *res);
 
 	void handle_write_result(struct poller_result *res);
+	void handle_output_result(struct poller_result *res);
+	static void flush_held_output(struct list_head *held);
 	void handle_read_result(struct poller_result *res);
 
 	void handle_connect_result(struct poller_result *res);
@@ -342,6 +458,11 @@ private:
 	static int first_timeout_recv(CommSession *session);
 
 	static int append(const void *buf, size_t *size, poller_message_t *msg);
+	static int append_mux(const void *buf, size_t *size, CommMessageIn *in);
+	static int append_mux_reply(const void *buf, size_t *size,
+								poller_message_t *msg);
+	static int mux_appended(int ret, CommMessageIn *in);
+	static void *get_buffer(size_t *size, poller_message_t *msg);
 
 	static int create_service_session(struct CommConnEntry *entry);
 
@@ -356,6 +477,8 @@ private:
 
 public:
 	virtual ~Communicator() { }
+	friend class CommMessageIn;
+	friend class CommSession;
 };
 
 #endif
@@ -21,6 +21,7 @@
 #include <pthread.h>
 #include "list.h"
 #include "thrdpool.h"
+#include "wspool.h"
 #include "Executor.h"
 
 struct ExecTaskEntry
@@ -28,6 +29,7 @@ struct ExecTaskEntry
 	struct list_head list;//
 	ExecSession *session;//所属的session
 	thrdpool_t *thrdpool;//执行的线程池
+	wspool_t *wspool;
 };
 
 int ExecQueue::init()//里面有任务链表
@@ -51,6 +53,16 @@ void ExecQueue::deinit()
 }
 
 int Executor::init(size_t nthreads)//里面有线程池
+{
+	return this->init(nthreads, EXECUTOR_ENGINE_THRDPOOL);
+}
+
+int Executor::init(size_t nthreads, int engine)
+{
+	return this->init(nthreads, engine, 0);
+}
+
+int Executor::init(size_t nthreads, int engine, int lockfree_queue)
 {
 	if (nthreads == 0)
 	{
@@ -58,20 +70,40 @@ int Executor::init(size_t nthreads)//里面有线程池
 		return -1;
 	}
 
-	this->thrdpool = thrdpool_create(nthreads, 0);//stacksize=0?
-	if (this->thrdpool)
-		return 0;
+	this->thrdpool = NULL;
+	this->wspool = NULL;
+	if (engine == EXECUTOR_ENGINE_WORK_STEALING)
+	{
+		this->wspool = wspool_create(nthreads, 0);
+		if (this->wspool)
+			return 0;
+	}
+	else
+	{
+		if (lockfree_queue)
+			this->thrdpool = thrdpool_create_lockfree(nthreads, 0);
+		else
+			this->thrdpool = thrdpool_create(nthreads, 0);//stacksize=0?
+
+		if (this->thrdpool)
+			return 0;
+	}
 
 	return -1;
 }
 
 void Executor::deinit()
 {
-	thrdpool_destroy(Executor::executor_cancel_tasks, this->thrdpool);
+	if (this->wspool)
+		wspool_destroy(Executor::executor_cancel_tasks, this->wspool);
+	else
+		thrdpool_destroy(Executor::executor_cancel_tasks, this->thrdpool);
 }
 
 extern "C" void __thrdpool_schedule(const struct thrdpool_task *, void *,
 									thrdpool_t *);//？？？？？？？？？？？？？？？？？？？让c++ 兼容c代码，这里的代码要用c编译器编译（因为编译规则不一样，翻译成符号的时候的规则不一样吧）
+extern "C" void __wspool_schedule(const struct thrdpool_task *, void *,
+								  wspool_t *);
 
 void Executor::executor_thread_routine(void *context)
 {
@@ -92,7 +124,10 @@ void Executor::executor_thread_routine(void *context)
 			.routine	=	Executor::executor_thread_routine,//递归了，重点在这里
 			.context	=	queue
 		};
-		__thrdpool_schedule(&task, entry, entry->thrdpool);//拿到任务，放到线程池中执行，entry即之前的msg，里面有task和link，这里即设置了task
+		if (entry->wspool)
+			__wspool_schedule(&task, entry, entry->wspool);
+		else
+			__thrdpool_schedule(&task, entry, entry->thrdpool);//拿到任务，放到线程池中执行，entry即之前的msg，里面有task和link，这里即设置了task
 	}
 	else
 		free(entry);
@@ -132,6 +167,7 @@ int Executor::request(ExecSession *session, ExecQueue *queue)//request的含义
 	{
 		entry->session = session;//entry放到session中
 		entry->thrdpool = this->thrdpool;//entry分配一个thrdpool
+		entry->wspool = this->wspool;
 		pthread_mutex_lock(&queue->mutex);
 		list_add_tail(&entry->list, &queue->task_list);//Execquue中有一个task_list指针，其实是个双向链表，把task_list理解成双向链表的表尾部，在尾部前面增加节点，task_list 的next是双向链表的头部
 		if (queue->task_list.next == &entry->list)
@@ -140,7 +176,14 @@ int Executor::request(ExecSession *session, ExecQueue *queue)//request的含义
 				.routine	=	Executor::executor_thread_routine,
 				.context	=	queue
 			};
-			if (thrdpool_schedule(&task, this->thrdpool) < 0)
+			int ret;
+
+			if (this->wspool)
+				ret = wspool_schedule(&task, this->wspool);
+			else
+				ret = thrdpool_schedule(&task, this->thrdpool);
+
+			if (ret < 0)
 			{
 				list_del(&entry->list);
 				free(entry);
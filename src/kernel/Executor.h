@@ -59,16 +59,25 @@ public:
 	friend class Executor;
 };
 
+/* ENGINE_WORK_STEALING gives each thread its own task deque. Tasks of one
+ * ExecQueue are still started one by one in FIFO order. 'lockfree_queue'
+ * makes ENGINE_THRDPOOL queue tasks with msgqueue_create_lockfree(). */
+#define EXECUTOR_ENGINE_THRDPOOL		0
+#define EXECUTOR_ENGINE_WORK_STEALING	1
+
 class Executor
 {
 public:
 	int init(size_t nthreads);
+	int init(size_t nthreads, int engine);
+	int init(size_t nthreads, int engine, int lockfree_queue);
 	void deinit();
 
 	int request(ExecSession *session, ExecQueue *queue);
 
 private:
 	struct __thrdpool *thrdpool;//线程池在Executor里
+	struct __wspool *wspool;
 
 private:
 	static void executor_thread_routine(void *context);
@@ -20,9 +20,20 @@
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <errno.h>
+#include <limits.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#if defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  include <linux/io_uring.h>
+# endif
+#endif
+#ifdef IOSQE_CQE_SKIP_SUCCESS
+# include <sys/mman.h>
+# define IOS_HAS_IO_URING
+#endif
 #include "list.h"
 #include "IOService_linux.h"
 
@@ -176,6 +187,340 @@ static inline void io_set_eventfd(struct iocb *iocb, int eventfd)
 	iocb->u.c.resfd = eventfd;
 }
 
+#ifdef IOS_HAS_IO_URING
+
+/*
+ * The io_uring backend runs buffered file I/O in the kernel workers instead
+ * of blocking in io_submit(). Sessions still complete through event_fd, so
+ * the poller and Communicator::handle_aio_result() work unchanged: every
+ * request is followed by a hard-linked 8-byte write to event_fd, which adds
+ * exactly one to the counter after the request completes. (A registered
+ * eventfd of io_uring may signal once for many CQEs, and the poller calls
+ * aio_finish() once per count.) event_fd is written through the registered
+ * file table, so a write issued after event_fd was closed never reaches an
+ * fd that reuses the number. The CQE of the write is skipped on success.
+ */
+
+#define IOS_URING_SQ_ENTRIES	64
+#define IOS_URING_EVENT_FD		0	/* index in the registered file table */
+
+struct __ios_uring
+{
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *ring;
+	size_t ring_size;
+	size_t sqes_size;
+	int ring_fd;
+	int event_fd;
+	pthread_mutex_t cq_mutex;
+};
+
+static inline int __uring_setup(unsigned int entries,
+								struct io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int __uring_enter(int fd, unsigned int to_submit,
+								unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+				   NULL, 0);
+}
+
+static inline int __uring_register(int fd, unsigned int opcode, void *arg,
+								   unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int __ios_uring_map(const struct io_uring_params *params,
+						   struct __ios_uring *uring)
+{
+	size_t sq_size = params->sq_off.array + params->sq_entries *
+					 sizeof (unsigned int);
+	size_t cq_size = params->cq_off.cqes + params->cq_entries *
+					 sizeof (struct io_uring_cqe);
+	char *ring;
+
+	uring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+	uring->ring = mmap(NULL, uring->ring_size, PROT_READ | PROT_WRITE,
+					   MAP_SHARED | MAP_POPULATE, uring->ring_fd,
+					   IORING_OFF_SQ_RING);
+	if (uring->ring != MAP_FAILED)
+	{
+		uring->sqes_size = params->sq_entries * sizeof (struct io_uring_sqe);
+		uring->sqes = (struct io_uring_sqe *)
+					  mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+						   MAP_SHARED | MAP_POPULATE, uring->ring_fd,
+						   IORING_OFF_SQES);
+		if (uring->sqes != MAP_FAILED)
+		{
+			ring = (char *)uring->ring;
+			uring->sq_head = (unsigned int *)(ring + params->sq_off.head);
+			uring->sq_tail = (unsigned int *)(ring + params->sq_off.tail);
+			uring->sq_mask = (unsigned int *)(ring + params->sq_off.ring_mask);
+			uring->sq_array = (unsigned int *)(ring + params->sq_off.array);
+			uring->cq_head = (unsigned int *)(ring + params->cq_off.head);
+			uring->cq_tail = (unsigned int *)(ring + params->cq_off.tail);
+			uring->cq_mask = (unsigned int *)(ring + params->cq_off.ring_mask);
+			uring->cqes = (struct io_uring_cqe *)(ring + params->cq_off.cqes);
+			return 0;
+		}
+
+		munmap(uring->ring, uring->ring_size);
+	}
+
+	return -1;
+}
+
+static struct __ios_uring *__ios_uring_create(int maxevents)
+{
+	struct __ios_uring *uring;
+	struct io_uring_params params;
+	int fd = -1;
+	int ret;
+
+	uring = (struct __ios_uring *)malloc(sizeof (struct __ios_uring));
+	if (!uring)
+		return NULL;
+
+	/* The CQ keeps up to 'maxevents' completed sessions. With NODROP the
+	 * kernel holds the overflow instead of losing it. */
+	memset(&params, 0, sizeof (struct io_uring_params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+	params.cq_entries = maxevents > IOS_URING_SQ_ENTRIES ?
+						maxevents : IOS_URING_SQ_ENTRIES;
+	uring->ring_fd = __uring_setup(IOS_URING_SQ_ENTRIES, &params);
+	if (uring->ring_fd >= 0)
+	{
+		if ((params.features & IORING_FEAT_NODROP) &&
+			(params.features & IORING_FEAT_CQE_SKIP) &&
+			(params.features & IORING_FEAT_RW_CUR_POS))
+		{
+			if (__ios_uring_map(&params, uring) >= 0)
+			{
+				/* One sparse slot for event_fd, filled by the first request. */
+				if (__uring_register(uring->ring_fd, IORING_REGISTER_FILES,
+									 &fd, 1) >= 0)
+				{
+					ret = pthread_mutex_init(&uring->cq_mutex, NULL);
+					if (ret == 0)
+					{
+						uring->event_fd = -1;
+						return uring;
+					}
+
+					errno = ret;
+				}
+
+				munmap(uring->sqes, uring->sqes_size);
+				munmap(uring->ring, uring->ring_size);
+			}
+		}
+		else
+			errno = ENOSYS;
+
+		close(uring->ring_fd);
+	}
+
+	free(uring);
+	return NULL;
+}
+
+static void __ios_uring_destroy(struct __ios_uring *uring)
+{
+	pthread_mutex_destroy(&uring->cq_mutex);
+	munmap(uring->sqes, uring->sqes_size);
+	munmap(uring->ring, uring->ring_size);
+	close(uring->ring_fd);
+	free(uring);
+}
+
+static struct io_uring_sqe *__ios_uring_get_sqe(struct __ios_uring *uring)
+{
+	unsigned int tail = *uring->sq_tail;
+	unsigned int index = tail & *uring->sq_mask;
+	struct io_uring_sqe *sqe;
+
+	if (tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >
+		*uring->sq_mask)
+	{
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	sqe = &uring->sqes[index];
+	memset(sqe, 0, sizeof (struct io_uring_sqe));
+	uring->sq_array[index] = index;
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+/* The kernel checks an iovec array when the SQE is submitted. Failing there
+ * cancels the linked write to event_fd too, and the session would never be
+ * reported, so reject beforehand what the kernel rejects. */
+static int __ios_check_iov(const struct iovec *iov, int iovcnt)
+{
+	size_t total = 0;
+	int i;
+
+	if (iovcnt < 0 || iovcnt > IOV_MAX)
+		return -1;
+
+	for (i = 0; i < iovcnt; i++)
+	{
+		if (iov[i].iov_len > SSIZE_MAX - total)
+			return -1;
+
+		total += iov[i].iov_len;
+	}
+
+	return 0;
+}
+
+/* Translate the iocb filled by IOSession::prep_xxx() into an SQE. Called
+ * with the service mutex held, which serializes the SQ. */
+static int __ios_uring_submit(const struct iocb *iocb, void *data,
+							  int event_fd, struct __ios_uring *uring)
+{
+	static const unsigned long long one = 1;
+	unsigned int tail = *uring->sq_tail;
+	struct io_uring_sqe *sqe;
+	int ret;
+
+	if (iocb->aio_lio_opcode == IO_CMD_PREADV ||
+		iocb->aio_lio_opcode == IO_CMD_PWRITEV)
+	{
+		if (__ios_check_iov((const struct iovec *)iocb->u.c.buf,
+							(int)iocb->u.c.nbytes) < 0)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	if (uring->event_fd != event_fd)
+	{
+		struct io_uring_files_update update = { };
+
+		update.offset = IOS_URING_EVENT_FD;
+		update.fds = (unsigned long)&event_fd;
+		if (__uring_register(uring->ring_fd, IORING_REGISTER_FILES_UPDATE,
+							 &update, 1) < 0)
+			return -1;
+
+		uring->event_fd = event_fd;
+	}
+
+	sqe = __ios_uring_get_sqe(uring);
+	if (!sqe)
+		return -1;
+
+	sqe->fd = iocb->aio_fildes;
+	sqe->addr = (unsigned long)iocb->u.c.buf;
+	sqe->len = iocb->u.c.nbytes;
+	sqe->off = iocb->u.c.offset;
+	switch (iocb->aio_lio_opcode)
+	{
+	case IO_CMD_PREAD:
+		sqe->opcode = IORING_OP_READ;
+		break;
+	case IO_CMD_PWRITE:
+		sqe->opcode = IORING_OP_WRITE;
+		break;
+	case IO_CMD_PREADV:
+		sqe->opcode = IORING_OP_READV;
+		break;
+	case IO_CMD_PWRITEV:
+		sqe->opcode = IORING_OP_WRITEV;
+		break;
+	case IO_CMD_FSYNC:
+		sqe->opcode = IORING_OP_FSYNC;
+		break;
+	case IO_CMD_FDSYNC:
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		break;
+	default:
+		errno = EINVAL;
+		__atomic_store_n(uring->sq_tail, tail, __ATOMIC_RELEASE);
+		return -1;
+	}
+
+	sqe->flags = IOSQE_IO_HARDLINK;
+	sqe->user_data = (unsigned long)data;
+
+	sqe = __ios_uring_get_sqe(uring);
+	if (sqe)
+	{
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = IOS_URING_EVENT_FD;
+		sqe->addr = (unsigned long)&one;
+		sqe->len = sizeof one;
+		sqe->off = (unsigned long long)-1;
+		sqe->flags = IOSQE_FIXED_FILE | IOSQE_CQE_SKIP_SUCCESS;
+		sqe->user_data = 0;
+		do
+		{
+			ret = __uring_enter(uring->ring_fd, 2, 0, 0);
+		} while (ret < 0 && errno == EINTR);
+
+		if (ret == 2)
+			return 0;
+
+		if (ret >= 0)
+		{
+			/* Never happens with a valid SQE pair. */
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	__atomic_store_n(uring->sq_tail, tail, __ATOMIC_RELEASE);
+	return -1;
+}
+
+/* Reap the CQE of one session, waiting if none has arrived. The CQE of a
+ * write to event_fd shows up only if the write failed. */
+static void *__ios_uring_reap(long *res, struct __ios_uring *uring)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head;
+	void *data = NULL;
+
+	pthread_mutex_lock(&uring->cq_mutex);
+	while (1)
+	{
+		head = *uring->cq_head;
+		if (head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE))
+		{
+			cqe = &uring->cqes[head & *uring->cq_mask];
+			data = (void *)(unsigned long)cqe->user_data;
+			*res = cqe->res;
+			__atomic_store_n(uring->cq_head, head + 1, __ATOMIC_RELEASE);
+			if (data)
+				break;
+		}
+		else if (__uring_enter(uring->ring_fd, 0, 1,
+							   IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+			break;
+	}
+
+	pthread_mutex_unlock(&uring->cq_mutex);
+	return data;
+}
+
+#endif
+
 void IOSession::prep_pread(int fd, void *buf, size_t count, long long offset)
 {
 	struct iocb *iocb = (struct iocb *)this->iocb_buf;
@@ -244,7 +589,7 @@ void IOSession::prep_fdsync(int fd)
 	iocb->aio_lio_opcode = IO_CMD_FDSYNC;
 }
 
-int IOService::init(int maxevents)
+int IOService::init(int maxevents, int backend)
 {
 	int ret;
 
@@ -255,7 +600,14 @@ int IOService::init(int maxevents)
 	}
 
 	this->io_ctx = NULL;
-	if (io_setup(maxevents, &this->io_ctx) >= 0)
+	this->uring = NULL;
+#ifdef IOS_HAS_IO_URING
+	/* Fall back to aio if io_uring is not supported. */
+	if (backend == IOS_BACKEND_IO_URING)
+		this->uring = __ios_uring_create(maxevents);
+#endif
+
+	if (this->uring || io_setup(maxevents, &this->io_ctx) >= 0)
 	{
 		ret = pthread_mutex_init(&this->mutex, NULL);
 		if (ret == 0)
@@ -266,6 +618,11 @@ int IOService::init(int maxevents)
 		}
 
 		errno = ret;
+#ifdef IOS_HAS_IO_URING
+		if (this->uring)
+			__ios_uring_destroy(this->uring);
+		else
+#endif
 		io_destroy(this->io_ctx);
 	}
 
@@ -275,6 +632,11 @@ int IOService::init(int maxevents)
 void IOService::deinit()
 {
 	pthread_mutex_destroy(&this->mutex);
+#ifdef IOS_HAS_IO_URING
+	if (this->uring)
+		__ios_uring_destroy(this->uring);
+	else
+#endif
 	io_destroy(this->io_ctx);
 }
 
@@ -286,18 +648,15 @@ inline void IOService::incref()
 void IOService::decref()
 {
 	IOSession *session;
-	struct io_event event;
 	int state, error;
 
 	if (__sync_sub_and_fetch(&this->ref, 1) == 0)
 	{
 		while (!list_empty(&this->session_list))
 		{
-			if (io_getevents(this->io_ctx, 1, 1, &event, NULL) > 0)
+			if (this->reap(&session) > 0)
 			{
-				session = (IOSession *)event.data;
 				list_del(&session->list);
-				session->res = event.res;
 				if (session->res >= 0)
 				{
 					state = IOS_STATE_SUCCESS;
@@ -327,13 +686,21 @@ int IOService::request(IOSession *session)
 	{
 		if (session->prepare() >= 0)
 		{
-			io_set_eventfd(iocb, this->event_fd);
-			iocb->data = session;
-			if (io_submit(this->io_ctx, 1, &iocb) > 0)
+#ifdef IOS_HAS_IO_URING
+			if (this->uring)
+				ret = __ios_uring_submit(iocb, session, this->event_fd,
+										 this->uring);
+			else
+#endif
 			{
-				list_add_tail(&session->list, &this->session_list);
-				ret = 0;
+				io_set_eventfd(iocb, this->event_fd);
+				iocb->data = session;
+				if (io_submit(this->io_ctx, 1, &iocb) > 0)
+					ret = 0;
 			}
+
+			if (ret >= 0)
+				list_add_tail(&session->list, &this->session_list);
 		}
 	}
 	else
@@ -346,20 +713,45 @@ int IOService::request(IOSession *session)
 	return ret;
 }
 
+/* Wait for one completed session. */
+int IOService::reap(IOSession **session)
+{
+	struct io_event event;
+
+#ifdef IOS_HAS_IO_URING
+	if (this->uring)
+	{
+		long res;
+
+		*session = (IOSession *)__ios_uring_reap(&res, this->uring);
+		if (!*session)
+			return -1;
+
+		(*session)->res = res;
+		return 1;
+	}
+#endif
+
+	if (io_getevents(this->io_ctx, 1, 1, &event, NULL) > 0)
+	{
+		*session = (IOSession *)event.data;
+		(*session)->res = event.res;
+		return 1;
+	}
+
+	return -1;
+}
+
 void *IOService::aio_finish(void *context)
 {
 	IOService *service = (IOService *)context;
 	IOSession *session;
-	struct io_event event;
 
-	if (io_getevents(service->io_ctx, 1, 1, &event, NULL) > 0)
+	if (service->reap(&session) > 0)
 	{
 		service->incref();
-		session = (IOSession *)event.data;
-		session->res = event.res;
 		return session;
 	}
 
 	return NULL;
 }
-
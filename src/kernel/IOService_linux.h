@@ -28,6 +28,9 @@
 #define IOS_STATE_SUCCESS	0
 #define IOS_STATE_ERROR		1
 
+#define IOS_BACKEND_DEFAULT		0
+#define IOS_BACKEND_IO_URING	1
+
 class IOSession
 {
 private:
@@ -64,7 +67,12 @@ public:
 class IOService
 {
 public:
-	int init(int maxevents);
+	int init(int maxevents, int backend);
+	int init(int maxevents)
+	{
+		return this->init(maxevents, IOS_BACKEND_DEFAULT);
+	}
+
 	void deinit();
 
 	int request(IOSession *session);
@@ -81,10 +89,12 @@ private:
 
 private:
 	struct io_context *io_ctx;
+	struct __ios_uring *uring;
 
 private:
 	void incref();
 	void decref();
+	int reap(IOSession **session);
 
 private:
 	int event_fd;
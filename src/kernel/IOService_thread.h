@@ -28,6 +28,9 @@
 #define IOS_STATE_SUCCESS	0
 #define IOS_STATE_ERROR		1
 
+#define IOS_BACKEND_DEFAULT		0
+#define IOS_BACKEND_IO_URING	1
+
 class IOSession
 {
 private:
@@ -71,6 +74,12 @@ class IOService
 {
 public:
 	int init(int maxevents);
+	int init(int maxevents, int backend)
+	{
+		/* Only threads here. */
+		return this->init(maxevents);
+	}
+
 	void deinit();
 
 	int request(IOSession *session);
@@ -28,9 +28,15 @@ static int __mpoller_create(const struct poller_params *params,
 							mpoller_t *mpoller)
 {
 	void **nodes_buf = (void **)calloc(params->max_open_files, sizeof (void *));
+	unsigned int *index_buf;
 	unsigned int i;
 
-	if (nodes_buf)
+	if (!nodes_buf)
+		return -1;
+
+	index_buf = (unsigned int *)calloc(params->max_open_files,
+									   sizeof (unsigned int));
+	if (index_buf)
 	{
 		for (i = 0; i < mpoller->nthreads; i++)
 		{
@@ -42,15 +48,18 @@ static int __mpoller_create(const struct poller_params *params,
 		if (i == mpoller->nthreads)
 		{
 			mpoller->nodes_buf = nodes_buf;
+			mpoller->index_buf = index_buf;
+			mpoller->max_open_files = params->max_open_files;
 			return 0;
 		}
 
 		while (i > 0)
 			__poller_destroy(mpoller->poller[--i]);
 
-		free(nodes_buf);
+		free(index_buf);
 	}
 
+	free(nodes_buf);
 	return -1;
 }
 
@@ -110,6 +119,7 @@ void mpoller_destroy(mpoller_t *mpoller)
 	for (i = 0; i < mpoller->nthreads; i++)
 		__poller_destroy(mpoller->poller[i]);
 
+	free(mpoller->index_buf);
 	free(mpoller->nodes_buf);
 	free(mpoller);
 }
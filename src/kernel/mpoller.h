@@ -41,36 +41,70 @@ void mpoller_destroy(mpoller_t *mpoller);
 struct __mpoller
 {
 	void **nodes_buf;
+	unsigned int *index_buf;
+	size_t max_open_files;
 	unsigned int nthreads;
 	poller_t *poller[1];
 };
 
+/* The index of the poller that an fd is added to. */
+static inline unsigned int mpoller_index(int fd, const mpoller_t *mpoller)
+{
+	if ((size_t)fd < mpoller->max_open_files)
+		return mpoller->index_buf[fd];
+
+	return 0;
+}
+
+/* Add an fd to the poller of 'index', e.g. the one that accepted it. */
+static inline int mpoller_add_to(const struct poller_data *data, int timeout,
+								 unsigned int index, mpoller_t *mpoller)
+{
+	index %= mpoller->nthreads;
+	if ((size_t)data->fd < mpoller->max_open_files)
+		mpoller->index_buf[data->fd] = index;
+
+	return poller_add(data, timeout, mpoller->poller[index]);
+}
+
 static inline int mpoller_add(const struct poller_data *data, int timeout,
 							  mpoller_t *mpoller)
 {
 	unsigned int index = (unsigned int)data->fd % mpoller->nthreads;
-	return poller_add(data, timeout, mpoller->poller[index]);
+	return mpoller_add_to(data, timeout, index, mpoller);
 }
 
 static inline int mpoller_del(int fd, mpoller_t *mpoller)
 {
-	unsigned int index = (unsigned int)fd % mpoller->nthreads;
+	unsigned int index = mpoller_index(fd, mpoller);
 	return poller_del(fd, mpoller->poller[index]);
 }
 
 static inline int mpoller_mod(const struct poller_data *data, int timeout,
 							  mpoller_t *mpoller)
 {
-	unsigned int index = (unsigned int)data->fd % mpoller->nthreads;
+	unsigned int index = mpoller_index(data->fd, mpoller);
 	return poller_mod(data, timeout, mpoller->poller[index]);
 }
 
 static inline int mpoller_set_timeout(int fd, int timeout, mpoller_t *mpoller)
 {
-	unsigned int index = (unsigned int)fd % mpoller->nthreads;
+	unsigned int index = mpoller_index(fd, mpoller);
 	return poller_set_timeout(fd, timeout, mpoller->poller[index]);
 }
 
+static inline int mpoller_pause(int fd, mpoller_t *mpoller)
+{
+	unsigned int index = mpoller_index(fd, mpoller);
+	return poller_pause(fd, mpoller->poller[index]);
+}
+
+static inline int mpoller_resume(int fd, int timeout, mpoller_t *mpoller)
+{
+	unsigned int index = mpoller_index(fd, mpoller);
+	return poller_resume(fd, timeout, mpoller->poller[index]);
+}
+
 static inline int mpoller_add_timer(const struct timespec *value, void *context,
 									mpoller_t *mpoller)
 {
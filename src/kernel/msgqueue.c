@@ -27,8 +27,15 @@
  */
 
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <pthread.h>
+#ifdef __linux__
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+# include <sched.h>
+#endif
 #include "msgqueue.h"
 
 struct __msgqueue
@@ -46,10 +53,212 @@ struct __msgqueue
 	pthread_mutex_t put_mutex;
 	pthread_cond_t get_cond;//消费者条件变量，需配合锁使用，用于线程间通信（通过全局变量）
 	pthread_cond_t put_cond;
+#ifdef __linux__
+	int lockfree;
+	void **lf_head;
+	void **lf_tail;
+	void *lf_stub;
+	int get_seq;
+	int get_waiting;
+	int put_seq;
+	int put_waiting;
+#endif
 };
 
+/* An idle consumer waits with get_mutex held. So without blocking, a busy
+ * get_mutex is taken as an empty queue. */
+static int __msgqueue_lock_get(int block, msgqueue_t *queue)
+{
+	if (block)
+		return pthread_mutex_lock(&queue->get_mutex);
+
+	return pthread_mutex_trylock(&queue->get_mutex);
+}
+
+#ifdef __linux__
+
+/*
+ * The lock-free variant is a Vyukov intrusive MPSC list. A producer takes
+ * the tail by atomic exchange and then links the previous tail to its own
+ * message. The consumer (serialized by get_mutex) pops from lf_head. In the
+ * short window between the exchange and the link, the message is counted
+ * in msg_cnt but cannot be popped yet. The consumer then lets go of
+ * get_mutex and yields before it tries again.
+ *
+ * A producer reserves its place in msg_cnt by compare-and-swap before it
+ * pushes, so at most 'maxlen' messages are pending in blocking mode.
+ *
+ * Sleeping threads park on the futex words get_seq and put_seq. A sleeper
+ * reads the sequence, sets the waiting flag, and then checks the queue
+ * again. A waker changes the queue, and bumps the sequence only if it takes
+ * the flag. So one system call is made for each sleep at most. Blocked
+ * producers are woken up when the queue is drained to half of 'maxlen',
+ * to avoid waking them up for every single message.
+ */
+
+static inline void __msgqueue_futex_wait(int *addr, int val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static inline void __msgqueue_futex_wake(int *addr, int n)
+{
+	__atomic_add_fetch(addr, 1, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+static void __msgqueue_lf_push(void **link, msgqueue_t *queue)
+{
+	void **prev;
+
+	*link = NULL;
+	prev = __atomic_exchange_n(&queue->lf_tail, link, __ATOMIC_ACQ_REL);
+	__atomic_store_n(prev, (void *)link, __ATOMIC_RELEASE);
+}
+
+static void **__msgqueue_lf_pop(msgqueue_t *queue)
+{
+	void **head = queue->lf_head;
+	void **next = (void **)__atomic_load_n(head, __ATOMIC_ACQUIRE);
+
+	if (head == &queue->lf_stub)
+	{
+		if (!next)
+			return NULL;
+
+		queue->lf_head = next;
+		head = next;
+		next = (void **)__atomic_load_n(head, __ATOMIC_ACQUIRE);
+	}
+
+	if (!next)
+	{
+		if (head != __atomic_load_n(&queue->lf_tail, __ATOMIC_ACQUIRE))
+			return NULL;
+
+		/* 'head' is the last one. Put the stub behind it to take it out. */
+		__msgqueue_lf_push(&queue->lf_stub, queue);
+		next = (void **)__atomic_load_n(head, __ATOMIC_ACQUIRE);
+		if (!next)
+			return NULL;
+	}
+
+	queue->lf_head = next;
+	return head;
+}
+
+static void __msgqueue_lf_put(void *msg, msgqueue_t *queue)
+{
+	void **link = (void **)((char *)msg + queue->linkoff);
+	size_t cnt = __atomic_load_n(&queue->msg_cnt, __ATOMIC_SEQ_CST);
+	int seq;
+
+	while (1)
+	{
+		if (cnt <= queue->msg_max - 1 ||
+			__atomic_load_n(&queue->nonblock, __ATOMIC_SEQ_CST))
+		{
+			if (__atomic_compare_exchange_n(&queue->msg_cnt, &cnt, cnt + 1, 0,
+											__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+				break;
+
+			continue;
+		}
+
+		seq = __atomic_load_n(&queue->put_seq, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&queue->put_waiting, 1, __ATOMIC_SEQ_CST);
+		cnt = __atomic_load_n(&queue->msg_cnt, __ATOMIC_SEQ_CST);
+		if (cnt > queue->msg_max - 1 &&
+			!__atomic_load_n(&queue->nonblock, __ATOMIC_SEQ_CST))
+		{
+			__msgqueue_futex_wait(&queue->put_seq, seq);
+			cnt = __atomic_load_n(&queue->msg_cnt, __ATOMIC_SEQ_CST);
+		}
+	}
+
+	__msgqueue_lf_push(link, queue);
+	if (__atomic_load_n(&queue->get_waiting, __ATOMIC_SEQ_CST) &&
+		__atomic_exchange_n(&queue->get_waiting, 0, __ATOMIC_SEQ_CST))
+		__msgqueue_futex_wake(&queue->get_seq, 1);
+}
+
+static void *__msgqueue_lf_get(int block, msgqueue_t *queue)
+{
+	void **link;
+	size_t cnt = 0;
+	int seq;
+
+	if (__msgqueue_lock_get(block, queue) != 0)
+	{
+		errno = ENOENT;
+		return NULL;
+	}
+
+	while (1)
+	{
+		seq = __atomic_load_n(&queue->get_seq, __ATOMIC_SEQ_CST);
+		link = __msgqueue_lf_pop(queue);
+		if (link)
+			break;
+
+		if (!block)
+			break;
+
+		if (__atomic_load_n(&queue->msg_cnt, __ATOMIC_SEQ_CST) > 0)
+		{
+			/* A producer is linking its message. Let others in meanwhile. */
+			pthread_mutex_unlock(&queue->get_mutex);
+			sched_yield();
+			pthread_mutex_lock(&queue->get_mutex);
+			continue;
+		}
+
+		if (__atomic_load_n(&queue->nonblock, __ATOMIC_SEQ_CST))
+			break;
+
+		__atomic_store_n(&queue->get_waiting, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&queue->msg_cnt, __ATOMIC_SEQ_CST) == 0 &&
+			!__atomic_load_n(&queue->nonblock, __ATOMIC_SEQ_CST))
+			__msgqueue_futex_wait(&queue->get_seq, seq);
+	}
+
+	if (link)
+		cnt = __atomic_sub_fetch(&queue->msg_cnt, 1, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_unlock(&queue->get_mutex);
+	if (!link)
+	{
+		errno = ENOENT;
+		return NULL;
+	}
+
+	if (cnt <= queue->msg_max / 2 &&
+		__atomic_load_n(&queue->put_waiting, __ATOMIC_SEQ_CST) &&
+		__atomic_exchange_n(&queue->put_waiting, 0, __ATOMIC_SEQ_CST))
+		__msgqueue_futex_wake(&queue->put_seq, INT_MAX);
+
+	return (char *)link - queue->linkoff;
+}
+
+static void __msgqueue_lf_set_nonblock(msgqueue_t *queue)
+{
+	__atomic_store_n(&queue->nonblock, 1, __ATOMIC_SEQ_CST);
+	__msgqueue_futex_wake(&queue->get_seq, INT_MAX);
+	__msgqueue_futex_wake(&queue->put_seq, INT_MAX);
+}
+
+#endif
+
 void msgqueue_set_nonblock(msgqueue_t *queue)
 {
+#ifdef __linux__
+	if (queue->lockfree)
+	{
+		__msgqueue_lf_set_nonblock(queue);
+		return;
+	}
+#endif
+
 	queue->nonblock = 1;
 	pthread_mutex_lock(&queue->put_mutex);//参数为put_mutex的地址，应该会隐式转换为pthread_mutex_t *__mutex指针
 	pthread_cond_signal(&queue->get_cond);
@@ -59,17 +268,25 @@ void msgqueue_set_nonblock(msgqueue_t *queue)
 
 void msgqueue_set_block(msgqueue_t *queue)
 {
+#ifdef __linux__
+	if (queue->lockfree)
+	{
+		__atomic_store_n(&queue->nonblock, 0, __ATOMIC_SEQ_CST);
+		return;
+	}
+#endif
+
 	queue->nonblock = 0;
 }
 
-static size_t __msgqueue_swap(msgqueue_t *queue)
+static size_t __msgqueue_swap(int block, msgqueue_t *queue)
 {
 	void **get_head = queue->get_head;//执行到这里，说明消费者队列已经没有msg了
 	size_t cnt;
 
 	queue->get_head = queue->put_head;
 	pthread_mutex_lock(&queue->put_mutex);
-	while (queue->msg_cnt == 0 && !queue->nonblock)//生产者队列为0，需要收到生产者生产新msg的信号，再进行后续操作
+	while (block && queue->msg_cnt == 0 && !queue->nonblock)//生产者队列为0，需要收到生产者生产新msg的信号，再进行后续操作
 		pthread_cond_wait(&queue->get_cond, &queue->put_mutex);//会先释放put_mutex锁，然后阻塞等待，直到被激活（激活主动方会主动释放锁），重新获取put_mutex锁
 
 	cnt = queue->msg_cnt;//生产者生产的msg个数
@@ -85,7 +302,17 @@ static size_t __msgqueue_swap(msgqueue_t *queue)
 
 void msgqueue_put(void *msg, msgqueue_t *queue)
 {
-	void **link = (void **)((char *)msg + queue->linkoff);//这里明明是指针在msg后面，但是struct __thrdpool_task_entry//先是next指针，后是数据本体
+	void **link;
+
+#ifdef __linux__
+	if (queue->lockfree)
+	{
+		__msgqueue_lf_put(msg, queue);
+		return;
+	}
+#endif
+
+	link = (void **)((char *)msg + queue->linkoff);//这里明明是指针在msg后面，但是struct __thrdpool_task_entry//先是next指针，后是数据本体
 
 	*link = NULL;//link是指向指针的指针，提解一次变成它指向的那个指针，令void*指针为NULL
 	pthread_mutex_lock(&queue->put_mutex);
@@ -99,12 +326,22 @@ void msgqueue_put(void *msg, msgqueue_t *queue)
 	pthread_cond_signal(&queue->get_cond);
 }
 
-void *msgqueue_get(msgqueue_t *queue)
+static void *__msgqueue_get(int block, msgqueue_t *queue)
 {
 	void *msg;//创建空消息指针
 
-	pthread_mutex_lock(&queue->get_mutex);//获取get队列的锁（锁是引用）
-	if (*queue->get_head || __msgqueue_swap(queue) > 0)//get队列有msg，或者没有msg，但是put队列和get队列交换了，返回值是get队列的msg个数
+#ifdef __linux__
+	if (queue->lockfree)
+		return __msgqueue_lf_get(block, queue);
+#endif
+
+	if (__msgqueue_lock_get(block, queue) != 0)//获取get队列的锁（锁是引用）
+	{
+		errno = ENOENT;
+		return NULL;
+	}
+
+	if (*queue->get_head || __msgqueue_swap(block, queue) > 0)//get队列有msg，或者没有msg，但是put队列和get队列交换了，返回值是get队列的msg个数
 	{
 		msg = (char *)*queue->get_head - queue->linkoff;
 		*queue->get_head = *(void **)*queue->get_head;
@@ -119,6 +356,16 @@ void *msgqueue_get(msgqueue_t *queue)
 	return msg;
 }
 
+void *msgqueue_get(msgqueue_t *queue)
+{
+	return __msgqueue_get(1, queue);
+}
+
+void *msgqueue_try_get(msgqueue_t *queue)
+{
+	return __msgqueue_get(0, queue);
+}
+
 msgqueue_t *msgqueue_create(size_t maxlen, int linkoff)//不懂
 {
 	msgqueue_t *queue = (msgqueue_t *)malloc(sizeof (msgqueue_t));
@@ -148,6 +395,9 @@ msgqueue_t *msgqueue_create(size_t maxlen, int linkoff)//不懂
 					queue->put_tail = &queue->head2;
 					queue->msg_cnt = 0;
 					queue->nonblock = 0;
+#ifdef __linux__
+					queue->lockfree = 0;
+#endif
 					return queue;
 				}
 
@@ -165,6 +415,27 @@ msgqueue_t *msgqueue_create(size_t maxlen, int linkoff)//不懂
 	return NULL;
 }
 
+msgqueue_t *msgqueue_create_lockfree(size_t maxlen, int linkoff)
+{
+	msgqueue_t *queue = msgqueue_create(maxlen, linkoff);
+
+#ifdef __linux__
+	if (queue)
+	{
+		queue->lockfree = 1;
+		queue->lf_stub = NULL;
+		queue->lf_head = &queue->lf_stub;
+		queue->lf_tail = &queue->lf_stub;
+		queue->get_seq = 0;
+		queue->get_waiting = 0;
+		queue->put_seq = 0;
+		queue->put_waiting = 0;
+	}
+#endif
+
+	return queue;
+}
+
 void msgqueue_destroy(msgqueue_t *queue)
 {
 	pthread_cond_destroy(&queue->put_cond);
@@ -35,8 +35,20 @@ extern "C"
  * 'linkoff' can be positive or negative or zero. */
 
 msgqueue_t *msgqueue_create(size_t maxlen, int linkoff);
+
+/* Same interface, but producers never take a lock. They link messages into
+ * an intrusive MPSC list by atomic exchange, and consumers still take turns
+ * on a mutex. Idle threads park on futexes, so no system call is made when
+ * nobody is waiting. The max pending messages is 'maxlen' in blocking mode.
+ * Fall back to msgqueue_create() on non-Linux platforms. */
+msgqueue_t *msgqueue_create_lockfree(size_t maxlen, int linkoff);
+
 void msgqueue_put(void *msg, msgqueue_t *queue);
 void *msgqueue_get(msgqueue_t *queue);
+
+/* Same as msgqueue_get(), but returns NULL at once if no message is there. */
+void *msgqueue_try_get(msgqueue_t *queue);
+
 void msgqueue_set_nonblock(msgqueue_t *queue);
 void msgqueue_set_block(msgqueue_t *queue);
 void msgqueue_destroy(msgqueue_t *queue);
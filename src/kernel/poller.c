@@ -16,12 +16,27 @@
   Author: Xie Han (xiehan@sogou-inc.com)
 */
 
+#ifdef __linux__
+# define _GNU_SOURCE
+#endif
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
 #ifdef __linux__
+# include <sched.h>
 # include <sys/epoll.h>
 # include <sys/timerfd.h>
+# include <sys/sendfile.h>
+# if defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#   include <linux/io_uring.h>
+#  endif
+# endif
+# ifdef IORING_ASYNC_CANCEL_FD
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  define POLLER_HAS_IO_URING
+# endif
 #else
 # include <sys/event.h>
 # undef LIST_HEAD
@@ -35,14 +50,24 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include "list.h"
 #include "rbtree.h"
+#include "slab.h"
 #include "poller.h"
 
 #define POLLER_BUFSIZE			(256 * 1024)
+#define POLLER_WHEEL_BITS		6
+#define POLLER_WHEEL_SLOTS		(1 << POLLER_WHEEL_BITS)
+#define POLLER_WHEEL_MASK		(POLLER_WHEEL_SLOTS - 1)
+#define POLLER_WHEEL_LEVELS		5
 #define POLLER_EVENTS_MAX		256
+#define POLLER_SSL_RECORD_MAX	16384
+#define POLLER_DGRAM_MAX		65536
+#define POLLER_MMSG_MAX			(POLLER_BUFSIZE / POLLER_DGRAM_MAX)
+#define POLLER_SPIN_MIN_NS		1000
 
 struct __poller_node
 {
@@ -58,9 +83,59 @@ struct __poller_node
 #pragma pack()
 	char in_rbtree;
 	char removed;
+	char paused;
 	int event;
 	struct timespec timeout;
 	struct __poller_node *res;
+#ifdef POLLER_HAS_IO_URING
+	unsigned int seq;
+#endif
+};
+
+#ifdef POLLER_HAS_IO_URING
+struct __poller_uring
+{
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *ring;
+	size_t ring_size;
+	size_t sqes_size;
+	unsigned int sqe_tail;
+	unsigned int seq;
+	unsigned int pipe_seq;
+	unsigned int timer_seq;
+	int deferred;
+	int retry;
+	struct io_uring_sqe *backlog;
+	unsigned int nbacklog;
+	unsigned int backlog_size;
+	int nrearm;
+	unsigned long long rearm[POLLER_EVENTS_MAX];
+};
+#endif
+
+/*
+ * The timing wheel keeps the timeouts of fds with a tick of one millisecond.
+ * Level 0 has one slot per tick. Every slot of level n covers all slots of
+ * level n - 1, and is cascaded into the lower levels when the wheel reaches
+ * its range. Insertion and removal are O(1). A timeout beyond the last level
+ * is parked in the last level, and is placed again when cascaded. The bitmap
+ * of every level marks the slots that may be non-empty. A bit is cleared
+ * lazily, because a node is removed by list_del() without knowing its slot.
+ */
+struct __poller_wheel
+{
+	unsigned long long current;
+	unsigned long long timer;
+	unsigned long long bitmap[POLLER_WHEEL_LEVELS];
+	struct list_head slots[POLLER_WHEEL_LEVELS][POLLER_WHEEL_SLOTS];
 };
 
 struct __poller
@@ -83,15 +158,631 @@ struct __poller
 	struct list_head timeo_list;
 	struct list_head no_timeo_list;
 	struct __poller_node **nodes;
+	struct __poller_wheel *wheel;
+	long long busy_poll_ns;
+	long long spin_ns;
+#ifdef POLLER_HAS_IO_URING
+	struct __poller_uring *uring;
+#endif
 	pthread_mutex_t mutex;
 	char buf[POLLER_BUFSIZE];
 };
 
+/* Nodes and results of all pollers come from one slab. A result is freed
+ * by the callback owner, usually in another thread. */
+static slab_t *__poller_node_slab;
+static pthread_once_t __poller_slab_once = PTHREAD_ONCE_INIT;
+
+static void __poller_create_slab(void)
+{
+	__poller_node_slab = slab_create("poller_node",
+									 sizeof (struct __poller_node));
+}
+
+static inline struct __poller_node *__poller_node_alloc(void)
+{
+	return (struct __poller_node *)slab_alloc(__poller_node_slab);
+}
+
+static inline void __poller_node_free(struct __poller_node *node)
+{
+	slab_free(node, __poller_node_slab);
+}
+
 #ifdef __linux__
 
-static inline int __poller_create_pfd()
+#ifdef POLLER_HAS_IO_URING
+
+/*
+ * The io_uring backend keeps the readiness model of epoll, so that all the
+ * handlers below work unchanged. An edge-triggered fd is armed with one
+ * multishot IORING_OP_POLL_ADD. Multishot poll is always edge-triggered, so
+ * a level-triggered fd (pipe and listen) is armed with a oneshot poll that
+ * is re-armed in the next wait, after its event has been handled. An fd is
+ * removed by cancelling all requests on it. All ring operations are called
+ * with poller->mutex held, except reaping the completion queue.
+ *
+ * A CQE may be reaped after its node was removed and freed, so user_data
+ * never carries a node pointer. It carries fd and a sequence number instead,
+ * and a CQE is delivered only if the sequence matches the node that is
+ * currently registered at poller->nodes[fd]. Every registration gets a new
+ * sequence, including the ones of pipe and timerfd.
+ *
+ * A request belongs to the thread that submits it, and a poll submitted by
+ * a thread that exits is lost. So other threads only queue their SQEs, and
+ * wake the poller thread through the pipe to submit them. When the ring is
+ * full, SQEs wait in a backlog in order, and the poller thread moves them to
+ * the ring as it submits. SQEs queued before the poller thread starts, and
+ * those that fail to be submitted, stay queued till the poller thread tries
+ * them again before it waits for events.
+ */
+
+#define URING_SQ_ENTRIES		256
+#define URING_CQ_ENTRIES		(16 * POLLER_EVENTS_MAX)
+#define URING_CANCEL_DATA		0xffffffffULL
+
+static inline int __uring_setup(unsigned int entries,
+								struct io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int __uring_enter(int fd, unsigned int to_submit,
+								unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+				   NULL, 0);
+}
+
+static inline unsigned long long __uring_user_data(int fd, unsigned int seq)
+{
+	return ((unsigned long long)seq << 32) | (unsigned int)fd;
+}
+
+/* An SQE in the ring, or in the backlog if the ring is full or the backlog
+ * is not empty, so that the order of submission is kept. */
+static struct io_uring_sqe *__uring_get_sqe(struct __poller_uring *uring)
+{
+	unsigned int head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned int index = uring->sqe_tail & *uring->sq_mask;
+	struct io_uring_sqe *sqe;
+	unsigned int size;
+
+	if (uring->nbacklog == 0 && uring->sqe_tail - head <= *uring->sq_mask)
+	{
+		sqe = &uring->sqes[index];
+		uring->sq_array[index] = index;
+		uring->sqe_tail++;
+	}
+	else
+	{
+		if (uring->nbacklog == uring->backlog_size)
+		{
+			size = 2 * uring->backlog_size;
+			if (size == 0)
+				size = *uring->sq_mask + 1;
+
+			sqe = (struct io_uring_sqe *)realloc(uring->backlog,
+										size * sizeof (struct io_uring_sqe));
+			if (!sqe)
+				return NULL;
+
+			uring->backlog = sqe;
+			uring->backlog_size = size;
+		}
+
+		sqe = &uring->backlog[uring->nbacklog++];
+	}
+
+	memset(sqe, 0, sizeof (struct io_uring_sqe));
+	return sqe;
+}
+
+/* Give back the last SQE got. */
+static inline void __uring_put_sqe(struct __poller_uring *uring)
+{
+	if (uring->nbacklog > 0)
+		uring->nbacklog--;
+	else
+		uring->sqe_tail--;
+}
+
+static inline int __uring_pending(const struct __poller_uring *uring)
+{
+	return uring->nbacklog > 0 ||
+		   uring->sqe_tail != __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/* Submit the SQEs queued, moving the backlog to the ring as it takes them.
+ * On failure, the SQEs not consumed stay queued for the next submission. */
+static int __uring_submit(int ring_fd, struct __poller_uring *uring)
+{
+	unsigned int head;
+	unsigned int index;
+	unsigned int i = 0;
+	int ret;
+
+	while (1)
+	{
+		head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+		while (i < uring->nbacklog && uring->sqe_tail - head <= *uring->sq_mask)
+		{
+			index = uring->sqe_tail & *uring->sq_mask;
+			uring->sqes[index] = uring->backlog[i++];
+			uring->sq_array[index] = index;
+			uring->sqe_tail++;
+		}
+
+		__atomic_store_n(uring->sq_tail, uring->sqe_tail, __ATOMIC_RELEASE);
+		do
+		{
+			ret = __uring_enter(ring_fd, uring->sqe_tail - head, 0, 0);
+		} while (ret < 0 && errno == EINTR);
+
+		if (ret <= 0 || i == uring->nbacklog)
+			break;
+	}
+
+	if (i != 0)
+	{
+		uring->nbacklog -= i;
+		memmove(uring->backlog, uring->backlog + i,
+				uring->nbacklog * sizeof (struct io_uring_sqe));
+	}
+
+	return ret >= 0 ? 0 : -1;
+}
+
+static inline void __uring_prep_poll(struct io_uring_sqe *sqe, int fd,
+									 int event, unsigned int seq)
+{
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = event & ~EPOLLET;
+	if (event & EPOLLET)
+		sqe->len = IORING_POLL_ADD_MULTI;
+
+	sqe->user_data = __uring_user_data(fd, seq);
+}
+
+static inline void __uring_prep_cancel(struct io_uring_sqe *sqe, int fd)
+{
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = fd;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	sqe->user_data = URING_CANCEL_DATA;
+}
+
+static unsigned int __uring_next_seq(void *data, poller_t *poller)
+{
+	struct __poller_uring *uring = poller->uring;
+	unsigned int seq;
+
+	do
+	{
+		seq = ++uring->seq;
+	} while (seq == 0 || seq == 0xffffffff);
+
+	if (data == NULL)
+		uring->timer_seq = seq;
+	else if (data == (void *)1)
+		uring->pipe_seq = seq;
+	else
+		((struct __poller_node *)data)->seq = seq;
+
+	return seq;
+}
+
+/* The CQ is full (EBUSY) or the kernel is short of memory (EAGAIN) for the
+ * moment. The poller thread submits again later. */
+static inline int __uring_submit_error(int error)
+{
+	return error != EBUSY && error != EAGAIN;
+}
+
+static int __poller_uring_commit(poller_t *poller)
+{
+	struct __poller_uring *uring = poller->uring;
+	void *p = (void *)1;
+	int ret;
+
+	/* Submitted by the poller thread when it starts. */
+	if (poller->stopped)
+	{
+		uring->retry = 1;
+		return 0;
+	}
+
+	if (pthread_equal(pthread_self(), poller->tid))
+	{
+		ret = __uring_submit(poller->pfd, uring);
+		uring->retry = __uring_pending(uring);
+		if (ret < 0 && __uring_submit_error(errno))
+			return -1;
+
+		return 0;
+	}
+
+	if (!uring->deferred)
+	{
+		if (write(poller->pipe_wr, &p, sizeof (void *)) < 0)
+			return -1;
+
+		uring->deferred = 1;
+	}
+
+	return 0;
+}
+
+/* Called by the poller thread when the pipe is readable, or before it waits
+ * for events if some SQEs failed to be submitted. */
+static void __poller_uring_flush(poller_t *poller)
+{
+	struct __poller_uring *uring = poller->uring;
+
+	pthread_mutex_lock(&poller->mutex);
+	if (uring->deferred || uring->retry)
+	{
+		uring->deferred = 0;
+		__uring_submit(poller->pfd, uring);
+		uring->retry = __uring_pending(uring);
+	}
+
+	pthread_mutex_unlock(&poller->mutex);
+}
+
+static int __poller_uring_add_fd(int fd, int event, void *data,
+								 poller_t *poller)
+{
+	struct __poller_uring *uring = poller->uring;
+	struct io_uring_sqe *sqe;
+
+	sqe = __uring_get_sqe(uring);
+	if (!sqe)
+		return -1;
+
+	__uring_prep_poll(sqe, fd, event, __uring_next_seq(data, poller));
+	return __poller_uring_commit(poller);
+}
+
+static int __poller_uring_del_fd(int fd, poller_t *poller)
+{
+	struct __poller_uring *uring = poller->uring;
+	struct io_uring_sqe *sqe;
+
+	sqe = __uring_get_sqe(uring);
+	if (!sqe)
+		return -1;
+
+	__uring_prep_cancel(sqe, fd);
+	return __poller_uring_commit(poller);
+}
+
+static int __poller_uring_mod_fd(int fd, int event, void *data,
+								 poller_t *poller)
+{
+	struct __poller_uring *uring = poller->uring;
+	struct io_uring_sqe *sqe;
+
+	sqe = __uring_get_sqe(uring);
+	if (!sqe)
+		return -1;
+
+	__uring_prep_cancel(sqe, fd);
+	sqe = __uring_get_sqe(uring);
+	if (!sqe)
+	{
+		__uring_put_sqe(uring);
+		return -1;
+	}
+
+	/* Submitted in order. The new poll is never hit by the cancellation. */
+	__uring_prep_poll(sqe, fd, event, __uring_next_seq(data, poller));
+	return __poller_uring_commit(poller);
+}
+
+static int __poller_uring_cqe_event(const struct io_uring_cqe *cqe,
+									struct epoll_event *ev,
+									poller_t *poller)
+{
+	struct __poller_uring *uring = poller->uring;
+	int fd = (int)(cqe->user_data & 0xffffffff);
+	unsigned int seq = (unsigned int)(cqe->user_data >> 32);
+	struct __poller_node *node = NULL;
+	struct io_uring_sqe *sqe;
+	int event;
+
+	if (cqe->user_data == URING_CANCEL_DATA || cqe->res == -ECANCELED)
+		return 0;
+
+	if (seq == uring->timer_seq && fd == poller->timerfd)
+	{
+		event = EPOLLIN | EPOLLET;
+		ev->data.ptr = NULL;
+	}
+	else if (seq == uring->pipe_seq && fd == poller->pipe_rd)
+	{
+		event = EPOLLIN;
+		ev->data.ptr = (void *)1;
+	}
+	else
+	{
+		if ((size_t)fd >= poller->max_open_files)
+			return 0;
+
+		node = poller->nodes[fd];
+		if (!node || node->seq != seq)
+			return 0;
+
+		event = node->event;
+		ev->data.ptr = node;
+	}
+
+	ev->events = cqe->res > 0 ? cqe->res : EPOLLERR;
+	if (!(event & EPOLLET))
+	{
+		if (cqe->res > 0)
+			uring->rearm[uring->nrearm++] = cqe->user_data;
+	}
+	else if (!(cqe->flags & IORING_CQE_F_MORE) && cqe->res > 0)
+	{
+		/* Multishot poll terminated by the kernel (e.g. CQ overflow). */
+		pthread_mutex_lock(&poller->mutex);
+		if (!node || (poller->nodes[fd] == node && node->seq == seq))
+		{
+			sqe = __uring_get_sqe(uring);
+			if (sqe)
+			{
+				__uring_prep_poll(sqe, fd, event, seq);
+				__uring_submit(poller->pfd, uring);
+				uring->retry = __uring_pending(uring);
+			}
+		}
+
+		pthread_mutex_unlock(&poller->mutex);
+	}
+
+	return 1;
+}
+
+static void __poller_uring_rearm(poller_t *poller)
+{
+	struct __poller_uring *uring = poller->uring;
+	struct io_uring_sqe *sqe;
+	unsigned int seq;
+	int event;
+	int fd;
+	int i;
+
+	pthread_mutex_lock(&poller->mutex);
+	for (i = 0; i < uring->nrearm; i++)
+	{
+		fd = (int)(uring->rearm[i] & 0xffffffff);
+		seq = (unsigned int)(uring->rearm[i] >> 32);
+		if (seq == uring->pipe_seq && fd == poller->pipe_rd)
+			event = EPOLLIN;
+		else if (poller->nodes[fd] && poller->nodes[fd]->seq == seq)
+			event = poller->nodes[fd]->event;
+		else
+			continue;
+
+		sqe = __uring_get_sqe(uring);
+		if (!sqe)
+			break;
+
+		__uring_prep_poll(sqe, fd, event, seq);
+	}
+
+	__uring_submit(poller->pfd, uring);
+	uring->retry = __uring_pending(uring);
+	pthread_mutex_unlock(&poller->mutex);
+	uring->nrearm = 0;
+}
+
+static int __poller_uring_wait(struct epoll_event *events, int maxevents,
+							   int timeout, poller_t *poller)
+{
+	struct __poller_uring *uring = poller->uring;
+	unsigned int head, tail;
+	int n = 0;
+	int i;
+
+	if (uring->nrearm > 0)
+		__poller_uring_rearm(poller);
+	else if (uring->retry)
+		__poller_uring_flush(poller);
+
+	while (1)
+	{
+		head = *uring->cq_head;
+		tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail && n < maxevents)
+		{
+			if (__poller_uring_cqe_event(&uring->cqes[head & *uring->cq_mask],
+										 &events[n], poller) > 0)
+			{
+				/* A multishot poll may complete more than once in a batch,
+				 * but a node is handled once, as with epoll. */
+				for (i = 0; i < n; i++)
+				{
+					if (events[i].data.ptr == events[n].data.ptr)
+					{
+						events[i].events |= events[n].events;
+						break;
+					}
+				}
+
+				if (i == n)
+					n++;
+			}
+
+			head++;
+		}
+
+		__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+		if (n > 0 || timeout == 0)
+			return n;
+
+		if (__uring_enter(poller->pfd, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+			return -1;
+	}
+}
+
+static int __poller_uring_probe(int ring_fd, struct __poller_uring *uring)
+{
+	struct io_uring_sqe *sqe = __uring_get_sqe(uring);
+	struct io_uring_cqe *cqe;
+	unsigned int head;
+	int ret;
+
+	/* Cancellation by fd is the newest feature we need (Linux 5.19). */
+	__uring_prep_cancel(sqe, ring_fd);
+	if (__uring_submit(ring_fd, uring) < 0)
+		return -1;
+
+	while (1)
+	{
+		head = *uring->cq_head;
+		if (head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE))
+			break;
+
+		if (__uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+			errno != EINTR)
+			return -1;
+	}
+
+	cqe = &uring->cqes[head & *uring->cq_mask];
+	ret = cqe->res;
+
+	__atomic_store_n(uring->cq_head, head + 1, __ATOMIC_RELEASE);
+	if (ret >= 0 || ret == -ENOENT)
+		return 0;
+
+	errno = -ret;
+	return -1;
+}
+
+static int __poller_uring_create(poller_t *poller)
+{
+	struct __poller_uring *uring;
+	struct io_uring_params params;
+	size_t sq_size, cq_size;
+	char *ring;
+	int ring_fd;
+
+	uring = (struct __poller_uring *)malloc(sizeof (struct __poller_uring));
+	if (!uring)
+		return -1;
+
+	memset(&params, 0, sizeof (struct io_uring_params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = URING_CQ_ENTRIES;
+	ring_fd = __uring_setup(URING_SQ_ENTRIES, &params);
+	if (ring_fd >= 0)
+	{
+		if ((params.features & IORING_FEAT_SINGLE_MMAP) &&
+			(params.features & IORING_FEAT_NODROP))
+		{
+			sq_size = params.sq_off.array + params.sq_entries *
+					  sizeof (unsigned int);
+			cq_size = params.cq_off.cqes + params.cq_entries *
+					  sizeof (struct io_uring_cqe);
+			uring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+			uring->ring = mmap(NULL, uring->ring_size, PROT_READ | PROT_WRITE,
+							   MAP_SHARED | MAP_POPULATE, ring_fd,
+							   IORING_OFF_SQ_RING);
+			if (uring->ring != MAP_FAILED)
+			{
+				uring->sqes_size = params.sq_entries *
+								   sizeof (struct io_uring_sqe);
+				uring->sqes = (struct io_uring_sqe *)
+							  mmap(NULL, uring->sqes_size,
+								   PROT_READ | PROT_WRITE,
+								   MAP_SHARED | MAP_POPULATE, ring_fd,
+								   IORING_OFF_SQES);
+				if (uring->sqes != MAP_FAILED)
+				{
+					ring = (char *)uring->ring;
+					uring->sq_head = (unsigned int *)(ring + params.sq_off.head);
+					uring->sq_tail = (unsigned int *)(ring + params.sq_off.tail);
+					uring->sq_mask = (unsigned int *)(ring +
+													  params.sq_off.ring_mask);
+					uring->sq_array = (unsigned int *)(ring +
+													   params.sq_off.array);
+					uring->cq_head = (unsigned int *)(ring + params.cq_off.head);
+					uring->cq_tail = (unsigned int *)(ring + params.cq_off.tail);
+					uring->cq_mask = (unsigned int *)(ring +
+													  params.cq_off.ring_mask);
+					uring->cqes = (struct io_uring_cqe *)(ring +
+														  params.cq_off.cqes);
+					uring->sqe_tail = *uring->sq_tail;
+					uring->seq = 0;
+					uring->pipe_seq = 0;
+					uring->timer_seq = 0;
+					uring->deferred = 0;
+					uring->retry = 0;
+					uring->backlog = NULL;
+					uring->nbacklog = 0;
+					uring->backlog_size = 0;
+					uring->nrearm = 0;
+					if (__poller_uring_probe(ring_fd, uring) >= 0)
+					{
+						poller->uring = uring;
+						return ring_fd;
+					}
+
+					munmap(uring->sqes, uring->sqes_size);
+				}
+
+				munmap(uring->ring, uring->ring_size);
+			}
+		}
+
+		close(ring_fd);
+	}
+
+	free(uring);
+	return -1;
+}
+
+static void __poller_uring_destroy(poller_t *poller)
+{
+	struct __poller_uring *uring = poller->uring;
+
+	munmap(uring->sqes, uring->sqes_size);
+	munmap(uring->ring, uring->ring_size);
+	free(uring->backlog);
+	free(uring);
+}
+
+#endif
+
+static inline int __poller_create_pfd(int backend, poller_t *poller)
+{
+	int pfd;
+
+#ifdef POLLER_HAS_IO_URING
+	poller->uring = NULL;
+	if (backend == POLLER_BACKEND_IO_URING)
+	{
+		pfd = __poller_uring_create(poller);
+		if (pfd >= 0)
+			return pfd;
+	}
+#endif
+
+	pfd = epoll_create(1);
+	return pfd;
+}
+
+static inline void __poller_close_pfd(poller_t *poller)
 {
-	return epoll_create(1);
+#ifdef POLLER_HAS_IO_URING
+	if (poller->uring)
+		__poller_uring_destroy(poller);
+#endif
+
+	close(poller->pfd);
 }
 
 static inline int __poller_add_fd(int fd, int event, void *data,
@@ -103,11 +794,22 @@ static inline int __poller_add_fd(int fd, int event, void *data,
 			.ptr	=	data
 		}
 	};
+
+#ifdef POLLER_HAS_IO_URING
+	if (poller->uring)
+		return __poller_uring_add_fd(fd, event, data, poller);
+#endif
+
 	return epoll_ctl(poller->pfd, EPOLL_CTL_ADD, fd, &ev);
 }
 
 static inline int __poller_del_fd(int fd, int event, poller_t *poller)
 {
+#ifdef POLLER_HAS_IO_URING
+	if (poller->uring)
+		return __poller_uring_del_fd(fd, poller);
+#endif
+
 	return epoll_ctl(poller->pfd, EPOLL_CTL_DEL, fd, NULL);
 }
 
@@ -121,6 +823,12 @@ static inline int __poller_mod_fd(int fd, int old_event,
 			.ptr	=	data
 		}
 	};
+
+#ifdef POLLER_HAS_IO_URING
+	if (poller->uring)
+		return __poller_uring_mod_fd(fd, new_event, data, poller);
+#endif
+
 	return epoll_ctl(poller->pfd, EPOLL_CTL_MOD, fd, &ev);
 }
 
@@ -131,13 +839,7 @@ static inline int __poller_create_timerfd()
 
 static inline int __poller_add_timerfd(int fd, poller_t *poller)
 {
-	struct epoll_event ev = {
-		.events		=	EPOLLIN | EPOLLET,
-		.data		=	{
-			.ptr	=	NULL
-		}
-	};
-	return epoll_ctl(poller->pfd, EPOLL_CTL_ADD, fd, &ev);
+	return __poller_add_fd(fd, EPOLLIN | EPOLLET, NULL, poller);
 }
 
 static inline int __poller_set_timerfd(int fd, const struct timespec *abstime,
@@ -152,10 +854,16 @@ static inline int __poller_set_timerfd(int fd, const struct timespec *abstime,
 
 typedef struct epoll_event __poller_event_t;
 
+/* 'timeout' is either -1 (block) or 0 (poll). */
 static inline int __poller_wait(__poller_event_t *events, int maxevents,
-								poller_t *poller)
+								int timeout, poller_t *poller)
 {
-	return epoll_wait(poller->pfd, events, maxevents, -1);
+#ifdef POLLER_HAS_IO_URING
+	if (poller->uring)
+		return __poller_uring_wait(events, maxevents, timeout, poller);
+#endif
+
+	return epoll_wait(poller->pfd, events, maxevents, timeout);
 }
 
 static inline void *__poller_event_data(const __poller_event_t *event)
@@ -165,11 +873,16 @@ static inline void *__poller_event_data(const __poller_event_t *event)
 
 #else /* BSD, macOS */
 
-static inline int __poller_create_pfd()
+static inline int __poller_create_pfd(int backend, poller_t *poller)
 {
 	return kqueue();
 }
 
+static inline void __poller_close_pfd(poller_t *poller)
+{
+	close(poller->pfd);
+}
+
 static inline int __poller_add_fd(int fd, int event, void *data,
 								  poller_t *poller)
 {
@@ -233,9 +946,12 @@ static int __poller_set_timerfd(int fd, const struct timespec *abstime,
 typedef struct kevent __poller_event_t;
 
 static inline int __poller_wait(__poller_event_t *events, int maxevents,
-								poller_t *poller)
+								int timeout, poller_t *poller)
 {
-	return kevent(poller->pfd, NULL, 0, events, maxevents, NULL);
+	struct timespec ts = { };
+
+	return kevent(poller->pfd, NULL, 0, events, maxevents,
+				  timeout == 0 ? &ts : NULL);
 }
 
 static inline void *__poller_event_data(const __poller_event_t *event)
@@ -312,6 +1028,206 @@ static inline void __poller_tree_erase(struct __poller_node *node,
 	node->in_rbtree = 0;
 }
 
+static inline unsigned long long __timeout_ticks(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000ULL + (ts->tv_nsec + 999999) / 1000000;
+}
+
+static void __poller_wheel_add(struct __poller_node *node,
+							   struct __poller_wheel *wheel)
+{
+	unsigned long long expire = __timeout_ticks(&node->timeout);
+	unsigned long long delta;
+	unsigned int index;
+	int level = 0;
+
+	if (expire < wheel->current)
+		expire = wheel->current;
+
+	delta = expire - wheel->current;
+	if (delta >> (POLLER_WHEEL_BITS * POLLER_WHEEL_LEVELS))
+	{
+		delta = (1ULL << (POLLER_WHEEL_BITS * POLLER_WHEEL_LEVELS)) - 1;
+		expire = wheel->current + delta;
+	}
+
+	while (delta >> (POLLER_WHEEL_BITS * (level + 1)))
+		level++;
+
+	index = (expire >> (POLLER_WHEEL_BITS * level)) & POLLER_WHEEL_MASK;
+	list_add_tail(&node->list, &wheel->slots[level][index]);
+	wheel->bitmap[level] |= 1ULL << index;
+}
+
+/* Offset of the first non-empty slot of 'level' from 'start', or -1. */
+static int __poller_wheel_first(int level, unsigned int start,
+								struct __poller_wheel *wheel)
+{
+	unsigned long long bits;
+	unsigned int index;
+	int off;
+
+	while ((bits = wheel->bitmap[level]) != 0)
+	{
+		bits = (bits >> start) |
+			   (bits << ((POLLER_WHEEL_SLOTS - start) & POLLER_WHEEL_MASK));
+		off = __builtin_ctzll(bits);
+		index = (start + off) & POLLER_WHEEL_MASK;
+		if (!list_empty(&wheel->slots[level][index]))
+			return off;
+
+		wheel->bitmap[level] &= ~(1ULL << index);
+	}
+
+	return -1;
+}
+
+/* The first tick when the wheel has something to do: either some nodes
+ * expire, or a slot of a higher level is cascaded. */
+static int __poller_wheel_next(unsigned long long *tick,
+							   struct __poller_wheel *wheel)
+{
+	unsigned long long base;
+	unsigned long long next;
+	int level;
+	int off;
+
+	*tick = ~0ULL;
+	for (level = 0; level < POLLER_WHEEL_LEVELS; level++)
+	{
+		base = wheel->current + (1ULL << (POLLER_WHEEL_BITS * level)) - 1;
+		base >>= POLLER_WHEEL_BITS * level;
+		off = __poller_wheel_first(level, base & POLLER_WHEEL_MASK, wheel);
+		if (off >= 0)
+		{
+			next = (base + off) << (POLLER_WHEEL_BITS * level);
+			if (next < *tick)
+				*tick = next;
+		}
+	}
+
+	return *tick != ~0ULL;
+}
+
+static void __poller_wheel_insert(struct __poller_node *node,
+								  poller_t *poller)
+{
+	struct __poller_wheel *wheel = poller->wheel;
+	unsigned long long tick = __timeout_ticks(&node->timeout);
+	struct timespec abstime;
+
+	__poller_wheel_add(node, wheel);
+	if (tick < wheel->timer)
+	{
+		abstime.tv_sec = tick / 1000;
+		abstime.tv_nsec = tick % 1000 * 1000000;
+		__poller_set_timerfd(poller->timerfd, &abstime, poller);
+		wheel->timer = tick;
+	}
+}
+
+static void __poller_wheel_cascade(int level, unsigned int index,
+								   struct __poller_wheel *wheel)
+{
+	struct __poller_node *node;
+	LIST_HEAD(list);
+
+	list_splice_init(&wheel->slots[level][index], &list);
+	wheel->bitmap[level] &= ~(1ULL << index);
+	while (!list_empty(&list))
+	{
+		node = list_entry(list.next, struct __poller_node, list);
+		list_del(&node->list);
+		__poller_wheel_add(node, wheel);
+	}
+}
+
+/* Move all the nodes that expire before 'now' to 'timeo_list'. Empty ranges
+ * are skipped in one step, so a long sleep costs no more than a short one. */
+static void __poller_wheel_expire(const struct timespec *now,
+								  struct list_head *timeo_list,
+								  poller_t *poller)
+{
+	struct __poller_wheel *wheel = poller->wheel;
+	unsigned long long end = now->tv_sec * 1000ULL + now->tv_nsec / 1000000;
+	unsigned long long next;
+	struct __poller_node *node;
+	struct list_head *pos, *tmp;
+	unsigned int index;
+	int level;
+
+	while (wheel->current <= end)
+	{
+		for (level = 1; level < POLLER_WHEEL_LEVELS; level++)
+		{
+			if (wheel->current & ((1ULL << (POLLER_WHEEL_BITS * level)) - 1))
+				break;
+
+			index = (wheel->current >> (POLLER_WHEEL_BITS * level)) &
+					POLLER_WHEEL_MASK;
+			__poller_wheel_cascade(level, index, wheel);
+		}
+
+		index = wheel->current & POLLER_WHEEL_MASK;
+		list_for_each_safe(pos, tmp, &wheel->slots[0][index])
+		{
+			node = list_entry(pos, struct __poller_node, list);
+			poller->nodes[node->data.fd] = NULL;
+			__poller_del_fd(node->data.fd, node->event, poller);
+			list_move_tail(pos, timeo_list);
+		}
+
+		wheel->bitmap[0] &= ~(1ULL << index);
+		wheel->current++;
+
+		level = 0;
+		while (level < POLLER_WHEEL_LEVELS &&
+			   __poller_wheel_first(level, 0, wheel) < 0)
+			level++;
+
+		if (level == 0)
+			continue;
+
+		if (level < POLLER_WHEEL_LEVELS)
+		{
+			next = wheel->current + (1ULL << (POLLER_WHEEL_BITS * level)) - 1;
+			next >>= POLLER_WHEEL_BITS * level;
+			next <<= POLLER_WHEEL_BITS * level;
+			if (next > end + 1)
+				next = end + 1;
+		}
+		else
+			next = end + 1;
+
+		wheel->current = next;
+	}
+}
+
+static int __poller_create_wheel(poller_t *poller)
+{
+	struct __poller_wheel *wheel;
+	struct timespec now;
+	int level;
+	int i;
+
+	wheel = (struct __poller_wheel *)malloc(sizeof (struct __poller_wheel));
+	if (!wheel)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wheel->current = now.tv_sec * 1000ULL + now.tv_nsec / 1000000;
+	wheel->timer = ~0ULL;
+	for (level = 0; level < POLLER_WHEEL_LEVELS; level++)
+	{
+		wheel->bitmap[level] = 0;
+		for (i = 0; i < POLLER_WHEEL_SLOTS; i++)
+			INIT_LIST_HEAD(&wheel->slots[level][i]);
+	}
+
+	poller->wheel = wheel;
+	return 0;
+}
+
 static int __poller_remove_node(struct __poller_node *node, poller_t *poller)
 {
 	int removed;
@@ -334,6 +1250,18 @@ static int __poller_remove_node(struct __poller_node *node, poller_t *poller)
 	return removed;
 }
 
+static void __poller_unpause(struct __poller_node *node, poller_t *poller)
+{
+	pthread_mutex_lock(&poller->mutex);
+	if (!node->removed && node->paused)
+	{
+		if (__poller_add_fd(node->data.fd, node->event, node, poller) >= 0)
+			node->paused = 0;
+	}
+
+	pthread_mutex_unlock(&poller->mutex);
+}
+
 static int __poller_append_message(const void *buf, size_t *n,
 								   struct __poller_node *node,
 								   poller_t *poller)
@@ -344,14 +1272,14 @@ static int __poller_append_message(const void *buf, size_t *n,
 
 	if (!msg)
 	{
-		res = (struct __poller_node *)malloc(sizeof (struct __poller_node));
+		res = __poller_node_alloc();
 		if (!res)
 			return -1;
 
 		msg = poller->create_message(node->data.context);
 		if (!msg)
 		{
-			free(res);
+			__poller_node_free(res);
 			return -1;
 		}
 
@@ -364,6 +1292,10 @@ static int __poller_append_message(const void *buf, size_t *n,
 	ret = msg->append(buf, n, msg);
 	if (ret > 0)
 	{
+		/* A message paused by itself has nothing more to wait for. */
+		if (node->paused)
+			__poller_unpause(node, poller);
+
 		res->data = node->data;
 		res->error = 0;
 		res->state = PR_ST_SUCCESS;
@@ -409,23 +1341,120 @@ static int __poller_handle_ssl_error(struct __poller_node *node, int ret,
 	else
 		ret = 0;
 
-	pthread_mutex_unlock(&poller->mutex);
-	return ret;
+	pthread_mutex_unlock(&poller->mutex);
+	return ret;
+}
+
+static char *__poller_read_buffer(size_t *size, struct __poller_node *node,
+								  poller_t *poller)
+{
+	poller_message_t *msg = node->data.message;
+	char *p;
+
+	if (msg && msg->get_buffer)
+	{
+		p = (char *)msg->get_buffer(size, msg);
+		if (p)
+			return p;
+	}
+
+	*size = POLLER_BUFSIZE;
+	return poller->buf;
+}
+
+#ifdef __linux__
+/* Every datagram is read into a slot of the poller buffer. Fewer datagrams
+ * than slots means that the socket is drained, and need not be read again. */
+static void __poller_handle_recvmmsg(struct __poller_node *node,
+									 poller_t *poller)
+{
+	struct mmsghdr msgs[POLLER_MMSG_MAX];
+	struct iovec iov[POLLER_MMSG_MAX];
+	ssize_t nleft = 0;
+	size_t n;
+	char *p;
+	int cnt;
+	int i;
+
+	for (i = 0; i < POLLER_MMSG_MAX; i++)
+	{
+		iov[i].iov_base = poller->buf + i * POLLER_DGRAM_MAX;
+		iov[i].iov_len = POLLER_DGRAM_MAX;
+		memset(&msgs[i].msg_hdr, 0, sizeof (struct msghdr));
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	do
+	{
+		cnt = recvmmsg(node->data.fd, msgs, POLLER_MMSG_MAX, 0, NULL);
+		if (cnt < 0)
+		{
+			if (errno == EAGAIN)
+				return;
+
+			break;
+		}
+
+		for (i = 0; i < cnt && nleft >= 0; i++)
+		{
+			p = (char *)iov[i].iov_base;
+			nleft = msgs[i].msg_len;
+			while (nleft > 0)
+			{
+				n = nleft;
+				if (__poller_append_message(p, &n, node, poller) >= 0)
+				{
+					nleft -= n;
+					p += n;
+				}
+				else
+					nleft = -1;
+			}
+		}
+
+		if (nleft < 0)
+			break;
+
+		if (node->paused)
+			return;
+	} while (cnt == POLLER_MMSG_MAX);
+
+	if (cnt >= 0 && nleft >= 0)
+		return;
+
+	if (__poller_remove_node(node, poller))
+		return;
+
+	node->error = errno;
+	node->state = PR_ST_ERROR;
+	__poller_node_free(node->res);
+	poller->cb((struct poller_result *)node, poller->ctx);
 }
+#endif
 
 static void __poller_handle_read(struct __poller_node *node,
 								 poller_t *poller)
 {
 	ssize_t nleft;
+	size_t size;
 	size_t n;
 	char *p;
 
+#ifdef __linux__
+	if (node->data.dgram && !node->data.ssl)
+	{
+		__poller_handle_recvmmsg(node, poller);
+		return;
+	}
+#endif
+
 	while (1)
 	{
-		p = poller->buf;
+		p = __poller_read_buffer(&size, node, poller);
 		if (!node->data.ssl)
 		{
-			nleft = read(node->data.fd, p, POLLER_BUFSIZE);
+			nleft = read(node->data.fd, p, size);
 			if (nleft < 0)
 			{
 				if (errno == EAGAIN)
@@ -434,7 +1463,7 @@ static void __poller_handle_read(struct __poller_node *node,
 		}
 		else
 		{
-			nleft = SSL_read(node->data.ssl, p, POLLER_BUFSIZE);
+			nleft = SSL_read(node->data.ssl, p, size);
 			if (nleft < 0)
 			{
 				if (__poller_handle_ssl_error(node, nleft, poller) >= 0)
@@ -459,6 +1488,12 @@ static void __poller_handle_read(struct __poller_node *node,
 
 		if (nleft < 0)
 			break;
+
+		/* Paused in append(). Bytes that SSL has already taken from the
+		 * socket raise no more events, so they are read first. */
+		if (node->paused &&
+			!(node->data.ssl && SSL_pending(node->data.ssl) > 0))
+			return;
 	}
 
 	if (__poller_remove_node(node, poller))
@@ -475,7 +1510,7 @@ static void __poller_handle_read(struct __poller_node *node,
 		node->state = PR_ST_ERROR;
 	}
 
-	free(node->res);
+	__poller_node_free(node->res);
 	poller->cb((struct poller_result *)node, poller->ctx);
 }
 
@@ -487,6 +1522,161 @@ static void __poller_handle_read(struct __poller_node *node,
 # endif
 #endif
 
+static inline int __poller_iov_file_fd(const struct iovec *iov)
+{
+	return ((const struct poller_file *)iov[1].iov_base)->fd;
+}
+
+static inline off_t __poller_iov_file_offset(const struct iovec *iov)
+{
+	const struct poller_file *file = (const struct poller_file *)iov[1].iov_base;
+
+	return file->offset + (off_t)iov[1].iov_len;
+}
+
+/* Number of vectors before the first file range, at most IOV_MAX. */
+static int __poller_iov_count(const struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	if (iovcnt > IOV_MAX)
+		iovcnt = IOV_MAX;
+
+	for (i = 0; i < iovcnt; i++)
+	{
+		if (POLLER_IOV_FILE(&iov[i]))
+			break;
+	}
+
+	return i;
+}
+
+static ssize_t __poller_read_file(char *buf, size_t size,
+								  const struct iovec *iov)
+{
+	ssize_t n;
+
+	if (size > iov->iov_len)
+		size = iov->iov_len;
+
+	n = pread(__poller_iov_file_fd(iov), buf, size,
+			  __poller_iov_file_offset(iov));
+	if (n == 0)
+	{
+		/* The file is shorter than the range. */
+		errno = EIO;
+		return -1;
+	}
+
+	return n;
+}
+
+static ssize_t __poller_sendfile(int fd, const struct iovec *iov,
+								 poller_t *poller)
+{
+	ssize_t n;
+#ifdef __linux__
+	off_t offset = __poller_iov_file_offset(iov);
+
+	n = sendfile(fd, __poller_iov_file_fd(iov), &offset, iov->iov_len);
+	if (n == 0)
+	{
+		errno = EIO;
+		return -1;
+	}
+#else
+	n = __poller_read_file(poller->buf, POLLER_BUFSIZE, iov);
+	if (n > 0)
+		n = write(fd, poller->buf, n);
+#endif
+
+	return n;
+}
+
+/* Send the datagrams of iov, which are separated by POLLER_IOV_DGRAM.
+ * Returns the bytes of the datagrams that are sent as a whole. */
+static ssize_t __poller_sendmmsg(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t total = 0;
+	int i;
+#ifdef __linux__
+	struct mmsghdr msgs[POLLER_MMSG_MAX];
+	int cnt = 0;
+	int ret;
+
+	while (iovcnt > 0 && cnt < POLLER_MMSG_MAX)
+	{
+		for (i = 0; i < iovcnt && !POLLER_IOV_DGRAM(&iov[i]); i++)
+			;
+
+		memset(&msgs[cnt].msg_hdr, 0, sizeof (struct msghdr));
+		msgs[cnt].msg_hdr.msg_iov = iov;
+		msgs[cnt].msg_hdr.msg_iovlen = i;
+		cnt++;
+		if (i < iovcnt)
+			i++;
+
+		iov += i;
+		iovcnt -= i;
+	}
+
+	ret = sendmmsg(fd, msgs, cnt, 0);
+	if (ret < 0)
+		return -1;
+
+	for (i = 0; i < ret; i++)
+		total += msgs[i].msg_len;
+#else
+	ssize_t n;
+
+	while (iovcnt > 0)
+	{
+		for (i = 0; i < iovcnt && !POLLER_IOV_DGRAM(&iov[i]); i++)
+			;
+
+		n = writev(fd, iov, i);
+		if (n < 0)
+			return total > 0 ? total : -1;
+
+		total += n;
+		if (i < iovcnt)
+			i++;
+
+		iov += i;
+		iovcnt -= i;
+	}
+#endif
+
+	return total;
+}
+
+/* Gather the small vectors at the front into one TLS record, instead of
+ * one record and one syscall per vector. The poller buffer is free here,
+ * and a retry rebuilds the same data since iov is advanced only on success.
+ */
+static int __poller_ssl_writev(SSL *ssl, const struct iovec *iov, int iovcnt,
+							   poller_t *poller)
+{
+	size_t nleft = POLLER_SSL_RECORD_MAX;
+	char *p = poller->buf;
+	size_t n;
+
+	if (iov->iov_len >= POLLER_SSL_RECORD_MAX || iovcnt == 1 ||
+		POLLER_IOV_FILE(&iov[1]))
+		return SSL_write(ssl, iov->iov_base, iov->iov_len);
+
+	do
+	{
+		n = iov->iov_len <= nleft ? iov->iov_len : nleft;
+		memcpy(p, iov->iov_base, n);
+		p += n;
+		nleft -= n;
+		iov++;
+	} while (--iovcnt > 0 && nleft > 0 && !POLLER_IOV_FILE(iov));
+
+	return SSL_write(ssl, poller->buf, p - poller->buf);
+}
+
 static void __poller_handle_write(struct __poller_node *node,
 								  poller_t *poller)
 {
@@ -500,20 +1690,44 @@ static void __poller_handle_write(struct __poller_node *node,
 	{
 		if (!node->data.ssl)
 		{
-			iovcnt = node->data.iovcnt;
-			if (iovcnt > IOV_MAX)
-				iovcnt = IOV_MAX;
+			if (POLLER_IOV_FILE(iov))
+				nleft = __poller_sendfile(node->data.fd, iov, poller);
+			else
+			{
+				iovcnt = __poller_iov_count(iov, node->data.iovcnt);
+				if (node->data.dgram)
+					nleft = __poller_sendmmsg(node->data.fd, iov, iovcnt);
+				else
+					nleft = writev(node->data.fd, iov, iovcnt);
+			}
 
-			nleft = writev(node->data.fd, iov, iovcnt);
 			if (nleft < 0)
 			{
 				ret = errno == EAGAIN ? 0 : -1;
 				break;
 			}
 		}
+		else if (POLLER_IOV_FILE(iov))
+		{
+			/* Read again after SSL_ERROR_WANT_WRITE. Same bytes. */
+			nleft = __poller_read_file(poller->buf, POLLER_SSL_RECORD_MAX, iov);
+			if (nleft < 0)
+			{
+				ret = -1;
+				break;
+			}
+
+			nleft = SSL_write(node->data.ssl, poller->buf, nleft);
+			if (nleft <= 0)
+			{
+				ret = __poller_handle_ssl_error(node, nleft, poller);
+				break;
+			}
+		}
 		else if (iov->iov_len > 0)
 		{
-			nleft = SSL_write(node->data.ssl, iov->iov_base, iov->iov_len);
+			nleft = __poller_ssl_writev(node->data.ssl, iov, node->data.iovcnt,
+										poller);
 			if (nleft <= 0)
 			{
 				ret = __poller_handle_ssl_error(node, nleft, poller);
@@ -526,7 +1740,23 @@ static void __poller_handle_write(struct __poller_node *node,
 		count += nleft;
 		do
 		{
-			if (nleft >= iov->iov_len)
+			if (POLLER_IOV_FILE(iov))
+			{
+				if (nleft >= iov->iov_len)
+				{
+					nleft -= iov->iov_len;
+					iov->iov_len = 0;
+					iov += 2;
+					node->data.iovcnt -= 2;
+				}
+				else
+				{
+					iov[1].iov_len += nleft;
+					iov->iov_len -= nleft;
+					break;
+				}
+			}
+			else if (nleft >= iov->iov_len)
 			{
 				nleft -= iov->iov_len;
 				iov->iov_base = (char *)iov->iov_base + iov->iov_len;
@@ -604,7 +1834,7 @@ static void __poller_handle_listen(struct __poller_node *node,
 		res->state = PR_ST_SUCCESS;
 		poller->cb((struct poller_result *)res, poller->ctx);
 
-		res = (struct __poller_node *)malloc(sizeof (struct __poller_node));
+		res = __poller_node_alloc();
 		node->res = res;
 		if (!res)
 			break;
@@ -615,7 +1845,7 @@ static void __poller_handle_listen(struct __poller_node *node,
 
 	node->error = errno;
 	node->state = PR_ST_ERROR;
-	free(node->res);
+	__poller_node_free(node->res);
 	poller->cb((struct poller_result *)node, poller->ctx);
 }
 
@@ -769,7 +1999,7 @@ static void __poller_handle_event(struct __poller_node *node,
 			res->state = PR_ST_SUCCESS;
 			poller->cb((struct poller_result *)res, poller->ctx);
 
-			res = (struct __poller_node *)malloc(sizeof (struct __poller_node));
+			res = __poller_node_alloc();
 			node->res = res;
 			if (!res)
 				break;
@@ -784,7 +2014,7 @@ static void __poller_handle_event(struct __poller_node *node,
 
 	node->error = errno;
 	node->state = PR_ST_ERROR;
-	free(node->res);
+	__poller_node_free(node->res);
 	poller->cb((struct poller_result *)node, poller->ctx);
 }
 
@@ -810,7 +2040,7 @@ static void __poller_handle_notify(struct __poller_node *node,
 			res->state = PR_ST_SUCCESS;
 			poller->cb((struct poller_result *)res, poller->ctx);
 
-			res = (struct __poller_node *)malloc(sizeof (struct __poller_node));
+			res = __poller_node_alloc();
 			node->res = res;
 			if (!res)
 				break;
@@ -839,7 +2069,7 @@ static void __poller_handle_notify(struct __poller_node *node,
 		node->state = PR_ST_ERROR;
 	}
 
-	free(node->res);
+	__poller_node_free(node->res);
 	poller->cb((struct poller_result *)node, poller->ctx);
 }
 
@@ -851,11 +2081,20 @@ static int __poller_handle_pipe(poller_t *poller)
 	int i;
 
 	n = read(poller->pipe_rd, node, POLLER_BUFSIZE) / sizeof (void *);
+#ifdef POLLER_HAS_IO_URING
+	/* Before the callbacks, which may close the fds of removed nodes. */
+	if (poller->uring && !poller->stopped)
+		__poller_uring_flush(poller);
+#endif
+
 	for (i = 0; i < n; i++)
 	{
+		if (node[i] == (struct __poller_node *)1)
+			continue;
+
 		if (node[i])
 		{
-			free(node[i]->res);
+			__poller_node_free(node[i]->res);
 			poller->cb((struct poller_result *)node[i], poller->ctx);
 		}
 		else
@@ -916,6 +2155,9 @@ static void __poller_handle_timeout(const struct __poller_node *time_node,
 		}
 	}
 
+	if (poller->wheel)
+		__poller_wheel_expire(&time_node->timeout, &timeo_list, poller);
+
 	pthread_mutex_unlock(&poller->mutex);
 	while (!list_empty(&timeo_list))
 	{
@@ -924,7 +2166,7 @@ static void __poller_handle_timeout(const struct __poller_node *time_node,
 
 		node->error = ETIMEDOUT;
 		node->state = PR_ST_ERROR;
-		free(node->res);
+		__poller_node_free(node->res);
 		poller->cb((struct poller_result *)node, poller->ctx);
 	}
 }
@@ -934,6 +2176,7 @@ static void __poller_set_timer(poller_t *poller)
 	struct __poller_node *node = NULL;
 	struct __poller_node *first;
 	struct timespec abstime;
+	unsigned long long tick;
 
 	pthread_mutex_lock(&poller->mutex);
 	if (!list_empty(&poller->timeo_list))
@@ -954,10 +2197,77 @@ static void __poller_set_timer(poller_t *poller)
 		abstime.tv_nsec = 0;
 	}
 
+	if (poller->wheel)
+	{
+		if (__poller_wheel_next(&tick, poller->wheel) &&
+			(!node || tick < __timeout_ticks(&abstime)))
+		{
+			abstime.tv_sec = tick / 1000;
+			abstime.tv_nsec = tick % 1000 * 1000000;
+		}
+
+		if (abstime.tv_sec || abstime.tv_nsec)
+			poller->wheel->timer = __timeout_ticks(&abstime);
+		else
+			poller->wheel->timer = ~0ULL;
+	}
+
 	__poller_set_timerfd(poller->timerfd, &abstime, poller);
 	pthread_mutex_unlock(&poller->mutex);
 }
 
+static inline long long __elapsed_ns(const struct timespec *start,
+									 const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000LL +
+		   end->tv_nsec - start->tv_nsec;
+}
+
+/*
+ * Adaptive busy polling, in the way of the halt polling of KVM. Poll without
+ * blocking for up to 'spin' ns before blocking. If an event comes soon after
+ * blocking, within the maximum budget, a longer spin would have caught it,
+ * so the budget grows. If the block lasts longer, spinning was wasted, so
+ * the budget shrinks.
+ */
+static int __poller_busy_wait(__poller_event_t *events, int maxevents,
+							  poller_t *poller)
+{
+	struct timespec start, now;
+	long long ns;
+	int n;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do
+	{
+		n = __poller_wait(events, maxevents, 0, poller);
+		if (n != 0)
+			return n;
+
+		sched_yield();
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (__elapsed_ns(&start, &now) < poller->spin_ns);
+
+	start = now;
+	n = __poller_wait(events, maxevents, -1, poller);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = __elapsed_ns(&start, &now);
+	if (ns <= poller->busy_poll_ns)
+	{
+		if (poller->spin_ns < POLLER_SPIN_MIN_NS)
+			poller->spin_ns = POLLER_SPIN_MIN_NS;
+		else
+			poller->spin_ns *= 2;
+
+		if (poller->spin_ns > poller->busy_poll_ns)
+			poller->spin_ns = poller->busy_poll_ns;
+	}
+	else
+		poller->spin_ns /= 2;
+
+	return n;
+}
+
 static void *__poller_thread_routine(void *arg)
 {
 	poller_t *poller = (poller_t *)arg;
@@ -971,7 +2281,10 @@ static void *__poller_thread_routine(void *arg)
 	while (1)
 	{
 		__poller_set_timer(poller);
-		nevents = __poller_wait(events, POLLER_EVENTS_MAX, poller);
+		if (poller->busy_poll_ns > 0)
+			nevents = __poller_busy_wait(events, POLLER_EVENTS_MAX, poller);
+		else
+			nevents = __poller_wait(events, POLLER_EVENTS_MAX, -1, poller);
 		clock_gettime(CLOCK_MONOTONIC, &time_node.timeout);
 		has_pipe_event = 0;
 		for (i = 0; i < nevents; i++)
@@ -1073,13 +2386,22 @@ static int __poller_create_timer(poller_t *poller)
 
 poller_t *__poller_create(void **nodes_buf, const struct poller_params *params)
 {
-	poller_t *poller = (poller_t *)malloc(sizeof (poller_t));
+	poller_t *poller;
 	int ret;
 
+	pthread_once(&__poller_slab_once, __poller_create_slab);
+	if (!__poller_node_slab)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	poller = (poller_t *)malloc(sizeof (poller_t));
 	if (!poller)
 		return NULL;
 
-	poller->pfd = __poller_create_pfd();
+	poller->stopped = 1;
+	poller->pfd = __poller_create_pfd(params->backend, poller);
 	if (poller->pfd >= 0)
 	{
 		if (__poller_create_timer(poller) >= 0)
@@ -1087,28 +2409,35 @@ poller_t *__poller_create(void **nodes_buf, const struct poller_params *params)
 			ret = pthread_mutex_init(&poller->mutex, NULL);
 			if (ret == 0)
 			{
-				poller->nodes = (struct __poller_node **)nodes_buf;
-				poller->max_open_files = params->max_open_files;
-				poller->create_message = params->create_message;
-				poller->partial_written = params->partial_written;
-				poller->cb = params->callback;
-				poller->ctx = params->context;
-
-				poller->timeo_tree.rb_node = NULL;
-				poller->tree_first = NULL;
-				poller->tree_last = NULL;
-				INIT_LIST_HEAD(&poller->timeo_list);
-				INIT_LIST_HEAD(&poller->no_timeo_list);
+				poller->wheel = NULL;
+				if (!params->timer_wheel || __poller_create_wheel(poller) >= 0)
+				{
+					poller->nodes = (struct __poller_node **)nodes_buf;
+					poller->max_open_files = params->max_open_files;
+					poller->create_message = params->create_message;
+					poller->partial_written = params->partial_written;
+					poller->cb = params->callback;
+					poller->ctx = params->context;
+					poller->busy_poll_ns = params->busy_poll * 1000LL;
+					poller->spin_ns = poller->busy_poll_ns;
+
+					poller->timeo_tree.rb_node = NULL;
+					poller->tree_first = NULL;
+					poller->tree_last = NULL;
+					INIT_LIST_HEAD(&poller->timeo_list);
+					INIT_LIST_HEAD(&poller->no_timeo_list);
+					return poller;
+				}
 
-				poller->stopped = 1;
-				return poller;
+				ret = errno;
+				pthread_mutex_destroy(&poller->mutex);
 			}
 
 			errno = ret;
 			close(poller->timerfd);
 		}
 
-		close(poller->pfd);
+		__poller_close_pfd(poller);
 	}
 
 	free(poller);
@@ -1134,9 +2463,10 @@ poller_t *poller_create(const struct poller_params *params)
 
 void __poller_destroy(poller_t *poller)
 {
+	free(poller->wheel);
 	pthread_mutex_destroy(&poller->mutex);
 	close(poller->timerfd);
-	close(poller->pfd);
+	__poller_close_pfd(poller);
 	free(poller);
 }
 
@@ -1146,6 +2476,11 @@ void poller_destroy(poller_t *poller)
 	__poller_destroy(poller);
 }
 
+void poller_free_result(struct poller_result *result)
+{
+	__poller_node_free((struct __poller_node *)result);
+}
+
 int poller_start(poller_t *poller)
 {
 	pthread_t tid;
@@ -1177,6 +2512,12 @@ static void __poller_insert_node(struct __poller_node *node,
 {
 	struct __poller_node *end;
 
+	if (poller->wheel && node->data.fd >= 0)
+	{
+		__poller_wheel_insert(node, poller);
+		return;
+	}
+
 	end = list_entry(poller->timeo_list.prev, struct __poller_node, list);
 	if (list_empty(&poller->timeo_list))
 	{
@@ -1198,7 +2539,11 @@ static void __poller_insert_node(struct __poller_node *node,
 	}
 
 	if (!poller->tree_first || __timeout_cmp(node, end) < 0)
+	{
 		__poller_set_timerfd(poller->timerfd, &node->timeout, poller);
+		if (poller->wheel)
+			poller->wheel->timer = __timeout_ticks(&node->timeout);
+	}
 }
 
 static void __poller_node_set_timeout(int timeout, struct __poller_node *node)
@@ -1269,18 +2614,19 @@ int poller_add(const struct poller_data *data, int timeout, poller_t *poller)
 
 	if (need_res)
 	{
-		res = (struct __poller_node *)malloc(sizeof (struct __poller_node));
+		res = __poller_node_alloc();
 		if (!res)
 			return -1;
 	}
 
-	node = (struct __poller_node *)malloc(sizeof (struct __poller_node));
+	node = __poller_node_alloc();
 	if (node)
 	{
 		node->data = *data;
 		node->event = event;
 		node->in_rbtree = 0;
 		node->removed = 0;
+		node->paused = 0;
 		node->res = res;
 		if (timeout >= 0)
 			__poller_node_set_timeout(timeout, node);
@@ -1288,6 +2634,8 @@ int poller_add(const struct poller_data *data, int timeout, poller_t *poller)
 		pthread_mutex_lock(&poller->mutex);
 		if (!poller->nodes[data->fd])
 		{
+			/* Set before adding. The io_uring backend looks it up. */
+			poller->nodes[data->fd] = node;
 			if (__poller_add_fd(data->fd, event, node, poller) >= 0)
 			{
 				if (timeout >= 0)
@@ -1295,19 +2643,20 @@ int poller_add(const struct poller_data *data, int timeout, poller_t *poller)
 				else
 					list_add_tail(&node->list, &poller->no_timeo_list);
 
-				poller->nodes[data->fd] = node;
 				node = NULL;
 			}
+			else
+				poller->nodes[data->fd] = NULL;
 		}
 
 		pthread_mutex_unlock(&poller->mutex);
 		if (node == NULL)
 			return 0;
 
-		free(node);
+		__poller_node_free(node);
 	}
 
-	free(res);
+	__poller_node_free(res);
 	return -1;
 }
 
@@ -1338,7 +2687,7 @@ int poller_del(int fd, poller_t *poller)
 		node->state = PR_ST_DELETED;
 		if (poller->stopped)
 		{
-			free(node->res);
+			__poller_node_free(node->res);
 			poller->cb((struct poller_result *)node, poller->ctx);
 		}
 		else
@@ -1361,6 +2710,7 @@ int poller_mod(const struct poller_data *data, int timeout, poller_t *poller)
 	struct __poller_node *old;
 	int need_res;
 	int event;
+	int ret;
 
 	if ((size_t)data->fd >= poller->max_open_files)
 	{
@@ -1374,18 +2724,19 @@ int poller_mod(const struct poller_data *data, int timeout, poller_t *poller)
 
 	if (need_res)
 	{
-		res = (struct __poller_node *)malloc(sizeof (struct __poller_node));
+		res = __poller_node_alloc();
 		if (!res)
 			return -1;
 	}
 
-	node = (struct __poller_node *)malloc(sizeof (struct __poller_node));
+	node = __poller_node_alloc();
 	if (node)
 	{
 		node->data = *data;
 		node->event = event;
 		node->in_rbtree = 0;
 		node->removed = 0;
+		node->paused = 0;
 		node->res = res;
 		if (timeout >= 0)
 			__poller_node_set_timeout(timeout, node);
@@ -1394,7 +2745,13 @@ int poller_mod(const struct poller_data *data, int timeout, poller_t *poller)
 		old = poller->nodes[data->fd];
 		if (old)
 		{
-			if (__poller_mod_fd(data->fd, old->event, event, node, poller) >= 0)
+			poller->nodes[data->fd] = node;
+			if (old->paused)
+				ret = __poller_add_fd(data->fd, event, node, poller);
+			else
+				ret = __poller_mod_fd(data->fd, old->event, event, node, poller);
+
+			if (ret >= 0)
 			{
 				if (old->in_rbtree)
 					__poller_tree_erase(old, poller);
@@ -1405,7 +2762,7 @@ int poller_mod(const struct poller_data *data, int timeout, poller_t *poller)
 				old->state = PR_ST_MODIFIED;
 				if (poller->stopped)
 				{
-					free(old->res);
+					__poller_node_free(old->res);
 					poller->cb((struct poller_result *)old, poller->ctx);
 				}
 				else
@@ -1419,9 +2776,10 @@ int poller_mod(const struct poller_data *data, int timeout, poller_t *poller)
 				else
 					list_add_tail(&node->list, &poller->no_timeo_list);
 
-				poller->nodes[data->fd] = node;
 				node = NULL;
 			}
+			else
+				poller->nodes[data->fd] = old;
 		}
 		else
 			errno = ENOENT;
@@ -1430,10 +2788,10 @@ int poller_mod(const struct poller_data *data, int timeout, poller_t *poller)
 		if (node == NULL)
 			return 0;
 
-		free(node);
+		__poller_node_free(node);
 	}
 
-	free(res);
+	__poller_node_free(res);
 	return -1;
 }
 
@@ -1475,12 +2833,91 @@ int poller_set_timeout(int fd, int timeout, poller_t *poller)
 	return -!node;
 }
 
+int poller_pause(int fd, poller_t *poller)
+{
+	struct __poller_node *node;
+	int ret = -1;
+
+	if ((size_t)fd >= poller->max_open_files)
+	{
+		errno = fd < 0 ? EBADF : EMFILE;
+		return -1;
+	}
+
+	pthread_mutex_lock(&poller->mutex);
+	node = poller->nodes[fd];
+	if (!node)
+		errno = ENOENT;
+	else if (node->data.operation != PD_OP_READ)
+		errno = EINVAL;
+	else if (node->paused)
+		ret = 0;
+	else if (__poller_del_fd(fd, node->event, poller) >= 0)
+	{
+		if (node->in_rbtree)
+			__poller_tree_erase(node, poller);
+		else
+			list_del(&node->list);
+
+		list_add_tail(&node->list, &poller->no_timeo_list);
+		node->paused = 1;
+		ret = 0;
+	}
+
+	pthread_mutex_unlock(&poller->mutex);
+	return ret;
+}
+
+int poller_resume(int fd, int timeout, poller_t *poller)
+{
+	struct __poller_node time_node;
+	struct __poller_node *node;
+	int ret = -1;
+
+	if ((size_t)fd >= poller->max_open_files)
+	{
+		errno = fd < 0 ? EBADF : EMFILE;
+		return -1;
+	}
+
+	if (timeout >= 0)
+		__poller_node_set_timeout(timeout, &time_node);
+
+	pthread_mutex_lock(&poller->mutex);
+	node = poller->nodes[fd];
+	if (!node)
+		errno = ENOENT;
+	else if (!node->paused)
+		ret = 0;
+	else if (__poller_add_fd(fd, node->event, node, poller) >= 0)
+	{
+		node->paused = 0;
+		if (node->in_rbtree)
+			__poller_tree_erase(node, poller);
+		else
+			list_del(&node->list);
+
+		if (timeout >= 0)
+		{
+			node->timeout = time_node.timeout;
+			__poller_insert_node(node, poller);
+		}
+		else
+			list_add_tail(&node->list, &poller->no_timeo_list);
+
+		ret = 0;
+	}
+
+	pthread_mutex_unlock(&poller->mutex);
+	return ret;
+}
+
 int poller_add_timer(const struct timespec *value, void *context,
 					 poller_t *poller)
 {
 	struct __poller_node *node;
 
-	node = (struct __poller_node *)malloc(sizeof (struct __poller_node));
+	node = __poller_node_alloc();
 	if (node)
 	{
 		memset(&node->data, 0, sizeof (struct poller_data));
@@ -1489,6 +2926,7 @@ int poller_add_timer(const struct timespec *value, void *context,
 		node->data.context = context;
 		node->in_rbtree = 0;
 		node->removed = 0;
+		node->paused = 0;
 		node->res = NULL;
 
 		clock_gettime(CLOCK_MONOTONIC, &node->timeout);
@@ -1509,21 +2947,52 @@ int poller_add_timer(const struct timespec *value, void *context,
 	return -1;
 }
 
+int poller_bind_cpu(int cpu, poller_t *poller)
+{
+#ifdef __linux__
+	cpu_set_t cpuset;
+	int ret;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	ret = pthread_setaffinity_np(poller->tid, sizeof (cpu_set_t), &cpuset);
+	if (ret == 0)
+		return 0;
+
+	errno = ret;
+#else
+	errno = ENOSYS;
+#endif
+	return -1;
+}
+
 void poller_stop(poller_t *poller)
 {
 	struct __poller_node *node;
 	struct list_head *pos, *tmp;
 	void *p = NULL;
+	int level;
+	int i;
 
 	write(poller->pipe_wr, &p, sizeof (void *));
 	pthread_join(poller->tid, NULL);
 	poller->stopped = 1;
 
 	pthread_mutex_lock(&poller->mutex);
+#ifdef POLLER_HAS_IO_URING
+	if (poller->uring)
+	{
+		poller->uring->deferred = 0;
+		__uring_submit(poller->pfd, poller->uring);
+		poller->uring->retry = __uring_pending(poller->uring);
+	}
+#endif
+
 	poller->nodes[poller->pipe_rd] = NULL;
 	poller->nodes[poller->pipe_wr] = NULL;
 	close(poller->pipe_wr);
 	__poller_handle_pipe(poller);
+	__poller_del_fd(poller->pipe_rd, EPOLLIN, poller);
 	close(poller->pipe_rd);
 
 	poller->tree_first = NULL;
@@ -1535,6 +3004,14 @@ void poller_stop(poller_t *poller)
 		list_add(&node->list, &poller->timeo_list);
 	}
 
+	for (level = 0; poller->wheel && level < POLLER_WHEEL_LEVELS; level++)
+	{
+		for (i = 0; i < POLLER_WHEEL_SLOTS; i++)
+			list_splice_init(&poller->wheel->slots[level][i], &poller->timeo_list);
+
+		poller->wheel->bitmap[level] = 0;
+	}
+
 	list_splice_init(&poller->no_timeo_list, &poller->timeo_list);
 	list_for_each_safe(pos, tmp, &poller->timeo_list)
 	{
@@ -1548,7 +3025,7 @@ void poller_stop(poller_t *poller)
 
 		node->error = 0;
 		node->state = PR_ST_STOPPED;
-		free(node->res);
+		__poller_node_free(node->res);
 		poller->cb((struct poller_result *)node, poller->ctx);
 	}
 
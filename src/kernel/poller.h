@@ -30,6 +30,10 @@ typedef struct __poller_message poller_message_t;
 struct __poller_message
 {
 	int (*append)(const void *, size_t *, poller_message_t *);
+	/* Optional. Returns a buffer to read the next bytes into, and its size,
+	 * which must not exceed the bytes that the message still expects. The
+	 * data is then passed to append() in place. NULL means poller's buffer. */
+	void *(*get_buffer)(size_t *, poller_message_t *);
 	char data[0];
 };
 
@@ -64,8 +68,29 @@ struct poller_data
 		struct iovec *write_iov;
 		void *result;
 	};
+	/* Non-zero if the fd of a PD_OP_READ or PD_OP_WRITE is a datagram
+	 * socket. Datagrams are read with recvmmsg() into the poller buffer,
+	 * and written with sendmmsg(), where they are supported. */
+	int dgram;
 };
 
+/* A range of a file takes two write vectors: { NULL, size } followed by
+ * { file, skip }. 'file' points to a struct poller_file that stays valid
+ * till the write is done, and the range starts 'skip' bytes after its
+ * offset. It is sent with sendfile() if possible, or read into a buffer
+ * first, as with SSL. The fd is never closed by poller. */
+#define POLLER_IOV_FILE(iov)	((iov)->iov_base == NULL && (iov)->iov_len != 0)
+
+struct poller_file
+{
+	int fd;
+	off_t offset;
+};
+
+/* On a datagram socket, a vector { NULL, 0 } ends one datagram and starts
+ * the next. All the datagrams of a write go out with one sendmmsg(). */
+#define POLLER_IOV_DGRAM(iov)	((iov)->iov_base == NULL && (iov)->iov_len == 0)
+
 struct poller_result
 {
 #define PR_ST_SUCCESS		0
@@ -87,6 +112,17 @@ struct poller_params
 	int (*partial_written)(size_t, void *);
 	void (*callback)(struct poller_result *, void *);
 	void *context;
+	/* IO_URING is Linux only. Poller falls back to the default backend
+	 * (epoll or kqueue) when io_uring is not supported by the kernel. */
+#define POLLER_BACKEND_DEFAULT		0
+#define POLLER_BACKEND_IO_URING		1
+	int backend;
+	/* Keep the timeouts of fds in a timing wheel of millisecond ticks,
+	 * instead of the sorted list and rbtree that timers still use. */
+	int timer_wheel;
+	/* Microseconds to poll without blocking before the poller sleeps.
+	 * The actual spin adapts between 0 and this budget. 0 never spins. */
+	int busy_poll;
 };
 
 #ifdef __cplusplus
@@ -100,11 +136,21 @@ int poller_add(const struct poller_data *data, int timeout, poller_t *poller);
 int poller_del(int fd, poller_t *poller);
 int poller_mod(const struct poller_data *data, int timeout, poller_t *poller);
 int poller_set_timeout(int fd, int timeout, poller_t *poller);
+/* Stop reading a PD_OP_READ fd without removing it, e.g. in the append()
+ * of its message, and drop its timeout. The poller stops after the bytes
+ * already read are appended. poller_resume() restarts it with a timeout.
+ * A message that is completed resumes its fd by itself. */
+int poller_pause(int fd, poller_t *poller);
+int poller_resume(int fd, int timeout, poller_t *poller);
 int poller_add_timer(const struct timespec *value, void *context,
 					 poller_t *poller);
+int poller_bind_cpu(int cpu, poller_t *poller);
 void poller_stop(poller_t *poller);
 void poller_destroy(poller_t *poller);
 
+/* A result passed to the callback must be freed by this function. */
+void poller_free_result(struct poller_result *result);
+
 #ifdef __cplusplus
 }
 #endif
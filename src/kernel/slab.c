@@ -0,0 +1,257 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "slab.h"
+
+#define SLAB_CACHE_MAX		64
+#define SLAB_BATCH			32
+#define SLAB_DEPOT_MAX		4096
+
+/* A free object keeps the link to the next one in its first word. */
+
+struct __slab_cache
+{
+	void *head;
+	size_t count;
+	size_t hits;
+	slab_t *slab;
+};
+
+struct __slab
+{
+	const char *name;
+	size_t size;
+	void *depot;
+	size_t depot_count;
+	size_t hits;
+	size_t refills;
+	size_t misses;
+	pthread_key_t key;
+	pthread_mutex_t mutex;
+	struct __slab *next;
+};
+
+static struct __slab *__slab_list;
+static pthread_mutex_t __slab_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Move up to 'n' objects from the cache to the depot. The ones that do not
+ * fit in the depot are freed. */
+static void __slab_spill(size_t n, struct __slab_cache *cache, slab_t *slab)
+{
+	void *list = NULL;
+	void *ptr;
+
+	pthread_mutex_lock(&slab->mutex);
+	slab->hits += cache->hits;
+	cache->hits = 0;
+	while (n > 0 && cache->head)
+	{
+		ptr = cache->head;
+		cache->head = *(void **)ptr;
+		cache->count--;
+		if (slab->depot_count < SLAB_DEPOT_MAX)
+		{
+			*(void **)ptr = slab->depot;
+			slab->depot = ptr;
+			slab->depot_count++;
+		}
+		else
+		{
+			*(void **)ptr = list;
+			list = ptr;
+		}
+
+		n--;
+	}
+
+	pthread_mutex_unlock(&slab->mutex);
+	while (list)
+	{
+		ptr = list;
+		list = *(void **)ptr;
+		free(ptr);
+	}
+}
+
+static void __slab_refill(struct __slab_cache *cache, slab_t *slab)
+{
+	void *ptr;
+	size_t n;
+
+	pthread_mutex_lock(&slab->mutex);
+	slab->hits += cache->hits;
+	cache->hits = 0;
+	for (n = 0; n < SLAB_BATCH && slab->depot; n++)
+	{
+		ptr = slab->depot;
+		slab->depot = *(void **)ptr;
+		slab->depot_count--;
+		*(void **)ptr = cache->head;
+		cache->head = ptr;
+		cache->count++;
+	}
+
+	pthread_mutex_unlock(&slab->mutex);
+}
+
+static void __slab_cache_destroy(void *arg)
+{
+	struct __slab_cache *cache = (struct __slab_cache *)arg;
+
+	__slab_spill(cache->count, cache, cache->slab);
+	free(cache);
+}
+
+static struct __slab_cache *__slab_get_cache(slab_t *slab)
+{
+	struct __slab_cache *cache;
+
+	cache = (struct __slab_cache *)pthread_getspecific(slab->key);
+	if (!cache)
+	{
+		cache = (struct __slab_cache *)malloc(sizeof (struct __slab_cache));
+		if (cache)
+		{
+			cache->head = NULL;
+			cache->count = 0;
+			cache->hits = 0;
+			cache->slab = slab;
+			if (pthread_setspecific(slab->key, cache) != 0)
+			{
+				free(cache);
+				cache = NULL;
+			}
+		}
+	}
+
+	return cache;
+}
+
+slab_t *slab_create(const char *name, size_t size)
+{
+	slab_t *slab = (slab_t *)malloc(sizeof (slab_t));
+	int ret;
+
+	if (!slab)
+		return NULL;
+
+	ret = pthread_key_create(&slab->key, __slab_cache_destroy);
+	if (ret == 0)
+	{
+		ret = pthread_mutex_init(&slab->mutex, NULL);
+		if (ret == 0)
+		{
+			slab->name = name;
+			slab->size = size < sizeof (void *) ? sizeof (void *) : size;
+			slab->depot = NULL;
+			slab->depot_count = 0;
+			slab->hits = 0;
+			slab->refills = 0;
+			slab->misses = 0;
+
+			pthread_mutex_lock(&__slab_list_mutex);
+			slab->next = __slab_list;
+			__slab_list = slab;
+			pthread_mutex_unlock(&__slab_list_mutex);
+			return slab;
+		}
+
+		pthread_key_delete(slab->key);
+	}
+
+	errno = ret;
+	free(slab);
+	return NULL;
+}
+
+void *slab_alloc(slab_t *slab)
+{
+	struct __slab_cache *cache = __slab_get_cache(slab);
+	void *ptr;
+
+	if (cache)
+	{
+		if (cache->head)
+			cache->hits++;
+		else
+		{
+			__slab_refill(cache, slab);
+			if (cache->head)
+				__atomic_add_fetch(&slab->refills, 1, __ATOMIC_RELAXED);
+		}
+
+		ptr = cache->head;
+		if (ptr)
+		{
+			cache->head = *(void **)ptr;
+			cache->count--;
+			return ptr;
+		}
+	}
+
+	__atomic_add_fetch(&slab->misses, 1, __ATOMIC_RELAXED);
+	return malloc(slab->size);
+}
+
+void slab_free(void *ptr, slab_t *slab)
+{
+	struct __slab_cache *cache;
+
+	if (!ptr)
+		return;
+
+	cache = __slab_get_cache(slab);
+	if (cache)
+	{
+		*(void **)ptr = cache->head;
+		cache->head = ptr;
+		cache->count++;
+		if (cache->count > SLAB_CACHE_MAX)
+			__slab_spill(SLAB_BATCH, cache, slab);
+	}
+	else
+		free(ptr);
+}
+
+size_t slab_get_stats(struct slab_stats stats[], size_t max)
+{
+	struct __slab *slab;
+	size_t n = 0;
+
+	pthread_mutex_lock(&__slab_list_mutex);
+	for (slab = __slab_list; slab; slab = slab->next)
+	{
+		if (n < max)
+		{
+			pthread_mutex_lock(&slab->mutex);
+			stats[n].name = slab->name;
+			stats[n].size = slab->size;
+			stats[n].hits = slab->hits;
+			stats[n].refills = slab->refills;
+			stats[n].misses = slab->misses;
+			pthread_mutex_unlock(&slab->mutex);
+		}
+
+		n++;
+	}
+
+	pthread_mutex_unlock(&__slab_list_mutex);
+	return n;
+}
+
@@ -0,0 +1,60 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <stddef.h>
+
+typedef struct __slab slab_t;
+
+/*
+ * Cache of fixed-size objects. Every thread keeps a small list of free
+ * objects, and exchanges batches of them with a global depot, so that an
+ * object allocated by one thread may be freed by another. malloc() is
+ * called only when both the thread cache and the depot are empty.
+ *
+ * Slabs are registered globally and live until the process exits.
+ */
+
+struct slab_stats
+{
+	const char *name;
+	size_t size;
+	size_t hits;		/* from the cache of the calling thread */
+	size_t refills;		/* from the depot */
+	size_t misses;		/* from malloc() */
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+slab_t *slab_create(const char *name, size_t size);
+void *slab_alloc(slab_t *slab);
+void slab_free(void *ptr, slab_t *slab);
+
+/* Fill at most 'max' entries, and return the number of slabs. The counters
+ * of a thread are published when it visits the depot or exits. */
+size_t slab_get_stats(struct slab_stats stats[], size_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -139,7 +139,8 @@ static int __thrdpool_create_threads(size_t nthreads, thrdpool_t *pool)
 	return -1;
 }
 
-thrdpool_t *thrdpool_create(size_t nthreads, size_t stacksize)//创建threadpool，初始化参数
+static thrdpool_t *__thrdpool_create(size_t nthreads, size_t stacksize,
+									 int lockfree)
 {
 	thrdpool_t *pool;
 	int ret;
@@ -148,7 +149,11 @@ thrdpool_t *thrdpool_create(size_t nthreads, size_t stacksize)//创建threadpool
 	if (!pool)
 		return NULL;
 
-	pool->msgqueue = msgqueue_create((size_t)-1, 0);//-1转成无符号的long型，设置msg 中maxlen的大小，创建消息队列，消息队列在哪里put任务呢？__thrdpool_schedule里
+	if (lockfree)
+		pool->msgqueue = msgqueue_create_lockfree((size_t)-1, 0);
+	else
+		pool->msgqueue = msgqueue_create((size_t)-1, 0);
+
 	if (pool->msgqueue)
 	{
 		ret = pthread_mutex_init(&pool->mutex, NULL);
@@ -178,6 +183,16 @@ thrdpool_t *thrdpool_create(size_t nthreads, size_t stacksize)//创建threadpool
 	return NULL;
 }
 
+thrdpool_t *thrdpool_create(size_t nthreads, size_t stacksize)//创建threadpool，初始化参数
+{
+	return __thrdpool_create(nthreads, stacksize, 0);
+}
+
+thrdpool_t *thrdpool_create_lockfree(size_t nthreads, size_t stacksize)
+{
+	return __thrdpool_create(nthreads, stacksize, 1);
+}
+
 inline void __thrdpool_schedule(const struct thrdpool_task *task, void *buf,
 								thrdpool_t *pool);//?为啥没有实现，内联？
 
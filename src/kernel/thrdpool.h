@@ -47,6 +47,10 @@ extern "C"
  */
 
 thrdpool_t *thrdpool_create(size_t nthreads, size_t stacksize);
+
+/* Same, but tasks are queued by msgqueue_create_lockfree(). */
+thrdpool_t *thrdpool_create_lockfree(size_t nthreads, size_t stacksize);
+
 int thrdpool_schedule(const struct thrdpool_task *task, thrdpool_t *pool);
 int thrdpool_increase(thrdpool_t *pool);
 int thrdpool_in_pool(thrdpool_t *pool);
@@ -0,0 +1,575 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+ * The deque of each thread is a bounded ring in the Chase-Lev style. Only
+ * the owner pushes at the bottom, and every thread, the owner included,
+ * takes from the top by CAS. The owner does not pop at the bottom (LIFO),
+ * so that the continuation task of one ExecQueue does not starve the other
+ * queues that were scheduled earlier on the same thread. When the ring is
+ * full, the task goes to the inbox of the thread, a list with a mutex.
+ *
+ * A thread that is looking for a task counts itself in 'nsearching', and
+ * yields a few times before giving up. If it finds none, it sets its
+ * 'sleeping' flag, leaves 'nsearching', scans again, and then sleeps on its
+ * own condition. After publishing a task, a scheduler wakes a sleeper only
+ * when no thread is searching, because the searching thread is bound to see
+ * the task. A searcher that finds a task while more tasks are visible wakes
+ * the next sleeper, so a burst of tasks from outside costs a few wakeups
+ * rather than one per task. Waking means claiming one sleeping thread by
+ * clearing its flag, and then signaling it.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wspool.h"
+
+#define WSPOOL_DEQUE_SIZE		4096
+#define WSPOOL_SPIN_COUNT		8
+
+struct __wspool_task_entry
+{
+	void *link;
+	struct thrdpool_task task;
+};
+
+struct __wspool_worker
+{
+	long long top;
+	char pad[64 - sizeof (long long)];
+	long long bottom;
+	void *deque[WSPOOL_DEQUE_SIZE];
+	void *inbox;
+	void **inbox_tail;
+	int sleeping;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t tid;
+	size_t index;
+	wspool_t *pool;
+};
+
+struct __wspool
+{
+	struct __wspool_worker *workers;
+	size_t nthreads;
+	size_t stacksize;
+	unsigned int next;
+	int nsearching;
+	int nsleepers;
+	int terminate;
+	pthread_key_t key;
+};
+
+static int __wspool_push(struct __wspool_task_entry *entry,
+						 struct __wspool_worker *worker)
+{
+	long long b = worker->bottom;
+	long long t = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+
+	if (b - t >= WSPOOL_DEQUE_SIZE)
+		return -1;
+
+	__atomic_store_n(&worker->deque[b & (WSPOOL_DEQUE_SIZE - 1)], entry,
+					 __ATOMIC_RELAXED);
+	__atomic_store_n(&worker->bottom, b + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static struct __wspool_task_entry *__wspool_steal(struct __wspool_worker *worker)
+{
+	void *entry;
+	long long t;
+	long long b;
+
+	while (1)
+	{
+		t = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+		b = __atomic_load_n(&worker->bottom, __ATOMIC_ACQUIRE);
+		if (t >= b)
+			return NULL;
+
+		entry = __atomic_load_n(&worker->deque[t & (WSPOOL_DEQUE_SIZE - 1)],
+								__ATOMIC_RELAXED);
+		if (__atomic_compare_exchange_n(&worker->top, &t, t + 1, 0,
+										__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			return (struct __wspool_task_entry *)entry;
+	}
+}
+
+static void __wspool_inbox_put(struct __wspool_task_entry *entry,
+							   struct __wspool_worker *worker)
+{
+	entry->link = NULL;
+	pthread_mutex_lock(&worker->mutex);
+	__atomic_store_n(worker->inbox_tail, entry, __ATOMIC_RELEASE);
+	worker->inbox_tail = &entry->link;
+	pthread_mutex_unlock(&worker->mutex);
+}
+
+static struct __wspool_task_entry *__wspool_inbox_get(struct __wspool_worker *worker)
+{
+	struct __wspool_task_entry *entry;
+
+	if (!__atomic_load_n(&worker->inbox, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	pthread_mutex_lock(&worker->mutex);
+	entry = (struct __wspool_task_entry *)worker->inbox;
+	if (entry)
+	{
+		worker->inbox = entry->link;
+		if (!worker->inbox)
+			worker->inbox_tail = &worker->inbox;
+	}
+
+	pthread_mutex_unlock(&worker->mutex);
+	return entry;
+}
+
+/* Take a batch from the inbox of 'victim'. Return the first task, and move
+ * the others to the deque of 'self', where other threads may steal them.
+ * The batch is no larger than the free room of the deque. */
+static struct __wspool_task_entry *__wspool_inbox_take(struct __wspool_worker *victim,
+													   struct __wspool_worker *self)
+{
+	struct __wspool_task_entry *entry;
+	struct __wspool_task_entry *next;
+	struct __wspool_task_entry *p;
+	long long room;
+
+	if (!__atomic_load_n(&victim->inbox, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	room = WSPOOL_DEQUE_SIZE - (self->bottom -
+								__atomic_load_n(&self->top, __ATOMIC_ACQUIRE));
+	pthread_mutex_lock(&victim->mutex);
+	entry = (struct __wspool_task_entry *)victim->inbox;
+	if (entry)
+	{
+		p = entry;
+		while (room > 0 && p->link)
+		{
+			p = (struct __wspool_task_entry *)p->link;
+			room--;
+		}
+
+		victim->inbox = p->link;
+		if (!victim->inbox)
+			victim->inbox_tail = &victim->inbox;
+
+		p->link = NULL;
+	}
+
+	pthread_mutex_unlock(&victim->mutex);
+	if (entry)
+	{
+		next = (struct __wspool_task_entry *)entry->link;
+		while (next)
+		{
+			/* Read the link first. The task may run as soon as pushed. */
+			p = next;
+			next = (struct __wspool_task_entry *)p->link;
+			__wspool_push(p, self);
+		}
+	}
+
+	return entry;
+}
+
+static struct __wspool_task_entry *__wspool_find(struct __wspool_worker *worker,
+												 wspool_t *pool)
+{
+	struct __wspool_task_entry *entry;
+	struct __wspool_worker *victim;
+	size_t i;
+
+	entry = __wspool_steal(worker);
+	if (!entry)
+		entry = __wspool_inbox_take(worker, worker);
+
+	for (i = 1; !entry && i < pool->nthreads; i++)
+	{
+		victim = &pool->workers[(worker->index + i) % pool->nthreads];
+		entry = __wspool_steal(victim);
+		if (!entry)
+			entry = __wspool_inbox_take(victim, worker);
+	}
+
+	return entry;
+}
+
+static int __wspool_has_task(wspool_t *pool)
+{
+	struct __wspool_worker *worker;
+	size_t i;
+
+	for (i = 0; i < pool->nthreads; i++)
+	{
+		worker = &pool->workers[i];
+		if (__atomic_load_n(&worker->top, __ATOMIC_RELAXED) <
+				__atomic_load_n(&worker->bottom, __ATOMIC_RELAXED) ||
+			__atomic_load_n(&worker->inbox, __ATOMIC_RELAXED))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void __wspool_wakeup(wspool_t *pool);
+
+static struct __wspool_task_entry *__wspool_take(struct __wspool_worker *worker,
+												 wspool_t *pool)
+{
+	struct __wspool_task_entry *entry;
+	int i;
+
+	while (!__atomic_load_n(&pool->terminate, __ATOMIC_SEQ_CST))
+	{
+		__atomic_add_fetch(&pool->nsearching, 1, __ATOMIC_SEQ_CST);
+		entry = __wspool_find(worker, pool);
+		for (i = 0; !entry && i < WSPOOL_SPIN_COUNT; i++)
+		{
+			sched_yield();
+			entry = __wspool_find(worker, pool);
+		}
+
+		if (entry)
+		{
+			if (__atomic_sub_fetch(&pool->nsearching, 1, __ATOMIC_SEQ_CST) == 0 &&
+				__atomic_load_n(&pool->nsleepers, __ATOMIC_SEQ_CST) > 0 &&
+				__wspool_has_task(pool))
+				__wspool_wakeup(pool);
+
+			return entry;
+		}
+
+		__atomic_add_fetch(&pool->nsleepers, 1, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&worker->sleeping, 1, __ATOMIC_SEQ_CST);
+		__atomic_sub_fetch(&pool->nsearching, 1, __ATOMIC_SEQ_CST);
+		entry = __wspool_find(worker, pool);
+		if (entry || __atomic_load_n(&pool->terminate, __ATOMIC_SEQ_CST))
+		{
+			/* If a scheduler has claimed us, the signal is just lost. */
+			__atomic_store_n(&worker->sleeping, 0, __ATOMIC_SEQ_CST);
+			__atomic_sub_fetch(&pool->nsleepers, 1, __ATOMIC_SEQ_CST);
+			return entry;
+		}
+
+		pthread_mutex_lock(&worker->mutex);
+		while (__atomic_load_n(&worker->sleeping, __ATOMIC_SEQ_CST) &&
+			   !__atomic_load_n(&pool->terminate, __ATOMIC_SEQ_CST))
+			pthread_cond_wait(&worker->cond, &worker->mutex);
+
+		pthread_mutex_unlock(&worker->mutex);
+		__atomic_sub_fetch(&pool->nsleepers, 1, __ATOMIC_SEQ_CST);
+	}
+
+	return NULL;
+}
+
+static void __wspool_wakeup(wspool_t *pool)
+{
+	struct __wspool_worker *worker;
+	int sleeping;
+	size_t i;
+
+	for (i = 0; i < pool->nthreads; i++)
+	{
+		worker = &pool->workers[i];
+		sleeping = 1;
+		if (__atomic_load_n(&worker->sleeping, __ATOMIC_SEQ_CST) &&
+			__atomic_compare_exchange_n(&worker->sleeping, &sleeping, 0, 0,
+										__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		{
+			pthread_mutex_lock(&worker->mutex);
+			pthread_cond_signal(&worker->cond);
+			pthread_mutex_unlock(&worker->mutex);
+			break;
+		}
+	}
+}
+
+static void *__wspool_routine(void *arg)
+{
+	struct __wspool_worker *worker = (struct __wspool_worker *)arg;
+	wspool_t *pool = worker->pool;
+	struct __wspool_task_entry *entry;
+	void (*task_routine)(void *);
+	void *task_context;
+
+	pthread_setspecific(pool->key, worker);
+	while ((entry = __wspool_take(worker, pool)) != NULL)
+	{
+		task_routine = entry->task.routine;
+		task_context = entry->task.context;
+		free(entry);
+		task_routine(task_context);
+
+		if (pool->nthreads == 0)
+		{
+			/* Thread pool was destroyed by the task. */
+			free(pool);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static void __wspool_terminate(struct __wspool_worker *self, size_t nthreads,
+							   wspool_t *pool)
+{
+	struct __wspool_worker *worker;
+	size_t i;
+
+	__atomic_store_n(&pool->terminate, 1, __ATOMIC_SEQ_CST);
+	for (i = 0; i < nthreads; i++)
+	{
+		worker = &pool->workers[i];
+		pthread_mutex_lock(&worker->mutex);
+		pthread_cond_signal(&worker->cond);
+		pthread_mutex_unlock(&worker->mutex);
+	}
+
+	for (i = 0; i < nthreads; i++)
+	{
+		if (&pool->workers[i] != self)
+			pthread_join(pool->workers[i].tid, NULL);
+		else
+			pthread_detach(self->tid);
+	}
+}
+
+static int __wspool_create_threads(wspool_t *pool)
+{
+	pthread_attr_t attr;
+	size_t i = 0;
+	int ret;
+
+	ret = pthread_attr_init(&attr);
+	if (ret == 0)
+	{
+		if (pool->stacksize)
+			pthread_attr_setstacksize(&attr, pool->stacksize);
+
+		for (i = 0; i < pool->nthreads; i++)
+		{
+			ret = pthread_create(&pool->workers[i].tid, &attr,
+								 __wspool_routine, &pool->workers[i]);
+			if (ret != 0)
+				break;
+		}
+
+		pthread_attr_destroy(&attr);
+		if (i == pool->nthreads)
+			return 0;
+
+		__wspool_terminate(NULL, i, pool);
+	}
+
+	errno = ret;
+	return -1;
+}
+
+static int __wspool_init_workers(wspool_t *pool)
+{
+	struct __wspool_worker *worker;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < pool->nthreads; i++)
+	{
+		worker = &pool->workers[i];
+		ret = pthread_mutex_init(&worker->mutex, NULL);
+		if (ret != 0)
+			break;
+
+		ret = pthread_cond_init(&worker->cond, NULL);
+		if (ret != 0)
+		{
+			pthread_mutex_destroy(&worker->mutex);
+			break;
+		}
+
+		worker->sleeping = 0;
+		worker->top = 0;
+		worker->bottom = 0;
+		worker->inbox = NULL;
+		worker->inbox_tail = &worker->inbox;
+		worker->index = i;
+		worker->pool = pool;
+	}
+
+	if (i == pool->nthreads)
+		return 0;
+
+	while (i > 0)
+	{
+		i--;
+		pthread_cond_destroy(&pool->workers[i].cond);
+		pthread_mutex_destroy(&pool->workers[i].mutex);
+	}
+
+	errno = ret;
+	return -1;
+}
+
+static void __wspool_deinit_workers(wspool_t *pool)
+{
+	size_t i;
+
+	for (i = 0; i < pool->nthreads; i++)
+	{
+		pthread_cond_destroy(&pool->workers[i].cond);
+		pthread_mutex_destroy(&pool->workers[i].mutex);
+	}
+}
+
+wspool_t *wspool_create(size_t nthreads, size_t stacksize)
+{
+	wspool_t *pool;
+	int ret;
+
+	if (nthreads == 0)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pool = (wspool_t *)malloc(sizeof (wspool_t));
+	if (!pool)
+		return NULL;
+
+	pool->workers = (struct __wspool_worker *)
+					malloc(nthreads * sizeof (struct __wspool_worker));
+	if (pool->workers)
+	{
+		pool->nthreads = nthreads;
+		pool->stacksize = stacksize;
+		pool->next = 0;
+		pool->nsearching = 0;
+		pool->nsleepers = 0;
+		pool->terminate = 0;
+		if (__wspool_init_workers(pool) >= 0)
+		{
+			ret = pthread_key_create(&pool->key, NULL);
+			if (ret == 0)
+			{
+				if (__wspool_create_threads(pool) >= 0)
+					return pool;
+
+				ret = errno;
+				pthread_key_delete(pool->key);
+			}
+
+			errno = ret;
+			__wspool_deinit_workers(pool);
+		}
+
+		free(pool->workers);
+	}
+
+	free(pool);
+	return NULL;
+}
+
+inline void __wspool_schedule(const struct thrdpool_task *task, void *buf,
+							  wspool_t *pool);
+
+void __wspool_schedule(const struct thrdpool_task *task, void *buf,
+					   wspool_t *pool)
+{
+	struct __wspool_task_entry *entry = (struct __wspool_task_entry *)buf;
+	struct __wspool_worker *worker;
+	unsigned int n;
+
+	entry->task = *task;
+	worker = (struct __wspool_worker *)pthread_getspecific(pool->key);
+	if (!worker || __wspool_push(entry, worker) < 0)
+	{
+		if (!worker)
+		{
+			n = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+			worker = &pool->workers[n % pool->nthreads];
+		}
+
+		__wspool_inbox_put(entry, worker);
+	}
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pool->nsearching, __ATOMIC_SEQ_CST) == 0 &&
+		__atomic_load_n(&pool->nsleepers, __ATOMIC_SEQ_CST) > 0)
+		__wspool_wakeup(pool);
+}
+
+int wspool_schedule(const struct thrdpool_task *task, wspool_t *pool)
+{
+	void *buf = malloc(sizeof (struct __wspool_task_entry));
+
+	if (buf)
+	{
+		__wspool_schedule(task, buf, pool);
+		return 0;
+	}
+
+	return -1;
+}
+
+int wspool_in_pool(wspool_t *pool)
+{
+	return pthread_getspecific(pool->key) != NULL;
+}
+
+void wspool_destroy(void (*pending)(const struct thrdpool_task *),
+					wspool_t *pool)
+{
+	struct __wspool_worker *self;
+	struct __wspool_task_entry *entry;
+	size_t i;
+
+	self = (struct __wspool_worker *)pthread_getspecific(pool->key);
+	__wspool_terminate(self, pool->nthreads, pool);
+	for (i = 0; i < pool->nthreads; i++)
+	{
+		while (1)
+		{
+			entry = __wspool_steal(&pool->workers[i]);
+			if (!entry)
+				entry = __wspool_inbox_get(&pool->workers[i]);
+
+			if (!entry)
+				break;
+
+			if (pending)
+				pending(&entry->task);
+
+			free(entry);
+		}
+	}
+
+	pthread_key_delete(pool->key);
+	__wspool_deinit_workers(pool);
+	free(pool->workers);
+	if (!self)
+		free(pool);
+	else
+		pool->nthreads = 0;
+}
+
@@ -0,0 +1,53 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef _WSPOOL_H_
+#define _WSPOOL_H_
+
+#include <stddef.h>
+#include "thrdpool.h"
+
+typedef struct __wspool wspool_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Work-stealing thread pool. Every thread owns a bounded deque. A task
+ * scheduled by a pool thread goes to the deque of that thread, and a task
+ * scheduled from outside goes to the inbox of one thread (round-robin).
+ * An idle thread takes from its own deque, then its own inbox, and then
+ * steals from the others. All takes are from the oldest end, so the tasks
+ * scheduled by one thread are started in FIFO order.
+ *
+ * Same as thrdpool, a task can be scheduled by another task, even if the
+ * pool is being destroyed, and the pool can be destroyed by a task.
+ */
+
+wspool_t *wspool_create(size_t nthreads, size_t stacksize);
+int wspool_schedule(const struct thrdpool_task *task, wspool_t *pool);
+int wspool_in_pool(wspool_t *pool);
+void wspool_destroy(void (*pending)(const struct thrdpool_task *),
+					wspool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -54,6 +54,8 @@ private:
 		this->get_addr(&addr, &addrlen);
 		return socket(addr->sa_family, SOCK_DGRAM, 0);
 	}
+
+	virtual bool is_datagram() const { return true; }
 };
 
 class RouteTargetSCTP : public RouteManager::RouteTarget
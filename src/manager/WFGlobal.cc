@@ -336,9 +336,11 @@ public:
 			fio_mutex_.lock();
 			if (!fio_flag_)
 			{
+				const auto *settings = WFGlobal::get_global_settings();
+
 				fio_service_ = new __FileIOService(&scheduler_);
 				//todo EAGAIN 65536->2
-				if (fio_service_->init(8192) < 0)
+				if (fio_service_->init(8192, settings->fio_backend) < 0)
 					abort();
 
 				if (fio_service_->bind() < 0)
@@ -359,8 +361,18 @@ private:
 		fio_flag_(false)
 	{
 		const auto *settings = WFGlobal::get_global_settings();
-		if (scheduler_.init(settings->poller_threads,
-							settings->handler_threads) < 0)
+		struct CommParams params = {
+			.poller_threads		=	(size_t)settings->poller_threads,
+			.handler_threads	=	(size_t)settings->handler_threads,
+			.poller_backend		=	settings->poller_backend,
+			.handler_affinity	=	settings->handler_affinity,
+			.timer_wheel		=	settings->timer_wheel,
+			.busy_poll			=	settings->poller_busy_poll,
+			.lockfree_queue		=	settings->lockfree_queue,
+			.coalesce_output	=	settings->coalesce_output,
+		};
+
+		if (scheduler_.init(&params) < 0)
 			abort();
 
 		signal(SIGPIPE, SIG_IGN);
@@ -436,12 +448,15 @@ private:
 	__ExecManager():
 		rwlock_(PTHREAD_RWLOCK_INITIALIZER)
 	{
-		int compute_threads = WFGlobal::get_global_settings()->compute_threads;
+		const auto *settings = WFGlobal::get_global_settings();
+		int compute_threads = settings->compute_threads;
 
 		if (compute_threads <= 0)
 			compute_threads = sysconf(_SC_NPROCESSORS_ONLN);
 
-		if (compute_executor_.init(compute_threads) < 0)
+		if (compute_executor_.init(compute_threads,
+								   settings->compute_engine,
+								   settings->lockfree_queue) < 0)
 			abort();
 	}
 
@@ -509,8 +524,8 @@ static inline const char *__try_options(const char *p, const char *q,
 	return NULL;
 }
 
-static void __set_options(const char *p,
-						  int *ndots, int *attempts, bool *rotate)
+static void __set_options(const char *p, int *ndots, int *attempts,
+						  bool *rotate, bool *single_request)
 {
 	const char *start;
 	const char *opt;
@@ -536,12 +551,15 @@ static void __set_options(const char *p,
 			*attempts = atoi(opt);
 		else if ((opt = __try_options(start, p, "rotate")) != NULL)
 			*rotate = true;
+		else if ((opt = __try_options(start, p, "single-request")) != NULL)
+			*single_request = true;
 	}
 }
 
 static int __parse_resolv_conf(const char *path,
 							   std::string& url, std::string& search_list,
-							   int *ndots, int *attempts, bool *rotate)
+							   int *ndots, int *attempts, bool *rotate,
+							   bool *single_request)
 {
 	size_t bufsize = 0;
 	char *line = NULL;
@@ -559,7 +577,7 @@ static int __parse_resolv_conf(const char *path,
 		else if (strncmp(line, "search", 6) == 0)
 			__split_merge_str(line + 6, false, search_list);
 		else if (strncmp(line, "options", 7) == 0)
-			__set_options(line + 7, ndots, attempts, rotate);
+			__set_options(line + 7, ndots, attempts, rotate, single_request);
 	}
 
 	ret = ferror(fp) ? -1 : 0;
@@ -593,16 +611,21 @@ private:
 			int ndots = 1;
 			int attempts = 2;
 			bool rotate = false;
+			bool single_request = false;
 			std::string url;
 			std::string search;
 
-			__parse_resolv_conf(path, url, search, &ndots, &attempts, &rotate);
+			__parse_resolv_conf(path, url, search, &ndots, &attempts, &rotate,
+								&single_request);
 			if (url.size() == 0)
 				url = "8.8.8.8";
 
 			client_ = new WFDnsClient;
 			if (client_->init(url, search, ndots, attempts, rotate) >= 0)
+			{
+				client_->set_single_request(single_request);
 				return;
+			}
 
 			delete client_;
 			client_ = NULL;
@@ -798,6 +821,9 @@ static inline const char *__get_task_error_string(int error)
 	case WFT_ERR_MYSQL_SSL_NOT_SUPPORTED:
 		return "MySQL SSL Not Supported";
 
+	case WFT_ERR_MYSQL_STMT_PARAM_COUNT:
+		return "MySQL Statement Parameter Count Mismatch";
+
 	case WFT_ERR_KAFKA_PARSE_RESPONSE_FAILED:
 		return "Kafka parse response failed";
 
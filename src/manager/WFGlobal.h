@@ -58,6 +58,14 @@ struct WFGlobalSettings
 	int compute_threads;			///< auto-set by system CPU number if value<=0
 	const char *resolv_conf_path;
 	const char *hosts_path;
+	int poller_backend;				///< POLLER_BACKEND_IO_URING falls back to epoll if unsupported
+	int handler_affinity;			///< COMM_HANDLER_PER_POLLER gives every poller its own handler threads
+	int compute_engine;				///< EXECUTOR_ENGINE_WORK_STEALING for many small computing tasks
+	int timer_wheel;				///< 1 keeps connection timeouts in a timing wheel
+	int poller_busy_poll;			///< in microseconds, max spin of a poller before sleeping
+	int fio_backend;				///< IOS_BACKEND_IO_URING falls back to aio if unsupported
+	int lockfree_queue;				///< 1 queues poller results and computing tasks without locks
+	int coalesce_output;			///< 1 merges what a handler thread sends to one HTTP/2 connection
 };
 
 /**
@@ -75,6 +83,14 @@ static constexpr struct WFGlobalSettings GLOBAL_SETTINGS_DEFAULT =
 	.compute_threads	=	-1,
 	.resolv_conf_path	=	"/etc/resolv.conf",
 	.hosts_path			=	"/etc/hosts",
+	.poller_backend		=	POLLER_BACKEND_DEFAULT,
+	.handler_affinity	=	COMM_HANDLER_SHARED,
+	.compute_engine		=	EXECUTOR_ENGINE_THRDPOOL,
+	.timer_wheel		=	0,
+	.poller_busy_poll	=	0,
+	.fio_backend		=	IOS_BACKEND_DEFAULT,
+	.lockfree_queue		=	0,
+	.coalesce_output	=	0,
 };
 
 /**
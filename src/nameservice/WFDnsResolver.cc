@@ -300,15 +300,18 @@ void WFResolverTask::dispatch()
 		static int family = __default_family();
 		WFResourcePool *respool = WFGlobal::get_dns_respool();
 
-		if (family == AF_INET || family == AF_INET6)
+		if (family != AF_UNSPEC || !client->is_single_request())
 		{
 			auto&& cb = std::bind(&WFResolverTask::dns_single_callback,
 								  this,
 								  std::placeholders::_1);
 			WFDnsTask *dns_task = client->create_dns_task(hostname, std::move(cb));
 
+			/* Both A and AAAA, sent at once and waited for together. */
 			if (family == AF_INET6)
 				dns_task->get_req()->set_question_type(DNS_TYPE_AAAA);
+			else if (family == AF_UNSPEC)
+				dns_task->get_req()->set_extra_question_type(DNS_TYPE_AAAA);
 
 			WFConditional *cond = respool->get(dns_task);
 			series_of(this)->push_front(cond);
@@ -429,10 +432,24 @@ void WFResolverTask::dns_single_callback(void *net_dns_task)
 
 	if (dns_task->get_state() == WFT_STATE_SUCCESS)
 	{
+		protocol::DnsResponse *resp = dns_task->get_resp();
+		const protocol::DnsResponse *extra = resp->get_extra();
 		struct addrinfo *ai = NULL;
+		struct addrinfo *ai6 = NULL;
+		struct addrinfo **pai;
 		int ret;
 
-		ret = protocol::DnsUtil::getaddrinfo(dns_task->get_resp(), port_, &ai);
+		ret = protocol::DnsUtil::getaddrinfo(resp, port_, &ai);
+		if (extra && protocol::DnsUtil::getaddrinfo(extra, port_, &ai6) == 0)
+		{
+			pai = &ai;
+			while (*pai)
+				pai = &(*pai)->ai_next;
+
+			*pai = ai6;
+			ret = 0;
+		}
+
 		DnsOutput out;
 		DnsRoutine::create(&out, ret, ai);
 		dns_callback_internal(&out, dns_ttl_default_, dns_ttl_min_);
@@ -18,6 +18,7 @@
 
 #include <errno.h>
 #include <arpa/inet.h>
+#include <utility>
 #include "DnsMessage.h"
 
 #define DNS_LABELS_MAX				63
@@ -69,28 +70,29 @@ DnsMessage& DnsMessage::operator = (DnsMessage&& msg)
 	return *this;
 }
 
-int DnsMessage::encode_reply()
+int DnsMessage::encode_question(int id, int qtype,
+								std::string& buf, uint16_t *size)
 {
 	struct dns_header h;
 	const char *name;
 	const char *p;
 	size_t len;
 
-	msgbuf.clear();
-	msgbuf.reserve(DNS_HEADER_SIZE);
-	msgsize = 0;
+	buf.clear();
+	buf.reserve(DNS_HEADER_SIZE);
+	*size = 0;
 
 	// TODO encode other field
 	// pointers can only be used for occurances of a domain name where
 	// the format is not class specific
 	h = this->parser->header;
-	h.id = htons(h.id);
+	h.id = htons(id);
 	h.qdcount = htons(1);
 	h.ancount = htons(0);
 	h.nscount = htons(0);
 	h.arcount = htons(0);
 
-	msgbuf.append((const char *)&h, sizeof (struct dns_header));
+	buf.append((const char *)&h, sizeof (struct dns_header));
 	p = parser->question.qname ? parser->question.qname : ".";
 	while (*p)
 	{
@@ -107,8 +109,8 @@ int DnsMessage::encode_reply()
 
 		if (len > 0)
 		{
-			__append_uint8(msgbuf, len);
-			msgbuf.append(name, len);
+			__append_uint8(buf, len);
+			buf.append(name, len);
 		}
 
 		if (*p == '.')
@@ -116,21 +118,28 @@ int DnsMessage::encode_reply()
 	}
 
 	len = 0;
-	__append_uint8(msgbuf, len);
-	__append_uint16(msgbuf, parser->question.qtype);
-	__append_uint16(msgbuf, parser->question.qclass);
+	__append_uint8(buf, len);
+	__append_uint16(buf, qtype);
+	__append_uint16(buf, parser->question.qclass);
 
-	if (msgbuf.size() >= (1 << 16))
+	if (buf.size() >= (1 << 16))
 	{
 		errno = EOVERFLOW;
 		return -1;
 	}
 
-	msgsize = htons(msgbuf.size());
+	*size = htons(buf.size());
 
 	return 0;
 }
 
+int DnsMessage::encode_reply()
+{
+	return this->encode_question(this->parser->header.id,
+								 this->parser->question.qtype,
+								 this->msgbuf, &this->msgsize);
+}
+
 int DnsMessage::encode(struct iovec vectors[], int)
 {
 	struct iovec *p = vectors;
@@ -178,9 +187,85 @@ int DnsMessage::append(const void *buf, size_t *size)
 
 std::atomic<uint16_t> DnsRequest::req_id_;
 
-int DnsResponse::append(const void *buf, size_t *size)
+/* The extra query follows the first one as another datagram, or with its own
+ * length over TCP. */
+int DnsRequest::encode(struct iovec vectors[], int max)
+{
+	struct iovec *p;
+	int cnt;
+
+	cnt = this->DnsMessage::encode(vectors, max);
+	if (cnt < 0 || this->extra_qtype == 0)
+		return cnt;
+
+	if (cnt + 2 > max)
+	{
+		errno = EOVERFLOW;
+		return -1;
+	}
+
+	if (this->encode_question(this->extra_id, this->extra_qtype,
+							  this->extra_msgbuf, &this->extra_msgsize) < 0)
+		return -1;
+
+	p = vectors + cnt;
+	if (this->is_single_packet())
+	{
+		/* POLLER_IOV_DGRAM */
+		p->iov_base = NULL;
+		p->iov_len = 0;
+	}
+	else
+	{
+		p->iov_base = &this->extra_msgsize;
+		p->iov_len = sizeof (uint16_t);
+	}
+
+	p++;
+	p->iov_base = (void *)this->extra_msgbuf.data();
+	p->iov_len = this->extra_msgbuf.size();
+	return p - vectors + 1;
+}
+
+DnsResponse::DnsResponse(DnsResponse&& resp) :
+	DnsMessage(std::move(resp))
+{
+	this->request_id = resp.request_id;
+	this->request_name = std::move(resp.request_name);
+	this->extra = resp.extra;
+	resp.extra = NULL;
+}
+
+DnsResponse& DnsResponse::operator = (DnsResponse&& resp)
+{
+	if (&resp != this)
+	{
+		*(DnsMessage *)this = std::move(resp);
+
+		this->request_id = resp.request_id;
+		this->request_name = std::move(resp.request_name);
+		delete this->extra;
+		this->extra = resp.extra;
+		resp.extra = NULL;
+	}
+
+	return *this;
+}
+
+void DnsResponse::set_extra_request_id(uint16_t id)
+{
+	delete this->extra;
+	this->extra = new DnsResponse;
+	this->extra->set_request_id(id);
+	this->extra->request_name = this->request_name;
+	this->extra->set_single_packet(this->is_single_packet());
+	this->extra->size_limit = this->size_limit;
+}
+
+/* A reply of another query, like a late one of an earlier try, is dropped,
+ * or fails a TCP connection. */
+int DnsResponse::check_reply(int ret)
 {
-	int ret = this->DnsMessage::append(buf, size);
 	const char *qname = this->parser->question.qname;
 
 	if (ret >= 1 && (this->request_id != this->get_id() ||
@@ -202,5 +287,31 @@ int DnsResponse::append(const void *buf, size_t *size)
 	return ret;
 }
 
+/* With an extra question, the two replies come in any order, and the response
+ * is complete when both have come. */
+int DnsResponse::append(const void *buf, size_t *size)
+{
+	DnsResponse *extra = this->extra;
+	DnsResponse *resp = this;
+	int ret;
+
+	if (extra && this->parser->complete)
+		resp = extra;
+
+	ret = resp->DnsMessage::append(buf, size);
+	if (ret >= 1 && resp == this && extra && !extra->parser->complete &&
+		this->get_id() == extra->request_id)
+	{
+		std::swap(this->parser, extra->parser);
+		resp = extra;
+	}
+
+	ret = resp->check_reply(ret);
+	if (ret >= 1 && extra &&
+		!(this->parser->complete && extra->parser->complete))
+		ret = 0;
+
+	return ret;
 }
 
+}
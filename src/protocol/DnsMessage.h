@@ -188,6 +188,9 @@ protected:
 	std::string msgbuf;
 	size_t cur_size;
 
+protected:
+	int encode_question(int id, int qtype, std::string& buf, uint16_t *size);
+
 private:
 	int encode_reply();
 	int encode_truncation_reply();
@@ -203,6 +206,8 @@ public:
 	DnsRequest()
 	{
 		dns_parser_set_id(req_id_++, this->parser);
+		this->extra_qtype = 0;
+		this->extra_id = 0;
 	}
 
 	DnsRequest(DnsRequest&& req) = default;
@@ -212,6 +217,35 @@ public:
 	{
 		dns_parser_set_question(host, qtype, qclass, this->parser);
 	}
+
+	/* Ask the same name of a second type, like AAAA besides A, in another
+	 * query sent together with the first one. 0 for none. */
+	void set_extra_question_type(uint16_t qtype)
+	{
+		if (qtype != 0 && this->extra_qtype == 0)
+			this->extra_id = req_id_++;
+
+		this->extra_qtype = qtype;
+	}
+
+	int get_extra_question_type() const
+	{
+		return this->extra_qtype;
+	}
+
+	int get_extra_id() const
+	{
+		return this->extra_id;
+	}
+
+protected:
+	virtual int encode(struct iovec vectors[], int max);
+
+private:
+	uint16_t extra_qtype;
+	uint16_t extra_id;
+	std::string extra_msgbuf;
+	uint16_t extra_msgsize;
 };
 
 class DnsResponse : public DnsMessage
@@ -220,16 +254,29 @@ public:
 	DnsResponse()
 	{
 		this->request_id = 0;
+		this->extra = NULL;
 	}
 
-	DnsResponse(DnsResponse&& req) = default;
-	DnsResponse& operator = (DnsResponse&& req) = default;
+	virtual ~DnsResponse()
+	{
+		delete this->extra;
+	}
+
+	DnsResponse(DnsResponse&& resp);
+	DnsResponse& operator = (DnsResponse&& resp);
 
 	const dns_parser_t *get_parser() const
 	{
 		return this->parser;
 	}
 
+	/* The reply to the extra question of the request, or NULL if it has
+	 * none. Received along with this one. */
+	const DnsResponse *get_extra() const
+	{
+		return this->extra;
+	}
+
 	void set_request_id(uint16_t id)
 	{
 		this->request_id = id;
@@ -244,12 +291,19 @@ public:
 			req_name.pop_back();
 	}
 
+	// Inner use only
+	void set_extra_request_id(uint16_t id);
+
 protected:
 	virtual int append(const void *buf, size_t *size);
 
+private:
+	int check_reply(int ret);
+
 private:
 	uint16_t request_id;
 	std::string request_name;
+	DnsResponse *extra;
 };
 
 }
@@ -17,10 +17,15 @@
 */
 
 #include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
 #include <utility>
 #include "HttpMessage.h"
+#include "HttpUtil.h"
 
 namespace protocol
 {
@@ -32,6 +37,13 @@ struct HttpMessageBlock
 	size_t size;
 };
 
+/* A block of a file has NULL ptr. */
+struct HttpMessageFileBlock
+{
+	struct HttpMessageBlock block;
+	struct poller_file file;
+};
+
 bool HttpMessage::append_output_body(const void *buf, size_t size)
 {
 	size_t n = sizeof (struct HttpMessageBlock) + size;
@@ -67,6 +79,29 @@ bool HttpMessage::append_output_body_nocopy(const void *buf, size_t size)
 	return false;
 }
 
+bool HttpMessage::append_output_body_file(int fd, off_t offset, size_t size)
+{
+	size_t n = sizeof (struct HttpMessageFileBlock);
+	struct HttpMessageFileBlock *file;
+
+	if (size == 0)
+		return true;
+
+	file = (struct HttpMessageFileBlock *)malloc(n);
+	if (file)
+	{
+		file->block.ptr = NULL;
+		file->block.size = size;
+		file->file.fd = fd;
+		file->file.offset = offset;
+		list_add_tail(&file->block.list, &this->output_body);
+		this->output_body_size += size;
+		return true;
+	}
+
+	return false;
+}
+
 void HttpMessage::clear_output_body()
 {
 	struct HttpMessageBlock *block;
@@ -82,13 +117,172 @@ void HttpMessage::clear_output_body()
 	this->output_body_size = 0;
 }
 
-struct list_head *HttpMessage::combine_from(struct list_head *pos, size_t size)
+bool HttpMessage::set_header_pushed()
 {
-	size_t n = sizeof (struct HttpMessageBlock) + size;
-	struct HttpMessageBlock *block = (struct HttpMessageBlock *)malloc(n);
+	struct HttpMessageBlock *block;
+	char line[32];
+	int n;
+
+	if (this->output_body_size != 0)
+	{
+		n = sprintf(line, "%zx\r\n", this->output_body_size);
+		block = (struct HttpMessageBlock *)malloc(sizeof *block + n);
+		if (!block)
+			return false;
+
+		memcpy(block + 1, line, n);
+		block->ptr = block + 1;
+		block->size = n;
+		list_add(&block->list, &this->output_body);
+		this->output_body_size += n;
+		if (!this->append_output_body_nocopy("\r\n0\r\n\r\n", 7))
+			return false;
+	}
+	else if (!this->append_output_body_nocopy("0\r\n\r\n", 5))
+		return false;
+
+	this->header_pushed = true;
+	return true;
+}
+
+#define HTTP_COMPRESS_BLOCK_MAX		65536
+
+bool HttpMessage::compress_output_body(int encoding, int level)
+{
+	struct HttpMessageBlock *block = NULL;
+	struct HttpMessageBlock *entry;
+	struct list_head *pos;
+	struct list_head list;
+	http_encoder_t enc;
+	size_t block_size;
+	size_t room = 0;
+	size_t total = 0;
+	size_t left;
+	int finish;
+	long n = 0;
+
+	/* An empty body needs no coding. */
+	if (list_empty(&this->output_body))
+		return true;
+
+	list_for_each(pos, &this->output_body)
+	{
+		entry = list_entry(pos, struct HttpMessageBlock, list);
+		if (!entry->ptr)
+		{
+			errno = EINVAL;
+			return false;
+		}
+	}
+
+	if (http_encoder_init(encoding, level, &enc) < 0)
+		return false;
+
+	/* Compress block by block into new blocks of at most BLOCK_MAX. */
+	block_size = http_encoder_bound(this->output_body_size, &enc);
+	if (block_size > HTTP_COMPRESS_BLOCK_MAX)
+		block_size = HTTP_COMPRESS_BLOCK_MAX;
+
+	INIT_LIST_HEAD(&list);
+	list_for_each(pos, &this->output_body)
+	{
+		entry = list_entry(pos, struct HttpMessageBlock, list);
+		finish = (pos->next == &this->output_body);
+		left = entry->size;
+		do
+		{
+			if (room == 0)
+			{
+				block = (struct HttpMessageBlock *)
+						malloc(sizeof *block + block_size);
+				if (!block)
+				{
+					n = -1;
+					break;
+				}
+
+				block->ptr = block + 1;
+				block->size = 0;
+				list_add_tail(&block->list, &list);
+				room = block_size;
+			}
+
+			n = http_encoder_append((const char *)entry->ptr + entry->size -
+									left, &left, finish,
+									(char *)block->ptr + block->size, room,
+									&enc);
+			if (n < 0)
+				break;
+
+			block->size += n;
+			room -= n;
+			total += n;
+		} while (left > 0 || (finish && room == 0));
+
+		if (n < 0)
+			break;
+	}
+
+	http_encoder_deinit(&enc);
+	if (pos == &this->output_body)
+	{
+		/* Give the unused room of the last block back. */
+		list_del(&block->list);
+		entry = (struct HttpMessageBlock *)realloc(block,
+												   sizeof *block + block->size);
+		if (entry)
+		{
+			block = entry;
+			block->ptr = block + 1;
+		}
+
+		list_add_tail(&block->list, &list);
+		if (this->set_header_pair("Content-Encoding",
+								  http_encoding_name(encoding)))
+		{
+			this->clear_output_body();
+			list_splice(&list, &this->output_body);
+			this->output_body_size = total;
+			return true;
+		}
+	}
+
+	while (!list_empty(&list))
+	{
+		block = list_entry(list.next, struct HttpMessageBlock, list);
+		list_del(&block->list);
+		free(block);
+	}
+
+	return false;
+}
+
+/* Combine the memory blocks from pos till the next file block into one,
+ * and take the blocks combined away from *count. File blocks cannot be
+ * combined. */
+struct list_head *HttpMessage::combine_from(struct list_head *pos, int *count)
+{
+	struct HttpMessageBlock *block;
 	struct HttpMessageBlock *entry;
+	struct list_head *end;
+	size_t size = 0;
 	char *ptr;
 
+	for (end = pos; end != &this->output_body; end = end->next)
+	{
+		entry = list_entry(end, struct HttpMessageBlock, list);
+		if (!entry->ptr)
+			break;
+
+		size += entry->size;
+		(*count)--;
+	}
+
+	(*count)++;
+	if (pos->next == end)
+		return pos;
+
+	block = (struct HttpMessageBlock *)malloc(sizeof *block + size);
 	if (block)
 	{
 		block->ptr = block + 1;
@@ -103,23 +297,418 @@ struct list_head *HttpMessage::combine_from(struct list_head *pos, size_t size)
 			memcpy(ptr, entry->ptr, entry->size);
 			ptr += entry->size;
 			free(entry);
-		} while (pos != &this->output_body);
+		} while (pos != end);
 
-		list_add_tail(&block->list, &this->output_body);
+		list_add_tail(&block->list, end);
 		return &block->list;
 	}
 
 	return NULL;
 }
 
-int HttpMessage::encode(struct iovec vectors[], int max)
+static bool __is_http2_header(const struct HttpMessageHeader *header,
+							  bool is_req)
 {
-	const char *start_line[3];
+	const char *name = (const char *)header->name;
+
+	switch (header->name_len)
+	{
+	case 2:
+		/* TE is allowed only with the value "trailers". */
+		return strncasecmp(name, "TE", 2) != 0 ||
+			   (header->value_len == 8 &&
+				strncasecmp((const char *)header->value, "trailers", 8) == 0);
+	case 4:
+		/* A request carries Host as :authority. */
+		return !is_req || strncasecmp(name, "Host", 4) != 0;
+	case 7:
+		return strncasecmp(name, "Upgrade", 7) != 0;
+	case 10:
+		return strncasecmp(name, "Connection", 10) != 0 &&
+			   strncasecmp(name, "Keep-Alive", 10) != 0;
+	case 16:
+		return strncasecmp(name, "Proxy-Connection", 16) != 0;
+	case 17:
+		return strncasecmp(name, "Transfer-Encoding", 17) != 0;
+	}
+
+	return true;
+}
+
+/* The vectors that the first 'size' bytes of the body take as DATA frames. */
+static size_t __data_vectors(const struct list_head *body, size_t size,
+							 size_t frame_size)
+{
+	const struct list_head *pos = body->next;
+	const struct HttpMessageBlock *block;
+	size_t offset = 0;
+	size_t count = 0;
+	size_t len;
+	size_t n;
+
+	while (size > 0)
+	{
+		len = size < frame_size ? size : frame_size;
+		size -= len;
+		count++;
+		while (len > 0)
+		{
+			block = list_entry(pos, struct HttpMessageBlock, list);
+			n = block->size - offset < len ? block->size - offset : len;
+			if (n != 0)
+				count += block->ptr ? 1 : 2;
+
+			offset += n;
+			len -= n;
+			if (offset == block->size)
+			{
+				pos = pos->next;
+				offset = 0;
+			}
+		}
+	}
+
+	return count;
+}
+
+/* A stream of ours that fails before being sent is not reset either. */
+static void __discard_stream(http2_stream_t *stream, http2_conn_t *conn)
+{
+	stream->local_closed = 1;
+	stream->remote_closed = 1;
+	http2_conn_close_stream(stream, conn);
+}
+
+/* Copy the body from 'offset' on into the queue of the stream. */
+static int __queue_body(struct list_head *pos, size_t offset,
+						const struct list_head *end, http2_stream_t *stream,
+						http2_conn_t *conn)
+{
+	struct HttpMessageFileBlock *file;
+	struct HttpMessageBlock *block;
+	char buf[HTTP2_FRAME_SIZE_DEFAULT];
+	size_t size;
+	ssize_t n;
+
+	for (; pos != end; pos = pos->next, offset = 0)
+	{
+		block = list_entry(pos, struct HttpMessageBlock, list);
+		if (block->ptr)
+		{
+			if (http2_stream_queue_data((const char *)block->ptr + offset,
+										block->size - offset, stream,
+										conn) < 0)
+				return -1;
+
+			continue;
+		}
+
+		file = (struct HttpMessageFileBlock *)block;
+		while (offset < block->size)
+		{
+			size = block->size - offset;
+			if (size > sizeof buf)
+				size = sizeof buf;
+
+			n = pread(file->file.fd, buf, size, file->file.offset + offset);
+			if (n <= 0)
+			{
+				if (n == 0)
+					errno = EIO;
+
+				return -1;
+			}
+
+			if (http2_stream_queue_data(buf, n, stream, conn) < 0)
+				return -1;
+
+			offset += n;
+		}
+	}
+
+	return 0;
+}
+
+/* Stored in h2_buf: the connection preface if not sent yet, the HEADERS
+ * frame and its CONTINUATION frames, and the header of every DATA frame.
+ * The payloads of DATA frames are the body blocks themselves, as far as the
+ * send windows allow. The rest of the body is queued in the stream. */
+int HttpMessage::encode_http2(struct iovec vectors[], int max)
+{
+	http2_conn_t *conn = this->h2_conn;
+	const char *method = http_parser_get_method(this->parser);
+	const char *pseudo[4][2];
 	http_header_cursor_t cursor;
 	struct HttpMessageHeader header;
+	struct HttpMessageFileBlock *file;
 	struct HttpMessageBlock *block;
+	http2_stream_t *stream;
 	struct list_head *pos;
+	size_t frame_size = conn->max_frame_size;
+	size_t body_size = this->output_body_size;
+	size_t npseudo = 0;
+	size_t block_size;
+	size_t frames;
+	size_t offset;
 	size_t size;
+	size_t len;
+	size_t n;
+	char *base;
+	char *start;
+	char *p;
+	int flags;
+	int i;
+
+	if (method)
+	{
+		pseudo[0][0] = ":method";
+		pseudo[0][1] = method;
+		pseudo[1][0] = ":scheme";
+		pseudo[1][1] = "http";
+		pseudo[2][0] = ":path";
+		pseudo[2][1] = http_parser_get_uri(this->parser);
+		npseudo = 3;
+		if (!pseudo[2][1])
+		{
+			errno = EBADMSG;
+			return -1;
+		}
+	}
+	else
+	{
+		pseudo[0][0] = ":status";
+		pseudo[0][1] = http_parser_get_code(this->parser);
+		npseudo = 1;
+		if (!pseudo[0][1])
+		{
+			errno = EBADMSG;
+			return -1;
+		}
+	}
+
+	/* Leave room for :authority too. */
+	block_size = HPACK_ENCODE_MAX(0, 0);
+	for (n = 0; n < npseudo; n++)
+	{
+		block_size += HPACK_ENCODE_MAX(strlen(pseudo[n][0]),
+									   strlen(pseudo[n][1]));
+	}
+
+	http_header_cursor_init(&cursor, this->parser);
+	while (http_header_cursor_next(&header.name, &header.name_len,
+								   &header.value, &header.value_len,
+								   &cursor) == 0)
+	{
+		block_size += HPACK_ENCODE_MAX(header.name_len, header.value_len);
+	}
+
+	/* At most the whole body is sent now. */
+	frames = block_size / frame_size + 1;
+	frames += (body_size + frame_size - 1) / frame_size;
+	size = HTTP2_PREFACE_MAX + block_size + frames * HTTP2_FRAME_HEADER_SIZE;
+	base = (char *)malloc(size);
+	if (!base)
+	{
+		http_header_cursor_deinit(&cursor);
+		return -1;
+	}
+
+	if (method)
+	{
+		stream = http2_conn_open_stream(conn);
+		if (!stream)
+		{
+			http_header_cursor_deinit(&cursor);
+			free(base);
+			return -1;
+		}
+
+		this->h2_stream = stream->id;
+	}
+	else
+	{
+		/* The client has reset the stream. Nothing is sent. */
+		stream = http2_conn_find_stream(this->h2_stream, conn);
+		if (!stream)
+		{
+			http_header_cursor_deinit(&cursor);
+			free(base);
+			return 0;
+		}
+	}
+
+	size = http2_stream_window(stream, conn);
+	if (size > body_size)
+		size = body_size;
+
+	if (1 + __data_vectors(&this->output_body, size, frame_size) > (size_t)max)
+	{
+		errno = EOVERFLOW;
+		if (method)
+			__discard_stream(stream, conn);
+
+		http_header_cursor_deinit(&cursor);
+		free(base);
+		return -1;
+	}
+
+	/* Every byte after the window is queued. */
+	if (size < body_size)
+	{
+		pos = this->output_body.next;
+		offset = size;
+		while (offset >= list_entry(pos, struct HttpMessageBlock, list)->size)
+		{
+			offset -= list_entry(pos, struct HttpMessageBlock, list)->size;
+			pos = pos->next;
+		}
+
+		if (__queue_body(pos, offset, &this->output_body, stream, conn) < 0)
+		{
+			if (method)
+				__discard_stream(stream, conn);
+
+			http_header_cursor_deinit(&cursor);
+			free(base);
+			return -1;
+		}
+
+		body_size = size;
+	}
+
+	free(this->h2_buf);
+	this->h2_buf = base;
+	p = base;
+	if (!conn->settings_sent)
+		p += http2_conn_preface(p, conn);
+
+	/* Encode the block after the HEADERS frame header, and split it into
+	 * CONTINUATION frames afterwards if it is too large for one frame. */
+	start = p;
+	p += HTTP2_FRAME_HEADER_SIZE;
+	for (n = 0; n < npseudo; n++)
+	{
+		p += hpack_encode_header(pseudo[n][0], strlen(pseudo[n][0]),
+								 pseudo[n][1], strlen(pseudo[n][1]), p);
+		if (n == 0 && method)
+		{
+			http_header_cursor_rewind(&cursor);
+			if (http_header_cursor_find("Host", 4, &header.value,
+										&header.value_len, &cursor) == 0)
+			{
+				p += hpack_encode_header(":authority", 10,
+										 (const char *)header.value,
+										 header.value_len, p);
+			}
+		}
+	}
+
+	http_header_cursor_rewind(&cursor);
+	while (http_header_cursor_next(&header.name, &header.name_len,
+								   &header.value, &header.value_len,
+								   &cursor) == 0)
+	{
+		if (__is_http2_header(&header, method != NULL))
+		{
+			p += hpack_encode_header((const char *)header.name,
+									 header.name_len,
+									 (const char *)header.value,
+									 header.value_len, p);
+		}
+	}
+
+	http_header_cursor_deinit(&cursor);
+	block_size = p - start - HTTP2_FRAME_HEADER_SIZE;
+	frames = block_size / frame_size + (block_size % frame_size != 0);
+	if (frames == 0)
+		frames = 1;
+
+	for (n = frames; n-- > 0; )
+	{
+		offset = n * frame_size;
+		len = n == frames - 1 ? block_size - offset : frame_size;
+		p = start + n * (HTTP2_FRAME_HEADER_SIZE + frame_size);
+		memmove(p + HTTP2_FRAME_HEADER_SIZE,
+				start + HTTP2_FRAME_HEADER_SIZE + offset, len);
+		flags = n == frames - 1 ? HTTP2_FLAG_END_HEADERS : 0;
+		if (n == 0)
+		{
+			if (this->output_body_size == 0)
+				flags |= HTTP2_FLAG_END_STREAM;
+
+			http2_frame_header(len, HTTP2_HEADERS, flags, stream->id, p);
+		}
+		else
+		{
+			http2_frame_header(len, HTTP2_CONTINUATION, flags,
+							   stream->id, p);
+		}
+	}
+
+	p = start + frames * HTTP2_FRAME_HEADER_SIZE + block_size;
+
+	vectors[0].iov_base = base;
+	vectors[0].iov_len = p - base;
+	i = 1;
+
+	http2_stream_consume_window(body_size, stream, conn);
+	size = this->output_body_size - body_size;
+	pos = this->output_body.next;
+	offset = 0;
+	while (body_size > 0)
+	{
+		len = body_size < frame_size ? body_size : frame_size;
+		body_size -= len;
+		/* The queued part, if any, ends the stream instead. */
+		flags = body_size == 0 && size == 0 ? HTTP2_FLAG_END_STREAM : 0;
+		http2_frame_header(len, HTTP2_DATA, flags, stream->id, p);
+		vectors[i].iov_base = p;
+		vectors[i].iov_len = HTTP2_FRAME_HEADER_SIZE;
+		p += HTTP2_FRAME_HEADER_SIZE;
+		i++;
+
+		while (len > 0)
+		{
+			block = list_entry(pos, struct HttpMessageBlock, list);
+			n = block->size - offset < len ? block->size - offset : len;
+			if (n != 0)
+			{
+				if (block->ptr)
+				{
+					vectors[i].iov_base = (char *)block->ptr + offset;
+					vectors[i].iov_len = n;
+					i++;
+				}
+				else
+				{
+					file = (struct HttpMessageFileBlock *)block;
+					vectors[i].iov_base = NULL;
+					vectors[i].iov_len = n;
+					vectors[i + 1].iov_base = &file->file;
+					vectors[i + 1].iov_len = offset;
+					i += 2;
+				}
+			}
+
+			offset += n;
+			len -= n;
+			if (offset == block->size)
+			{
+				pos = pos->next;
+				offset = 0;
+			}
+		}
+	}
+
+	http2_stream_end(stream, conn);
+	return i;
+}
+
+int HttpMessage::encode_header(struct iovec vectors[], int max)
+{
+	const char *start_line[3];
+	http_header_cursor_t cursor;
+	struct HttpMessageHeader header;
 	int i;
 
 	start_line[0] = http_parser_get_method(this->parser);
@@ -179,23 +768,71 @@ int HttpMessage::encode(struct iovec vectors[], int max)
 
 	vectors[i].iov_base = (void *)"\r\n";
 	vectors[i].iov_len = 2;
-	i++;
+	return i + 1;
+}
+
+int HttpMessage::encode(struct iovec vectors[], int max)
+{
+	struct HttpMessageFileBlock *file;
+	struct HttpMessageBlock *block;
+	struct list_head *pos;
+	int i = 0;
+	int n;
+
+	if (this->is_http2())
+		return this->encode_http2(vectors, max);
+
+	if (!this->header_pushed)
+	{
+		i = this->encode_header(vectors, max);
+		if (i < 0)
+			return -1;
+	}
+
+	n = 0;
+	list_for_each(pos, &this->output_body)
+	{
+		block = list_entry(pos, struct HttpMessageBlock, list);
+		n += block->ptr ? 1 : 2;
+	}
 
-	size = this->output_body_size;
+	/* n is the vectors that the rest of the body takes. When they are too
+	 * many, the memory blocks till the next file block take only one. */
 	list_for_each(pos, &this->output_body)
 	{
-		if (i + 1 == max && pos != this->output_body.prev)
+		block = list_entry(pos, struct HttpMessageBlock, list);
+		if (block->ptr && i + n > max)
 		{
-			pos = this->combine_from(pos, size);
+			pos = this->combine_from(pos, &n);
 			if (!pos)
 				return -1;
+
+			block = list_entry(pos, struct HttpMessageBlock, list);
 		}
 
-		block = list_entry(pos, struct HttpMessageBlock, list);
-		vectors[i].iov_base = (void *)block->ptr;
-		vectors[i].iov_len = block->size;
-		size -= block->size;
-		i++;
+		if (i + (block->ptr ? 1 : 2) > max)
+		{
+			errno = EOVERFLOW;
+			return -1;
+		}
+
+		n -= block->ptr ? 1 : 2;
+
+		if (block->ptr)
+		{
+			vectors[i].iov_base = (void *)block->ptr;
+			vectors[i].iov_len = block->size;
+			i++;
+		}
+		else
+		{
+			file = (struct HttpMessageFileBlock *)block;
+			vectors[i].iov_base = NULL;
+			vectors[i].iov_len = block->size;
+			vectors[i + 1].iov_base = &file->file;
+			vectors[i + 1].iov_len = 0;
+			i += 2;
+		}
 	}
 
 	return i;
@@ -203,11 +840,30 @@ int HttpMessage::encode(struct iovec vectors[], int max)
 
 inline int HttpMessage::append(const void *buf, size_t *size)
 {
-	int ret = http_parser_append_message(buf, size, this->parser);
+	int ret;
+
+	if (this->body_sink || this->header_callback)
+		this->body_streaming = true;
+
+	if (!this->body_streaming)
+		ret = http_parser_append_message(buf, size, this->parser);
+	else
+	{
+		ret = http_parser_append_stream(buf, size, HttpMessage::stream_callback,
+										this, this->parser);
+		/* A body kept without a sink is not chunked any more. */
+		if (ret > 0 && !this->body_sink)
+			this->parser->chunked = 0;
+	}
 
 	if (ret >= 0)
 	{
-		this->cur_size += *size;
+		/* A streamed body is not kept, and not counted. */
+		if (!this->body_streaming)
+			this->cur_size += *size;
+		else
+			this->cur_size = this->parser->msgsize;
+
 		if (this->cur_size > this->size_limit)
 		{
 			errno = EMSGSIZE;
@@ -223,6 +879,413 @@ inline int HttpMessage::append(const void *buf, size_t *size)
 	return ret;
 }
 
+/* A client receives the frames of all its streams in the message that
+ * reads the connection. Each of them goes to the message of its stream. */
+int HttpMessage::append_http2(const void *buf, size_t *size)
+{
+	http2_conn_t *conn = this->h2_conn;
+	const char *p = (const char *)buf;
+	const char *end = p + *size;
+	http2_stream_t *stream;
+	http_parser_t *parser;
+	HttpMessage *msg;
+	size_t n;
+	int ret;
+
+	this->h2_complete = NULL;
+	this->h2_error = 0;
+	do
+	{
+		n = end - p;
+		ret = http2_parser_append_message(p, &n, &stream, conn);
+		p += n;
+		if (ret < 0 || !stream)
+			continue;
+
+		if (conn->is_server)
+		{
+			/* Of a server, only a complete request is taken. */
+			if (ret == 0)
+			{
+				if (stream->parser->msgsize > this->size_limit)
+				{
+					errno = EMSGSIZE;
+					ret = -1;
+				}
+
+				continue;
+			}
+
+			http2_stream_take_message(this->parser, stream);
+			this->h2_stream = stream->id;
+			msg = this;
+		}
+		else
+		{
+			msg = (HttpMessage *)stream->context;
+			if (stream->reset)
+			{
+				this->h2_complete = msg;
+				this->h2_error = ECONNRESET;
+				http2_conn_close_stream(stream, conn);
+				continue;
+			}
+
+			msg->renew();
+		}
+
+		parser = msg->parser;
+		if (http_parser_header_complete(parser))
+			msg->header_received();
+
+		if (msg->body_sink && http_parser_header_complete(parser))
+		{
+			if (parser->msgsize > parser->header_offset)
+			{
+				if (msg->stream_body((char *)parser->msgbuf +
+										parser->header_offset,
+									 parser->msgsize - parser->header_offset) < 0)
+					ret = -1;
+
+				parser->msgsize = parser->header_offset;
+			}
+		}
+
+		msg->cur_size = parser->msgsize;
+		if (ret >= 0 && msg->cur_size > msg->size_limit)
+		{
+			errno = EMSGSIZE;
+			ret = -1;
+		}
+
+		/* Of a client, the stream fails alone, and is reset. */
+		if (ret < 0 && !conn->is_server)
+		{
+			this->h2_error = errno;
+			ret = 1;
+		}
+
+		if (ret > 0)
+		{
+			this->h2_complete = msg;
+			if (!conn->is_server)
+				http2_conn_close_stream(stream, conn);
+		}
+	} while (ret == 0 && p < end);
+
+	if (ret == -2)
+	{
+		errno = EBADMSG;
+		ret = -1;
+	}
+
+	/* Answers to the control frames of the peer, and the queued DATA. */
+	if (ret >= 0 && conn->out_size != 0)
+	{
+		int n = this->feedback(conn->out, conn->out_size);
+
+		if (n != (int)conn->out_size)
+		{
+			if (n >= 0)
+				errno = EAGAIN;
+			ret = -1;
+		}
+	}
+
+	conn->out_size = 0;
+	*size = p - (const char *)buf;
+	return ret;
+}
+
+CommMessageIn *HttpMessage::get_complete(int *error)
+{
+	*error = this->h2_error;
+	if (this->h2_complete)
+		return this->h2_complete;
+
+	return this;
+}
+
+/* The stream of a client message given up is reset, so that nothing more
+ * comes to the message. */
+void HttpMessage::cancel()
+{
+	http2_conn_t *conn = this->h2_conn;
+	http2_stream_t *stream;
+
+	if (!this->is_http2() || conn->is_server)
+		return;
+
+	stream = http2_conn_find_stream(this->h2_stream, conn);
+	if (stream && stream->context == this)
+	{
+		http2_conn_close_stream(stream, conn);
+		if (conn->out_size != 0)
+		{
+			this->feedback(conn->out, conn->out_size);
+			conn->out_size = 0;
+		}
+	}
+}
+
+void HttpMessage::set_http2_stream(unsigned int stream_id)
+{
+	http2_stream_t *stream;
+
+	this->h2_stream = stream_id;
+	if (this->parser->is_resp && this->h2_conn && !this->h2_conn->is_server)
+	{
+		stream = http2_conn_find_stream(stream_id, this->h2_conn);
+		if (stream)
+		{
+			stream->parser = this->parser;
+			stream->context = this;
+		}
+	}
+}
+
+/* Start decoding the body if it has a content coding we know. */
+int HttpMessage::init_decoder(size_t reserve)
+{
+	http_header_cursor_t cursor;
+	const void *value;
+	size_t value_len;
+	int encoding = -1;
+
+	http_header_cursor_init(&cursor, this->parser);
+	if (http_header_cursor_find("Content-Encoding", 16, &value,
+								&value_len, &cursor) == 0)
+		encoding = http_encoding_parse((const char *)value, value_len);
+
+	http_header_cursor_deinit(&cursor);
+	if (encoding <= HTTP_ENCODING_IDENTITY)
+	{
+		this->decode_offset = (size_t)-1;
+		return 0;
+	}
+
+	this->decoder = new http_decoder_t;
+	if (http_decoder_init(encoding, reserve, this->decoder) < 0)
+	{
+		delete this->decoder;
+		this->decoder = NULL;
+		return -1;
+	}
+
+	this->decode_offset = reserve;
+	return 0;
+}
+
+/* The body is complete. Its encoded data must be complete too. */
+int HttpMessage::finish_decoder()
+{
+	http_decoder_t *decoder = this->decoder;
+	int ret = 0;
+
+	if (!decoder)
+		return 0;
+
+	/* No data at all is an empty body. */
+	if (decoder->buf && !decoder->finished)
+	{
+		errno = EBADMSG;
+		ret = -1;
+	}
+
+	http_decoder_deinit(decoder);
+	delete decoder;
+	this->decoder = NULL;
+	this->decode_offset = (size_t)-1;
+	return ret;
+}
+
+/* Decode the body received so far, and when the message is complete, make
+ * the decoded data the body of the parser. Of a chunked body, only the
+ * complete chunks are decoded, the chunk lines are skipped. */
+int HttpMessage::decode_body()
+{
+	http_parser_t *parser = this->parser;
+	http_decoder_t *decoder;
+	const char *msgbuf;
+	const char *line;
+	const char *data;
+	size_t size;
+	int ret = 0;
+
+	if (!http_parser_header_complete(parser))
+		return 0;
+
+	/* Not encoded, or done already. */
+	if (!this->decoder && this->decode_offset == (size_t)-1)
+		return 0;
+
+	if (!this->decoder)
+	{
+		if (this->init_decoder(parser->header_offset) < 0)
+			return -1;
+
+		if (!this->decoder)
+			return 0;
+	}
+
+	decoder = this->decoder;
+	msgbuf = (const char *)parser->msgbuf;
+	if (!parser->chunked)
+	{
+		size = parser->msgsize - this->decode_offset;
+		ret = http_decoder_append(msgbuf + this->decode_offset, size, decoder);
+		this->decode_offset = parser->msgsize;
+	}
+	else
+	{
+		/* Every chunk before chunk_offset has been checked by the parser. */
+		while (ret == 0 && this->decode_offset < parser->chunk_offset)
+		{
+			line = msgbuf + this->decode_offset;
+			size = strtoul(line, NULL, 16);
+			if (size == 0)
+				break;
+
+			data = (const char *)memchr(line, '\n', parser->chunk_offset -
+											   this->decode_offset) + 1;
+			ret = http_decoder_append(data, size, decoder);
+			this->decode_offset = data + size + 2 - msgbuf;
+		}
+	}
+
+	if (ret == -2)
+	{
+		errno = EBADMSG;
+		return -1;
+	}
+
+	if (ret == 0 && decoder->size > this->size_limit)
+	{
+		errno = EMSGSIZE;
+		ret = -1;
+	}
+
+	if (ret == 0 && parser->complete)
+	{
+		if (!decoder->buf)
+			parser->msgsize = parser->header_offset;
+		else if (decoder->finished)
+		{
+			memcpy(decoder->buf, msgbuf, parser->header_offset);
+			free(parser->msgbuf);
+			parser->msgbuf = decoder->buf;
+			parser->bufsize = decoder->bufsize;
+			parser->msgsize = parser->header_offset + decoder->size;
+			decoder->buf = NULL;
+		}
+
+		parser->chunked = 0;
+		ret = this->finish_decoder();
+	}
+
+	return ret;
+}
+
+#define HTTP_STREAM_PIECE_SIZE	16384
+
+/* A piece of a streamed body, which goes to the sink, decoded if needed.
+ * Encoded data is decoded a piece at a time, to keep the output small. */
+int HttpMessage::stream_body(const void *buf, size_t size)
+{
+	http_decoder_t *decoder;
+	const char *p = (const char *)buf;
+	size_t n;
+	int ret;
+
+	this->header_received();
+	if (!this->body_sink)
+		return http_parser_append_body(buf, size, this->parser);
+
+	if (this->decompress && !this->decoder &&
+		this->decode_offset != (size_t)-1)
+	{
+		if (this->init_decoder(0) < 0)
+			return -1;
+	}
+
+	decoder = this->decoder;
+	if (!decoder)
+	{
+		if (this->body_sink(buf, size))
+			return 0;
+
+		errno = ECANCELED;
+		return -1;
+	}
+
+	while (size > 0)
+	{
+		n = size < HTTP_STREAM_PIECE_SIZE ? size : HTTP_STREAM_PIECE_SIZE;
+		ret = http_decoder_append(p, n, decoder);
+		if (ret < 0)
+		{
+			if (ret == -2)
+				errno = EBADMSG;
+
+			return -1;
+		}
+
+		if (decoder->size != 0)
+		{
+			if (!this->body_sink(decoder->buf, decoder->size))
+			{
+				errno = ECANCELED;
+				return -1;
+			}
+
+			decoder->size = 0;
+		}
+
+		p += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+int HttpMessage::stream_callback(const void *buf, size_t size, void *context)
+{
+	return ((HttpMessage *)context)->stream_body(buf, size);
+}
+
+/* The header callback runs once, before any of the body. */
+void HttpMessage::header_received()
+{
+	std::function<void ()> callback;
+
+	if (this->header_callback)
+	{
+		callback = std::move(this->header_callback);
+		this->header_callback = nullptr;
+		callback();
+	}
+}
+
+bool HttpMessage::end_parsing()
+{
+	http_parser_close_message(this->parser);
+	if (this->body_sink)
+		return this->finish_decoder() == 0;
+
+	if (this->decompress)
+		return this->decode_body() == 0;
+
+	return true;
+}
+
+void *HttpMessage::get_buffer(size_t *size)
+{
+	if (this->is_http2() || this->body_streaming)
+		return NULL;
+
+	return http_parser_get_buffer(size, this->parser);
+}
+
 HttpMessage::HttpMessage(HttpMessage&& msg) :
 	ProtocolMessage(std::move(msg))
 {
@@ -234,6 +1297,23 @@ HttpMessage::HttpMessage(HttpMessage&& msg) :
 	this->output_body_size = msg.output_body_size;
 	msg.output_body_size = 0;
 
+	this->h2_conn = msg.h2_conn;
+	msg.h2_conn = NULL;
+	this->h2_stream = msg.h2_stream;
+	this->h2_complete = NULL;
+	this->h2_error = 0;
+	this->h2_buf = msg.h2_buf;
+	msg.h2_buf = NULL;
+
+	this->decompress = msg.decompress;
+	this->body_streaming = msg.body_streaming;
+	this->body_sink = std::move(msg.body_sink);
+	this->header_callback = std::move(msg.header_callback);
+	this->decoder = msg.decoder;
+	msg.decoder = NULL;
+	this->decode_offset = msg.decode_offset;
+	this->header_pushed = msg.header_pushed;
+
 	this->cur_size = msg.cur_size;
 	msg.cur_size = 0;
 }
@@ -258,6 +1338,30 @@ HttpMessage& HttpMessage::operator = (HttpMessage&& msg)
 		this->output_body_size = msg.output_body_size;
 		msg.output_body_size = 0;
 
+		this->h2_conn = msg.h2_conn;
+		msg.h2_conn = NULL;
+		this->h2_stream = msg.h2_stream;
+		this->h2_complete = NULL;
+		this->h2_error = 0;
+		free(this->h2_buf);
+		this->h2_buf = msg.h2_buf;
+		msg.h2_buf = NULL;
+
+		this->decompress = msg.decompress;
+		this->body_streaming = msg.body_streaming;
+		this->body_sink = std::move(msg.body_sink);
+		this->header_callback = std::move(msg.header_callback);
+		if (this->decoder)
+		{
+			http_decoder_deinit(this->decoder);
+			delete this->decoder;
+		}
+
+		this->decoder = msg.decoder;
+		msg.decoder = NULL;
+		this->decode_offset = msg.decode_offset;
+		this->header_pushed = msg.header_pushed;
+
 		this->cur_size = msg.cur_size;
 		msg.cur_size = 0;
 	}
@@ -314,10 +1418,44 @@ int HttpRequest::handle_expect_continue()
 	return 0;
 }
 
+bool HttpRequest::is_http2_preface() const
+{
+	const char *method = http_parser_get_method(this->parser);
+	const char *uri = http_parser_get_uri(this->parser);
+	const char *version = http_parser_get_version(this->parser);
+
+	return strcmp(method, "PRI") == 0 && strcmp(uri, "*") == 0 &&
+		   strcmp(version, "HTTP/2.0") == 0 &&
+		   list_empty(&this->parser->header_list);
+}
+
 int HttpRequest::append(const void *buf, size_t *size)
 {
+	if (this->is_http2())
+		return this->append_http2(buf, size);
+
+	size_t total = *size;
 	int ret = HttpMessage::append(buf, size);
 
+	/* "PRI * HTTP/2.0\r\n\r\n" is parsed as a request without body. */
+	if (ret > 0 && this->h2_conn && this->is_http2_preface())
+	{
+		size_t n = total - *size;
+
+		http_parser_deinit(this->parser);
+		http_parser_init(0, this->parser);
+		if (http2_conn_enable(this->h2_conn) < 0 || this->multiplex() < 0)
+			return -1;
+
+		ret = this->append_http2((const char *)buf + *size, &n);
+		*size += n;
+		return ret;
+	}
+
+	/* The body may have come with the header, but not always. */
+	if (ret >= 0 && http_parser_header_complete(this->parser))
+		this->header_received();
+
 	if (ret == 0)
 	{
 		if (this->parser->expect_continue &&
@@ -338,10 +1476,46 @@ int HttpRequest::append(const void *buf, size_t *size)
 	return ret;
 }
 
+int HttpResponse::end_http2()
+{
+	/* HTTP/2 has no reason phrase. */
+	HttpUtil::set_response_status(this,
+								  atoi(http_parser_get_code(this->parser)));
+	if (this->decompress)
+	{
+		if (this->body_sink)
+		{
+			if (this->finish_decoder() < 0)
+				return -1;
+		}
+		else if (this->decode_body() < 0)
+			return -1;
+	}
+
+	return 1;
+}
+
 int HttpResponse::append(const void *buf, size_t *size)
 {
-	int ret = HttpMessage::append(buf, size);
+	HttpResponse *resp;
+	int ret;
+
+	if (this->is_http2())
+	{
+		ret = this->append_http2(buf, size);
+		if (ret <= 0)
+			return ret;
+
+		/* The response of another stream may be the one completed, or
+		 * failed alone. */
+		resp = static_cast<HttpResponse *>(this->h2_complete);
+		if (this->h2_error == 0 && resp->end_http2() < 0)
+			this->h2_error = errno;
+
+		return 1;
+	}
 
+	ret = HttpMessage::append(buf, size);
 	if (ret > 0)
 	{
 		if (strcmp(http_parser_get_code(this->parser), "100") == 0)
@@ -352,6 +1526,17 @@ int HttpResponse::append(const void *buf, size_t *size)
 		}
 	}
 
+	if (ret >= 0 && this->decompress)
+	{
+		if (this->body_sink)
+		{
+			if (ret > 0 && this->finish_decoder() < 0)
+				ret = -1;
+		}
+		else if (this->decode_body() < 0)
+			ret = -1;
+	}
+
 	return ret;
 }
 
@@ -19,12 +19,17 @@
 #ifndef _HTTPMESSAGE_H_
 #define _HTTPMESSAGE_H_
 
+#include <sys/types.h>
+#include <stdlib.h>
 #include <string.h>
 #include <utility>
 #include <string>
+#include <functional>
 #include "list.h"
 #include "ProtocolMessage.h"
 #include "http_parser.h"
+#include "http2_parser.h"
+#include "http_encoding.h"
 
 /**
  * @file   HttpMessage.h
@@ -121,11 +126,20 @@ public:
 	/* Call when the message is incomplete, but you want the parsed body.
 	 * If get_parse_body() still returns false after calling this function,
 	 * even header is incomplete. In a success state task, messages are
-	 * always complete. */
-	void end_parsing()
-	{
-		http_parser_close_message(this->parser);
-	}
+	 * always complete. Returns false if the body can not be decoded.
+	 * API change: this used to return void, so a pointer to it, typed
+	 * 'void (HttpMessage::*)()', no longer compiles. */
+	bool end_parsing();
+
+	/* Flow control of a body sink. Call pause_receiving() in the sink, and
+	 * the connection is read no more after the bytes already read reach
+	 * the sink, till resume_receiving() is called in any thread. No
+	 * timeout runs while paused, so always resume, but never after the
+	 * callback of the task: the bytes already read may complete the
+	 * message, which resumes it by itself. Returns false on error, e.g.
+	 * pausing in a sink called by end_parsing(). */
+	bool pause_receiving() { return this->pause() >= 0; }
+	bool resume_receiving() { return this->resume() >= 0; }
 
 	/* Output body is for sending. Want to transfer a message received, maybe:
 	 * msg->get_parsed_body(&body, &size);
@@ -144,6 +158,12 @@ public:
 		return this->append_output_body_nocopy(buf, strlen(buf));
 	}
 
+	/* Send 'size' bytes of an open file from 'offset', with sendfile() when
+	 * the connection is not SSL. The fd is not closed by the message, and
+	 * must be kept open until the message is sent, e.g. be closed in the
+	 * callback of a server task. */
+	bool append_output_body_file(int fd, off_t offset, size_t size);
+
 	void clear_output_body();
 
 	size_t get_output_body_size() const
@@ -151,6 +171,41 @@ public:
 		return this->output_body_size;
 	}
 
+	/* Compress the output body with HTTP_ENCODING_GZIP or DEFLATE, and set
+	 * the Content-Encoding header. 'level' is a zlib level, -1 for default.
+	 * Call after the whole body is appended. Not for file blocks. An empty
+	 * body is left as it is. Fails with ENOSYS if built with ZLIB=n. */
+	bool compress_output_body(int encoding, int level);
+
+	/* For a server that has pushed the header and some chunks of a chunked
+	 * body already. Only the output body is sent then, as the last chunk,
+	 * and the end of the body follows. */
+	bool set_header_pushed();
+
+	/* HTTP/2 state of the connection, shared by all its messages. A client
+	 * sets an enabled one to send the request over HTTP/2 (h2c). A server
+	 * sets a disabled one, which is enabled when a request begins with the
+	 * HTTP/2 connection preface. The connection keeps it, not the message. */
+	void set_http2_conn(http2_conn_t *conn)
+	{
+		this->h2_conn = conn;
+	}
+
+	bool is_http2() const
+	{
+		return this->h2_conn && this->h2_conn->enabled;
+	}
+
+	/* The stream of the message on an HTTP/2 connection. A request has it
+	 * once encoded or received. A client binds its response to the stream
+	 * of the request, and a server sets it to the stream of the request. */
+	void set_http2_stream(unsigned int stream_id);
+
+	unsigned int get_http2_stream() const
+	{
+		return this->h2_stream;
+	}
+
 	/* std::string interface */
 public:
 	bool get_http_version(std::string& version) const
@@ -197,6 +252,14 @@ public:
 
 protected:
 	http_parser_t *parser;
+	http2_conn_t *h2_conn;
+	unsigned int h2_stream;
+	HttpMessage *h2_complete;
+	int h2_error;
+	bool decompress;
+	bool body_streaming;
+	std::function<bool (const void *, size_t)> body_sink;
+	std::function<void ()> header_callback;
 	size_t cur_size;
 
 public:
@@ -209,13 +272,30 @@ public:
 protected:
 	virtual int encode(struct iovec vectors[], int max);
 	virtual int append(const void *buf, size_t *size);
+	virtual void *get_buffer(size_t *size);
+
+	int append_http2(const void *buf, size_t *size);
+	int decode_body();
+	int finish_decoder();
+	void header_received();
 
 private:
-	struct list_head *combine_from(struct list_head *pos, size_t size);
+	virtual CommMessageIn *get_complete(int *error);
+	virtual void cancel();
+	struct list_head *combine_from(struct list_head *pos, int *count);
+	int encode_header(struct iovec vectors[], int max);
+	int encode_http2(struct iovec vectors[], int max);
+	int init_decoder(size_t reserve);
+	int stream_body(const void *buf, size_t size);
+	static int stream_callback(const void *buf, size_t size, void *context);
 
 private:
 	struct list_head output_body;
 	size_t output_body_size;
+	void *h2_buf;
+	http_decoder_t *decoder;
+	size_t decode_offset;
+	bool header_pushed;
 
 public:
 	HttpMessage(bool is_resp) : parser(new http_parser_t)
@@ -223,12 +303,29 @@ public:
 		http_parser_init(is_resp, this->parser);
 		INIT_LIST_HEAD(&this->output_body);
 		this->output_body_size = 0;
+		this->h2_conn = NULL;
+		this->h2_stream = 0;
+		this->h2_complete = NULL;
+		this->h2_error = 0;
+		this->h2_buf = NULL;
+		this->decompress = false;
+		this->body_streaming = false;
+		this->decoder = NULL;
+		this->decode_offset = 0;
+		this->header_pushed = false;
 		this->cur_size = 0;
 	}
 
 	virtual ~HttpMessage()
 	{
 		this->clear_output_body();
+		free(this->h2_buf);
+		if (this->decoder)
+		{
+			http_decoder_deinit(this->decoder);
+			delete this->decoder;
+		}
+
 		if (this->parser)
 		{
 			http_parser_deinit(this->parser);
@@ -265,6 +362,51 @@ public:
 		return http_parser_set_uri(uri, this->parser) == 0;
 	}
 
+	/* Client side. Accept a gzip or deflate response, adding an
+	 * "Accept-Encoding" header if there is none, and decode its body while
+	 * it is received. The response keeps the Content-Encoding header. */
+	void set_decompress_response(bool on)
+	{
+		this->decompress_response = on;
+	}
+
+	bool is_decompress_response() const
+	{
+		return this->decompress_response;
+	}
+
+	/* Client side. Pass the body of the response to 'sink' as it is
+	 * received, see HttpResponse::set_body_sink(). The sink sees the body of
+	 * every response the task receives, redirections included, so check
+	 * the status code of the task's response in it. */
+	void set_response_body_sink(std::function<bool (const void *, size_t)> sink)
+	{
+		this->response_body_sink = std::move(sink);
+	}
+
+	const std::function<bool (const void *, size_t)>&
+	get_response_body_sink() const
+	{
+		return this->response_body_sink;
+	}
+
+	/* Server side. 'callback' is called in the network thread as soon as
+	 * the header is received, and may set a body sink to receive the body
+	 * piece by piece. Without a sink, the body is kept as usual, but never
+	 * chunked. WFHttpServer sets it, see WFHttpServer::set_header_process().
+	 */
+	void set_header_callback(std::function<void ()> callback)
+	{
+		this->header_callback = std::move(callback);
+	}
+
+	/* Server side. Like HttpResponse::set_body_sink(), to be called in the
+	 * header callback. */
+	void set_body_sink(std::function<bool (const void *, size_t)> sink)
+	{
+		this->body_sink = std::move(sink);
+	}
+
 	/* std::string interface */
 public:
 	bool get_method(std::string& method) const
@@ -308,9 +450,17 @@ protected:
 
 private:
 	int handle_expect_continue();
+	bool is_http2_preface() const;
+
+private:
+	bool decompress_response;
+	std::function<bool (const void *, size_t)> response_body_sink;
 
 public:
-	HttpRequest() : HttpMessage(false) { }
+	HttpRequest() : HttpMessage(false)
+	{
+		this->decompress_response = false;
+	}
 
 	/* for std::move() */
 public:
@@ -347,6 +497,39 @@ public:
 		this->parser->transfer_length = 0;
 	}
 
+	/* Decode a gzip or deflate body while it is received. The parsed body
+	 * is the decoded one, and is never chunked. */
+	void set_decompress(bool on)
+	{
+		this->decompress = on;
+	}
+
+	/* Pass the body to 'sink' piece by piece as it is received, instead of
+	 * keeping it in the message, so memory stays bounded whatever the body
+	 * size. The body is decoded from the chunked transfer coding, and also
+	 * from the content coding with set_decompress(). The sink runs in the
+	 * network thread, so a slow consumer should take the data and pause
+	 * the connection with pause_receiving() instead of blocking in it.
+	 * Returning false aborts the message with ECANCELED. The parsed body
+	 * of the message is empty, and the size limit applies to the header
+	 * only. */
+	void set_body_sink(std::function<bool (const void *, size_t)> sink)
+	{
+		this->body_sink = std::move(sink);
+	}
+
+	/* Server side. Compress an output body of at least 'size' bytes, if the
+	 * client accepts gzip or deflate. Off by default. */
+	void set_compress_min_size(size_t size)
+	{
+		this->compress_min_size = size;
+	}
+
+	size_t get_compress_min_size() const
+	{
+		return this->compress_min_size;
+	}
+
 	/* std::string interface */
 public:
 	bool get_status_code(std::string& code) const
@@ -388,8 +571,17 @@ public:
 protected:
 	virtual int append(const void *buf, size_t *size);
 
+private:
+	int end_http2();
+
+private:
+	size_t compress_min_size;
+
 public:
-	HttpResponse() : HttpMessage(true) { }
+	HttpResponse() : HttpMessage(true)
+	{
+		this->compress_min_size = (size_t)-1;
+	}
 
 	/* for std::move() */
 public:
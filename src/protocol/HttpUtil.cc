@@ -17,6 +17,8 @@
            Wu Jiaxu (wujiaxu@sogou-inc.com)
 */
 
+#include <string.h>
+#include <strings.h>
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -93,6 +95,28 @@ bool HttpHeaderMap::get_strict(std::string key, std::vector<std::string>& values
 	return true;
 }
 
+static inline bool __name_is(const struct HttpMessageHeader *header,
+							 const char *name)
+{
+	size_t len = strlen(name);
+
+	return header->name_len == len &&
+		   strncasecmp((const char *)header->name, name, len) == 0;
+}
+
+/* Feeds a message to a response, as if it was received. */
+class __HttpResponseLoader : public ProtocolWrapper
+{
+public:
+	int load(const void *buf, size_t *size)
+	{
+		return this->append(buf, size);
+	}
+
+public:
+	__HttpResponseLoader(HttpResponse *resp) : ProtocolWrapper(resp) { }
+};
+
 std::string HttpUtil::decode_chunked_body(const HttpMessage *msg)
 {
 	const void *body;
@@ -112,6 +136,68 @@ std::string HttpUtil::decode_chunked_body(const HttpMessage *msg)
 	return decode_result;
 }
 
+/* A chunked body is saved as it is, like the body received. */
+bool HttpUtil::save_response(const HttpResponse *resp, std::string& message)
+{
+	HttpHeaderCursor cursor(resp);
+	struct HttpMessageHeader header;
+	const char *phrase = resp->get_reason_phrase();
+	bool chunked = resp->is_chunked();
+	const void *body;
+	size_t size;
+
+	if (!resp->get_parsed_body(&body, &size))
+		return false;
+
+	message = "HTTP/1.1 ";
+	message += resp->get_status_code();
+	message += ' ';
+	message += phrase && *phrase ? phrase : "OK";
+	message += "\r\n";
+	while (cursor.next(&header))
+	{
+		if (__name_is(&header, "Connection") ||
+			__name_is(&header, "Keep-Alive") ||
+			__name_is(&header, "Proxy-Connection") ||
+			__name_is(&header, "Content-Length") ||
+			(!chunked && __name_is(&header, "Transfer-Encoding")))
+			continue;
+
+		message.append((const char *)header.name, header.name_len);
+		message += ": ";
+		message.append((const char *)header.value, header.value_len);
+		message += "\r\n";
+	}
+
+	if (!chunked)
+	{
+		message += "Content-Length: ";
+		message += std::to_string(size);
+		message += "\r\n";
+	}
+
+	message += "\r\n";
+	message.append((const char *)body, size);
+	return true;
+}
+
+bool HttpUtil::load_response(const std::string& message, HttpResponse *resp)
+{
+	size_t size = message.size();
+	HttpResponse msg;
+
+	msg.set_size_limit(resp->get_size_limit());
+	{
+		__HttpResponseLoader loader(&msg);
+
+		if (loader.load(message.data(), &size) <= 0)
+			return false;
+	}
+
+	*resp = std::move(msg);
+	return true;
+}
+
 void HttpUtil::set_response_status(HttpResponse *resp, int status_code)
 {
 	char buf[32];
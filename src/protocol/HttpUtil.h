@@ -124,6 +124,11 @@ class HttpUtil
 public:
 	static void set_response_status(HttpResponse *resp, int status_code);
 	static std::string decode_chunked_body(const HttpMessage *msg);
+
+	/* Saves a received response as HTTP/1.1, and loads it into another
+	 * response as if it was received. For responses shared by tasks. */
+	static bool save_response(const HttpResponse *resp, std::string& message);
+	static bool load_response(const std::string& message, HttpResponse *resp);
 };
 
 class HttpHeaderMap
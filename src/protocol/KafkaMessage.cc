@@ -1804,6 +1804,11 @@ int KafkaMessage::append(const void *buf, size_t *size)
 	return ret;
 }
 
+void *KafkaMessage::get_buffer(size_t *size)
+{
+	return kafka_parser_get_buffer(size, this->parser);
+}
+
 static int kafka_compress_prepare(int compress_type, void **env,
 								  KafkaBlock *block)
 {
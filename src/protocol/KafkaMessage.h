@@ -43,6 +43,7 @@ public:
 protected:
 	virtual int encode(struct iovec vectors[], int max);
 	virtual int append(const void *buf, size_t *size);
+	virtual void *get_buffer(size_t *size);
 
 private:
 	int encode_head();
@@ -159,6 +159,9 @@ int MySQLMessage::encode(struct iovec vectors[], int max)
 void MySQLRequest::set_query(const char *query, size_t length)
 {
 	set_command(MYSQL_COM_QUERY);
+	stmt_query_.clear();
+	stmt_types_.clear();
+	stmt_values_.clear();
 	buf_.resize(length + 1);
 	char *buffer = const_cast<char *>(buf_.c_str());
 
@@ -176,6 +179,144 @@ std::string MySQLRequest::get_query() const
 	return std::string(buf_.c_str() + 1);
 }
 
+void MySQLRequest::set_stmt_query(const std::string& query)
+{
+	set_command(MYSQL_COM_STMT_EXECUTE);
+	buf_.clear();
+	stmt_query_ = query;
+	stmt_types_.clear();
+	stmt_values_.clear();
+}
+
+void MySQLRequest::add_stmt_null()
+{
+	stmt_types_.push_back((char)MYSQL_TYPE_NULL);
+	stmt_types_.push_back(0);
+}
+
+void MySQLRequest::add_stmt_int(long long value)
+{
+	unsigned char buf[8];
+
+	int8store(buf, (uint64_t)value);
+	stmt_types_.push_back((char)MYSQL_TYPE_LONGLONG);
+	stmt_types_.push_back(0);
+	stmt_values_.append((const char *)buf, 8);
+}
+
+void MySQLRequest::add_stmt_uint(unsigned long long value)
+{
+	unsigned char buf[8];
+
+	int8store(buf, value);
+	stmt_types_.push_back((char)MYSQL_TYPE_LONGLONG);
+	stmt_types_.push_back((char)0x80); // unsigned
+	stmt_values_.append((const char *)buf, 8);
+}
+
+void MySQLRequest::add_stmt_double(double value)
+{
+	unsigned char buf[8];
+
+	float8store(buf, value);
+	stmt_types_.push_back((char)MYSQL_TYPE_DOUBLE);
+	stmt_types_.push_back(0);
+	stmt_values_.append((const char *)buf, 8);
+}
+
+void MySQLRequest::add_stmt_string(const char *value, size_t length)
+{
+	unsigned char buf[9];
+
+	switch (get_length_size(length))
+	{
+	case 1:
+		buf[0] = (unsigned char)length;
+		break;
+	case 3:
+		buf[0] = 0xfc;
+		int2store(buf + 1, (uint16_t)length);
+		break;
+	case 4:
+		buf[0] = 0xfd;
+		int3store(buf + 1, (uint32_t)length);
+		break;
+	default:
+		buf[0] = 0xfe;
+		int8store(buf + 1, length);
+		break;
+	}
+
+	stmt_types_.push_back((char)MYSQL_TYPE_STRING);
+	stmt_types_.push_back(0);
+	stmt_values_.append((const char *)buf, get_length_size(length));
+	stmt_values_.append(value, length);
+}
+
+// 1:0x17|4:stmt_id|1:flags|4:iteration_count|
+// (num_params+7)/8:null_bitmap|1:new_params_bound_flag|2n:types|values
+void MySQLRequest::set_stmt_id(uint32_t stmt_id)
+{
+	size_t n = stmt_types_.size() / 2;
+	unsigned char head[10];
+	size_t i;
+
+	head[0] = MYSQL_COM_STMT_EXECUTE;
+	int4store(head + 1, stmt_id);
+	head[5] = 0; // CURSOR_TYPE_NO_CURSOR
+	int4store(head + 6, 1);
+
+	buf_.clear();
+	buf_.append((const char *)head, 10);
+	if (n > 0)
+	{
+		std::string null_bitmap((n + 7) / 8, 0);
+
+		for (i = 0; i < n; i++)
+		{
+			if (stmt_types_[2 * i] == MYSQL_TYPE_NULL)
+				null_bitmap[i / 8] |= 1 << (i % 8);
+		}
+
+		buf_.append(null_bitmap);
+		buf_.push_back(1);
+		buf_.append(stmt_types_);
+		buf_.append(stmt_values_);
+	}
+}
+
+void MySQLPrepareRequest::set_prepare(const std::string& query)
+{
+	set_command(MYSQL_COM_STMT_PREPARE);
+	buf_.clear();
+	buf_.push_back(MYSQL_COM_STMT_PREPARE);
+	buf_.append(query);
+}
+
+int MySQLPrepareRequest::encode(struct iovec vectors[], int max)
+{
+	int ret;
+
+	if (!close_)
+		return this->MySQLMessage::encode(vectors, max);
+
+	if (max < 1)
+	{
+		errno = EOVERFLOW;
+		return -1;
+	}
+
+	int3store(close_buf_, 5);
+	close_buf_[3] = 0;
+	close_buf_[4] = MYSQL_COM_STMT_CLOSE;
+	int4store(close_buf_ + 5, close_id_);
+	vectors[0].iov_base = close_buf_;
+	vectors[0].iov_len = 9;
+
+	ret = this->MySQLMessage::encode(vectors + 1, max - 1);
+	return ret >= 0 ? ret + 1 : -1;
+}
+
 int MySQLHandshakeResponse::encode(struct iovec vectors[], int max)
 {
 	const char empty[11] = {0};
@@ -390,9 +531,111 @@ void MySQLResponse::set_ok_packet()
 	buf_.append((const char *)&zero16, 2);
 }
 
+/* With a row sink, every packet is parsed as soon as it is complete, so
+ * that the rows are passed on and removed before the next one. */
+int MySQLResponse::append(const void *buf, size_t *size)
+{
+	const void *stream_buf;
+	size_t stream_len;
+	size_t nleft = *size;
+	size_t n;
+	int ret;
+
+	if (!row_sink_)
+		return this->MySQLMessage::append(buf, size);
+
+	cur_size_ += *size;
+	if (cur_size_ > this->size_limit)
+	{
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	do
+	{
+		n = nleft;
+		ret = mysql_stream_write_packet(buf, &n, stream_);
+		if (ret > 0)
+		{
+			seqid_ = mysql_stream_get_seq(stream_);
+			mysql_stream_get_buf(&stream_buf, &stream_len, stream_);
+			ret = decode_packet((const unsigned char *)stream_buf, stream_len);
+			if (ret == -2)
+			{
+				errno = EBADMSG;
+				ret = -1;
+			}
+		}
+
+		nleft -= n;
+		buf = (const char *)buf + n;
+	} while (ret == 0 && nleft > 0);
+
+	if (ret > 0)
+		*size -= nleft;
+
+	return ret;
+}
+
 int MySQLResponse::decode_packet(const unsigned char *buf, size_t buflen)
 {
-	return mysql_parser_parse(buf, buflen, parser_);
+	int ret = mysql_parser_parse(buf, buflen, parser_);
+
+	if (ret >= 0 && row_sink_ && !sink_rows(buf))
+	{
+		errno = ECANCELED;
+		return -1;
+	}
+
+	return ret;
+}
+
+bool MySQLResponse::sink_rows(const unsigned char *buf)
+{
+	struct __mysql_result_set *result_set = parser_->current_result_set;
+	struct __mysql_result_set batch;
+	struct list_head head;
+	size_t begin, end;
+	bool ret;
+
+	if (parser_->result_set_count == 0 ||
+		parser_->packet_type == MYSQL_PACKET_ERROR ||
+		result_set->type != MYSQL_PACKET_GET_RESULT ||
+		result_set->rows_begin_offset == 0 || result_set->row_count == 0)
+	{
+		return true;
+	}
+
+	/* Rows end at the EOF packet, or are still coming. */
+	begin = result_set->rows_begin_offset;
+	end = result_set->rows_end_offset;
+	if (end == 0)
+	{
+		if ((size_t)result_set->row_count < row_batch_)
+			return true;
+
+		end = parser_->offset;
+	}
+
+	batch = *result_set;
+	batch.rows_end_offset = end;
+	INIT_LIST_HEAD(&head);
+	list_add_tail(&batch.list, &head);
+	parser_->buf = buf;
+
+	{
+		MySQLResultCursor cursor(parser_, &head);
+		ret = row_sink_(cursor);
+	}
+
+	mysql_stream_erase(begin, end - begin, stream_);
+	parser_->offset -= end - begin;
+	cur_size_ -= end - begin;
+	if (result_set->rows_end_offset != 0)
+		result_set->rows_end_offset = begin;
+
+	result_set->row_count = 0;
+	return ret;
 }
 
 unsigned long long MySQLResponse::get_affected_rows() const
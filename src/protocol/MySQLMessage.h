@@ -21,6 +21,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <functional>
 #include "ProtocolMessage.h"
 #include "mysql_stream.h"
 #include "mysql_parser.h"
@@ -30,9 +31,13 @@
  * @brief  MySQL Protocol Interface
  */
 
+class ComplexMySQLTask;
+
 namespace protocol
 {
 
+class MySQLResultCursor;
+
 class MySQLMessage : public ProtocolMessage
 {
 public:
@@ -65,6 +70,8 @@ public:
 	MySQLMessage(MySQLMessage&& move);
 	//move operator
 	MySQLMessage& operator= (MySQLMessage&& move);
+
+	friend class ::ComplexMySQLTask;
 };
 
 class MySQLRequest : public MySQLMessage
@@ -78,11 +85,58 @@ public:
 	bool query_is_unset() const;
 
 public:
-	MySQLRequest() = default;
+	/* Prepared statement. The query is prepared once on each connection
+	 * and executed with the binary protocol. Parameters are bound to the
+	 * '?' of the query in the order they are added. */
+	void set_stmt_query(const std::string& query);
+
+	void add_stmt_null();
+	void add_stmt_int(long long value);
+	void add_stmt_uint(unsigned long long value);
+	void add_stmt_double(double value);
+	void add_stmt_string(const std::string& value);
+	void add_stmt_string(const char *value, size_t length);
+
+	const std::string& get_stmt_query() const { return stmt_query_; }
+	int get_stmt_param_count() const;
+
+public:
+	/* Client side. Pass the rows of the response to 'sink' as they are
+	 * received, see MySQLResponse::set_row_sink(). The sink may pause the
+	 * response of the task, task->get_resp(). */
+	void set_response_row_sink(size_t batch_rows,
+							   std::function<bool (MySQLResultCursor&)> sink)
+	{
+		response_row_batch_ = batch_rows;
+		response_row_sink_ = std::move(sink);
+	}
+
+	size_t get_response_row_batch() const { return response_row_batch_; }
+
+	const std::function<bool (MySQLResultCursor&)>&
+	get_response_row_sink() const
+	{
+		return response_row_sink_;
+	}
+
+private:
+	/* Build COM_STMT_EXECUTE with the statement prepared by the task. */
+	void set_stmt_id(uint32_t stmt_id);
+
+	std::string stmt_query_;
+	std::string stmt_types_;
+	std::string stmt_values_;
+	size_t response_row_batch_;
+	std::function<bool (MySQLResultCursor&)> response_row_sink_;
+
+public:
+	MySQLRequest() : response_row_batch_(0) { }
 	//move constructor
 	MySQLRequest(MySQLRequest&& move) = default;
 	//move operator
 	MySQLRequest& operator= (MySQLRequest&& move) = default;
+
+	friend class ::ComplexMySQLTask;
 };
 
 class MySQLResponse : public MySQLMessage
@@ -102,15 +156,46 @@ public:
 
 	void set_ok_packet();
 
+	/* Pass the rows to 'sink' in batches of at least 'batch_rows' rows as
+	 * they are received, instead of keeping them in the message, so memory
+	 * stays bounded whatever the number of rows. The cursor of each call
+	 * is over a part of one result set, and its cells point into the
+	 * message, valid only in the call. Returning false aborts the message
+	 * with ECANCELED. The result sets of the message keep their fields, but
+	 * no rows. Calls are made in the network thread while the connection is
+	 * being read, so a consumer that falls behind should pause_receiving()
+	 * in the sink and resume later rather than block the thread. */
+	void set_row_sink(size_t batch_rows,
+					  std::function<bool (MySQLResultCursor&)> sink)
+	{
+		row_batch_ = batch_rows;
+		row_sink_ = std::move(sink);
+	}
+
+	/* Stop reading the connection after the rows already received are
+	 * passed on, till resume_receiving() is called in any thread. There is
+	 * no timeout while paused, but never resume after the callback of the
+	 * task, since the rows already received may end the response. Return
+	 * false on error, e.g. when no row sink is running. */
+	bool pause_receiving() { return this->pause() >= 0; }
+	bool resume_receiving() { return this->resume() >= 0; }
+
 public:
-	MySQLResponse() = default;
+	MySQLResponse() : row_batch_(0) { }
 	//move constructor
 	MySQLResponse(MySQLResponse&& move) = default;
 	//move operator
 	MySQLResponse& operator= (MySQLResponse&& move) = default;
 
 protected:
+	virtual int append(const void *buf, size_t *size);
 	virtual int decode_packet(const unsigned char *buf, size_t buflen);
+
+private:
+	bool sink_rows(const unsigned char *buf);
+
+	size_t row_batch_;
+	std::function<bool (MySQLResultCursor&)> row_sink_;
 };
 
 }
@@ -21,6 +21,7 @@
 #include <string.h>
 #include <string>
 #include <openssl/ssl.h>
+#include "mysql_types.h"
 #include "SSLWrapper.h"
 
 namespace protocol
@@ -147,6 +148,48 @@ public:
 
 using MySQLAuthResponse = MySQLResponse;
 
+class MySQLPrepareRequest : public MySQLRequest
+{
+public:
+	void set_prepare(const std::string& query);
+
+	/* COM_STMT_CLOSE has no reply, so it is sent just before. */
+	void set_close(uint32_t stmt_id)
+	{
+		close_ = true;
+		close_id_ = stmt_id;
+	}
+
+private:
+	virtual int encode(struct iovec vectors[], int max);
+
+	unsigned char close_buf_[9];
+	uint32_t close_id_;
+	bool close_;
+
+public:
+	MySQLPrepareRequest() : close_(false) { }
+	//move constructor
+	MySQLPrepareRequest(MySQLPrepareRequest&& move) = default;
+	//move operator
+	MySQLPrepareRequest& operator= (MySQLPrepareRequest&& move) = default;
+};
+
+class MySQLPrepareResponse : public MySQLResponse
+{
+public:
+	uint32_t get_stmt_id() const { return parser_->stmt_id; }
+	int get_param_count() const { return parser_->stmt_param_count; }
+	int get_column_count() const { return parser_->stmt_column_count; }
+
+public:
+	MySQLPrepareResponse() { set_command(MYSQL_COM_STMT_PREPARE); }
+	//move constructor
+	MySQLPrepareResponse(MySQLPrepareResponse&& move) = default;
+	//move operator
+	MySQLPrepareResponse& operator= (MySQLPrepareResponse&& move) = default;
+};
+
 //////////
 
 inline mysql_parser_t *MySQLMessage::get_parser() const
@@ -186,7 +229,17 @@ inline MySQLMessage::MySQLMessage():
 
 inline bool MySQLRequest::query_is_unset() const
 {
-	return buf_.empty();
+	return buf_.empty() && stmt_query_.empty();
+}
+
+inline int MySQLRequest::get_stmt_param_count() const
+{
+	return stmt_types_.size() / 2;
+}
+
+inline void MySQLRequest::add_stmt_string(const std::string& value)
+{
+	add_stmt_string(value.c_str(), value.size());
 }
 
 inline void MySQLRequest::set_query(const char *query)
@@ -16,6 +16,7 @@
   Authors: Li Yingxin (liyingxin@sogou-inc.com)
 */
 
+#include <stdio.h>
 #include <vector>
 #include "mysql_types.h"
 #include "mysql_byteorder.h"
@@ -25,6 +26,49 @@
 namespace protocol
 {
 
+std::string MySQLCell::binary_time_string() const
+{
+	const unsigned char *p = (const unsigned char *)this->data;
+	char buf[64];
+	int n = 0;
+
+	if (this->data_type == MYSQL_TYPE_TIME)
+	{
+		// 1:is_negative|4:days|1:hour|1:minute|1:second|4:microsecond
+		if (this->len < 8)
+			return "00:00:00";
+
+		n = snprintf(buf, sizeof buf, "%s%02u:%02u:%02u", p[0] ? "-" : "",
+					 uint4korr(p + 1) * 24 + p[5], p[6], p[7]);
+		if (this->len >= 12)
+			n += snprintf(buf + n, sizeof buf - n, ".%06u", uint4korr(p + 8));
+
+		return std::string(buf, n);
+	}
+
+	// 2:year|1:month|1:day|1:hour|1:minute|1:second|4:microsecond
+	if (this->len >= 4)
+	{
+		n = snprintf(buf, sizeof buf, "%04u-%02u-%02u",
+					 uint2korr(p), p[2], p[3]);
+	}
+	else
+		n = snprintf(buf, sizeof buf, "0000-00-00");
+
+	if (this->data_type == MYSQL_TYPE_DATE)
+		return std::string(buf, n);
+
+	if (this->len >= 7)
+		n += snprintf(buf + n, sizeof buf - n, " %02u:%02u:%02u", p[4], p[5], p[6]);
+	else
+		n += snprintf(buf + n, sizeof buf - n, " 00:00:00");
+
+	if (this->len >= 11)
+		n += snprintf(buf + n, sizeof buf - n, ".%06u", uint4korr(p + 7));
+
+	return std::string(buf, n);
+}
+
 MySQLField::MySQLField(const void *buf, mysql_field_t *field)
 {
 	const char *p = (const char *)buf;
@@ -74,6 +118,7 @@ void MySQLResultCursor::init()
 	this->current_row = 0;
 	this->field_count = 0;
 	this->fields = NULL;
+	this->binary = false;
 	this->parser = NULL;
 	this->status = MYSQL_STATUS_NOT_INIT;
 }
@@ -83,6 +128,20 @@ MySQLResultCursor::MySQLResultCursor(const MySQLResponse *resp)
 	this->init(resp);
 }
 
+MySQLResultCursor::MySQLResultCursor(mysql_parser_t *parser,
+									 const struct list_head *head)
+{
+	struct __mysql_result_set *result_set;
+
+	this->init();
+	this->parser = parser;
+	this->binary = (parser->cmd == MYSQL_COM_STMT_EXECUTE);
+	this->cursor.head = head;
+	this->cursor.current = head;
+	if (mysql_result_set_cursor_next(&result_set, &this->cursor) == 0)
+		this->fetch_result_set(result_set);
+}
+
 void MySQLResultCursor::reset(MySQLResponse *resp)
 {
 	this->clear();
@@ -133,6 +192,7 @@ void MySQLResultCursor::init(const MySQLResponse *resp)
 	this->field_count = 0;
 	this->fields = NULL;
 	this->parser = resp->get_parser();
+	this->binary = (this->parser->cmd == MYSQL_COM_STMT_EXECUTE);
 	this->status = MYSQL_STATUS_NOT_INIT;
 
 	if (!list_empty(&this->parser->result_set_list))
@@ -180,30 +240,32 @@ bool MySQLResultCursor::fetch_row(std::vector<MySQLCell>& row_arr)
 	if (this->status != MYSQL_STATUS_GET_RESULT)
 		return false;
 
+	/* No rows, or all of them are passed to a row sink. */
+	if (this->current_row >= this->row_count)
+	{
+		this->status = MYSQL_STATUS_END;
+		return false;
+	}
+
 	unsigned long long len;
 	const unsigned char *data;
 	int data_type;
 
 	const unsigned char *p = (const unsigned char *)this->pos;
 	const unsigned char *end = (const unsigned char *)this->end;
-	
+	const unsigned char *null_bitmap = this->fetch_row_head(&p);
+
 	row_arr.clear();
 
 	for (int i = 0; i < this->field_count; i++)
 	{
-		data_type = this->fields[i]->get_data_type();
-		if (*p == MYSQL_PACKET_HEADER_NULL)
+		if (!this->fetch_cell(i, null_bitmap, &p, end, &data, &len, &data_type))
 		{
-			data = NULL;
-			len = 0;
-			p++;
-			data_type = MYSQL_TYPE_NULL;
-		} else if (decode_string(&data, &len, &p, end) == false) {
 			this->status = MYSQL_STATUS_ERROR;
 			return false;
 		}
 
-		row_arr.emplace_back(data, len, data_type);
+		row_arr.emplace_back(this->make_cell(i, data, len, data_type));
 	}
 
 	if (++this->current_row == this->row_count)
@@ -229,21 +291,25 @@ bool MySQLResultCursor::fetch_row_nocopy(const void **data, size_t *len, int *da
 	if (this->status != MYSQL_STATUS_GET_RESULT)
 		return false;
 
+	/* No rows, or all of them are passed to a row sink. */
+	if (this->current_row >= this->row_count)
+	{
+		this->status = MYSQL_STATUS_END;
+		return false;
+	}
+
 	unsigned long long cell_len;
 	const unsigned char *cell_data;
+	int cell_type;
 
 	const unsigned char *p = (const unsigned char *)this->pos;
 	const unsigned char *end = (const unsigned char *)this->end;
+	const unsigned char *null_bitmap = this->fetch_row_head(&p);
 
 	for (int i = 0; i < this->field_count; i++)
-	{	
-		if (*p == MYSQL_PACKET_HEADER_NULL)
-		{
-			cell_data = NULL;
-			cell_len = 0;
-			p++;
-		}
-		else if (decode_string(&cell_data, &cell_len, &p, end) == false)
+	{
+		if (!this->fetch_cell(i, null_bitmap, &p, end,
+							  &cell_data, &cell_len, &cell_type))
 		{
 			this->status = MYSQL_STATUS_ERROR;
 			return false;
@@ -278,24 +344,19 @@ bool MySQLResultCursor::fetch_all(std::vector<std::vector<MySQLCell>>& rows)
 
 	for (int i = this->current_row; i < this->row_count; i++)
 	{
+		const unsigned char *null_bitmap = this->fetch_row_head(&p);
 		std::vector<MySQLCell> tmp;
+
 		for (int j = 0; j < this->field_count; j++)
 		{
-			data_type = this->fields[j]->get_data_type();
-			if (*p == MYSQL_PACKET_HEADER_NULL)
-			{
-				data = NULL;
-				len = 0;
-				p++;
-				data_type = MYSQL_TYPE_NULL;
-			}
-			else if (decode_string(&data, &len, &p, end) == false)
+			if (!this->fetch_cell(j, null_bitmap, &p, end,
+								  &data, &len, &data_type))
 			{
 				this->status = MYSQL_STATUS_ERROR;
 				return false;
 			}
 
-			tmp.emplace_back(data, len, data_type);
+			tmp.emplace_back(this->make_cell(j, data, len, data_type));
 		}
 		rows.emplace_back(std::move(tmp));
 	}
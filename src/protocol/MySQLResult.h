@@ -45,6 +45,10 @@ public:
 
 	MySQLCell(const void *data, size_t len, int data_type);
 
+	/* A cell of a prepared statement result, in the binary protocol. */
+	MySQLCell(const void *data, size_t len, int data_type,
+			  bool binary, bool is_unsigned);
+
 	int get_data_type() const;
 
 	bool is_null() const;
@@ -72,9 +76,13 @@ public:
 	void get_cell_nocopy(const void **data, size_t *len, int *data_type) const;
 
 private:
+	std::string binary_time_string() const;
+
 	int data_type;
 	void *data;
 	size_t len;
+	bool binary;
+	bool is_unsigned;
 };
 
 class MySQLField
@@ -163,9 +171,21 @@ private:
 
 	void fetch_result_set(const struct __mysql_result_set *result_set);
 
+	const unsigned char *fetch_row_head(const unsigned char **p) const;
+	bool fetch_cell(int i, const unsigned char *null_bitmap,
+					const unsigned char **p, const unsigned char *end,
+					const unsigned char **data, unsigned long long *len,
+					int *data_type) const;
+	MySQLCell make_cell(int i, const unsigned char *data,
+						unsigned long long len, int data_type) const;
+
 	template<class T>
 	bool fetch_row(T& row_map); 
 
+	/* Over the result sets in 'head'. For the row sink of MySQLResponse. */
+	MySQLResultCursor(mysql_parser_t *parser, const struct list_head *head);
+	friend class MySQLResponse;
+
 	int status;
 	int server_status;
 	const void *start;
@@ -178,6 +198,7 @@ private:
 	int field_count;
 	int current_row;
 	int current_field;
+	bool binary;
 
 	unsigned long long affected_rows;
 	unsigned long long insert_id;
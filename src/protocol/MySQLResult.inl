@@ -118,6 +118,8 @@ inline MySQLCell& MySQLCell::operator=(MySQLCell&& move)
 		this->data = move.data;
 		this->len = move.len;
 		this->data_type = move.data_type;
+		this->binary = move.binary;
+		this->is_unsigned = move.is_unsigned;
 
 		move.data = NULL;
 		move.len = 0;
@@ -131,6 +133,18 @@ inline MySQLCell::MySQLCell(const void *data, size_t len, int data_type)
 	this->data_type = data_type;
 	this->data = const_cast<void *>(data);
 	this->len = len;
+	this->binary = false;
+	this->is_unsigned = false;
+}
+
+inline MySQLCell::MySQLCell(const void *data, size_t len, int data_type,
+							bool binary, bool is_unsigned)
+{
+	this->data_type = data_type;
+	this->data = const_cast<void *>(data);
+	this->len = len;
+	this->binary = binary;
+	this->is_unsigned = is_unsigned;
 }
 
 inline MySQLCell::MySQLCell()
@@ -138,6 +152,8 @@ inline MySQLCell::MySQLCell()
 	this->data = NULL;
 	this->len = 0;
 	this->data_type = MYSQL_TYPE_NULL;
+	this->binary = false;
+	this->is_unsigned = false;
 }
 
 inline int MySQLCell::get_data_type() const
@@ -176,6 +192,23 @@ inline int MySQLCell::as_int() const
 	if (!this->is_int())
 		return 0;
 
+	if (this->binary)
+	{
+		const unsigned char *p = (const unsigned char *)this->data;
+
+		switch (this->len)
+		{
+		case 1:
+			return this->is_unsigned ? (int)p[0] : (int)(int8_t)p[0];
+		case 2:
+			return this->is_unsigned ? (int)uint2korr(p) : (int)sint2korr(p);
+		case 4:
+			return (int)sint4korr(p);
+		default:
+			return 0;
+		}
+	}
+
 	std::string num((char *)this->data, this->len);
 	return atoi(num.c_str());
 }
@@ -190,6 +223,14 @@ inline float MySQLCell::as_float() const
 	if (!this->is_float())
 		return NAN;
 
+	if (this->binary)
+	{
+		float value;
+
+		float4get(&value, (const unsigned char *)this->data);
+		return value;
+	}
+
 	std::string num((char *)this->data, this->len);
 	return strtof(num.c_str(), NULL);
 }
@@ -204,6 +245,14 @@ inline double MySQLCell::as_double() const
 	if (!this->is_double())
 		return NAN;
 
+	if (this->binary)
+	{
+		double value;
+
+		float8get(&value, (const unsigned char *)this->data);
+		return value;
+	}
+
 	std::string num((char *)this->data, this->len);
 	return strtod(num.c_str(), NULL);
 }
@@ -218,6 +267,9 @@ inline unsigned long long MySQLCell::as_ulonglong() const
 	if (!this->is_ulonglong())
 		return (unsigned long long)-1;
 
+	if (this->binary)
+		return uint8korr((const unsigned char *)this->data);
+
 	std::string num((char *)this->data, this->len);
 	return strtoull(num.c_str(), NULL, 10);
 }
@@ -232,6 +284,9 @@ inline std::string MySQLCell::as_date() const
 	if (!this->is_date())
 		return "";
 
+	if (this->binary)
+		return this->binary_time_string();
+
 	return std::string((char *)this->data, this->len);
 }
 
@@ -245,6 +300,9 @@ inline std::string MySQLCell::as_time() const
 	if (!this->is_time())
 		return "";
 
+	if (this->binary)
+		return this->binary_time_string();
+
 	return std::string((char *)this->data, this->len);
 }
 
@@ -259,6 +317,9 @@ inline std::string MySQLCell::as_datetime() const
 	if (!this->is_datetime())
 		return "";
 
+	if (this->binary)
+		return this->binary_time_string();
+
 	return std::string((char *)this->data, this->len);
 }
 
@@ -278,6 +339,9 @@ inline std::string MySQLCell::as_string() const
 		!this->is_date() && !this->is_datetime())
 		return "";
 
+	if (this->binary && !this->is_string())
+		return this->binary_time_string();
+
 	return std::string((char *)this->data, this->len);
 }
 
@@ -287,31 +351,33 @@ bool MySQLResultCursor::fetch_row(T& row_map)
 	if (this->status != MYSQL_STATUS_GET_RESULT)
 		return false;
 
+	/* No rows, or all of them are passed to a row sink. */
+	if (this->current_row >= this->row_count)
+	{
+		this->status = MYSQL_STATUS_END;
+		return false;
+	}
+
 	unsigned long long len;
 	const unsigned char *data;
 	int data_type;
 
 	const unsigned char *p = (const unsigned char *)this->pos;
 	const unsigned char *end = (const unsigned char *)this->end;
+	const unsigned char *null_bitmap = this->fetch_row_head(&p);
 
 	row_map.clear();
 
 	for (int i = 0; i < this->field_count; i++)
 	{
-		data_type = this->fields[i]->get_data_type();
-		if (*p == MYSQL_PACKET_HEADER_NULL)
-		{
-			data = NULL;
-			len = 0;
-			p++;
-			data_type = MYSQL_TYPE_NULL;
-		}
-		else if (decode_string(&data, &len, &p, end) == false)
+		if (!this->fetch_cell(i, null_bitmap, &p, end, &data, &len, &data_type))
 		{
 			this->status = MYSQL_STATUS_ERROR;
 			return false;
 		}
-		row_map.emplace(this->fields[i]->get_name(), MySQLCell(data, len, data_type));
+
+		row_map.emplace(this->fields[i]->get_name(),
+						this->make_cell(i, data, len, data_type));
 	}
 
 	this->pos = p;
@@ -322,6 +388,64 @@ bool MySQLResultCursor::fetch_row(T& row_map)
 	return true;
 }
 
+inline const unsigned char *
+MySQLResultCursor::fetch_row_head(const unsigned char **p) const
+{
+	const unsigned char *null_bitmap = NULL;
+
+	// binary row: 1:0x00|(field_count+9)/8:null_bitmap
+	if (this->binary)
+	{
+		null_bitmap = *p + 1;
+		*p = null_bitmap + (this->field_count + 9) / 8;
+	}
+
+	return null_bitmap;
+}
+
+inline bool MySQLResultCursor::fetch_cell(int i, const unsigned char *null_bitmap,
+										  const unsigned char **p,
+										  const unsigned char *end,
+										  const unsigned char **data,
+										  unsigned long long *len,
+										  int *data_type) const
+{
+	bool is_null;
+
+	*data_type = this->fields[i]->get_data_type();
+	if (null_bitmap)
+		is_null = null_bitmap[(i + 2) / 8] & (1 << ((i + 2) % 8));
+	else if (**p == MYSQL_PACKET_HEADER_NULL)
+	{
+		is_null = true;
+		(*p)++;
+	}
+	else
+		is_null = false;
+
+	if (is_null)
+	{
+		*data = NULL;
+		*len = 0;
+		*data_type = MYSQL_TYPE_NULL;
+		return true;
+	}
+
+	if (null_bitmap)
+		return decode_binary_value(*data_type, data, len, p, end) > 0;
+
+	return decode_string(data, len, p, end) > 0;
+}
+
+inline MySQLCell MySQLResultCursor::make_cell(int i, const unsigned char *data,
+											  unsigned long long len,
+											  int data_type) const
+{
+	bool is_unsigned = this->fields[i]->get_flags() & MYSQL_UNSIGNED_FLAG;
+
+	return MySQLCell(data, len, data_type, this->binary, is_unsigned);
+}
+
 inline const MySQLField *MySQLResultCursor::fetch_field()
 {
 	if (this->status != MYSQL_STATUS_GET_RESULT &&
@@ -443,6 +567,7 @@ inline MySQLResultCursor::MySQLResultCursor(MySQLResultCursor&& move)
 	this->field_count = move.field_count;
 	this->current_row = move.current_row;
 	this->current_field = move.current_field;
+	this->binary = move.binary;
 	this->affected_rows = move.affected_rows;
 	this->insert_id = move.insert_id;
 	this->warning_count = move.warning_count;
@@ -469,6 +594,7 @@ inline MySQLResultCursor& MySQLResultCursor::operator=(MySQLResultCursor&& move)
 		this->field_count = move.field_count;
 		this->current_row = move.current_row;
 		this->current_field = move.current_field;
+		this->binary = move.binary;
 		this->affected_rows = move.affected_rows;
 		this->insert_id = move.insert_id;
 		this->warning_count = move.warning_count;
@@ -89,6 +89,30 @@ protected:
 			return this->CommMessageIn::renew();
 	}
 
+	virtual int pause()
+	{
+		if (this->wrapper)
+			return this->wrapper->pause();
+		else
+			return this->CommMessageIn::pause();
+	}
+
+	virtual int resume()
+	{
+		if (this->wrapper)
+			return this->wrapper->resume();
+		else
+			return this->CommMessageIn::resume();
+	}
+
+	virtual int multiplex()
+	{
+		if (this->wrapper)
+			return this->wrapper->multiplex();
+		else
+			return this->CommMessageIn::multiplex();
+	}
+
 protected:
 	size_t size_limit;
 
@@ -567,27 +567,43 @@ int RedisMessage::append(const void *buf, size_t *size)
 void RedisRequest::set_request(const std::string& command,
 							   const std::vector<std::string>& params)
 {
-	size_t n = params.size() + 1;
-	user_request_.reserve(n);
 	user_request_.clear();
+	commands_.clear();
+	add_request(command, params);
+}
+
+void RedisRequest::add_request(const std::string& command,
+							   const std::vector<std::string>& params)
+{
+	commands_.push_back(user_request_.size());
+	user_request_.reserve(user_request_.size() + params.size() + 1);
 	user_request_.push_back(command);
 	for (size_t i = 0; i < params.size(); i++)
 		user_request_.push_back(params[i]);
+}
 
-	redis_reply_t *reply = &parser_->reply;
-	redis_reply_set_array(n, reply);
-	for (size_t i = 0; i < n; i++)
-	{
-		redis_reply_set_string(user_request_[i].c_str(),
-							   user_request_[i].size(),
-							   reply->element[i]);
-	}
+size_t RedisRequest::get_command_count() const
+{
+	if (!commands_.empty())
+		return commands_.size();
+
+	return parser_->reply.type == REDIS_REPLY_TYPE_ARRAY ? 1 : 0;
 }
 
-bool RedisRequest::get_command(std::string& command) const
+bool RedisRequest::get_command(size_t index, std::string& command) const
 {
+	if (!commands_.empty())
+	{
+		if (index >= commands_.size())
+			return false;
+
+		command = user_request_[commands_[index]];
+		return true;
+	}
+
 	const redis_reply_t *reply = &parser_->reply;
-	if (reply->type == REDIS_REPLY_TYPE_ARRAY && reply->elements > 0)
+	if (index == 0 && reply->type == REDIS_REPLY_TYPE_ARRAY &&
+		reply->elements > 0)
 	{
 		reply = reply->element[0];
 		if (reply->type == REDIS_REPLY_TYPE_STRING)
@@ -600,10 +616,25 @@ bool RedisRequest::get_command(std::string& command) const
 	return false;
 }
 
-bool RedisRequest::get_params(std::vector<std::string>& params) const
+bool RedisRequest::get_params(size_t index,
+							  std::vector<std::string>& params) const
 {
+	if (!commands_.empty())
+	{
+		if (index >= commands_.size())
+			return false;
+
+		size_t end = index + 1 < commands_.size() ? commands_[index + 1] :
+													user_request_.size();
+
+		params.assign(user_request_.begin() + commands_[index] + 1,
+					  user_request_.begin() + end);
+		return true;
+	}
+
 	const redis_reply_t *reply = &parser_->reply;
-	if (reply->type == REDIS_REPLY_TYPE_ARRAY && reply->elements > 0)
+	if (index == 0 && reply->type == REDIS_REPLY_TYPE_ARRAY &&
+		reply->elements > 0)
 	{
 		for (size_t i = 1; i < reply->elements; i++)
 		{
@@ -635,10 +666,30 @@ int RedisRequest::encode(struct iovec vectors[], int max)
 
 	if (is_asking())
 		(*stream_) << REDIS_ASK_REQUEST;
-	if (encode_reply(&parser_->reply))
-		return stream_->size();
 
-	return 0;
+	if (commands_.empty())
+	{
+		if (!encode_reply(&parser_->reply))
+			return 0;
+	}
+
+	/* All the commands of a batch go in one message, as pipelining. */
+	for (size_t i = 0; i < commands_.size(); i++)
+	{
+		size_t end = i + 1 < commands_.size() ? commands_[i + 1] :
+												user_request_.size();
+
+		(*stream_) << "*" << end - commands_[i] << "\r\n";
+		for (size_t j = commands_[i]; j < end; j++)
+		{
+			const std::string& str = user_request_[j];
+
+			(*stream_) << "$" << str.size() << "\r\n";
+			(*stream_) << std::make_pair(str.c_str(), str.size()) << "\r\n";
+		}
+	}
+
+	return stream_->size();
 }
 
 int RedisRequest::append(const void *buf, size_t *size)
@@ -680,19 +731,32 @@ int RedisResponse::append(const void *buf, size_t *size)
 		redis_parser_init(this->parser_);
 		ret = 0;
 		set_asking(false);
+		if (replies_ > 1 && redis_parser_set_batch(replies_, this->parser_) < 0)
+			ret = -1;
 	}
 
 	return ret;
 }
 
+bool RedisResponse::parse_replies(size_t n)
+{
+	if (n > 1 && redis_parser_set_batch(n, this->parser_) < 0)
+		return false;
+
+	replies_ = n;
+	return true;
+}
+
 bool RedisResponse::set_result(const RedisValue& value)
 {
 	redis_reply_t *reply = &parser_->reply;
 	redis_reply_deinit(reply);
 	redis_reply_init(reply);
 
+	/* A result set is read back by get_result(), like a parsed one. */
 	value_ = value;
-	return value_.transform(reply);
+	parser_->parse_succ = value_.transform(reply);
+	return parser_->parse_succ;
 }
 
 }
@@ -116,6 +116,62 @@ private:
 	void *data_;
 };
 
+// A read-only view of a parsed reply, with no copy of the data.
+// Valid while the response that it comes from is not changed or deleted.
+class RedisReplyView
+{
+public:
+	class iterator
+	{
+	public:
+		iterator(redis_reply_t * const *pos) : pos_(pos) { }
+
+		RedisReplyView operator* () const { return RedisReplyView(*pos_); }
+		iterator& operator++ () { pos_++; return *this; }
+		bool operator== (const iterator& it) const { return pos_ == it.pos_; }
+		bool operator!= (const iterator& it) const { return pos_ != it.pos_; }
+
+	private:
+		redis_reply_t * const *pos_;
+	};
+
+public:
+	// nil
+	RedisReplyView() : reply_(NULL) { }
+	explicit RedisReplyView(const redis_reply_t *reply) : reply_(reply) { }
+
+	bool is_ok() const;
+	bool is_error() const;
+	bool is_nil() const;
+	bool is_int() const;
+	bool is_array() const;
+	// Return true if string/status
+	bool is_string() const;
+	int get_type() const;
+
+	// If type isnot string/status/error, returns NULL. Not '\0' terminated.
+	const char *string_data() const;
+	// If type isnot string/status/error, returns 0
+	size_t string_size() const;
+	// Copy. If type isnot string/status/error, returns an empty std::string
+	std::string string_value() const;
+	// If type isnot integer, returns 0
+	int64_t int_value() const;
+	// If type isnot array, returns 0
+	size_t arr_size() const;
+	// No check of pos
+	RedisReplyView operator[] (size_t pos) const;
+
+	// Elements of an array. Empty if type isnot array.
+	iterator begin() const;
+	iterator end() const;
+
+	const redis_reply_t *reply() const { return reply_; }
+
+private:
+	const redis_reply_t *reply_;
+};
+
 class RedisMessage : public ProtocolMessage
 {
 public:
@@ -164,8 +220,26 @@ public:// C++ style
 	void set_request(const std::string& command,
 					 const std::vector<std::string>& params);
 
-	bool get_command(std::string& command) const;
-	bool get_params(std::vector<std::string>& params) const;
+	// add_request("GET", {"keyname"}) after set_request() makes a batch.
+	// The commands are sent at once, and the result is an array with the
+	// reply of each command.
+	void add_request(const std::string& command,
+					 const std::vector<std::string>& params);
+
+	size_t get_command_count() const;
+
+	bool get_command(std::string& command) const
+	{
+		return get_command(0, command);
+	}
+
+	bool get_params(std::vector<std::string>& params) const
+	{
+		return get_params(0, params);
+	}
+
+	bool get_command(size_t index, std::string& command) const;
+	bool get_params(size_t index, std::vector<std::string>& params) const;
 
 protected:
 	virtual int encode(struct iovec vectors[], int max);
@@ -173,12 +247,13 @@ protected:
 
 private:
 	std::vector<std::string> user_request_;
+	std::vector<size_t> commands_;	/* offsets in user_request_ */
 };
 
 class RedisResponse : public RedisMessage
 {
 public:
-	RedisResponse() = default;
+	RedisResponse() : replies_(1) { }
 	//move constructor
 	RedisResponse(RedisResponse&& move) = default;
 	//move operator
@@ -188,9 +263,17 @@ public:// C++ style
 	// client use get_result to get result from server, copy
 	void get_result(RedisValue& value) const;
 
+	// client use get_result_view to read result in place, no copy
+	RedisReplyView get_result_view() const;
+
 	// server use set_result to (prepare)send result to client, copy
+	// a client response set this way is read back by get_result(),
+	// as single flight and pipeline tasks get their results
 	bool set_result(const RedisValue& value);
 
+	// client of a batch request parses 'n' replies as one array result
+	bool parse_replies(size_t n);
+
 public:// C style
 	// redis_parser_t is absolutely same as hiredis-redisReply in memory
 	// If you include hiredis.h, redisReply* can cast to redis_reply_t* safely
@@ -205,6 +288,7 @@ protected:
 
 private:
 	RedisValue value_;
+	size_t replies_;
 };
 
 ////////////////////
@@ -309,6 +393,92 @@ inline redis_reply_t *RedisResponse::result_ptr()
 	return &parser_->reply;
 }
 
+inline RedisReplyView RedisResponse::get_result_view() const
+{
+	if (parser_->parse_succ)
+		return RedisReplyView(&parser_->reply);
+	else
+		return RedisReplyView();
+}
+
+inline int RedisReplyView::get_type() const
+{
+	return reply_ ? reply_->type : REDIS_REPLY_TYPE_NIL;
+}
+
+inline bool RedisReplyView::is_ok() const { return get_type() != REDIS_REPLY_TYPE_ERROR; }
+inline bool RedisReplyView::is_error() const { return get_type() == REDIS_REPLY_TYPE_ERROR; }
+inline bool RedisReplyView::is_nil() const { return get_type() == REDIS_REPLY_TYPE_NIL; }
+inline bool RedisReplyView::is_int() const { return get_type() == REDIS_REPLY_TYPE_INTEGER; }
+inline bool RedisReplyView::is_array() const { return get_type() == REDIS_REPLY_TYPE_ARRAY; }
+
+inline bool RedisReplyView::is_string() const
+{
+	int type = get_type();
+
+	return type == REDIS_REPLY_TYPE_STRING || type == REDIS_REPLY_TYPE_STATUS;
+}
+
+inline const char *RedisReplyView::string_data() const
+{
+	int type = get_type();
+
+	if (type == REDIS_REPLY_TYPE_STRING ||
+		type == REDIS_REPLY_TYPE_STATUS ||
+		type == REDIS_REPLY_TYPE_ERROR)
+		return reply_->str;
+	else
+		return NULL;
+}
+
+inline size_t RedisReplyView::string_size() const
+{
+	return string_data() ? reply_->len : 0;
+}
+
+inline std::string RedisReplyView::string_value() const
+{
+	const char *str = string_data();
+
+	if (str)
+		return std::string(str, reply_->len);
+	else
+		return "";
+}
+
+inline int64_t RedisReplyView::int_value() const
+{
+	if (get_type() == REDIS_REPLY_TYPE_INTEGER)
+		return reply_->integer;
+	else
+		return 0;
+}
+
+inline size_t RedisReplyView::arr_size() const
+{
+	if (get_type() == REDIS_REPLY_TYPE_ARRAY)
+		return reply_->elements;
+	else
+		return 0;
+}
+
+inline RedisReplyView RedisReplyView::operator[] (size_t pos) const
+{
+	return RedisReplyView(reply_->element[pos]);
+}
+
+inline RedisReplyView::iterator RedisReplyView::begin() const
+{
+	return iterator(arr_size() ? reply_->element : NULL);
+}
+
+inline RedisReplyView::iterator RedisReplyView::end() const
+{
+	size_t n = arr_size();
+
+	return iterator(n ? reply_->element + n : NULL);
+}
+
 inline void RedisResponse::get_result(RedisValue& value) const
 {
 	if (parser_->parse_succ)
@@ -0,0 +1,532 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "hpack.h"
+
+#define HPACK_ENTRY_OVERHEAD	32
+#define HPACK_STATIC_SIZE		61
+
+struct __hpack_entry
+{
+	size_t name_len;
+	size_t value_len;
+	char buf[1];
+};
+
+struct __hpack_static_entry
+{
+	const char *name;
+	const char *value;
+};
+
+static const struct __hpack_static_entry __static_table[HPACK_STATIC_SIZE] =
+{
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+};
+
+/* The Huffman code of HPACK is canonical: codes of the same length are
+ * consecutive, and are assigned in the order of the symbols. So the number
+ * of codes of each length, and the symbols sorted by code, describe it. */
+static const unsigned char __huffman_count[31] =
+{
+	0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 3
+};
+
+static const unsigned char __huffman_symbol[256] =
+{
+	0x30, 0x31, 0x32, 0x61, 0x63, 0x65, 0x69, 0x6f, 0x73, 0x74, 0x20, 0x25,
+	0x2d, 0x2e, 0x2f, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3d, 0x41,
+	0x5f, 0x62, 0x64, 0x66, 0x67, 0x68, 0x6c, 0x6d, 0x6e, 0x70, 0x72, 0x75,
+	0x3a, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4b, 0x4c,
+	0x4d, 0x4e, 0x4f, 0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x59,
+	0x6a, 0x6b, 0x71, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x26, 0x2a, 0x2c, 0x3b,
+	0x58, 0x5a, 0x21, 0x22, 0x28, 0x29, 0x3f, 0x27, 0x2b, 0x7c, 0x23, 0x3e,
+	0x00, 0x24, 0x40, 0x5b, 0x5d, 0x7e, 0x5e, 0x7d, 0x3c, 0x60, 0x7b, 0x5c,
+	0xc3, 0xd0, 0x80, 0x82, 0x83, 0xa2, 0xb8, 0xc2, 0xe0, 0xe2, 0x99, 0xa1,
+	0xa7, 0xac, 0xb0, 0xb1, 0xb3, 0xd1, 0xd8, 0xd9, 0xe3, 0xe5, 0xe6, 0x81,
+	0x84, 0x85, 0x86, 0x88, 0x92, 0x9a, 0x9c, 0xa0, 0xa3, 0xa4, 0xa9, 0xaa,
+	0xad, 0xb2, 0xb5, 0xb9, 0xba, 0xbb, 0xbd, 0xbe, 0xc4, 0xc6, 0xe4, 0xe8,
+	0xe9, 0x01, 0x87, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8f, 0x93, 0x95, 0x96,
+	0x97, 0x98, 0x9b, 0x9d, 0x9e, 0xa5, 0xa6, 0xa8, 0xae, 0xaf, 0xb4, 0xb6,
+	0xb7, 0xbc, 0xbf, 0xc5, 0xe7, 0xef, 0x09, 0x8e, 0x90, 0x91, 0x94, 0x9f,
+	0xab, 0xce, 0xd7, 0xe1, 0xec, 0xed, 0xc7, 0xcf, 0xea, 0xeb, 0xc0, 0xc1,
+	0xc8, 0xc9, 0xca, 0xcd, 0xd2, 0xd5, 0xda, 0xdb, 0xee, 0xf0, 0xf2, 0xf3,
+	0xff, 0xcb, 0xcc, 0xd3, 0xd4, 0xd6, 0xdd, 0xde, 0xdf, 0xf1, 0xf4, 0xf5,
+	0xf6, 0xf7, 0xf8, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0x02, 0x03, 0x04, 0x05,
+	0x06, 0x07, 0x08, 0x0b, 0x0c, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14,
+	0x15, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x7f, 0xdc,
+	0xf9, 0x0a, 0x0d, 0x16
+};
+
+/* Returns the length of the decoded string, or -1 if the code is invalid.
+ * 'out' must have room for len * 8 / 5 bytes. */
+static long __huffman_decode(const unsigned char *p, size_t len, char *out)
+{
+	unsigned int code = 0;
+	unsigned int first = 0;
+	unsigned int index = 0;
+	unsigned int count;
+	int bits = 0;
+	long n = 0;
+	int i;
+
+	while (len > 0)
+	{
+		for (i = 7; i >= 0; i--)
+		{
+			code |= (*p >> i) & 1;
+			bits++;
+			count = __huffman_count[bits];
+			if (code - first < count)
+			{
+				out[n++] = __huffman_symbol[index + code - first];
+				code = 0;
+				first = 0;
+				index = 0;
+				bits = 0;
+				continue;
+			}
+
+			/* The only 30 bits code left is EOS. */
+			if (bits == 30)
+				return -1;
+
+			index += count;
+			first = (first + count) << 1;
+			code <<= 1;
+		}
+
+		p++;
+		len--;
+	}
+
+	/* Padding is the most significant bits of EOS, and shorter than 8. */
+	if (bits >= 8 || code >> 1 != (1U << bits) - 1)
+		return -1;
+
+	return n;
+}
+
+static int __decode_integer(const unsigned char **p, const unsigned char *end,
+							int prefix, size_t *value)
+{
+	size_t mask = (1U << prefix) - 1;
+	size_t n = **p & mask;
+	int shift = 0;
+
+	(*p)++;
+	if (n == mask)
+	{
+		do
+		{
+			if (*p == end || shift > 28)
+				return -1;
+
+			n += (size_t)(**p & 0x7f) << shift;
+			shift += 7;
+		} while (*(*p)++ & 0x80);
+	}
+
+	*value = n;
+	return 0;
+}
+
+static int __decode_string(const unsigned char **p, const unsigned char *end,
+						   const char **str, size_t *len, char **scratch)
+{
+	int huffman;
+	size_t n;
+	long ret;
+
+	if (*p == end)
+		return -1;
+
+	huffman = **p & 0x80;
+	if (__decode_integer(p, end, 7, &n) < 0 || n > (size_t)(end - *p))
+		return -1;
+
+	if (huffman)
+	{
+		ret = __huffman_decode(*p, n, *scratch);
+		if (ret < 0)
+			return -1;
+
+		*str = *scratch;
+		*len = ret;
+		*scratch += ret;
+	}
+	else
+	{
+		*str = (const char *)*p;
+		*len = n;
+	}
+
+	*p += n;
+	return 0;
+}
+
+static struct __hpack_entry *__table_get(size_t index, hpack_table_t *table)
+{
+	size_t k = table->count - 1 - index;
+
+	return table->entries[(table->first + k) % table->capacity];
+}
+
+static void __table_evict(size_t max_size, hpack_table_t *table)
+{
+	struct __hpack_entry *entry;
+
+	while (table->size > max_size)
+	{
+		entry = table->entries[table->first];
+		table->size -= entry->name_len + entry->value_len + HPACK_ENTRY_OVERHEAD;
+		free(entry);
+		table->first = (table->first + 1) % table->capacity;
+		table->count--;
+	}
+}
+
+static int __table_add(struct __hpack_entry *entry, hpack_table_t *table)
+{
+	size_t size = entry->name_len + entry->value_len + HPACK_ENTRY_OVERHEAD;
+	struct __hpack_entry **entries;
+	size_t capacity;
+	size_t k;
+
+	/* An entry larger than the table empties it, and is not added. */
+	if (size > table->max_size)
+	{
+		__table_evict(0, table);
+		free(entry);
+		return 0;
+	}
+
+	__table_evict(table->max_size - size, table);
+	if (table->count == table->capacity)
+	{
+		capacity = table->capacity ? 2 * table->capacity : 16;
+		entries = (struct __hpack_entry **)malloc(capacity * sizeof (void *));
+		if (!entries)
+		{
+			free(entry);
+			return -1;
+		}
+
+		for (k = 0; k < table->count; k++)
+			entries[k] = table->entries[(table->first + k) % table->capacity];
+
+		free(table->entries);
+		table->entries = entries;
+		table->capacity = capacity;
+		table->first = 0;
+	}
+
+	table->entries[(table->first + table->count) % table->capacity] = entry;
+	table->count++;
+	table->size += size;
+	return 0;
+}
+
+static int __lookup(size_t index, const char **name, size_t *name_len,
+					const char **value, size_t *value_len,
+					hpack_table_t *table)
+{
+	struct __hpack_entry *entry;
+
+	if (index == 0)
+		return -1;
+
+	if (index <= HPACK_STATIC_SIZE)
+	{
+		*name = __static_table[index - 1].name;
+		*name_len = strlen(*name);
+		*value = __static_table[index - 1].value;
+		*value_len = strlen(*value);
+		return 0;
+	}
+
+	index -= HPACK_STATIC_SIZE + 1;
+	if (index >= table->count)
+		return -1;
+
+	entry = __table_get(index, table);
+	*name = entry->buf;
+	*name_len = entry->name_len;
+	*value = entry->buf + entry->name_len;
+	*value_len = entry->value_len;
+	return 0;
+}
+
+static struct __hpack_entry *__create_entry(const char *name, size_t name_len,
+											const char *value,
+											size_t value_len)
+{
+	size_t size = offsetof(struct __hpack_entry, buf) + name_len + value_len;
+	struct __hpack_entry *entry = (struct __hpack_entry *)malloc(size);
+
+	if (entry)
+	{
+		memcpy(entry->buf, name, name_len);
+		memcpy(entry->buf + name_len, value, value_len);
+		entry->name_len = name_len;
+		entry->value_len = value_len;
+	}
+
+	return entry;
+}
+
+static int __decode_field(const unsigned char **p, const unsigned char *end,
+						  hpack_header_t header, void *context,
+						  char *scratch, hpack_table_t *table)
+{
+	struct __hpack_entry *entry;
+	const char *name, *value;
+	size_t name_len, value_len;
+	size_t index;
+	int prefix;
+
+	if (**p & 0x80)
+	{
+		if (__decode_integer(p, end, 7, &index) < 0 ||
+			__lookup(index, &name, &name_len, &value, &value_len, table) < 0)
+			return -2;
+
+		return header(name, name_len, value, value_len, context) ? -2 : 0;
+	}
+
+	prefix = (**p & 0x40) ? 6 : 4;
+	if (__decode_integer(p, end, prefix, &index) < 0)
+		return -2;
+
+	if (index != 0)
+	{
+		if (__lookup(index, &name, &name_len, &value, &value_len, table) < 0)
+			return -2;
+	}
+	else if (__decode_string(p, end, &name, &name_len, &scratch) < 0)
+		return -2;
+
+	if (__decode_string(p, end, &value, &value_len, &scratch) < 0)
+		return -2;
+
+	if (prefix == 4)
+		return header(name, name_len, value, value_len, context) ? -2 : 0;
+
+	/* Literal with incremental indexing. The name may be in an entry that
+	 * is evicted by the new one, so the entry is created first. */
+	entry = __create_entry(name, name_len, value, value_len);
+	if (!entry)
+		return -1;
+
+	if (header(entry->buf, name_len, entry->buf + name_len, value_len,
+			   context) != 0)
+	{
+		free(entry);
+		return -2;
+	}
+
+	return __table_add(entry, table);
+}
+
+void hpack_table_init(size_t limit, hpack_table_t *table)
+{
+	table->entries = NULL;
+	table->capacity = 0;
+	table->first = 0;
+	table->count = 0;
+	table->size = 0;
+	table->max_size = limit;
+	table->limit = limit;
+}
+
+int hpack_decode_block(const void *block, size_t size,
+					   hpack_header_t header, void *context,
+					   hpack_table_t *table)
+{
+	const unsigned char *p = (const unsigned char *)block;
+	const unsigned char *end = p + size;
+	int fields = 0;
+	size_t max_size;
+	char *scratch;
+	int ret = 0;
+
+	/* Enough for the Huffman coded strings of any field. */
+	scratch = (char *)malloc(size * 8 / 5 + 1);
+	if (!scratch)
+		return -1;
+
+	while (p < end)
+	{
+		if ((*p & 0xe0) == 0x20)
+		{
+			/* Size updates are allowed only at the beginning of a block. */
+			if (fields != 0 || __decode_integer(&p, end, 5, &max_size) < 0 ||
+				max_size > table->limit)
+			{
+				ret = -2;
+				break;
+			}
+
+			__table_evict(max_size, table);
+			table->max_size = max_size;
+			continue;
+		}
+
+		ret = __decode_field(&p, end, header, context, scratch, table);
+		if (ret < 0)
+			break;
+
+		fields++;
+	}
+
+	free(scratch);
+	return ret;
+}
+
+void hpack_table_deinit(hpack_table_t *table)
+{
+	__table_evict(0, table);
+	free(table->entries);
+}
+
+static size_t __encode_integer(size_t value, int prefix, unsigned char flags,
+							   unsigned char *p)
+{
+	size_t mask = (1U << prefix) - 1;
+	size_t n = 1;
+
+	if (value < mask)
+	{
+		*p = flags | value;
+		return 1;
+	}
+
+	*p++ = flags | mask;
+	value -= mask;
+	while (value >= 0x80)
+	{
+		*p++ = (value & 0x7f) | 0x80;
+		value >>= 7;
+		n++;
+	}
+
+	*p = value;
+	return n + 1;
+}
+
+size_t hpack_encode_header(const char *name, size_t name_len,
+						   const char *value, size_t value_len,
+						   void *buf)
+{
+	unsigned char *p = (unsigned char *)buf;
+	size_t index = 0;
+	size_t i;
+
+	for (i = 0; i < HPACK_STATIC_SIZE; i++)
+	{
+		if (strlen(__static_table[i].name) == name_len &&
+			strncasecmp(__static_table[i].name, name, name_len) == 0)
+		{
+			if (strlen(__static_table[i].value) == value_len &&
+				memcmp(__static_table[i].value, value, value_len) == 0)
+			{
+				return __encode_integer(i + 1, 7, 0x80, p);
+			}
+
+			if (index == 0)
+				index = i + 1;
+		}
+	}
+
+	/* Literal header field without indexing. */
+	p += __encode_integer(index, 4, 0x00, p);
+	if (index == 0)
+	{
+		p += __encode_integer(name_len, 7, 0x00, p);
+		for (i = 0; i < name_len; i++)
+			*p++ = tolower((unsigned char)name[i]);
+	}
+
+	p += __encode_integer(value_len, 7, 0x00, p);
+	memcpy(p, value, value_len);
+	return p + value_len - (unsigned char *)buf;
+}
+
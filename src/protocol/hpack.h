@@ -0,0 +1,81 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef _HPACK_H_
+#define _HPACK_H_
+
+#include <stddef.h>
+
+/*
+ * HPACK (RFC 7541) header compression for HTTP/2.
+ *
+ * The decoder implements the whole format, including Huffman coded strings
+ * and the dynamic table. The encoder keeps no state: it emits indexed fields
+ * for exact matches of the static table, and literals without indexing for
+ * everything else, so the peer's decoder never has to maintain a table for
+ * us. Strings are not Huffman coded.
+ */
+
+#define HPACK_TABLE_SIZE_DEFAULT	4096
+
+/* Bytes enough for hpack_encode_header() to encode one field. */
+#define HPACK_ENCODE_MAX(name_len, value_len)	((name_len) + (value_len) + 16)
+
+typedef struct __hpack_table
+{
+	struct __hpack_entry **entries;
+	size_t capacity;
+	size_t first;
+	size_t count;
+	size_t size;
+	size_t max_size;
+	size_t limit;
+} hpack_table_t;
+
+typedef int (*hpack_header_t)(const char *name, size_t name_len,
+							  const char *value, size_t value_len,
+							  void *context);
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* 'limit' is the SETTINGS_HEADER_TABLE_SIZE we have announced. */
+void hpack_table_init(size_t limit, hpack_table_t *table);
+
+/* Decode a complete header block, calling 'header' for every field in
+ * order. Returns 0 on success, -1 on system error, or -2 if the block is
+ * malformed or 'header' returns non-zero. The table is updated as the
+ * block is decoded, so a failure leaves the connection unusable. */
+int hpack_decode_block(const void *block, size_t size,
+					   hpack_header_t header, void *context,
+					   hpack_table_t *table);
+
+void hpack_table_deinit(hpack_table_t *table);
+
+/* Encode one field into 'buf' and return the length. The name is converted
+ * to lower case, as HTTP/2 requires. */
+size_t hpack_encode_header(const char *name, size_t name_len,
+						   const char *value, size_t value_len,
+						   void *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
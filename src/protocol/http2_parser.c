@@ -0,0 +1,994 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "hpack.h"
+#include "http_parser.h"
+#include "http2_parser.h"
+
+#define MIN(x, y)	((x) <= (y) ? (x) : (y))
+
+#define HTTP2_CLIENT_MAGIC		"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_CLIENT_MAGIC_SIZE	24
+/* The part after the HTTP/1.x like request line, which is parsed as one. */
+#define HTTP2_MAGIC_REMAINDER	"SM\r\n\r\n"
+
+#define HTTP2_WINDOW_MAX		0x7fffffff
+#define HTTP2_WINDOW_DEFAULT	65535
+#define HTTP2_FRAME_SIZE_MAX	0xffffff
+
+#define HTTP2_SETTINGS_HEADER_TABLE_SIZE		0x1
+#define HTTP2_SETTINGS_ENABLE_PUSH				0x2
+#define HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS	0x3
+#define HTTP2_SETTINGS_INITIAL_WINDOW_SIZE		0x4
+#define HTTP2_SETTINGS_MAX_FRAME_SIZE			0x5
+
+#define HTTP2_REFUSED_STREAM	0x7
+#define HTTP2_CANCEL			0x8
+
+struct __header_context
+{
+	http_parser_t *parser;
+	int trailer;
+	int regular;
+	int has_authority;
+};
+
+static inline unsigned int __get_uint32(const void *buf)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+
+	return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void __put_uint32(unsigned int n, void *buf)
+{
+	unsigned char *p = (unsigned char *)buf;
+
+	p[0] = n >> 24;
+	p[1] = n >> 16;
+	p[2] = n >> 8;
+	p[3] = n;
+}
+
+static int __queue_frame(int type, int flags, unsigned int stream_id,
+						 const void *payload, size_t size,
+						 http2_conn_t *conn)
+{
+	size_t n = conn->out_size + HTTP2_FRAME_HEADER_SIZE + size;
+	char *out = (char *)realloc(conn->out, n);
+
+	if (!out)
+		return -1;
+
+	http2_frame_header(size, type, flags, stream_id, out + conn->out_size);
+	memcpy(out + conn->out_size + HTTP2_FRAME_HEADER_SIZE, payload, size);
+	conn->out = out;
+	conn->out_size = n;
+	return 0;
+}
+
+static int __set_string(const char *value, size_t len, char **field)
+{
+	char *str = (char *)malloc(len + 1);
+
+	if (!str)
+		return -1;
+
+	memcpy(str, value, len);
+	str[len] = '\0';
+	free(*field);
+	*field = str;
+	return 0;
+}
+
+static int __is_connection_header(const char *name, size_t len)
+{
+	switch (len)
+	{
+	case 7:
+		return strncasecmp(name, "upgrade", 7) == 0;
+	case 10:
+		return strncasecmp(name, "connection", 10) == 0 ||
+			   strncasecmp(name, "keep-alive", 10) == 0;
+	case 16:
+		return strncasecmp(name, "proxy-connection", 16) == 0;
+	case 17:
+		return strncasecmp(name, "transfer-encoding", 17) == 0;
+	}
+
+	return 0;
+}
+
+static int __add_header(const char *name, size_t name_len,
+						const char *value, size_t value_len,
+						void *context)
+{
+	struct __header_context *ctx = (struct __header_context *)context;
+	http_parser_t *parser = ctx->parser;
+
+	if (name_len > 0 && name[0] == ':')
+	{
+		if (ctx->regular || ctx->trailer)
+			return -1;
+
+		if (parser->is_resp)
+		{
+			if (name_len == 7 && memcmp(name, ":status", 7) == 0)
+				return __set_string(value, value_len, &parser->code);
+
+			return -1;
+		}
+
+		if (name_len == 7 && memcmp(name, ":method", 7) == 0)
+			return __set_string(value, value_len, &parser->method);
+
+		if (name_len == 5 && memcmp(name, ":path", 5) == 0)
+			return __set_string(value, value_len, &parser->uri);
+
+		if (name_len == 7 && memcmp(name, ":scheme", 7) == 0)
+			return 0;
+
+		if (name_len == 10 && memcmp(name, ":authority", 10) == 0)
+		{
+			ctx->has_authority = 1;
+			return http_parser_add_header("Host", 4, value, value_len, parser);
+		}
+
+		return -1;
+	}
+
+	ctx->regular = 1;
+	if (__is_connection_header(name, name_len))
+		return -1;
+
+	/* :authority takes the place of Host. */
+	if (ctx->has_authority && name_len == 4 &&
+		strncasecmp(name, "host", 4) == 0)
+		return 0;
+
+	return http_parser_add_header(name, name_len, value, value_len, parser);
+}
+
+static int __ignore_header(const char *name, size_t name_len,
+						   const char *value, size_t value_len,
+						   void *context)
+{
+	return 0;
+}
+
+static int __reset_stream(unsigned int stream_id, unsigned int code,
+						  http2_conn_t *conn)
+{
+	char buf[4];
+
+	__put_uint32(code, buf);
+	return __queue_frame(HTTP2_RST_STREAM, 0, stream_id, buf, 4, conn);
+}
+
+static http2_stream_t *__new_stream(unsigned int stream_id,
+									http2_conn_t *conn)
+{
+	http2_stream_t *stream = (http2_stream_t *)malloc(sizeof (http2_stream_t));
+
+	if (!stream)
+		return NULL;
+
+	stream->parser = NULL;
+	if (conn->is_server)
+	{
+		stream->parser = (http_parser_t *)malloc(sizeof (http_parser_t));
+		if (!stream->parser)
+		{
+			free(stream);
+			return NULL;
+		}
+
+		http_parser_init(0, stream->parser);
+	}
+
+	stream->id = stream_id;
+	stream->send_window = conn->initial_window;
+	stream->context = NULL;
+	stream->data = NULL;
+	stream->data_size = 0;
+	stream->data_offset = 0;
+	stream->end_stream = 0;
+	stream->local_closed = 0;
+	stream->remote_closed = 0;
+	stream->reset = 0;
+	list_add_tail(&stream->list, &conn->stream_list);
+	conn->nstreams++;
+	return stream;
+}
+
+static void __free_stream(http2_stream_t *stream, http2_conn_t *conn)
+{
+	list_del(&stream->list);
+	conn->nstreams--;
+	if (conn->is_server && stream->parser)
+	{
+		http_parser_deinit(stream->parser);
+		free(stream->parser);
+	}
+
+	conn->queued -= stream->data_size - stream->data_offset;
+	free(stream->data);
+	free(stream);
+}
+
+static void __finish_message(http2_stream_t *stream)
+{
+	http_parser_close_message(stream->parser);
+	stream->remote_closed = 1;
+}
+
+/* Queue DATA frames of the data waiting, as far as the windows allow. */
+static int __send_queued(http2_stream_t *stream, http2_conn_t *conn)
+{
+	size_t size;
+	int flags;
+
+	while (stream->data_offset < stream->data_size)
+	{
+		size = MIN(stream->data_size - stream->data_offset,
+				   conn->max_frame_size);
+		size = MIN(size, http2_stream_window(stream, conn));
+		if (size == 0)
+			return 0;
+
+		stream->data_offset += size;
+		conn->queued -= size;
+		flags = 0;
+		if (stream->data_offset == stream->data_size && stream->end_stream)
+			flags = HTTP2_FLAG_END_STREAM;
+
+		if (__queue_frame(HTTP2_DATA, flags, stream->id,
+						  stream->data + stream->data_offset - size, size,
+						  conn) < 0)
+			return -1;
+
+		http2_stream_consume_window(size, stream, conn);
+	}
+
+	free(stream->data);
+	stream->data = NULL;
+	stream->data_size = 0;
+	stream->data_offset = 0;
+	if (stream->end_stream)
+	{
+		stream->end_stream = 0;
+		http2_stream_end(stream, conn);
+	}
+
+	return 0;
+}
+
+static int __send_all_queued(http2_conn_t *conn)
+{
+	struct list_head *pos, *tmp;
+	http2_stream_t *stream;
+
+	list_for_each_safe(pos, tmp, &conn->stream_list)
+	{
+		stream = list_entry(pos, http2_stream_t, list);
+		if (stream->data && __send_queued(stream, conn) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int __handle_header_block(http2_conn_t *conn,
+								 http2_stream_t **touched)
+{
+	http2_stream_t *stream;
+	http_parser_t *parser;
+	struct __header_context ctx;
+	int ret;
+
+	stream = http2_conn_find_stream(conn->block_stream, conn);
+	conn->block_stream = 0;
+
+	/* A stream refused or closed by us still changes the decoder table. */
+	if (!stream || !stream->parser || stream->remote_closed)
+	{
+		return hpack_decode_block(conn->block, conn->block_size,
+								  __ignore_header, NULL, &conn->table);
+	}
+
+	parser = stream->parser;
+	ctx.parser = parser;
+	ctx.trailer = http_parser_header_complete(parser);
+	ctx.regular = 0;
+	ctx.has_authority = 0;
+	ret = hpack_decode_block(conn->block, conn->block_size,
+							 __add_header, &ctx, &conn->table);
+	if (ret < 0)
+		return ret;
+
+	*touched = stream;
+	if (ctx.trailer)
+	{
+		if (!conn->end_stream)
+			return -2;
+
+		__finish_message(stream);
+		return 0;
+	}
+
+	if (parser->is_resp)
+	{
+		if (!parser->code)
+			return -2;
+
+		/* Informational responses are followed by the final one. */
+		if (parser->code[0] == '1')
+		{
+			http_parser_deinit(parser);
+			http_parser_init(1, parser);
+			return conn->end_stream ? -2 : 0;
+		}
+	}
+	else if (!parser->method || !parser->uri)
+		return -2;
+
+	if (__set_string("HTTP/2.0", 8, &parser->version) < 0 ||
+		http_parser_append_body("", 0, parser) < 0)
+		return -1;
+
+	if (conn->end_stream)
+		__finish_message(stream);
+
+	return 0;
+}
+
+static int __handle_headers(const char *payload, size_t size,
+							int flags, unsigned int stream_id,
+							http2_conn_t *conn, http2_stream_t **touched)
+{
+	http2_stream_t *stream;
+	size_t pad = 0;
+	char *block;
+
+	if (stream_id == 0)
+		return -2;
+
+	if (flags & HTTP2_FLAG_PADDED)
+	{
+		if (size == 0)
+			return -2;
+
+		pad = (unsigned char)*payload++;
+		size--;
+	}
+
+	if (flags & HTTP2_FLAG_PRIORITY)
+	{
+		if (size < 5)
+			return -2;
+
+		payload += 5;
+		size -= 5;
+	}
+
+	if (pad > size)
+		return -2;
+
+	size -= pad;
+	stream = http2_conn_find_stream(stream_id, conn);
+	if (!stream)
+	{
+		/* Only a client opens streams, as we never enable push. */
+		if (stream_id <= conn->last_stream_id)
+		{
+			if (conn->is_server)
+				return -2;
+		}
+		else if (!conn->is_server || !(stream_id & 1))
+			return -2;
+		else
+		{
+			conn->last_stream_id = stream_id;
+			if (conn->nstreams >= HTTP2_STREAMS_MAX || conn->goaway ||
+				conn->queued >= HTTP2_QUEUED_MAX)
+			{
+				/* The client may retry a refused stream. */
+				if (__reset_stream(stream_id, HTTP2_REFUSED_STREAM, conn) < 0)
+					return -1;
+			}
+			else if (!__new_stream(stream_id, conn))
+				return -1;
+		}
+	}
+	else if (stream->parser && http_parser_header_complete(stream->parser) &&
+			 !(flags & HTTP2_FLAG_END_STREAM))
+		return -2;
+
+	block = (char *)malloc(size + 1);
+	if (!block)
+		return -1;
+
+	memcpy(block, payload, size);
+	free(conn->block);
+	conn->block = block;
+	conn->block_size = size;
+	conn->block_stream = stream_id;
+	conn->end_stream = flags & HTTP2_FLAG_END_STREAM;
+	if (flags & HTTP2_FLAG_END_HEADERS)
+		return __handle_header_block(conn, touched);
+
+	return 0;
+}
+
+static int __handle_continuation(const char *payload, size_t size,
+								 int flags, unsigned int stream_id,
+								 http2_conn_t *conn, http2_stream_t **touched)
+{
+	char *block;
+
+	if (stream_id != conn->block_stream)
+		return -2;
+
+	block = (char *)realloc(conn->block, conn->block_size + size);
+	if (!block)
+		return -1;
+
+	memcpy(block + conn->block_size, payload, size);
+	conn->block = block;
+	conn->block_size += size;
+	if (flags & HTTP2_FLAG_END_HEADERS)
+		return __handle_header_block(conn, touched);
+
+	return 0;
+}
+
+static int __handle_data(const char *payload, size_t size,
+						 int flags, unsigned int stream_id,
+						 http2_conn_t *conn, http2_stream_t **touched)
+{
+	http2_stream_t *stream;
+	unsigned int increment;
+	char buf[4];
+	size_t pad = 0;
+
+	if (stream_id == 0)
+		return -2;
+
+	/* Every DATA frame counts, even the ones of refused streams. */
+	conn->recv_window -= size;
+	if (conn->recv_window < HTTP2_WINDOW_MAX / 2)
+	{
+		increment = HTTP2_WINDOW_MAX - conn->recv_window;
+		__put_uint32(increment, buf);
+		if (__queue_frame(HTTP2_WINDOW_UPDATE, 0, 0, buf, 4, conn) < 0)
+			return -1;
+
+		conn->recv_window = HTTP2_WINDOW_MAX;
+	}
+
+	stream = http2_conn_find_stream(stream_id, conn);
+	if (!stream || !stream->parser || stream->remote_closed)
+		return stream_id > conn->last_stream_id ? -2 : 0;
+
+	if (!http_parser_header_complete(stream->parser))
+		return -2;
+
+	if (flags & HTTP2_FLAG_PADDED)
+	{
+		if (size == 0)
+			return -2;
+
+		pad = (unsigned char)*payload++;
+		size--;
+		if (pad > size)
+			return -2;
+
+		size -= pad;
+	}
+
+	if (http_parser_append_body(payload, size, stream->parser) < 0)
+		return -1;
+
+	*touched = stream;
+	if (flags & HTTP2_FLAG_END_STREAM)
+		__finish_message(stream);
+
+	return 0;
+}
+
+static int __handle_settings(const char *payload, size_t size, int flags,
+							 http2_conn_t *conn)
+{
+	struct list_head *pos;
+	http2_stream_t *stream;
+	unsigned int value;
+	long long delta;
+	int id;
+
+	if (flags & HTTP2_FLAG_ACK)
+		return size == 0 ? 0 : -2;
+
+	if (size % 6 != 0)
+		return -2;
+
+	while (size > 0)
+	{
+		id = ((unsigned char)payload[0] << 8) | (unsigned char)payload[1];
+		value = __get_uint32(payload + 2);
+		switch (id)
+		{
+		case HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS:
+			conn->max_streams = value;
+			break;
+
+		case HTTP2_SETTINGS_INITIAL_WINDOW_SIZE:
+			if (value > HTTP2_WINDOW_MAX)
+				return -2;
+
+			/* It changes the windows of all the open streams. */
+			delta = (long long)value - conn->initial_window;
+			list_for_each(pos, &conn->stream_list)
+			{
+				stream = list_entry(pos, http2_stream_t, list);
+				stream->send_window += delta;
+			}
+
+			conn->initial_window = value;
+			break;
+
+		case HTTP2_SETTINGS_MAX_FRAME_SIZE:
+			if (value < HTTP2_FRAME_SIZE_DEFAULT || value > HTTP2_FRAME_SIZE_MAX)
+				return -2;
+
+			conn->max_frame_size = value;
+			break;
+		}
+
+		payload += 6;
+		size -= 6;
+	}
+
+	if (__queue_frame(HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0, NULL, 0, conn) < 0)
+		return -1;
+
+	return __send_all_queued(conn);
+}
+
+static int __handle_window_update(const char *payload, size_t size,
+								  unsigned int stream_id, http2_conn_t *conn)
+{
+	http2_stream_t *stream;
+	unsigned int increment;
+
+	if (size != 4)
+		return -2;
+
+	increment = __get_uint32(payload) & 0x7fffffff;
+	if (increment == 0)
+		return -2;
+
+	if (stream_id == 0)
+	{
+		conn->send_window += increment;
+		if (conn->send_window > HTTP2_WINDOW_MAX)
+			return -2;
+
+		return __send_all_queued(conn);
+	}
+
+	stream = http2_conn_find_stream(stream_id, conn);
+	if (!stream)
+		return 0;
+
+	stream->send_window += increment;
+	if (stream->send_window > HTTP2_WINDOW_MAX)
+		return -2;
+
+	if (stream->data)
+		return __send_queued(stream, conn);
+
+	return 0;
+}
+
+static int __handle_goaway(const char *payload, size_t size,
+						   http2_conn_t *conn)
+{
+	unsigned int last_stream_id;
+	struct list_head *pos;
+	http2_stream_t *stream;
+
+	if (size < 8)
+		return -2;
+
+	last_stream_id = __get_uint32(payload) & 0x7fffffff;
+	conn->goaway = 1;
+	list_for_each(pos, &conn->stream_list)
+	{
+		stream = list_entry(pos, http2_stream_t, list);
+		if (stream->parser)
+			stream->parser->keep_alive = 0;
+
+		/* Our requests that the server will never process. */
+		if (!conn->is_server && stream->id > last_stream_id)
+		{
+			errno = ECONNRESET;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int __handle_frame(http2_conn_t *conn, http2_stream_t **touched)
+{
+	const unsigned char *header = conn->header;
+	size_t size = (header[0] << 16) | (header[1] << 8) | header[2];
+	unsigned int stream_id = __get_uint32(header + 5) & 0x7fffffff;
+	const char *payload = conn->payload;
+	http2_stream_t *stream;
+	int type = header[3];
+	int flags = header[4];
+
+	/* A header block must not be interleaved with any other frame. */
+	if (conn->block_stream != 0 && type != HTTP2_CONTINUATION)
+		return -2;
+
+	switch (type)
+	{
+	case HTTP2_DATA:
+		return __handle_data(payload, size, flags, stream_id, conn, touched);
+
+	case HTTP2_HEADERS:
+		return __handle_headers(payload, size, flags, stream_id, conn,
+								touched);
+
+	case HTTP2_CONTINUATION:
+		return __handle_continuation(payload, size, flags, stream_id,
+									 conn, touched);
+
+	case HTTP2_RST_STREAM:
+		if (size != 4 || stream_id == 0)
+			return -2;
+
+		stream = http2_conn_find_stream(stream_id, conn);
+		if (!stream)
+			return 0;
+
+		/* A request of ours is reset. Only its own message fails. */
+		if (!conn->is_server)
+		{
+			stream->local_closed = 1;
+			stream->remote_closed = 1;
+			stream->reset = 1;
+			*touched = stream;
+			return 0;
+		}
+
+		/* A response to it is not sent, if not complete yet. */
+		__free_stream(stream, conn);
+		return 0;
+
+	case HTTP2_SETTINGS:
+		if (stream_id != 0)
+			return -2;
+
+		return __handle_settings(payload, size, flags, conn);
+
+	case HTTP2_PING:
+		if (size != 8 || stream_id != 0)
+			return -2;
+
+		if (flags & HTTP2_FLAG_ACK)
+			return 0;
+
+		return __queue_frame(HTTP2_PING, HTTP2_FLAG_ACK, 0, payload, 8, conn);
+
+	case HTTP2_GOAWAY:
+		if (stream_id != 0)
+			return -2;
+
+		return __handle_goaway(payload, size, conn);
+
+	case HTTP2_WINDOW_UPDATE:
+		return __handle_window_update(payload, size, stream_id, conn);
+
+	case HTTP2_PUSH_PROMISE:
+		/* We never enable push. */
+		return -2;
+
+	default:
+		/* PRIORITY, and the types we do not know. */
+		return 0;
+	}
+}
+
+void http2_conn_init(int is_server, http2_conn_t *conn)
+{
+	hpack_table_init(HPACK_TABLE_SIZE_DEFAULT, &conn->table);
+	INIT_LIST_HEAD(&conn->stream_list);
+	conn->nstreams = 0;
+	/* Till the SETTINGS of the peer tell. */
+	conn->max_streams = HTTP2_STREAMS_MAX;
+	conn->last_stream_id = 0;
+	conn->max_frame_size = HTTP2_FRAME_SIZE_DEFAULT;
+	conn->initial_window = HTTP2_WINDOW_DEFAULT;
+	conn->send_window = HTTP2_WINDOW_DEFAULT;
+	conn->recv_window = HTTP2_WINDOW_DEFAULT;
+	conn->queued = 0;
+	conn->preface = 0;
+	conn->frame_offset = 0;
+	conn->payload = NULL;
+	conn->block = NULL;
+	conn->block_size = 0;
+	conn->block_stream = 0;
+	conn->out = NULL;
+	conn->out_size = 0;
+	conn->end_stream = 0;
+	conn->settings_sent = 0;
+	conn->goaway = 0;
+	conn->enabled = 0;
+	conn->is_server = is_server;
+}
+
+int http2_conn_enable(http2_conn_t *conn)
+{
+	char buf[HTTP2_PREFACE_MAX];
+	size_t size;
+
+	conn->payload = (char *)malloc(HTTP2_FRAME_SIZE_DEFAULT);
+	if (!conn->payload)
+		return -1;
+
+	if (conn->is_server)
+	{
+		/* The server preface is sent as soon as the client's comes. */
+		conn->preface = strlen(HTTP2_MAGIC_REMAINDER);
+		size = http2_conn_preface(buf, conn);
+		conn->out = (char *)malloc(size);
+		if (!conn->out)
+		{
+			free(conn->payload);
+			conn->payload = NULL;
+			return -1;
+		}
+
+		memcpy(conn->out, buf, size);
+		conn->out_size = size;
+	}
+
+	conn->enabled = 1;
+	return 0;
+}
+
+int http2_parser_append_message(const void *buf, size_t *n,
+								http2_stream_t **stream,
+								http2_conn_t *conn)
+{
+	const char *p = (const char *)buf;
+	const char *end = p + *n;
+	const unsigned char *header = conn->header;
+	size_t offset;
+	size_t size;
+	size_t len;
+	int ret;
+
+	*stream = NULL;
+	if (conn->preface != 0)
+	{
+		offset = strlen(HTTP2_MAGIC_REMAINDER) - conn->preface;
+		len = MIN(conn->preface, (size_t)(end - p));
+		if (memcmp(p, HTTP2_MAGIC_REMAINDER + offset, len) != 0)
+			return -2;
+
+		conn->preface -= len;
+		p += len;
+	}
+
+	while (p < end)
+	{
+		if (conn->frame_offset < HTTP2_FRAME_HEADER_SIZE)
+		{
+			len = MIN(HTTP2_FRAME_HEADER_SIZE - conn->frame_offset,
+					  (size_t)(end - p));
+			memcpy(conn->header + conn->frame_offset, p, len);
+			conn->frame_offset += len;
+			p += len;
+			if (conn->frame_offset < HTTP2_FRAME_HEADER_SIZE)
+				break;
+		}
+
+		/* We never announce a larger SETTINGS_MAX_FRAME_SIZE. */
+		size = (header[0] << 16) | (header[1] << 8) | header[2];
+		if (size > HTTP2_FRAME_SIZE_DEFAULT)
+			return -2;
+
+		offset = conn->frame_offset - HTTP2_FRAME_HEADER_SIZE;
+		len = MIN(size - offset, (size_t)(end - p));
+		memcpy(conn->payload + offset, p, len);
+		conn->frame_offset += len;
+		p += len;
+		if (offset + len < size)
+			break;
+
+		conn->frame_offset = 0;
+		ret = __handle_frame(conn, stream);
+		if (ret < 0)
+			return ret;
+
+		if (*stream)
+			break;
+	}
+
+	*n = p - (const char *)buf;
+	return *stream ? (*stream)->remote_closed : 0;
+}
+
+size_t http2_conn_preface(void *buf, http2_conn_t *conn)
+{
+	char *p = (char *)buf;
+	int n = 0;
+
+	if (!conn->is_server)
+	{
+		memcpy(p, HTTP2_CLIENT_MAGIC, HTTP2_CLIENT_MAGIC_SIZE);
+		p += HTTP2_CLIENT_MAGIC_SIZE;
+	}
+
+	http2_frame_header(12, HTTP2_SETTINGS, 0, 0, p);
+	p += HTTP2_FRAME_HEADER_SIZE;
+	if (conn->is_server)
+	{
+		p[n++] = 0;
+		p[n++] = HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS;
+		__put_uint32(HTTP2_STREAMS_MAX, p + n);
+	}
+	else
+	{
+		p[n++] = 0;
+		p[n++] = HTTP2_SETTINGS_ENABLE_PUSH;
+		__put_uint32(0, p + n);
+	}
+
+	n += 4;
+	p[n++] = 0;
+	p[n++] = HTTP2_SETTINGS_INITIAL_WINDOW_SIZE;
+	__put_uint32(HTTP2_WINDOW_MAX, p + n);
+	n += 4;
+	p += n;
+
+	http2_frame_header(4, HTTP2_WINDOW_UPDATE, 0, 0, p);
+	p += HTTP2_FRAME_HEADER_SIZE;
+	__put_uint32(HTTP2_WINDOW_MAX - HTTP2_WINDOW_DEFAULT, p);
+	p += 4;
+
+	conn->recv_window = HTTP2_WINDOW_MAX;
+	conn->settings_sent = 1;
+	return p - (char *)buf;
+}
+
+http2_stream_t *http2_conn_open_stream(http2_conn_t *conn)
+{
+	unsigned int stream_id = conn->last_stream_id ? conn->last_stream_id + 2 : 1;
+	http2_stream_t *stream;
+
+	if (stream_id > HTTP2_WINDOW_MAX || conn->goaway ||
+		conn->nstreams >= conn->max_streams ||
+		conn->queued >= HTTP2_QUEUED_MAX)
+	{
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	stream = __new_stream(stream_id, conn);
+	if (stream)
+		conn->last_stream_id = stream_id;
+
+	return stream;
+}
+
+http2_stream_t *http2_conn_find_stream(unsigned int id, http2_conn_t *conn)
+{
+	struct list_head *pos;
+	http2_stream_t *stream;
+
+	list_for_each(pos, &conn->stream_list)
+	{
+		stream = list_entry(pos, http2_stream_t, list);
+		if (stream->id == id)
+			return stream;
+	}
+
+	return NULL;
+}
+
+void http2_conn_close_stream(http2_stream_t *stream, http2_conn_t *conn)
+{
+	if (!stream->local_closed || !stream->remote_closed)
+		__reset_stream(stream->id, HTTP2_CANCEL, conn);
+
+	__free_stream(stream, conn);
+}
+
+size_t http2_stream_window(const http2_stream_t *stream,
+						   const http2_conn_t *conn)
+{
+	long long window = MIN(conn->send_window, stream->send_window);
+
+	return window > 0 ? window : 0;
+}
+
+void http2_stream_consume_window(size_t size, http2_stream_t *stream,
+								 http2_conn_t *conn)
+{
+	conn->send_window -= size;
+	stream->send_window -= size;
+}
+
+int http2_stream_queue_data(const void *buf, size_t size,
+							http2_stream_t *stream, http2_conn_t *conn)
+{
+	char *data = (char *)realloc(stream->data, stream->data_size + size);
+
+	if (!data)
+		return -1;
+
+	memcpy(data + stream->data_size, buf, size);
+	stream->data = data;
+	stream->data_size += size;
+	conn->queued += size;
+	return 0;
+}
+
+void http2_stream_end(http2_stream_t *stream, http2_conn_t *conn)
+{
+	if (stream->data)
+		stream->end_stream = 1;
+	else
+	{
+		stream->local_closed = 1;
+		if (conn->is_server && stream->remote_closed)
+			__free_stream(stream, conn);
+	}
+}
+
+void http2_stream_take_message(http_parser_t *parser, http2_stream_t *stream)
+{
+	http_parser_t *from = stream->parser;
+
+	http_parser_deinit(parser);
+	*parser = *from;
+	INIT_LIST_HEAD(&parser->header_list);
+	list_splice(&from->header_list, &parser->header_list);
+	free(from);
+	stream->parser = NULL;
+}
+
+void http2_conn_deinit(http2_conn_t *conn)
+{
+	struct list_head *pos, *tmp;
+
+	list_for_each_safe(pos, tmp, &conn->stream_list)
+		__free_stream(list_entry(pos, http2_stream_t, list), conn);
+
+	hpack_table_deinit(&conn->table);
+	free(conn->payload);
+	free(conn->block);
+	free(conn->out);
+}
@@ -0,0 +1,183 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef _HTTP2_PARSER_H_
+#define _HTTP2_PARSER_H_
+
+#include <stddef.h>
+#include "hpack.h"
+#include "http_parser.h"
+
+/*
+ * HTTP/2 framing (RFC 7540) over cleartext TCP, with prior knowledge.
+ *
+ * The streams of a connection are kept by ID, so that many requests share
+ * it. Each stream is decoded into an http_parser_t, with pseudo-header fields
+ * turned into the start line, so that an HTTP/2 message looks the same as an
+ * HTTP/1.1 one with version "HTTP/2.0". A server has a parser of its own for
+ * every stream, till the request is complete and taken. A client binds the
+ * parser of each response to its stream.
+ *
+ * DATA beyond the send windows that the peer allows is queued in its stream,
+ * and sent when WINDOW_UPDATE comes. Past HTTP2_QUEUED_MAX bytes queued on a
+ * connection, a client opens no more streams on it, and a server refuses the
+ * new ones. Both sides announce the largest possible receive windows.
+ * Frames to send while receiving, like the answers to SETTINGS and PING and
+ * the queued DATA, are put in the 'out' buffer, which the caller sends and
+ * clears after every append.
+ */
+
+#define HTTP2_FRAME_HEADER_SIZE		9
+#define HTTP2_FRAME_SIZE_DEFAULT	16384
+#define HTTP2_PREFACE_MAX			64
+#define HTTP2_STREAMS_MAX			100
+#define HTTP2_QUEUED_MAX			(8 * 1024 * 1024)
+
+#define HTTP2_DATA					0x0
+#define HTTP2_HEADERS				0x1
+#define HTTP2_PRIORITY				0x2
+#define HTTP2_RST_STREAM			0x3
+#define HTTP2_SETTINGS				0x4
+#define HTTP2_PUSH_PROMISE			0x5
+#define HTTP2_PING					0x6
+#define HTTP2_GOAWAY				0x7
+#define HTTP2_WINDOW_UPDATE			0x8
+#define HTTP2_CONTINUATION			0x9
+
+#define HTTP2_FLAG_END_STREAM		0x1
+#define HTTP2_FLAG_ACK				0x1
+#define HTTP2_FLAG_END_HEADERS		0x4
+#define HTTP2_FLAG_PADDED			0x8
+#define HTTP2_FLAG_PRIORITY			0x20
+
+typedef struct __http2_stream
+{
+	struct list_head list;
+	unsigned int id;
+	long long send_window;
+	http_parser_t *parser;
+	void *context;
+	char *data;			/* DATA waiting for the send windows */
+	size_t data_size;
+	size_t data_offset;
+	char end_stream;	/* the queued DATA ends the stream */
+	char local_closed;
+	char remote_closed;
+	char reset;			/* by the peer, of a client */
+} http2_stream_t;
+
+typedef struct __http2_conn
+{
+	hpack_table_t table;
+	struct list_head stream_list;
+	unsigned int nstreams;
+	unsigned int max_streams;
+	unsigned int last_stream_id;
+	unsigned int max_frame_size;
+	long long initial_window;
+	long long send_window;
+	long long recv_window;
+	size_t queued;		/* DATA queued in all the streams */
+	size_t preface;
+	unsigned char header[HTTP2_FRAME_HEADER_SIZE];
+	size_t frame_offset;
+	char *payload;
+	char *block;
+	size_t block_size;
+	unsigned int block_stream;
+	char *out;
+	size_t out_size;
+	char end_stream;
+	char settings_sent;
+	char goaway;
+	char enabled;
+	char is_server;
+} http2_conn_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* A connection starts disabled. A client enables it before sending the
+ * first request, and a server when it receives the client preface. */
+void http2_conn_init(int is_server, http2_conn_t *conn);
+int http2_conn_enable(http2_conn_t *conn);
+
+/* Handle frames till one of them changes the message of a stream, which is
+ * returned in '*stream', or till all the data is consumed. Returns 1 if the
+ * message of '*stream' is complete, 0 if not or if there is no such stream,
+ * or the same negative values as http_parser_append_message(). '*n' is set
+ * to the bytes consumed. A stream of a client reset by the server is
+ * returned complete, with 'reset' set. */
+int http2_parser_append_message(const void *buf, size_t *n,
+								http2_stream_t **stream,
+								http2_conn_t *conn);
+
+/* The client magic if a client, followed by our SETTINGS and a connection
+ * WINDOW_UPDATE. Returns the size, at most HTTP2_PREFACE_MAX. */
+size_t http2_conn_preface(void *buf, http2_conn_t *conn);
+
+/* Open the stream of the next request of a client. Fails with EAGAIN if
+ * the peer takes no more streams on this connection, or if too much DATA
+ * is queued on it. */
+http2_stream_t *http2_conn_open_stream(http2_conn_t *conn);
+http2_stream_t *http2_conn_find_stream(unsigned int id, http2_conn_t *conn);
+
+/* A stream that is not closed on both sides is reset with CANCEL. */
+void http2_conn_close_stream(http2_stream_t *stream, http2_conn_t *conn);
+
+/* The DATA that may be sent on the stream now, and taking it. */
+size_t http2_stream_window(const http2_stream_t *stream,
+						   const http2_conn_t *conn);
+void http2_stream_consume_window(size_t size, http2_stream_t *stream,
+								 http2_conn_t *conn);
+
+/* Queue the DATA beyond the windows. It is sent in later appends. */
+int http2_stream_queue_data(const void *buf, size_t size,
+							http2_stream_t *stream, http2_conn_t *conn);
+
+/* The end of the stream is sent, or queued after its DATA. A server stream
+ * that is closed on both sides is freed. */
+void http2_stream_end(http2_stream_t *stream, http2_conn_t *conn);
+
+/* Of a server, take the complete request of a stream into 'parser'. */
+void http2_stream_take_message(http_parser_t *parser, http2_stream_t *stream);
+
+void http2_conn_deinit(http2_conn_t *conn);
+
+#ifdef __cplusplus
+}
+#endif
+
+static inline void http2_frame_header(size_t length, int type, int flags,
+									  unsigned int stream_id, void *buf)
+{
+	unsigned char *p = (unsigned char *)buf;
+
+	p[0] = length >> 16;
+	p[1] = length >> 8;
+	p[2] = length;
+	p[3] = type;
+	p[4] = flags;
+	p[5] = (stream_id >> 24) & 0x7f;
+	p[6] = stream_id >> 16;
+	p[7] = stream_id >> 8;
+	p[8] = stream_id;
+}
+
+#endif
+
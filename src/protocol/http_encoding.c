@@ -0,0 +1,431 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+#include "http_encoding.h"
+
+#define HTTP_DECODER_INIT_SIZE	16384
+#define ZLIB_PIECE_MAX			(1U << 30)
+
+static int __encoding_name(const char *name, size_t len)
+{
+#ifdef HAVE_ZLIB
+	if ((len == 4 && strncasecmp(name, "gzip", 4) == 0) ||
+		(len == 6 && strncasecmp(name, "x-gzip", 6) == 0))
+		return HTTP_ENCODING_GZIP;
+
+	if (len == 7 && strncasecmp(name, "deflate", 7) == 0)
+		return HTTP_ENCODING_DEFLATE;
+#endif
+
+	if (len == 8 && strncasecmp(name, "identity", 8) == 0)
+		return HTTP_ENCODING_IDENTITY;
+
+	return -1;
+}
+
+static size_t __trim(const char **p, size_t len)
+{
+	while (len > 0 && (**p == ' ' || **p == '\t'))
+	{
+		(*p)++;
+		len--;
+	}
+
+	while (len > 0 && ((*p)[len - 1] == ' ' || (*p)[len - 1] == '\t'))
+		len--;
+
+	return len;
+}
+
+int http_encoding_parse(const char *value, size_t len)
+{
+	len = __trim(&value, len);
+	return __encoding_name(value, len);
+}
+
+/* A qvalue in thousandths: "0", "0.5", "1.000". */
+static int __parse_qvalue(const char *p, size_t len)
+{
+	int q = 0;
+	int scale = 1000;
+	size_t i;
+
+	len = __trim(&p, len);
+	if (len < 2 || (p[0] != 'q' && p[0] != 'Q') || p[1] != '=')
+		return 1000;
+
+	p += 2;
+	len -= 2;
+	len = __trim(&p, len);
+	if (len == 0 || (p[0] != '0' && p[0] != '1'))
+		return 0;
+
+	q = (p[0] - '0') * 1000;
+	if (len > 1 && p[1] == '.')
+	{
+		for (i = 2; i < len && i < 5 && p[i] >= '0' && p[i] <= '9'; i++)
+		{
+			scale /= 10;
+			q += (p[i] - '0') * scale;
+		}
+	}
+
+	return q > 1000 ? 1000 : q;
+}
+
+int http_encoding_accept(const char *value, size_t len)
+{
+	const char *end = value + len;
+	const char *comma;
+	const char *semi;
+	int q[3] = { -1, -1, -1 };
+	int any = -1;
+	int encoding;
+	int qvalue;
+	size_t n;
+
+	while (value < end)
+	{
+		comma = (const char *)memchr(value, ',', end - value);
+		if (!comma)
+			comma = end;
+
+		semi = (const char *)memchr(value, ';', comma - value);
+		if (!semi)
+			semi = comma;
+
+		n = __trim(&value, semi - value);
+		encoding = __encoding_name(value, n);
+		qvalue = 1000;
+		if (semi != comma)
+			qvalue = __parse_qvalue(semi + 1, comma - semi - 1);
+
+		if (encoding >= 0)
+			q[encoding] = qvalue;
+		else if (n == 1 && *value == '*')
+			any = qvalue;
+
+		value = comma + 1;
+	}
+
+#ifndef HAVE_ZLIB
+	return HTTP_ENCODING_IDENTITY;
+#endif
+
+	if (q[HTTP_ENCODING_GZIP] < 0)
+		q[HTTP_ENCODING_GZIP] = any;
+
+	if (q[HTTP_ENCODING_DEFLATE] < 0)
+		q[HTTP_ENCODING_DEFLATE] = any;
+
+	/* gzip is preferred, since "deflate" is not sent the same way by all. */
+	if (q[HTTP_ENCODING_GZIP] > 0 &&
+		q[HTTP_ENCODING_GZIP] >= q[HTTP_ENCODING_DEFLATE])
+		return HTTP_ENCODING_GZIP;
+
+	if (q[HTTP_ENCODING_DEFLATE] > 0)
+		return HTTP_ENCODING_DEFLATE;
+
+	return HTTP_ENCODING_IDENTITY;
+}
+
+const char *http_encoding_accepted(void)
+{
+#ifdef HAVE_ZLIB
+	return "gzip, deflate";
+#else
+	return NULL;
+#endif
+}
+
+const char *http_encoding_name(int encoding)
+{
+	switch (encoding)
+	{
+	case HTTP_ENCODING_GZIP:
+		return "gzip";
+	case HTTP_ENCODING_DEFLATE:
+		return "deflate";
+	default:
+		return "identity";
+	}
+}
+
+#ifdef HAVE_ZLIB
+
+static int __window_bits(int encoding)
+{
+	return encoding == HTTP_ENCODING_GZIP ? 16 + MAX_WBITS : MAX_WBITS;
+}
+
+int http_decoder_init(int encoding, size_t reserve, http_decoder_t *dec)
+{
+	z_stream *stream;
+
+	if (encoding != HTTP_ENCODING_GZIP && encoding != HTTP_ENCODING_DEFLATE)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	stream = (z_stream *)malloc(sizeof (z_stream));
+	if (!stream)
+		return -1;
+
+	memset(stream, 0, sizeof (z_stream));
+	if (inflateInit2(stream, __window_bits(encoding)) == Z_OK)
+	{
+		dec->stream = stream;
+		dec->encoding = encoding;
+		dec->finished = 0;
+		dec->buf = NULL;
+		dec->size = 0;
+		dec->bufsize = 0;
+		dec->reserve = reserve;
+		return 0;
+	}
+
+	free(stream);
+	errno = ENOMEM;
+	return -1;
+}
+
+static int __decoder_grow(size_t need, http_decoder_t *dec)
+{
+	size_t new_size = dec->bufsize ? 2 * dec->bufsize :
+					  dec->reserve + HTTP_DECODER_INIT_SIZE;
+	void *new_base;
+
+	while (new_size < dec->reserve + dec->size + need + 1)
+		new_size *= 2;
+
+	new_base = realloc(dec->buf, new_size);
+	if (!new_base)
+		return -1;
+
+	dec->buf = (char *)new_base;
+	dec->bufsize = new_size;
+	return 0;
+}
+
+static int __decoder_inflate(const void *buf, size_t size,
+							 http_decoder_t *dec)
+{
+	z_stream *stream = (z_stream *)dec->stream;
+	size_t room;
+	int ret;
+
+	stream->next_in = (Bytef *)buf;
+	while (size > 0)
+	{
+		stream->avail_in = size < ZLIB_PIECE_MAX ? size : ZLIB_PIECE_MAX;
+		size -= stream->avail_in;
+		do
+		{
+			room = dec->bufsize - dec->reserve - dec->size - 1;
+			if (dec->bufsize == 0 || room == 0)
+			{
+				if (__decoder_grow(stream->avail_in, dec) < 0)
+					return -1;
+
+				room = dec->bufsize - dec->reserve - dec->size - 1;
+			}
+
+			if (room > ZLIB_PIECE_MAX)
+				room = ZLIB_PIECE_MAX;
+
+			stream->next_out = (Bytef *)dec->buf + dec->reserve + dec->size;
+			stream->avail_out = room;
+			ret = inflate(stream, Z_NO_FLUSH);
+			dec->size += room - stream->avail_out;
+			if (ret == Z_STREAM_END)
+			{
+				dec->finished = 1;
+				return 0;
+			}
+
+			if (ret != Z_OK && ret != Z_BUF_ERROR)
+			{
+				if (ret == Z_MEM_ERROR)
+				{
+					errno = ENOMEM;
+					return -1;
+				}
+
+				return -2;
+			}
+		} while (stream->avail_in > 0 || stream->avail_out == 0);
+	}
+
+	return 0;
+}
+
+int http_decoder_append(const void *buf, size_t size, http_decoder_t *dec)
+{
+	z_stream *stream = (z_stream *)dec->stream;
+	int first = (stream->total_in == 0);
+	int ret;
+
+	if (dec->finished || size == 0)
+		return 0;
+
+	ret = __decoder_inflate(buf, size, dec);
+	if (ret == -2 && first && dec->encoding == HTTP_ENCODING_DEFLATE &&
+		dec->size == 0)
+	{
+		/* No zlib header. Try raw deflate data. */
+		if (inflateReset2(stream, -MAX_WBITS) != Z_OK)
+			return -2;
+
+		ret = __decoder_inflate(buf, size, dec);
+	}
+
+	return ret;
+}
+
+void http_decoder_deinit(http_decoder_t *dec)
+{
+	inflateEnd((z_stream *)dec->stream);
+	free(dec->stream);
+	free(dec->buf);
+}
+
+int http_encoder_init(int encoding, int level, http_encoder_t *enc)
+{
+	z_stream *stream;
+
+	if (encoding != HTTP_ENCODING_GZIP && encoding != HTTP_ENCODING_DEFLATE)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	stream = (z_stream *)malloc(sizeof (z_stream));
+	if (!stream)
+		return -1;
+
+	memset(stream, 0, sizeof (z_stream));
+	if (deflateInit2(stream, level, Z_DEFLATED, __window_bits(encoding),
+					 8, Z_DEFAULT_STRATEGY) == Z_OK)
+	{
+		enc->stream = stream;
+		enc->encoding = encoding;
+		return 0;
+	}
+
+	free(stream);
+	errno = EINVAL;
+	return -1;
+}
+
+size_t http_encoder_bound(size_t size, const http_encoder_t *enc)
+{
+	z_stream *stream = (z_stream *)enc->stream;
+	size_t bound = 0;
+
+	while (size > ZLIB_PIECE_MAX)
+	{
+		bound += deflateBound(stream, ZLIB_PIECE_MAX);
+		size -= ZLIB_PIECE_MAX;
+	}
+
+	return bound + deflateBound(stream, size);
+}
+
+long http_encoder_append(const void *buf, size_t *size, int finish,
+						 void *out, size_t room, http_encoder_t *enc)
+{
+	z_stream *stream = (z_stream *)enc->stream;
+	size_t n;
+	int ret;
+
+	if (room > ZLIB_PIECE_MAX)
+		room = ZLIB_PIECE_MAX;
+
+	stream->next_in = (Bytef *)buf;
+	stream->next_out = (Bytef *)out;
+	stream->avail_out = room;
+	do
+	{
+		n = *size < ZLIB_PIECE_MAX ? *size : ZLIB_PIECE_MAX;
+		stream->avail_in = n;
+		ret = deflate(stream, finish && n == *size ? Z_FINISH : Z_NO_FLUSH);
+		*size -= n - stream->avail_in;
+		if (ret == Z_STREAM_ERROR)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+	} while (*size > 0 && stream->avail_out > 0);
+
+	return room - stream->avail_out;
+}
+
+void http_encoder_deinit(http_encoder_t *enc)
+{
+	deflateEnd((z_stream *)enc->stream);
+	free(enc->stream);
+}
+
+#else
+
+int http_decoder_init(int encoding, size_t reserve, http_decoder_t *dec)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int http_decoder_append(const void *buf, size_t size, http_decoder_t *dec)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+void http_decoder_deinit(http_decoder_t *dec)
+{
+}
+
+int http_encoder_init(int encoding, int level, http_encoder_t *enc)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+size_t http_encoder_bound(size_t size, const http_encoder_t *enc)
+{
+	return 0;
+}
+
+long http_encoder_append(const void *buf, size_t *size, int finish,
+						 void *out, size_t room, http_encoder_t *enc)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+void http_encoder_deinit(http_encoder_t *enc)
+{
+}
+
+#endif
+
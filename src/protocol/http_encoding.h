@@ -0,0 +1,100 @@
+/*
+  Copyright (c) 2019 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef _HTTP_ENCODING_H_
+#define _HTTP_ENCODING_H_
+
+#include <stddef.h>
+
+/*
+ * Content codings of HTTP bodies (RFC 9110, section 8.4.1), with zlib.
+ * "deflate" is the zlib format, but raw deflate data, which some servers
+ * send instead, is decoded too. Built without zlib (HAVE_ZLIB undefined),
+ * only identity is supported, and the coders fail with ENOSYS.
+ */
+
+#define HTTP_ENCODING_IDENTITY		0
+#define HTTP_ENCODING_GZIP			1
+#define HTTP_ENCODING_DEFLATE		2
+
+typedef struct __http_decoder
+{
+	void *stream;
+	int encoding;
+	int finished;
+	char *buf;
+	size_t size;
+	size_t bufsize;
+	size_t reserve;
+} http_decoder_t;
+
+typedef struct __http_encoder
+{
+	void *stream;
+	int encoding;
+} http_encoder_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* The coding of a Content-Encoding value, or -1 if not supported. */
+int http_encoding_parse(const char *value, size_t len);
+
+/* The coding we prefer among those an Accept-Encoding value accepts.
+ * HTTP_ENCODING_IDENTITY if none of ours is acceptable. */
+int http_encoding_accept(const char *value, size_t len);
+
+/* The Accept-Encoding value of all the codings we decode, or NULL if
+ * there is none but identity. */
+const char *http_encoding_accepted(void);
+
+const char *http_encoding_name(int encoding);
+
+/* Decoded data is collected in 'buf', after 'reserve' bytes that are left
+ * for the caller. The buffer always has one spare byte at the end. */
+int http_decoder_init(int encoding, size_t reserve, http_decoder_t *dec);
+
+/* Returns 0 on success, -1 on system error, or -2 on bad data. Data after
+ * the end of the compressed stream is ignored. */
+int http_decoder_append(const void *buf, size_t size, http_decoder_t *dec);
+
+/* Frees 'buf' too, unless the caller has taken it and set it to NULL. */
+void http_decoder_deinit(http_decoder_t *dec);
+
+/* 'level' is a zlib compression level, -1 for the default. */
+int http_encoder_init(int encoding, int level, http_encoder_t *enc);
+
+/* The most bytes compressing 'size' bytes can output in total. */
+size_t http_encoder_bound(size_t size, const http_encoder_t *enc);
+
+/* Compress '*size' bytes into 'out' of 'room' bytes, and return the number
+ * of bytes output. '*size' is set to the input bytes left, when 'out' is
+ * full. The last piece of data is appended with 'finish' set, and the
+ * stream is finished when nothing is left and 'out' is not full. Call
+ * again with more room till then. Returns -1 on error. */
+long http_encoder_append(const void *buf, size_t *size, int finish,
+						 void *out, size_t room, http_encoder_t *enc);
+
+void http_encoder_deinit(http_encoder_t *enc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
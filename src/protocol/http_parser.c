@@ -21,6 +21,12 @@
 #include "list.h"
 #include "http_parser.h"
 
+#if defined(__x86_64__) && (defined(__clang__) || \
+	(defined(__GNUC__) && __GNUC__ * 100 + __GNUC_MINOR__ >= 409))
+# include <immintrin.h>
+# define HTTP_PARSER_SIMD
+#endif
+
 #define MIN(x, y)	((x) <= (y) ? (x) : (y))
 #define MAX(x, y)	((x) >= (y) ? (x) : (y))
 
@@ -29,6 +35,7 @@
 #define HTTP_CHUNK_LINE_MAX		1024
 #define HTTP_TRAILER_LINE_MAX	8192
 #define HTTP_MSGBUF_INIT_SIZE	2048
+#define HTTP_HEADER_BLOCK_SIZE	1024
 
 enum
 {
@@ -42,17 +49,86 @@ enum
 {
 	CPS_CHUNK_DATA,
 	CPS_TRAILER_PART,
-	CPS_CHUNK_COMPLETE
+	CPS_CHUNK_COMPLETE,
+	/* States of a streamed chunked body, which is parsed byte by byte. */
+	CPS_STREAM_SIZE_FIRST,
+	CPS_STREAM_SIZE,
+	CPS_STREAM_EXTENSION,
+	CPS_STREAM_SIZE_LF,
+	CPS_STREAM_DATA,
+	CPS_STREAM_DATA_CR,
+	CPS_STREAM_DATA_LF,
+	CPS_STREAM_TRAILER_START,
+	CPS_STREAM_TRAILER,
+	CPS_STREAM_END_LF
+};
+
+/* Header lines are allocated from blocks that are only freed with the
+ * parser, so parsing a message costs a few mallocs instead of one for
+ * every header. The newest block is the first in the list. */
+struct __header_block
+{
+	struct __header_block *next;
+	size_t size;
+	size_t used;
 };
 
 struct __header_line
 {
 	struct list_head list;
+	unsigned int hash;
 	int name_len;
 	int value_len;
 	char *buf;
 };
 
+#define HEADER_ALIGN(x)		(((x) + sizeof (void *) - 1) & ~(sizeof (void *) - 1))
+
+static void *__alloc_header(size_t size, http_parser_t *parser)
+{
+	struct __header_block *block = (struct __header_block *)parser->header_blocks;
+	size_t block_size;
+	void *ptr;
+
+	size = HEADER_ALIGN(size);
+	if (!block || block->used + size > block->size)
+	{
+		block_size = block ? 2 * block->size : HTTP_HEADER_BLOCK_SIZE;
+		while (block_size < HEADER_ALIGN(sizeof (struct __header_block)) + size)
+			block_size *= 2;
+
+		ptr = malloc(block_size);
+		if (!ptr)
+			return NULL;
+
+		((struct __header_block *)ptr)->next = block;
+		block = (struct __header_block *)ptr;
+		block->size = block_size;
+		block->used = HEADER_ALIGN(sizeof (struct __header_block));
+		parser->header_blocks = block;
+	}
+
+	ptr = (char *)block + block->used;
+	block->used += size;
+	return ptr;
+}
+
+/* FNV-1a of a header name, made case-insensitive by folding with 0x20. The
+ * few other characters that are folded together only cost a strncasecmp(). */
+static unsigned int __header_hash(const char *name, size_t name_len)
+{
+	unsigned int hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < name_len; i++)
+	{
+		hash ^= (unsigned char)(name[i] | 0x20);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
 static int __add_message_header(const void *name, size_t name_len,
 								const void *value, size_t value_len,
 								http_parser_t *parser)
@@ -60,7 +136,7 @@ static int __add_message_header(const void *name, size_t name_len,
 	size_t size = sizeof (struct __header_line) + name_len + value_len + 4;
 	struct __header_line *line;
 
-	line = (struct __header_line *)malloc(size);
+	line = (struct __header_line *)__alloc_header(size, parser);
 	if (line)
 	{
 		line->buf = (char *)(line + 1);
@@ -70,9 +146,11 @@ static int __add_message_header(const void *name, size_t name_len,
 		memcpy(line->buf + name_len + 2, value, value_len);
 		line->buf[name_len + 2 + value_len] = '\r';
 		line->buf[name_len + 2 + value_len + 1] = '\n';
+		line->hash = __header_hash((const char *)name, name_len);
 		line->name_len = name_len;
 		line->value_len = value_len;
 		list_add_tail(&line->list, &parser->header_list);
+		parser->header_mask |= 1ULL << (line->hash & 63);
 		return 0;
 	}
 
@@ -83,25 +161,26 @@ static int __set_message_header(const void *name, size_t name_len,
 								const void *value, size_t value_len,
 								http_parser_t *parser)
 {
+	unsigned int hash = __header_hash((const char *)name, name_len);
 	struct __header_line *line;
 	struct list_head *pos;
 	char *buf;
 
+	if (!(parser->header_mask & (1ULL << (hash & 63))))
+		return __add_message_header(name, name_len, value, value_len, parser);
+
 	list_for_each(pos, &parser->header_list)
 	{
 		line = list_entry(pos, struct __header_line, list);
-		if (line->name_len == name_len &&
+		if (line->hash == hash && line->name_len == name_len &&
 			strncasecmp(line->buf, name, name_len) == 0)
 		{
 			if (value_len > line->value_len)
 			{
-				buf = (char *)malloc(name_len + value_len + 4);
+				buf = (char *)__alloc_header(name_len + value_len + 4, parser);
 				if (!buf)
 					return -1;
 
-				if (line->buf != (char *)(line + 1))
-					free(line->buf);
-
 				line->buf = buf;
 				memcpy(buf, name, name_len);
 				buf[name_len] = ':';
@@ -192,6 +271,91 @@ static int __match_status_line(const char *version,
 	return -1;
 }
 
+/* Return the offset of the first 'delim', NUL or non-ASCII byte in 'ptr',
+ * or 'len' if there is none. Header parsing is mostly this scan, so it is
+ * done 16 or 32 bytes at a time where the CPU can. */
+static size_t __scan_scalar(const char *ptr, size_t len, char delim)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (ptr[i] == delim || (signed char)ptr[i] <= 0)
+			break;
+	}
+
+	return i;
+}
+
+#ifdef HTTP_PARSER_SIMD
+/* SSE2 is part of x86-64, so this needs no check. */
+static size_t __scan_sse2(const char *ptr, size_t len, char delim)
+{
+	__m128i d = _mm_set1_epi8(delim);
+	__m128i one = _mm_set1_epi8(1);
+	unsigned int mask;
+	__m128i x;
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		x = _mm_loadu_si128((const __m128i *)(ptr + i));
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, d),
+											  _mm_cmplt_epi8(x, one)));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + __scan_scalar(ptr + i, len - i, delim);
+}
+
+__attribute__((target("avx2")))
+static size_t __scan_avx2(const char *ptr, size_t len, char delim)
+{
+	__m256i d = _mm256_set1_epi8(delim);
+	__m256i one = _mm256_set1_epi8(1);
+	unsigned int mask;
+	__m256i x;
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32)
+	{
+		x = _mm256_loadu_si256((const __m256i *)(ptr + i));
+		mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, d),
+													_mm256_cmpgt_epi8(one, x)));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	if (i + 16 <= len)
+	{
+		__m128i y = _mm_loadu_si128((const __m128i *)(ptr + i));
+
+		mask = _mm_movemask_epi8(_mm_or_si128(
+								_mm_cmpeq_epi8(y, _mm256_castsi256_si128(d)),
+								_mm_cmplt_epi8(y, _mm256_castsi256_si128(one))));
+		if (mask)
+			return i + __builtin_ctz(mask);
+
+		i += 16;
+	}
+
+	return i + __scan_scalar(ptr + i, len - i, delim);
+}
+
+static size_t (*__scan)(const char *, size_t, char) = __scan_sse2;
+
+__attribute__((constructor))
+static void __scan_init(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		__scan = __scan_avx2;
+}
+#else
+# define __scan		__scan_scalar
+#endif
+
 static void __check_message_header(const char *name, size_t name_len,
 								   const char *value, size_t value_len,
 								   http_parser_t *parser)
@@ -255,7 +419,7 @@ static int __parse_start_line(const char *ptr, size_t len,
 	char start_line[HTTP_START_LINE_MAX];
 	size_t min = MIN(HTTP_START_LINE_MAX, len);
 	char *p1, *p2, *p3;
-	size_t i;
+	size_t i = 0;
 	int ret;
 
 	if (len >= 2 && ptr[0] == '\r' && ptr[1] == '\n')
@@ -264,52 +428,54 @@ static int __parse_start_line(const char *ptr, size_t len,
 		return 1;
 	}
 
-	for (i = 0; i < min; i++)
+	/* Non-ASCII bytes are allowed here, and only stop the scan. */
+	while (1)
 	{
-		start_line[i] = ptr[i];
-		if (start_line[i] == '\r')
-		{
-			if (i == len - 1)
-				return 0;
-
-			if (ptr[i + 1] != '\n')
-				return -2;
+		i += __scan(ptr + i, min - i, '\r');
+		if (i == min || ptr[i] == '\r')
+			break;
 
-			start_line[i] = '\0';
-			p1 = start_line;
-			p2 = strchr(p1, ' ');
-			if (p2)
-				*p2++ = '\0';
-			else
-				return -2;
+		if (ptr[i] == 0)
+			return -2;
 
-			p3 = strchr(p2, ' ');
-			if (p3)
-				*p3++ = '\0';
-			else
-				return -2;
+		i++;
+	}
 
-			if (parser->is_resp)
-				ret = __match_status_line(p1, p2, p3, parser);
-			else
-				ret = __match_request_line(p1, p2, p3, parser);
+	if (i == min)
+		return i == HTTP_START_LINE_MAX ? -2 : 0;
 
-			if (ret < 0)
-				return -1;
+	if (i == len - 1)
+		return 0;
 
-			parser->header_offset += i + 2;
-			parser->header_state = HPS_HEADER_NAME;
-			return 1;
-		}
+	if (ptr[i + 1] != '\n')
+		return -2;
 
-		if (start_line[i] == 0)
-			return -2;
-	}
+	memcpy(start_line, ptr, i);
+	start_line[i] = '\0';
+	p1 = start_line;
+	p2 = strchr(p1, ' ');
+	if (p2)
+		*p2++ = '\0';
+	else
+		return -2;
 
-	if (i == HTTP_START_LINE_MAX)
+	p3 = strchr(p2, ' ');
+	if (p3)
+		*p3++ = '\0';
+	else
 		return -2;
 
-	return 0;
+	if (parser->is_resp)
+		ret = __match_status_line(p1, p2, p3, parser);
+	else
+		ret = __match_request_line(p1, p2, p3, parser);
+
+	if (ret < 0)
+		return -1;
+
+	parser->header_offset += i + 2;
+	parser->header_state = HPS_HEADER_NAME;
+	return 1;
 }
 
 static int __parse_header_name(const char *ptr, size_t len,
@@ -325,26 +491,30 @@ static int __parse_header_name(const char *ptr, size_t len,
 		return 1;
 	}
 
-	for (i = 0; i < min; i++)
-	{
-		if (ptr[i] == ':')
-		{
-			parser->namebuf[i] = '\0';
-			parser->header_offset += i + 1;
-			parser->header_state = HPS_HEADER_VALUE;
-			return 1;
-		}
+	i = __scan(ptr, min, ':');
+	if (i == min)
+		return i == HTTP_HEADER_NAME_MAX ? -2 : 0;
 
-		if ((signed char)ptr[i] <= 0)
-			return -2;
+	if (ptr[i] != ':')
+		return -2;
 
-		parser->namebuf[i] = ptr[i];
-	}
+	memcpy(parser->namebuf, ptr, i);
+	parser->namebuf[i] = '\0';
+	parser->header_offset += i + 1;
+	parser->header_state = HPS_HEADER_VALUE;
+	return 1;
+}
 
-	if (i == HTTP_HEADER_NAME_MAX)
-		return -2;
+static int __add_header_value(const char *value, size_t value_len,
+							  size_t size, http_parser_t *parser)
+{
+	if (http_parser_add_header(parser->namebuf, strlen(parser->namebuf),
+							   value, value_len, parser) < 0)
+		return -1;
 
-	return 0;
+	parser->header_offset += size;
+	parser->header_state = HPS_HEADER_NAME;
+	return 1;
 }
 
 static int __parse_header_value(const char *ptr, size_t len,
@@ -353,8 +523,45 @@ static int __parse_header_value(const char *ptr, size_t len,
 	char header_value[HTTP_HEADER_VALUE_MAX];
 	const char *end = ptr + len;
 	const char *begin = ptr;
+	const char *value;
 	size_t i = 0;
 
+	/* Most values are not folded, and are added right from the buffer. */
+	while (ptr < end && (*ptr == ' ' || *ptr == '\t'))
+		ptr++;
+
+	value = ptr;
+	len = MIN((size_t)(end - value), HTTP_HEADER_VALUE_MAX);
+	i = __scan(value, len, '\r');
+	if (i < len && value[i] != '\r')
+		return -2;
+
+	if (i == (size_t)(end - value))
+		return 0;
+
+	if (i == HTTP_HEADER_VALUE_MAX)
+		return -2;
+
+	if (end - (value + i) < 2)
+		return 0;
+
+	if (value[i + 1] != '\n')
+		return -2;
+
+	if (end - (value + i) < 3)
+		return 0;
+
+	if (value[i + 2] != ' ' && value[i + 2] != '\t')
+	{
+		len = value + i + 2 - begin;
+		while (i > 0 && (value[i - 1] == ' ' || value[i - 1] == '\t'))
+			i--;
+
+		return __add_header_value(value, i, len, parser);
+	}
+
+	ptr = begin;
+	i = 0;
 	while (1)
 	{
 		while (1)
@@ -410,13 +617,7 @@ static int __parse_header_value(const char *ptr, size_t len,
 	}
 
 	header_value[i] = '\0';
-	if (http_parser_add_header(parser->namebuf, strlen(parser->namebuf),
-							   header_value, i, parser) < 0)
-		return -1;
-
-	parser->header_offset += ptr - begin;
-	parser->header_state = HPS_HEADER_NAME;
-	return 1;
+	return __add_header_value(header_value, i, ptr - begin, parser);
 }
 
 static int __parse_message_header(const void *message, size_t size,
@@ -563,6 +764,8 @@ void http_parser_init(int is_resp, http_parser_t *parser)
 	parser->code = NULL;
 	parser->phrase = NULL;
 	INIT_LIST_HEAD(&parser->header_list);
+	parser->header_blocks = NULL;
+	parser->header_mask = 0;
 	parser->msgbuf = NULL;
 	parser->msgsize = 0;
 	parser->bufsize = 0;
@@ -576,23 +779,14 @@ void http_parser_init(int is_resp, http_parser_t *parser)
 	parser->is_resp = is_resp;
 }
 
-int http_parser_append_message(const void *buf, size_t *n,
-							   http_parser_t *parser)
+static int __append_buffer(const void *buf, size_t n, http_parser_t *parser)
 {
-	int ret;
-
-	if (parser->complete)
-	{
-		*n = 0;
-		return 1;
-	}
-
-	if (parser->msgsize + *n + 1 > parser->bufsize)
+	if (parser->msgsize + n + 1 > parser->bufsize)
 	{
 		size_t new_size = MAX(HTTP_MSGBUF_INIT_SIZE, 2 * parser->bufsize);
 		void *new_base;
 
-		while (new_size < parser->msgsize + *n + 1)
+		while (new_size < parser->msgsize + n + 1)
 			new_size *= 2;
 
 		new_base = realloc(parser->msgbuf, new_size);
@@ -603,8 +797,29 @@ int http_parser_append_message(const void *buf, size_t *n,
 		parser->bufsize = new_size;
 	}
 
-	memcpy((char *)parser->msgbuf + parser->msgsize, buf, *n);
-	parser->msgsize += *n;
+	/* Data may be received in place by http_parser_get_buffer(), or be
+	 * moved from later in the buffer by http_parser_append_stream(). */
+	if (buf != (char *)parser->msgbuf + parser->msgsize)
+		memmove((char *)parser->msgbuf + parser->msgsize, buf, n);
+
+	parser->msgsize += n;
+	return 0;
+}
+
+int http_parser_append_message(const void *buf, size_t *n,
+							   http_parser_t *parser)
+{
+	int ret;
+
+	if (parser->complete)
+	{
+		*n = 0;
+		return 1;
+	}
+
+	if (__append_buffer(buf, *n, parser) < 0)
+		return -1;
+
 	if (parser->header_state != HPS_HEADER_COMPLETE)
 	{
 		ret = __parse_message_header(parser->msgbuf, parser->msgsize, parser);
@@ -651,11 +866,248 @@ int http_parser_append_message(const void *buf, size_t *n,
 	return 1;
 }
 
+/* For a message whose header is not in HTTP/1.x format, e.g. HTTP/2. The
+ * header is complete after the first call, and the body is all of msgbuf. */
+int http_parser_append_body(const void *buf, size_t size,
+							http_parser_t *parser)
+{
+	if (__append_buffer(buf, size, parser) < 0)
+		return -1;
+
+	parser->header_state = HPS_HEADER_COMPLETE;
+	return 0;
+}
+
+static int __hex_digit(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+
+	return -1;
+}
+
+/* Pass the body data in 'ptr' to 'body', and set '*n' to the bytes used.
+ * A chunked body is parsed byte by byte, so nothing has to be kept but the
+ * state: chunk_offset is the size of the chunk, and then the data left. */
+static int __stream_body(const char *ptr, size_t *n, http_body_t body,
+						 void *context, http_parser_t *parser)
+{
+	const char *end = ptr + *n;
+	const char *p = ptr;
+	size_t len;
+	int digit;
+	char c;
+
+	if (!parser->chunked)
+	{
+		len = MIN(*n, parser->transfer_length);
+		if (len != 0 && body(ptr, len, context) < 0)
+			return -1;
+
+		*n = len;
+		if (parser->transfer_length != (size_t)-1)
+		{
+			parser->transfer_length -= len;
+			if (parser->transfer_length == 0)
+				parser->complete = 1;
+		}
+
+		return parser->complete;
+	}
+
+	while (p < end && !parser->complete)
+	{
+		if (parser->chunk_state == CPS_STREAM_DATA)
+		{
+			len = MIN((size_t)(end - p), parser->chunk_offset);
+			if (body(p, len, context) < 0)
+				return -1;
+
+			p += len;
+			parser->chunk_offset -= len;
+			if (parser->chunk_offset == 0)
+				parser->chunk_state = CPS_STREAM_DATA_CR;
+
+			continue;
+		}
+
+		c = *p++;
+		switch (parser->chunk_state)
+		{
+		case CPS_STREAM_SIZE_FIRST:
+		case CPS_STREAM_SIZE:
+			digit = __hex_digit(c);
+			if (digit >= 0)
+			{
+				if (parser->chunk_offset > ((size_t)-1 >> 4))
+					return -2;
+
+				parser->chunk_offset = parser->chunk_offset * 16 + digit;
+				parser->chunk_state = CPS_STREAM_SIZE;
+			}
+			else if (parser->chunk_state == CPS_STREAM_SIZE_FIRST)
+				return -2;
+			else if (c == '\r')
+				parser->chunk_state = CPS_STREAM_SIZE_LF;
+			else if (c == ';' || c == ' ' || c == '\t')
+				parser->chunk_state = CPS_STREAM_EXTENSION;
+			else
+				return -2;
+
+			break;
+
+		case CPS_STREAM_EXTENSION:
+			if (c == '\r')
+				parser->chunk_state = CPS_STREAM_SIZE_LF;
+
+			break;
+
+		case CPS_STREAM_SIZE_LF:
+			if (c != '\n')
+				return -2;
+
+			if (parser->chunk_offset == 0)
+				parser->chunk_state = CPS_STREAM_TRAILER_START;
+			else
+				parser->chunk_state = CPS_STREAM_DATA;
+
+			break;
+
+		case CPS_STREAM_DATA_CR:
+			if (c != '\r')
+				return -2;
+
+			parser->chunk_state = CPS_STREAM_DATA_LF;
+			break;
+
+		case CPS_STREAM_DATA_LF:
+			if (c != '\n')
+				return -2;
+
+			parser->chunk_state = CPS_STREAM_SIZE_FIRST;
+			break;
+
+		case CPS_STREAM_TRAILER_START:
+			if (c == '\r')
+				parser->chunk_state = CPS_STREAM_END_LF;
+			else
+				parser->chunk_state = CPS_STREAM_TRAILER;
+
+			break;
+
+		case CPS_STREAM_TRAILER:
+			if (c == '\n')
+				parser->chunk_state = CPS_STREAM_TRAILER_START;
+
+			break;
+
+		case CPS_STREAM_END_LF:
+			if (c != '\n')
+				return -2;
+
+			parser->chunk_state = CPS_CHUNK_COMPLETE;
+			parser->complete = 1;
+			break;
+		}
+	}
+
+	*n = p - ptr;
+	return parser->complete;
+}
+
+int http_parser_append_stream(const void *buf, size_t *n,
+							  http_body_t body, void *context,
+							  http_parser_t *parser)
+{
+	size_t size;
+	size_t len;
+	int ret;
+
+	if (parser->complete)
+	{
+		*n = 0;
+		return 1;
+	}
+
+	if (parser->header_state != HPS_HEADER_COMPLETE)
+	{
+		if (__append_buffer(buf, *n, parser) < 0)
+			return -1;
+
+		ret = __parse_message_header(parser->msgbuf, parser->msgsize, parser);
+		if (ret <= 0)
+			return ret;
+
+		if (parser->chunked)
+		{
+			parser->chunk_offset = 0;
+			parser->chunk_state = CPS_STREAM_SIZE_FIRST;
+		}
+		else if (parser->transfer_length == (size_t)-1)
+			parser->transfer_length = parser->content_length;
+
+		/* The beginning of the body came with the header. */
+		buf = (char *)parser->msgbuf + parser->header_offset;
+		size = parser->msgsize - parser->header_offset;
+		parser->msgsize = parser->header_offset;
+	}
+	else
+		size = *n;
+
+	len = size;
+	ret = __stream_body((const char *)buf, &len, body, context, parser);
+	*n -= size - len;
+	return ret;
+}
+
 int http_parser_header_complete(const http_parser_t *parser)
 {
 	return parser->header_state == HPS_HEADER_COMPLETE;
 }
 
+/* When the body length is known, the rest of the body can be received right
+ * at the end of the message buffer. The buffer grows in the same way as in
+ * http_parser_append_message(), so a large Content-Length does not make us
+ * allocate memory before the data comes. */
+void *http_parser_get_buffer(size_t *size, http_parser_t *parser)
+{
+	size_t total;
+	size_t room;
+
+	if (parser->complete || parser->header_state != HPS_HEADER_COMPLETE ||
+		parser->transfer_length == (size_t)-1)
+		return NULL;
+
+	total = parser->header_offset + parser->transfer_length;
+	if (parser->msgsize >= total)
+		return NULL;
+
+	room = parser->bufsize - parser->msgsize - 1;
+	if (room < total - parser->msgsize && room < HTTP_MSGBUF_INIT_SIZE)
+	{
+		size_t new_size = MAX(HTTP_MSGBUF_INIT_SIZE, 2 * parser->bufsize);
+		void *new_base;
+
+		if (new_size > total + 1)
+			new_size = total + 1;
+
+		new_base = realloc(parser->msgbuf, new_size);
+		if (!new_base)
+			return NULL;
+
+		parser->msgbuf = new_base;
+		parser->bufsize = new_size;
+		room = new_size - parser->msgsize - 1;
+	}
+
+	*size = MIN(room, total - parser->msgsize);
+	return (char *)parser->msgbuf + parser->msgsize;
+}
+
 int http_parser_get_body(const void **body, size_t *size,
 						 const http_parser_t *parser)
 {
@@ -767,17 +1219,14 @@ int http_parser_set_header(const void *name, size_t name_len,
 
 void http_parser_deinit(http_parser_t *parser)
 {
-	struct __header_line *line;
-	struct list_head *pos, *tmp;
+	struct __header_block *block = (struct __header_block *)parser->header_blocks;
+	struct __header_block *next;
 
-	list_for_each_safe(pos, tmp, &parser->header_list)
+	while (block)
 	{
-		line = list_entry(pos, struct __header_line, list);
-		list_del(pos);
-		if (line->buf != (char *)(line + 1))
-			free(line->buf);
-
-		free(line);
+		next = block->next;
+		free(block);
+		block = next;
 	}
 
 	free(parser->version);
@@ -812,13 +1261,23 @@ int http_header_cursor_find(const void *name, size_t name_len,
 							const void **value, size_t *value_len,
 							http_header_cursor_t *cursor)
 {
+	const http_parser_t *parser = list_entry(cursor->head, http_parser_t,
+											 header_list);
+	unsigned int hash = __header_hash((const char *)name, name_len);
 	struct __header_line *line;
 
+	/* No header has a name of the same hash bit. Skip to the end. */
+	if (!(parser->header_mask & (1ULL << (hash & 63))))
+	{
+		cursor->next = cursor->head->prev;
+		return 1;
+	}
+
 	while (cursor->next->next != cursor->head)
 	{
 		cursor->next = cursor->next->next;
 		line = list_entry(cursor->next, struct __header_line, list);
-		if (line->name_len == name_len)
+		if (line->hash == hash && line->name_len == name_len)
 		{
 			if (strncasecmp(line->buf, name, name_len) == 0)
 			{
@@ -831,4 +1290,3 @@ int http_header_cursor_find(const void *name, size_t name_len,
 
 	return 1;
 }
-
@@ -38,6 +38,8 @@ typedef struct __http_parser
 	char *code;
 	char *phrase;
 	struct list_head header_list;
+	void *header_blocks;
+	unsigned long long header_mask;
 	char namebuf[HTTP_HEADER_NAME_MAX];
 	void *msgbuf;
 	size_t msgsize;
@@ -52,6 +54,8 @@ typedef struct __http_parser
 	char is_resp;
 } http_parser_t;
 
+typedef int (*http_body_t)(const void *buf, size_t size, void *context);
+
 typedef struct __http_header_cursor
 {
 	const struct list_head *head;
@@ -66,6 +70,15 @@ extern "C"
 void http_parser_init(int is_resp, http_parser_t *parser);
 int http_parser_append_message(const void *buf, size_t *n,
 							   http_parser_t *parser);
+void *http_parser_get_buffer(size_t *size, http_parser_t *parser);
+int http_parser_append_body(const void *buf, size_t size,
+							http_parser_t *parser);
+/* Like http_parser_append_message(), but the body is passed to 'body' as it
+ * comes, decoded from the chunked transfer coding, and not kept. A negative
+ * return value of 'body' aborts with -1. */
+int http_parser_append_stream(const void *buf, size_t *n,
+							  http_body_t body, void *context,
+							  http_parser_t *parser);
 int http_parser_get_body(const void **body, size_t *size,
 						 const http_parser_t *parser);
 int http_parser_header_complete(const http_parser_t *parser);
@@ -619,7 +619,10 @@ int kafka_parser_append_message(const void *buf, size_t *size,
 	}
 	else
 	{
-		memcpy(parser->msgbuf + parser->cur_size, buf, s);
+		/* Data may be received in place by kafka_parser_get_buffer(). */
+		if (buf != parser->msgbuf + parser->cur_size)
+			memcpy(parser->msgbuf + parser->cur_size, buf, s);
+
 		parser->cur_size += s;
 	}
 
@@ -630,6 +633,18 @@ int kafka_parser_append_message(const void *buf, size_t *size,
 	return 1;
 }
 
+/* The message buffer is allocated in full once the size is known, so the
+ * rest of the message can be received right into it. */
+void *kafka_parser_get_buffer(size_t *size, kafka_parser_t *parser)
+{
+	if (parser->complete || !parser->msgbuf ||
+		parser->cur_size >= parser->message_size)
+		return NULL;
+
+	*size = parser->message_size - parser->cur_size;
+	return (char *)parser->msgbuf + parser->cur_size;
+}
+
 int kafka_topic_partition_set_tp(const char *topic_name, int partition,
 								 kafka_topic_partition_t *toppar)
 {
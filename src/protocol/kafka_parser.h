@@ -429,6 +429,8 @@ extern "C"
 int kafka_parser_append_message(const void *buf, size_t *size,
 								kafka_parser_t *parser);
 
+void *kafka_parser_get_buffer(size_t *size, kafka_parser_t *parser);
+
 void kafka_parser_init(kafka_parser_t *parser);
 void kafka_parser_deinit(kafka_parser_t *parser);
 
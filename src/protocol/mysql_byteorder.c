@@ -16,6 +16,7 @@
   Authors: Li Yingxin (liyingxin@sogou-inc.com)
 */
 
+#include "mysql_types.h"
 #include "mysql_byteorder.h"
 
 int decode_length_safe(unsigned long long *res, const unsigned char **pos,
@@ -89,3 +90,60 @@ int decode_string(const unsigned char **str, unsigned long long *len,
 	*pos = *pos + length;
 	return 1;
 }
+
+int decode_binary_value(int data_type,
+						const unsigned char **str, unsigned long long *len,
+						const unsigned char **pos, const unsigned char *end)
+{
+	const unsigned char *p = *pos;
+	unsigned long long length;
+
+	switch (data_type)
+	{
+	case MYSQL_TYPE_NULL:
+		length = 0;
+		break;
+
+	case MYSQL_TYPE_TINY:
+		length = 1;
+		break;
+
+	case MYSQL_TYPE_SHORT:
+	case MYSQL_TYPE_YEAR:
+		length = 2;
+		break;
+
+	case MYSQL_TYPE_LONG:
+	case MYSQL_TYPE_INT24:
+	case MYSQL_TYPE_FLOAT:
+		length = 4;
+		break;
+
+	case MYSQL_TYPE_LONGLONG:
+	case MYSQL_TYPE_DOUBLE:
+		length = 8;
+		break;
+
+	// 1:length|0-11:value
+	case MYSQL_TYPE_DATE:
+	case MYSQL_TYPE_DATETIME:
+	case MYSQL_TYPE_TIMESTAMP:
+	case MYSQL_TYPE_TIME:
+		if (p >= end)
+			return 0;
+
+		length = *p++;
+		break;
+
+	default:
+		return decode_string(str, len, pos, end);
+	}
+
+	if (p + length > end)
+		return 0;
+
+	*len = length;
+	*str = p;
+	*pos = p + length;
+	return 1;
+}
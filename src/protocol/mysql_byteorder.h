@@ -430,6 +430,11 @@ int decode_length_safe(unsigned long long *res, const unsigned char **pos,
 int decode_string(const unsigned char **str, unsigned long long *len,
 				  const unsigned char **pos, const unsigned char *end);
 
+// decode a binary protocol value of column data_type, move pos forward
+int decode_binary_value(int data_type,
+						const unsigned char **str, unsigned long long *len,
+						const unsigned char **pos, const unsigned char *end);
+
 #ifdef __cplusplus
 }
 #endif
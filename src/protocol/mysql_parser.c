@@ -39,6 +39,10 @@ static int parse_local_inline(const void *buf, size_t len, mysql_parser_t *parse
 
 static int parse_row_packet(const void *buf, size_t len, mysql_parser_t *parser);
 
+static int parse_prepare_ok_packet(const void *buf, size_t len, mysql_parser_t *parser);
+
+static int parse_stmt_def_packet(const void *buf, size_t len, mysql_parser_t *parser);
+
 void mysql_parser_init(mysql_parser_t *parser)
 {
 	parser->offset = 0;
@@ -46,6 +50,9 @@ void mysql_parser_init(mysql_parser_t *parser)
 	parser->packet_type = MYSQL_PACKET_OTHER;
 	parser->parse = parse_base_packet;
 	parser->result_set_count = 0;
+	parser->stmt_id = 0;
+	parser->stmt_param_count = 0;
+	parser->stmt_column_count = 0;
 	INIT_LIST_HEAD(&parser->result_set_list);
 }
 
@@ -120,7 +127,10 @@ static int parse_base_packet(const void *buf, size_t len, mysql_parser_t *parser
 	{
 	// OK PACKET
 	case MYSQL_PACKET_HEADER_OK:
-		parser->parse = parse_ok_packet;
+		if (parser->cmd == MYSQL_COM_STMT_PREPARE)
+			parser->parse = parse_prepare_ok_packet;
+		else
+			parser->parse = parse_ok_packet;
 		break;
 	// ERR PACKET
 	case MYSQL_PACKET_HEADER_ERROR:
@@ -332,15 +342,36 @@ static int parse_row_packet(const void *buf, size_t len, mysql_parser_t *parser)
 		return 0;
 	}
 
-	for (i = 0; i < parser->current_result_set->field_count; i++)
+	if (parser->cmd == MYSQL_COM_STMT_EXECUTE)
 	{
-		if (*p == MYSQL_PACKET_HEADER_NULL)
+		// 1:0x00|(field_count+9)/8:null_bitmap|n:values
+		mysql_field_t **fields = parser->current_result_set->fields;
+		const unsigned char *null_bitmap = p + 1;
+
+		p = null_bitmap + (parser->current_result_set->field_count + 9) / 8;
+		if (p > buf_end)
+			return -2;
+
+		for (i = 0; i < parser->current_result_set->field_count; i++)
 		{
-			p++;
-		} else {
-			if (decode_string(&cell_data, &cell_len, &p, buf_end) == 0)
+			if (null_bitmap[(i + 2) / 8] & (1 << ((i + 2) % 8)))
+				continue;
+
+			if (decode_binary_value(fields[i]->data_type, &cell_data,
+									&cell_len, &p, buf_end) == 0)
 				break;
 		}
+	} else {
+		for (i = 0; i < parser->current_result_set->field_count; i++)
+		{
+			if (*p == MYSQL_PACKET_HEADER_NULL)
+			{
+				p++;
+			} else {
+				if (decode_string(&cell_data, &cell_len, &p, buf_end) == 0)
+					break;
+			}
+		}
 	}
 
 	if (i != parser->current_result_set->field_count)
@@ -379,6 +410,8 @@ static int parse_field_count(const void *buf, size_t len, mysql_parser_t *parser
 
 		result_set->field_count = field_count;
 		result_set->row_count = 0;
+		result_set->rows_begin_offset = 0;
+		result_set->rows_end_offset = 0;
 		result_set->type = MYSQL_PACKET_GET_RESULT;
 
 		list_add_tail(&result_set->list, &parser->result_set_list);
@@ -484,3 +517,69 @@ static int parse_column_def_packet(const void *buf, size_t len, mysql_parser_t *
 	return 0;
 }
 
+
+// 1:0x00|4:stmt_id|2:num_columns|2:num_params|1:0x00|2:warning_count
+// followed by num_params and num_columns column definitions, each with EOF
+static int parse_prepare_ok_packet(const void *buf, size_t len, mysql_parser_t *parser)
+{
+	const unsigned char *p = (const unsigned char *)buf + parser->offset;
+	const unsigned char *buf_end = (const unsigned char *)buf + len;
+
+	if (p + 12 > buf_end)
+		return -2;
+
+	parser->stmt_id = uint4korr(p + 1);
+	parser->stmt_column_count = uint2korr(p + 5);
+	parser->stmt_param_count = uint2korr(p + 7);
+	parser->packet_type = MYSQL_PACKET_OK;
+	parser->buf = buf;
+	parser->offset += 12;
+
+	parser->current_field_count = 0;
+	if (parser->stmt_param_count + parser->stmt_column_count == 0)
+		return 1;
+
+	parser->parse = parse_stmt_def_packet;
+	return 0;
+}
+
+// definitions are not kept. only skip them and their EOF packets
+static int parse_stmt_def_packet(const void *buf, size_t len, mysql_parser_t *parser)
+{
+	const unsigned char *p = (const unsigned char *)buf + parser->offset;
+	const unsigned char *buf_end = (const unsigned char *)buf + len;
+	int params = parser->stmt_param_count;
+	int columns = parser->stmt_column_count;
+	int columns_begin = params + (params > 0);
+	int total = columns_begin + columns + (columns > 0);
+	int n = parser->current_field_count;
+	const unsigned char *str;
+	unsigned long long str_len;
+	int i;
+
+	if (p >= buf_end)
+		return -2;
+
+	if ((params > 0 && n == params) ||
+		(columns > 0 && n == columns_begin + columns))
+	{
+		if (*p != MYSQL_PACKET_HEADER_EOF || p + 5 > buf_end)
+			return -2;
+
+		p += 5;
+	} else {
+		for (i = 0; i < 6; i++)
+		{
+			if (decode_string(&str, &str_len, &p, buf_end) == 0)
+				return -2;
+		}
+
+		if (p + 13 > buf_end)
+			return -2;
+
+		p += 13;
+	}
+
+	parser->offset = p - (const unsigned char *)buf;
+	return ++parser->current_field_count == total;
+}
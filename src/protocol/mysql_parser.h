@@ -103,6 +103,10 @@ typedef struct __mysql_parser
 	struct list_head result_set_list;
 	struct __mysql_result_set *current_result_set;
 	int current_field_count;
+
+	unsigned int stmt_id;			// COM_STMT_PREPARE OK packet
+	int stmt_param_count;
+	int stmt_column_count;
 } mysql_parser_t;
 
 #ifdef __cplusplus
@@ -103,6 +103,32 @@ int mysql_stream_write(const void *buf, size_t n, mysql_stream_t *stream)
 	}
 }
 
+int mysql_stream_write_packet(const void *buf, size_t *n, mysql_stream_t *stream)
+{
+	size_t nleft = *n;
+	size_t len;
+	int ret;
+
+	do
+	{
+		len = nleft;
+		ret = stream->write(buf, &len, stream);
+		nleft -= len;
+		buf = (const char *)buf + len;
+	} while (ret == 0 && nleft > 0);
+
+	*n -= nleft;
+	return ret;
+}
+
+void mysql_stream_erase(size_t offset, size_t n, mysql_stream_t *stream)
+{
+	char *p = (char *)stream->buf + offset;
+
+	memmove(p, p + n, stream->length - offset - n);
+	stream->length -= n;
+}
+
 void mysql_stream_init(mysql_stream_t *stream)
 {
 	stream->head_left = 4;
@@ -42,6 +42,12 @@ extern "C"
 void mysql_stream_init(mysql_stream_t *stream);
 int mysql_stream_write(const void *buf, size_t n, mysql_stream_t *stream);
 
+// stop when a packet is complete. *n is set to the bytes written
+int mysql_stream_write_packet(const void *buf, size_t *n, mysql_stream_t *stream);
+
+// remove n bytes of the payloads from offset, between packets only
+void mysql_stream_erase(size_t offset, size_t n, mysql_stream_t *stream);
+
 #ifdef __cplusplus
 }
 #endif
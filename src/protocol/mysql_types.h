@@ -26,6 +26,9 @@
 // may be set by server in EOF/OK packet
 #define MYSQL_SERVER_MORE_RESULTS_EXIST		0x0008
 
+// column flag in column definition
+#define MYSQL_UNSIGNED_FLAG					0x0020
+
 enum
 {
 	MYSQL_COM_SLEEP,
@@ -17,6 +17,7 @@
            Liu Kai (liukaidx@sogou-inc.com)
 */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
@@ -327,6 +328,35 @@ void redis_parser_deinit(redis_parser_t *parser)
 	free(parser->msgbuf);
 }
 
+int redis_parser_set_batch(size_t n, redis_parser_t *parser)
+{
+	struct __redis_read_record *node;
+	size_t i;
+
+	if (n == 0 || n > REDIS_ARRAY_SIZE_LIMIT || parser->msgsize != 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (redis_reply_set_array(n, &parser->reply) < 0)
+		return -1;
+
+	for (i = 0; i < n - 1; i++)
+	{
+		node = (struct __redis_read_record *)malloc(sizeof *node);
+		if (!node)
+			return -1;
+
+		node->reply = parser->reply.element[n - 1 - i];
+		list_add(&node->list, &parser->read_list);
+	}
+
+	parser->nleft = n;
+	parser->cur = parser->reply.element[0];
+	return 0;
+}
+
 static int __redis_parse_done(redis_reply_t *reply, char *buf, int depth)
 {
 	size_t i;
@@ -68,6 +68,9 @@ void redis_parser_deinit(redis_parser_t *parser);
 int redis_parser_append_message(const void *buf, size_t *size,
 								redis_parser_t *parser);
 
+/* Parse the next 'n' replies into one array, before appending messages. */
+int redis_parser_set_batch(size_t n, redis_parser_t *parser);
+
 void redis_reply_deinit(redis_reply_t *reply);
 
 int redis_reply_set_array(size_t size, redis_reply_t *reply);
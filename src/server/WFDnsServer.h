@@ -35,6 +35,7 @@ static constexpr struct WFServerParams DNS_SERVER_PARAMS_DEFAULT =
 	.keep_alive_timeout		=	300 * 1000,
 	.request_size_limit		=	(size_t)-1,
 	.ssl_accept_timeout		=	5000,
+	.reuse_port				=	0,
 };
 
 template<>
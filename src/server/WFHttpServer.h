@@ -25,8 +25,6 @@
 #include "WFTaskFactory.h"
 
 using http_process_t = std::function<void (WFHttpTask *)>;
-using WFHttpServer = WFServer<protocol::HttpRequest,
-							  protocol::HttpResponse>;
 
 static constexpr struct WFServerParams HTTP_SERVER_PARAMS_DEFAULT =
 {
@@ -36,17 +34,21 @@ static constexpr struct WFServerParams HTTP_SERVER_PARAMS_DEFAULT =
 	.keep_alive_timeout		=	60 * 1000,
 	.request_size_limit		=	(size_t)-1,
 	.ssl_accept_timeout		=	10 * 1000,
+	.reuse_port				=	0,
 };
 
 template<>
-inline WFHttpServer::WFServer(http_process_t proc) :
+inline WFServer<protocol::HttpRequest, protocol::HttpResponse>::
+WFServer(http_process_t proc) :
 	WFServerBase(&HTTP_SERVER_PARAMS_DEFAULT),
 	process(std::move(proc))
 {
 }
 
 template<>
-inline CommSession *WFHttpServer::new_session(long long seq, CommConnection *conn)
+inline CommSession *
+WFServer<protocol::HttpRequest, protocol::HttpResponse>::
+new_session(long long seq, CommConnection *conn)
 {
 	WFHttpTask *task;
 
@@ -58,5 +60,61 @@ inline CommSession *WFHttpServer::new_session(long long seq, CommConnection *con
 	return task;
 }
 
+/* Besides replying, the process function, or any task in its series, may
+ * send the response piece by piece with task->push_chunk(buf, size) before
+ * the series ends. The first push sends the header, adding "Transfer-Encoding:
+ * chunked", and every push sends one chunk of the body. It never waits for
+ * the client. While the client is too slow to take the chunks queued, it
+ * fails with EAGAIN and takes nothing, to be called again later, e.g. after
+ * a timer. The output body is sent with the reply as the last chunk. Not for
+ * HTTP/2. task->push() still writes raw bytes to the connection. */
+class WFHttpServer : public WFServer<protocol::HttpRequest,
+									 protocol::HttpResponse>
+{
+public:
+	WFHttpServer(const struct WFServerParams *params, http_process_t proc) :
+		WFServer(params, std::move(proc))
+	{
+	}
+
+	WFHttpServer(http_process_t proc) :
+		WFServer(&HTTP_SERVER_PARAMS_DEFAULT, std::move(proc))
+	{
+	}
+
+public:
+	/* 'proc' is called in the network thread as soon as the header of a
+	 * request is received, before the body. It may set a body sink on the
+	 * request, to receive a large body piece by piece while it comes:
+	 *   task->get_req()->set_body_sink(...);
+	 * The process function is called when the whole request is received.
+	 * Call before start(). */
+	void set_header_process(http_process_t proc)
+	{
+		this->header_process = std::move(proc);
+	}
+
+protected:
+	virtual CommSession *new_session(long long seq, CommConnection *conn);
+
+protected:
+	http_process_t header_process;
+};
+
+inline CommSession *WFHttpServer::new_session(long long seq, CommConnection *conn)
+{
+	CommSession *session = this->WFServer::new_session(seq, conn);
+	WFHttpTask *task = static_cast<WFHttpTask *>(session);
+
+	if (this->header_process)
+	{
+		task->get_req()->set_header_callback([this, task]() {
+			this->header_process(task);
+		});
+	}
+
+	return session;
+}
+
 #endif
 
@@ -36,6 +36,7 @@ static constexpr struct WFServerParams MYSQL_SERVER_PARAMS_DEFAULT =
 	.keep_alive_timeout		=	28800 * 1000,
 	.request_size_limit		=	(size_t)-1,
 	.ssl_accept_timeout		=	10 * 1000,
+	.reuse_port				=	0,
 };
 
 class WFMySQLServer : public WFServer<protocol::MySQLRequest,
@@ -100,6 +100,8 @@ int WFServerBase::init(const struct sockaddr *bind_addr, socklen_t addrlen,
 	if (this->CommService::init(bind_addr, addrlen, -1, timeout) < 0)
 		return -1;
 
+	this->set_reuse_port(this->params.reuse_port);
+
 	if (key_file && cert_file)
 	{
 		if (this->init_ssl_ctx(cert_file, key_file) < 0)
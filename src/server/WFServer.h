@@ -38,6 +38,7 @@ struct WFServerParams
 	int keep_alive_timeout;
 	size_t request_size_limit;
 	int ssl_accept_timeout;	/* if not ssl, this will be ignored */
+	int reuse_port;			/* one SO_REUSEPORT listener per poller thread */
 };
 
 static constexpr struct WFServerParams SERVER_PARAMS_DEFAULT =
@@ -48,6 +49,7 @@ static constexpr struct WFServerParams SERVER_PARAMS_DEFAULT =
 	.keep_alive_timeout		=	60 * 1000,
 	.request_size_limit		=	(size_t)-1,
 	.ssl_accept_timeout		=	10 * 1000,
+	.reuse_port				=	0,
 };
 
 class WFServerBase : protected CommService
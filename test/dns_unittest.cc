@@ -16,6 +16,13 @@
   Author: Liu Kai (liukaidx@sogou-inc.com)
 */
 
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <string>
+#include <thread>
 #include <future>
 #include <gtest/gtest.h>
 #include "workflow/WFTaskFactory.h"
@@ -120,6 +127,93 @@ TEST(dns_unittest, WFDnsClient)
 	fut.get();
 }
 
+/* Answer every query of two with one address, the second one first. */
+static void __paired_server(int fd, int *queries)
+{
+	char buf[2][512];
+	struct sockaddr_in peer;
+	socklen_t len = sizeof peer;
+	ssize_t n[2];
+	uint16_t qtype;
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		n[i] = recvfrom(fd, buf[i], 512 - 32, 0, (struct sockaddr *)&peer, &len);
+		if (n[i] < 16)
+			return;
+
+		(*queries)++;
+	}
+
+	for (i = 1; i >= 0; i--)
+	{
+		std::string reply(buf[i], n[i]);
+		memcpy(&qtype, buf[i] + n[i] - 4, 2);
+		reply[2] = (char)0x81;
+		reply[3] = (char)0x80;
+		reply[7] = 1;
+		reply.append("\xc0\x0c", 2);
+		reply.append((const char *)&qtype, 2);
+		reply.append("\x00\x01\x00\x00\x00\x3c", 6);
+		if (ntohs(qtype) == DNS_TYPE_AAAA)
+		{
+			reply.append("\x00\x10", 2);
+			reply.append("\x20\x01\x0d\xb8", 4);
+			reply.append(11, '\0');
+			reply.append(1, '\x01');
+		}
+		else
+			reply.append("\x00\x04\x7f\x00\x00\x01", 6);
+
+		sendto(fd, reply.data(), reply.size(), 0,
+			   (struct sockaddr *)&peer, len);
+	}
+}
+
+TEST(dns_unittest, ExtraQuestion)
+{
+	struct sockaddr_in addr = { };
+	std::promise<void> done;
+	int queries = 0;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	ASSERT_TRUE(fd >= 0);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(8853);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ASSERT_EQ(bind(fd, (struct sockaddr *)&addr, sizeof addr), 0);
+
+	std::thread server(__paired_server, fd, &queries);
+	auto *task = WFTaskFactory::create_dns_task("dns://127.0.0.1:8853/a.test",
+												0, [&done](WFDnsTask *task)
+	{
+		protocol::DnsResponse *resp = task->get_resp();
+		const protocol::DnsResponse *extra = resp->get_extra();
+
+		EXPECT_EQ(task->get_state(), WFT_STATE_SUCCESS);
+		EXPECT_EQ(resp->get_question_type(), DNS_TYPE_A);
+		EXPECT_EQ(resp->get_ancount(), 1);
+		EXPECT_TRUE(extra != NULL);
+		if (extra)
+		{
+			EXPECT_EQ(extra->get_question_type(), DNS_TYPE_AAAA);
+			EXPECT_EQ(extra->get_ancount(), 1);
+		}
+
+		done.set_value();
+	});
+
+	task->get_req()->set_extra_question_type(DNS_TYPE_AAAA);
+	task->set_receive_timeout(1000);
+	task->start();
+	done.get_future().get();
+	server.join();
+	close(fd);
+	EXPECT_EQ(queries, 2);
+}
+
 int main(int argc, char *argv[])
 {
 	::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,571 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <utility>
+#include <gtest/gtest.h>
+#include "workflow/hpack.h"
+#include "workflow/http_parser.h"
+#include "workflow/http2_parser.h"
+#include "workflow/WFGlobal.h"
+#include "workflow/WFTaskFactory.h"
+#include "workflow/WFFacilities.h"
+#include "workflow/WFHttpServer.h"
+
+typedef std::vector<std::pair<std::string, std::string>> header_list_t;
+
+static int __collect_header(const char *name, size_t name_len,
+							const char *value, size_t value_len,
+							void *context)
+{
+	header_list_t *headers = (header_list_t *)context;
+
+	headers->emplace_back(std::string(name, name_len),
+						  std::string(value, value_len));
+	return 0;
+}
+
+static header_list_t __decode(const std::string& block, hpack_table_t *table)
+{
+	header_list_t headers;
+
+	EXPECT_EQ(hpack_decode_block(block.data(), block.size(), __collect_header,
+								 &headers, table), 0);
+	return headers;
+}
+
+static std::string __unhex(const char *hex)
+{
+	std::string bytes;
+
+	for (; hex[0] && hex[1]; hex += 2)
+		bytes.push_back((char)std::stoi(std::string(hex, 2), NULL, 16));
+
+	return bytes;
+}
+
+static std::string __frame(size_t length, int type, int flags,
+						   unsigned int stream_id, const std::string& payload)
+{
+	char header[HTTP2_FRAME_HEADER_SIZE];
+
+	http2_frame_header(length, type, flags, stream_id, header);
+	return std::string(header, HTTP2_FRAME_HEADER_SIZE) + payload;
+}
+
+static std::string __uint32(unsigned int n)
+{
+	char buf[4] = { (char)(n >> 24), (char)(n >> 16), (char)(n >> 8), (char)n };
+
+	return std::string(buf, 4);
+}
+
+static std::string __settings(int id, unsigned int value)
+{
+	std::string payload;
+
+	payload.push_back((char)(id >> 8));
+	payload.push_back((char)id);
+	payload += __uint32(value);
+	return __frame(6, HTTP2_SETTINGS, 0, 0, payload);
+}
+
+static std::string __request_block(const char *path)
+{
+	char buf[256];
+	size_t n = 0;
+
+	n += hpack_encode_header(":method", 7, "GET", 3, buf + n);
+	n += hpack_encode_header(":scheme", 7, "http", 4, buf + n);
+	n += hpack_encode_header(":path", 5, path, strlen(path), buf + n);
+	return std::string(buf, n);
+}
+
+/* Append all of 'data', and the streams touched, in order. */
+static int __append(const std::string& data, http2_conn_t *conn,
+					std::vector<std::pair<unsigned int, int>> *touched)
+{
+	const char *p = data.data();
+	const char *end = p + data.size();
+	http2_stream_t *stream;
+	size_t n;
+	int ret;
+
+	while (p < end)
+	{
+		n = end - p;
+		ret = http2_parser_append_message(p, &n, &stream, conn);
+		if (ret < 0)
+			return ret;
+
+		if (stream && touched)
+			touched->emplace_back(stream->id, ret);
+
+		p += n;
+	}
+
+	return 0;
+}
+
+/* RFC 7541 C.4, requests with Huffman coding. */
+TEST(http2_unittest, HpackHuffman)
+{
+	hpack_table_t table;
+	header_list_t headers;
+
+	hpack_table_init(HPACK_TABLE_SIZE_DEFAULT, &table);
+	headers = __decode(__unhex("828684418cf1e3c2e5f23a6ba0ab90f4ff"), &table);
+	EXPECT_EQ(headers, (header_list_t{
+		{":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+		{":authority", "www.example.com"}}));
+	EXPECT_EQ(table.size, 57U);
+
+	headers = __decode(__unhex("828684be5886a8eb10649cbf"), &table);
+	EXPECT_EQ(headers, (header_list_t{
+		{":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+		{":authority", "www.example.com"}, {"cache-control", "no-cache"}}));
+	EXPECT_EQ(table.size, 110U);
+
+	headers = __decode(__unhex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"),
+					   &table);
+	EXPECT_EQ(headers, (header_list_t{
+		{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"},
+		{":authority", "www.example.com"}, {"custom-key", "custom-value"}}));
+	EXPECT_EQ(table.size, 164U);
+	hpack_table_deinit(&table);
+}
+
+/* RFC 7541 C.5, responses that evict entries of a 256 bytes table. */
+TEST(http2_unittest, HpackEviction)
+{
+	const char *date1 = "Mon, 21 Oct 2013 20:13:21 GMT";
+	const char *date2 = "Mon, 21 Oct 2013 20:13:22 GMT";
+	const char *location = "https://www.example.com";
+	const char *cookie = "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1";
+	hpack_table_t table;
+	header_list_t headers;
+	std::string block;
+
+	hpack_table_init(256, &table);
+	block = std::string("\x48\x03" "302" "\x58\x07" "private" "\x61\x1d") +
+			date1 + "\x6e\x17" + location;
+	headers = __decode(block, &table);
+	EXPECT_EQ(headers, (header_list_t{
+		{":status", "302"}, {"cache-control", "private"},
+		{"date", date1}, {"location", location}}));
+	EXPECT_EQ(table.size, 222U);
+
+	/* ":status: 302" is evicted. */
+	headers = __decode("\x48\x03" "307" "\xc1\xc0\xbf", &table);
+	EXPECT_EQ(headers, (header_list_t{
+		{":status", "307"}, {"cache-control", "private"},
+		{"date", date1}, {"location", location}}));
+	EXPECT_EQ(table.size, 222U);
+
+	block = std::string("\x88\xc1\x61\x1d") + date2 + "\xc0\x5a\x04" "gzip" +
+			"\x77\x38" + cookie;
+	headers = __decode(block, &table);
+	EXPECT_EQ(headers, (header_list_t{
+		{":status", "200"}, {"cache-control", "private"},
+		{"date", date2}, {"location", location},
+		{"content-encoding", "gzip"}, {"set-cookie", cookie}}));
+	EXPECT_EQ(table.count, 3U);
+	EXPECT_EQ(table.size, 215U);
+	hpack_table_deinit(&table);
+}
+
+/* RFC 7541 C.6.1, a response with Huffman coding. */
+TEST(http2_unittest, HpackHuffmanResponse)
+{
+	hpack_table_t table;
+	header_list_t headers;
+
+	hpack_table_init(256, &table);
+	headers = __decode(__unhex("488264025885aec3771a4b6196d07abe941054d444a8200595"
+							   "040b8166e082a62d1bff6e919d29ad171863c78f0b97c8e9ae"
+							   "82ae43d3"), &table);
+	EXPECT_EQ(headers, (header_list_t{
+		{":status", "302"}, {"cache-control", "private"},
+		{"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+		{"location", "https://www.example.com"}}));
+	EXPECT_EQ(table.size, 222U);
+	hpack_table_deinit(&table);
+}
+
+TEST(http2_unittest, SettingsAck)
+{
+	http2_conn_t conn;
+	std::string data;
+	std::string ack = __frame(0, HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0, "");
+
+	http2_conn_init(1, &conn);
+	ASSERT_EQ(http2_conn_enable(&conn), 0);
+	conn.out_size = 0;
+
+	/* The rest of the client magic, and its SETTINGS. */
+	data = "SM\r\n\r\n" + __settings(0x4, 1000);
+	EXPECT_EQ(__append(data, &conn, NULL), 0);
+	EXPECT_EQ(conn.initial_window, 1000);
+	EXPECT_EQ(std::string(conn.out, conn.out_size), ack);
+
+	/* No SETTINGS_MAX_FRAME_SIZE below the default is valid. */
+	conn.out_size = 0;
+	EXPECT_EQ(__append(__settings(0x5, 100), &conn, NULL), -2);
+	http2_conn_deinit(&conn);
+}
+
+/* DATA beyond the stream window waits for WINDOW_UPDATE. */
+TEST(http2_unittest, WindowUpdate)
+{
+	std::string body(30, 'x');
+	http2_stream_t *stream;
+	http2_conn_t conn;
+	std::string data;
+
+	http2_conn_init(0, &conn);
+	ASSERT_EQ(http2_conn_enable(&conn), 0);
+	EXPECT_EQ(__append(__settings(0x4, 10), &conn, NULL), 0);
+	conn.out_size = 0;
+
+	stream = http2_conn_open_stream(&conn);
+	ASSERT_TRUE(stream != NULL);
+	EXPECT_EQ(stream->id, 1U);
+	EXPECT_EQ(http2_stream_window(stream, &conn), 10U);
+	http2_stream_consume_window(10, stream, &conn);
+	ASSERT_EQ(http2_stream_queue_data(body.data() + 10, 20, stream, &conn), 0);
+	http2_stream_end(stream, &conn);
+	EXPECT_FALSE(stream->local_closed);
+
+	data = __frame(4, HTTP2_WINDOW_UPDATE, 0, 1, __uint32(5));
+	EXPECT_EQ(__append(data, &conn, NULL), 0);
+	data = __frame(5, HTTP2_DATA, 0, 1, body.substr(10, 5));
+	EXPECT_EQ(std::string(conn.out, conn.out_size), data);
+	EXPECT_FALSE(stream->local_closed);
+	conn.out_size = 0;
+
+	/* The connection window allows 65535 - 15. */
+	data = __frame(4, HTTP2_WINDOW_UPDATE, 0, 1, __uint32(100));
+	EXPECT_EQ(__append(data, &conn, NULL), 0);
+	data = __frame(15, HTTP2_DATA, HTTP2_FLAG_END_STREAM, 1, body.substr(15));
+	EXPECT_EQ(std::string(conn.out, conn.out_size), data);
+	EXPECT_TRUE(stream->local_closed);
+	EXPECT_EQ(stream->send_window, 85);
+	http2_conn_deinit(&conn);
+}
+
+/* The frames of two requests interleave on one connection. */
+TEST(http2_unittest, ConcurrentStreams)
+{
+	std::vector<std::pair<unsigned int, int>> touched;
+	std::string block1 = __request_block("/one");
+	std::string block3 = __request_block("/three");
+	http2_stream_t *stream;
+	http_parser_t parser;
+	http2_conn_t conn;
+	std::string data;
+
+	http2_conn_init(1, &conn);
+	ASSERT_EQ(http2_conn_enable(&conn), 0);
+	data = "SM\r\n\r\n";
+	data += __frame(block1.size(), HTTP2_HEADERS, HTTP2_FLAG_END_HEADERS, 1,
+					block1);
+	data += __frame(block3.size(), HTTP2_HEADERS,
+					HTTP2_FLAG_END_HEADERS | HTTP2_FLAG_END_STREAM, 3, block3);
+	data += __frame(3, HTTP2_DATA, HTTP2_FLAG_END_STREAM, 1, "abc");
+	EXPECT_EQ(__append(data, &conn, &touched), 0);
+	EXPECT_EQ(touched, (std::vector<std::pair<unsigned int, int>>{
+		{1, 0}, {3, 1}, {1, 1}}));
+	EXPECT_EQ(conn.nstreams, 2U);
+
+	http_parser_init(0, &parser);
+	stream = http2_conn_find_stream(1, &conn);
+	ASSERT_TRUE(stream != NULL);
+	http2_stream_take_message(&parser, stream);
+	EXPECT_STREQ(http_parser_get_uri(&parser), "/one");
+	EXPECT_STREQ(http_parser_get_version(&parser), "HTTP/2.0");
+	EXPECT_EQ(parser.msgsize - parser.header_offset, 3U);
+
+	stream = http2_conn_find_stream(3, &conn);
+	ASSERT_TRUE(stream != NULL);
+	http2_stream_take_message(&parser, stream);
+	EXPECT_STREQ(http_parser_get_uri(&parser), "/three");
+	http_parser_deinit(&parser);
+
+	/* A stream ID may not go backwards. */
+	data = __frame(block1.size(), HTTP2_HEADERS,
+				   HTTP2_FLAG_END_HEADERS | HTTP2_FLAG_END_STREAM, 1, block1);
+	http2_stream_end(http2_conn_find_stream(1, &conn), &conn);
+	EXPECT_EQ(conn.nstreams, 1U);
+	EXPECT_EQ(__append(data, &conn, NULL), -2);
+	http2_conn_deinit(&conn);
+}
+
+/* A reset from the server fails the request of that stream only. */
+TEST(http2_unittest, StreamReset)
+{
+	std::vector<std::pair<unsigned int, int>> touched;
+	http2_stream_t *stream1;
+	http2_stream_t *stream3;
+	http2_conn_t conn;
+	std::string data;
+
+	http2_conn_init(0, &conn);
+	ASSERT_EQ(http2_conn_enable(&conn), 0);
+	EXPECT_EQ(__append(__settings(0x3, 10), &conn, NULL), 0);
+	conn.out_size = 0;
+
+	stream1 = http2_conn_open_stream(&conn);
+	stream3 = http2_conn_open_stream(&conn);
+	ASSERT_TRUE(stream1 != NULL && stream3 != NULL);
+	data = __frame(4, HTTP2_RST_STREAM, 0, 1, __uint32(0x7));
+	EXPECT_EQ(__append(data, &conn, &touched), 0);
+	EXPECT_EQ(touched, (std::vector<std::pair<unsigned int, int>>{{1, 1}}));
+	EXPECT_TRUE(stream1->reset);
+	EXPECT_FALSE(stream3->reset);
+	EXPECT_FALSE(stream3->remote_closed);
+
+	http2_conn_close_stream(stream1, &conn);
+	EXPECT_EQ(conn.out_size, 0U);
+	EXPECT_EQ(conn.nstreams, 1U);
+	EXPECT_EQ(http2_conn_find_stream(3, &conn), stream3);
+	http2_conn_deinit(&conn);
+}
+
+/* No stream is opened while too much DATA waits for the windows. */
+TEST(http2_unittest, QueuedLimit)
+{
+	std::string body(HTTP2_QUEUED_MAX, 'x');
+	http2_stream_t *stream;
+	http2_conn_t conn;
+
+	http2_conn_init(0, &conn);
+	ASSERT_EQ(http2_conn_enable(&conn), 0);
+	stream = http2_conn_open_stream(&conn);
+	ASSERT_TRUE(stream != NULL);
+	ASSERT_EQ(http2_stream_queue_data(body.data(), body.size(), stream, &conn), 0);
+	EXPECT_EQ(conn.queued, body.size());
+
+	errno = 0;
+	EXPECT_TRUE(http2_conn_open_stream(&conn) == NULL);
+	EXPECT_EQ(errno, EAGAIN);
+
+	http2_conn_close_stream(stream, &conn);
+	EXPECT_EQ(conn.queued, 0U);
+	EXPECT_TRUE(http2_conn_open_stream(&conn) != NULL);
+	http2_conn_deinit(&conn);
+}
+
+static void __echo_process(std::mutex *mutex, std::set<unsigned short> *ports,
+						   WFHttpTask *task)
+{
+	auto *req = task->get_req();
+	auto *resp = task->get_resp();
+	struct sockaddr_in addr;
+	socklen_t len = sizeof addr;
+	const void *body;
+	size_t size;
+
+	task->get_peer_addr((struct sockaddr *)&addr, &len);
+	mutex->lock();
+	ports->insert(ntohs(addr.sin_port));
+	mutex->unlock();
+
+	req->get_parsed_body(&body, &size);
+	if (strcmp(req->get_request_uri(), "/big") == 0)
+		resp->append_output_body(std::string(200 * 1024, 'b'));
+	else
+		resp->append_output_body(std::to_string(size));
+}
+
+static WFHttpTask *__create_h2_task(const std::string& path,
+									WFFacilities::WaitGroup *wait_group,
+									std::string *result)
+{
+	auto *task = WFTaskFactory::create_http_task("http://127.0.0.1:8817" + path,
+												 0, 0, [wait_group, result](WFHttpTask *task) {
+		const void *body;
+		size_t size;
+
+		EXPECT_EQ(task->get_state(), WFT_STATE_SUCCESS);
+		if (task->get_state() == WFT_STATE_SUCCESS)
+		{
+			task->get_resp()->get_parsed_body(&body, &size);
+			result->assign((const char *)body, size);
+		}
+
+		wait_group->done();
+	});
+
+	task->get_req()->set_http_version("HTTP/2.0");
+	return task;
+}
+
+/* Requests started in one callback, and their replies, are merged into
+ * few writes. Before any other use of the library in this process, so
+ * the tests below run with output merged too. */
+TEST(http2_unittest, CoalescedOutput)
+{
+	struct WFGlobalSettings settings = GLOBAL_SETTINGS_DEFAULT;
+	std::mutex mutex;
+	std::set<unsigned short> ports;
+	WFHttpServer server(std::bind(__echo_process, &mutex, &ports,
+								  std::placeholders::_1));
+	std::vector<std::string> results(50);
+	WFFacilities::WaitGroup wait_group(results.size());
+
+	settings.coalesce_output = 1;
+	WORKFLOW_library_init(&settings);
+	EXPECT_TRUE(server.start("127.0.0.1", 8823) == 0) << "http server start failed";
+
+	auto *first = WFTaskFactory::create_http_task("http://127.0.0.1:8823/first",
+												  0, 0, [&](WFHttpTask *) {
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			std::string *result = &results[i];
+			auto *task = WFTaskFactory::create_http_task("http://127.0.0.1:8823/echo",
+														 0, 0, [&wait_group, result](WFHttpTask *task) {
+				const void *body;
+				size_t size;
+
+				EXPECT_EQ(task->get_state(), WFT_STATE_SUCCESS);
+				if (task->get_resp()->get_parsed_body(&body, &size))
+					result->assign((const char *)body, size);
+
+				wait_group.done();
+			});
+
+			task->get_req()->set_http_version("HTTP/2.0");
+			task->get_req()->set_method("POST");
+			task->get_req()->append_output_body(std::string(i * 100, 'a'));
+			task->start();
+		}
+	});
+
+	first->get_req()->set_http_version("HTTP/2.0");
+	first->start();
+	wait_group.wait();
+
+	for (size_t i = 0; i < results.size(); i++)
+		EXPECT_EQ(results[i], std::to_string(i * 100));
+
+	EXPECT_EQ(ports.size(), 1U);
+	server.stop();
+}
+
+/* Requests at the same time share one h2c connection. */
+TEST(http2_unittest, Multiplexing)
+{
+	std::mutex mutex;
+	std::set<unsigned short> ports;
+	WFHttpServer server(std::bind(__echo_process, &mutex, &ports,
+								  std::placeholders::_1));
+	std::vector<std::string> results(20);
+	std::string big;
+
+	EXPECT_TRUE(server.start("127.0.0.1", 8817) == 0) << "http server start failed";
+
+	/* The first one sets up the connection. */
+	{
+		WFFacilities::WaitGroup wait_group(1);
+
+		__create_h2_task("/first", &wait_group, &results[0])->start();
+		wait_group.wait();
+		EXPECT_EQ(results[0], "0");
+	}
+
+	WFFacilities::WaitGroup wait_group(results.size() + 1);
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		auto *task = __create_h2_task("/echo", &wait_group, &results[i]);
+
+		task->get_req()->set_method("POST");
+		task->get_req()->append_output_body(std::string(i * 10000, 'a'));
+		task->start();
+	}
+
+	/* Larger than the default windows of HTTP/2. */
+	__create_h2_task("/big", &wait_group, &big)->start();
+	wait_group.wait();
+
+	for (size_t i = 0; i < results.size(); i++)
+		EXPECT_EQ(results[i], std::to_string(i * 10000));
+
+	EXPECT_EQ(big, std::string(200 * 1024, 'b'));
+	EXPECT_EQ(ports.size(), 1U);
+	server.stop();
+}
+
+static void __slow_process(WFHttpTask *task)
+{
+	if (strcmp(task->get_req()->get_request_uri(), "/slow") == 0)
+		series_of(task)->push_back(WFTaskFactory::create_timer_task(500000, nullptr));
+
+	task->get_resp()->append_output_body("done");
+}
+
+/* A request that times out fails alone, and the connection goes on. */
+TEST(http2_unittest, StreamTimeout)
+{
+	WFHttpServer server(__slow_process);
+	WFFacilities::WaitGroup wait_group(2);
+	std::string fast;
+	int state = -1;
+	int error = 0;
+
+	EXPECT_TRUE(server.start("127.0.0.1", 8818) == 0) << "http server start failed";
+
+	auto *slow = WFTaskFactory::create_http_task("http://127.0.0.1:8818/slow",
+												 0, 0, [&](WFHttpTask *task) {
+		state = task->get_state();
+		error = task->get_error();
+		wait_group.done();
+	});
+
+	slow->get_req()->set_http_version("HTTP/2.0");
+	slow->set_receive_timeout(100);
+	slow->start();
+
+	auto *task = WFTaskFactory::create_http_task("http://127.0.0.1:8818/fast",
+												 0, 0, [&](WFHttpTask *task) {
+		const void *body;
+		size_t size;
+
+		if (task->get_state() == WFT_STATE_SUCCESS)
+		{
+			task->get_resp()->get_parsed_body(&body, &size);
+			fast.assign((const char *)body, size);
+		}
+
+		wait_group.done();
+	});
+
+	task->get_req()->set_http_version("HTTP/2.0");
+	task->start();
+	wait_group.wait();
+
+	EXPECT_EQ(state, WFT_STATE_SYS_ERROR);
+	EXPECT_EQ(error, ETIMEDOUT);
+	EXPECT_EQ(fast, "done");
+	server.stop();
+}
@@ -16,14 +16,28 @@
   Author: Wu Jiaxu (wujiaxu@sogou-inc.com)
 */
 
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
 #include <gtest/gtest.h>
 #include "workflow/WFTaskFactory.h"
+#include "workflow/WFFacilities.h"
+#include "workflow/WFHttpCache.h"
+#include "workflow/WFSingleFlight.h"
 #include "workflow/WFOperator.h"
 #include "workflow/WFHttpServer.h"
 #include "workflow/HttpUtil.h"
+#include "workflow/http_encoding.h"
 
 #define RETRY_MAX  3
 
@@ -205,6 +219,526 @@ KZ1lOvb+vi3TLrQf4tfBekrXXe5tZK40QSJ7UdtY7HHrrbAXU+8=
 	https_server.stop();
 }
 
+TEST(http_unittest, BodySinkPause)
+{
+	std::string body(4 * 1024 * 1024, 'x');
+	WFHttpServer server([&body](WFHttpTask *task) {
+		task->get_resp()->append_output_body_nocopy(body.data(), body.size());
+	});
+	EXPECT_TRUE(server.start("127.0.0.1", 8812) == 0) << "http server start failed";
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	bool done = false;
+	size_t received = 0;
+	int paused = 0;
+	int timers = 0;
+	auto *task = WFTaskFactory::create_http_task("http://127.0.0.1:8812/", 0, 0, [&](WFHttpTask *task) {
+		EXPECT_EQ(task->get_state(), WFT_STATE_SUCCESS);
+		mutex.lock();
+		done = true;
+		mutex.unlock();
+		cond.notify_one();
+	});
+
+	auto *resp = task->get_resp();
+	resp->set_body_sink([&](const void *buf, size_t size) {
+		received += size;
+		if (received / (256 * 1024) > (size_t)paused && received < body.size())
+		{
+			paused++;
+			EXPECT_TRUE(resp->pause_receiving());
+			auto *timer = WFTaskFactory::create_timer_task(10000, [&](WFTimerTask *) {
+				mutex.lock();
+				if (!done)
+				{
+					EXPECT_TRUE(resp->resume_receiving());
+				}
+
+				timers--;
+				mutex.unlock();
+				cond.notify_one();
+			});
+			mutex.lock();
+			timers++;
+			mutex.unlock();
+			timer->start();
+		}
+
+		return true;
+	});
+	task->start();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!done || timers > 0)
+		cond.wait(lock);
+
+	lock.unlock();
+	EXPECT_EQ(received, body.size());
+	EXPECT_GT(paused, 0);
+	server.stop();
+}
+
+/* A large request body goes to the sink in pieces, and is not kept. */
+TEST(http_unittest, StreamRequestBody)
+{
+	std::string body(4 * 1024 * 1024, 'x');
+	std::atomic<size_t> received(0);
+	std::atomic<int> pieces(0);
+	WFHttpServer server([&](WFHttpTask *task) {
+		const void *buf;
+		size_t size;
+
+		EXPECT_FALSE(task->get_req()->get_parsed_body(&buf, &size) && size != 0);
+		task->get_resp()->append_output_body(std::to_string(received));
+	});
+
+	server.set_header_process([&](WFHttpTask *task) {
+		task->get_req()->set_body_sink([&](const void *buf, size_t size) {
+			received += size;
+			pieces++;
+			return true;
+		});
+	});
+	EXPECT_TRUE(server.start("127.0.0.1", 8820) == 0) << "http server start failed";
+
+	WFFacilities::WaitGroup wait_group(1);
+	auto *task = WFTaskFactory::create_http_task("http://127.0.0.1:8820/", 0, 0, [&](WFHttpTask *task) {
+		const void *buf;
+		size_t size;
+
+		EXPECT_EQ(task->get_state(), WFT_STATE_SUCCESS);
+		task->get_resp()->get_parsed_body(&buf, &size);
+		EXPECT_EQ(std::string((const char *)buf, size), std::to_string(body.size()));
+		wait_group.done();
+	});
+
+	task->get_req()->set_method("POST");
+	task->get_req()->append_output_body_nocopy(body.data(), body.size());
+	task->start();
+	wait_group.wait();
+
+	EXPECT_EQ(received, body.size());
+	EXPECT_GT(pieces, 1);
+	server.stop();
+}
+
+/* Chunks are pushed from the process and from a later task of the series.
+ * While the client does not read, pushing fails with EAGAIN, and takes
+ * nothing, till the client reads again. */
+TEST(http_unittest, PushChunk)
+{
+	std::string chunk(1024 * 1024, 'c');
+	size_t pushed = 0;
+	int again = 0;
+	WFHttpServer server([&](WFHttpTask *task) {
+		EXPECT_EQ(task->push_chunk("abc", 3), 3);
+		while (again == 0 && pushed < 64 * chunk.size())
+		{
+			if (task->push_chunk(chunk.data(), chunk.size()) >= 0)
+				pushed += chunk.size();
+			else
+			{
+				EXPECT_EQ(errno, EAGAIN);
+				again++;
+			}
+		}
+
+		series_of(task)->push_back(WFTaskFactory::create_timer_task(300000, [task](WFTimerTask *) {
+			EXPECT_EQ(task->push_chunk("def", 3), 3);
+			task->get_resp()->append_output_body("end");
+		}));
+	});
+	EXPECT_TRUE(server.start("127.0.0.1", 8821) == 0) << "http server start failed";
+
+	WFFacilities::WaitGroup wait_group(1);
+	std::string result;
+	bool paused = false;
+	auto *task = WFTaskFactory::create_http_task("http://127.0.0.1:8821/", 0, 0, [&](WFHttpTask *task) {
+		EXPECT_EQ(task->get_state(), WFT_STATE_SUCCESS);
+		wait_group.done();
+	});
+
+	auto *resp = task->get_resp();
+	resp->set_body_sink([&](const void *buf, size_t size) {
+		/* Stop reading for a while at the first piece. */
+		if (!paused)
+		{
+			paused = true;
+			EXPECT_TRUE(resp->pause_receiving());
+			WFTaskFactory::create_timer_task(100000, [resp](WFTimerTask *) {
+				EXPECT_TRUE(resp->resume_receiving());
+			})->start();
+		}
+
+		result.append((const char *)buf, size);
+		return true;
+	});
+	task->start();
+	wait_group.wait();
+
+	EXPECT_EQ(again, 1);
+	EXPECT_EQ(result.size(), 3 + pushed + 6);
+	EXPECT_EQ(result.substr(0, 3), "abc");
+	EXPECT_EQ(result.substr(result.size() - 6), "defend");
+	server.stop();
+}
+
+/* "/fresh" is fresh for a minute, "/expire" for a second with an ETag, and
+ * "/slow" is not cacheable and takes 200ms. */
+static void __cache_process(WFHttpTask *task, std::atomic<int> *requests,
+							std::atomic<int> *not_modified)
+{
+	auto *req = task->get_req();
+	auto *resp = task->get_resp();
+	std::string uri = req->get_request_uri();
+	std::string etag;
+
+	(*requests)++;
+	if (uri == "/fresh")
+		resp->add_header_pair("Cache-Control", "max-age=60");
+	else if (uri == "/expire")
+	{
+		resp->add_header_pair("Cache-Control", "max-age=1");
+		resp->add_header_pair("ETag", "\"v1\"");
+		protocol::HttpHeaderCursor cursor(req);
+		if (cursor.find("If-None-Match", etag) && etag == "\"v1\"")
+		{
+			(*not_modified)++;
+			resp->set_status_code("304");
+			resp->set_reason_phrase("Not Modified");
+			return;
+		}
+	}
+	else if (uri == "/slow")
+	{
+		resp->add_header_pair("Cache-Control", "no-store");
+		series_of(task)->push_back(WFTaskFactory::create_timer_task(200000, nullptr));
+	}
+
+	resp->append_output_body("hello");
+}
+
+/* Run 'n' tasks of 'url' at the same time, and check that all get "hello". */
+static void __cache_get(WFHttpCache *cache, const std::string& url, int n)
+{
+	WFFacilities::WaitGroup wait_group(n);
+
+	for (int i = 0; i < n; i++)
+	{
+		auto *task = cache->create_http_task(url, 0, 0, [&wait_group](WFHttpTask *task) {
+			auto *resp = task->get_resp();
+			const void *body;
+			size_t size;
+
+			EXPECT_EQ(task->get_state(), WFT_STATE_SUCCESS);
+			EXPECT_STREQ(resp->get_status_code(), "200");
+			EXPECT_TRUE(resp->get_parsed_body(&body, &size));
+			EXPECT_EQ(std::string((const char *)body, size), "hello");
+			wait_group.done();
+		});
+
+		task->start();
+	}
+
+	wait_group.wait();
+}
+
+TEST(http_unittest, CacheHitMiss)
+{
+	std::atomic<int> requests(0);
+	std::atomic<int> not_modified(0);
+	WFHttpServer server(std::bind(__cache_process, std::placeholders::_1,
+								  &requests, &not_modified));
+	WFHttpCache cache(16);
+	EXPECT_TRUE(server.start("127.0.0.1", 8813) == 0) << "http server start failed";
+
+	__cache_get(&cache, "http://127.0.0.1:8813/fresh", 1);
+	__cache_get(&cache, "http://127.0.0.1:8813/fresh", 1);
+	__cache_get(&cache, "http://127.0.0.1:8813/fresh?other", 1);
+	EXPECT_EQ(requests, 2);
+
+	struct WFHttpCacheStats stats = cache.get_stats();
+	EXPECT_EQ(stats.hits, 1);
+	EXPECT_EQ(stats.misses, 2);
+
+	cache.clear();
+	__cache_get(&cache, "http://127.0.0.1:8813/fresh", 1);
+	EXPECT_EQ(requests, 3);
+	server.stop();
+}
+
+TEST(http_unittest, CacheExpire)
+{
+	std::atomic<int> requests(0);
+	std::atomic<int> not_modified(0);
+	WFHttpServer server(std::bind(__cache_process, std::placeholders::_1,
+								  &requests, &not_modified));
+	WFHttpCache cache(16);
+	EXPECT_TRUE(server.start("127.0.0.1", 8814) == 0) << "http server start failed";
+
+	__cache_get(&cache, "http://127.0.0.1:8814/expire", 1);
+	__cache_get(&cache, "http://127.0.0.1:8814/expire", 1);
+	EXPECT_EQ(requests, 1);
+
+	/* The stale entry is revalidated, and the 304 gets the cached body. */
+	usleep(1100000);
+	__cache_get(&cache, "http://127.0.0.1:8814/expire", 1);
+	EXPECT_EQ(requests, 2);
+	EXPECT_EQ(not_modified, 1);
+
+	struct WFHttpCacheStats stats = cache.get_stats();
+	EXPECT_EQ(stats.hits, 1);
+	EXPECT_EQ(stats.revalidated, 1);
+	EXPECT_EQ(stats.misses, 1);
+	server.stop();
+}
+
+TEST(http_unittest, CacheCoalesce)
+{
+	std::atomic<int> requests(0);
+	std::atomic<int> not_modified(0);
+	WFHttpServer server(std::bind(__cache_process, std::placeholders::_1,
+								  &requests, &not_modified));
+	WFHttpCache cache(16);
+	EXPECT_TRUE(server.start("127.0.0.1", 8815) == 0) << "http server start failed";
+
+	/* The waiting tasks get the response though it is not cacheable. */
+	__cache_get(&cache, "http://127.0.0.1:8815/slow", 5);
+	EXPECT_EQ(requests, 1);
+	EXPECT_EQ(cache.get_stats().coalesced, 4);
+
+	__cache_get(&cache, "http://127.0.0.1:8815/slow", 1);
+	EXPECT_EQ(requests, 2);
+	server.stop();
+}
+
+TEST(http_unittest, SingleFlight)
+{
+	std::atomic<int> requests(0);
+	std::atomic<int> not_modified(0);
+	WFHttpServer server(std::bind(__cache_process, std::placeholders::_1,
+								  &requests, &not_modified));
+	WFSingleFlight flight;
+	WFFacilities::WaitGroup wait_group(6);
+	EXPECT_TRUE(server.start("127.0.0.1", 8816) == 0) << "http server start failed";
+
+	for (int i = 0; i < 6; i++)
+	{
+		const char *key = i < 5 ? "slow" : "other";
+		auto *task = flight.create_http_task(key, "http://127.0.0.1:8816/slow", 0, 0,
+											 [&wait_group](WFHttpTask *task) {
+			auto *resp = task->get_resp();
+			const void *body;
+			size_t size;
+
+			EXPECT_EQ(task->get_state(), WFT_STATE_SUCCESS);
+			EXPECT_TRUE(resp->get_parsed_body(&body, &size));
+			EXPECT_EQ(std::string((const char *)body, size), "hello");
+			wait_group.done();
+		});
+
+		task->start();
+	}
+
+	wait_group.wait();
+	EXPECT_EQ(requests, 2);
+
+	struct WFSingleFlightStats stats = flight.get_stats();
+	EXPECT_EQ(stats.flights, 2);
+	EXPECT_EQ(stats.shared, 4);
+	server.stop();
+}
+
+static std::string __coding_body()
+{
+	std::string body;
+
+	for (int i = 0; i < 20000; i++)
+		body += "line " + std::to_string(i * 7919 % 100003) + "\n";
+
+	return body;
+}
+
+/* The body coded with 'encoding' in one piece, or empty on error. */
+static std::string __encode(int encoding, const std::string& data)
+{
+	http_encoder_t enc;
+	std::string out;
+	size_t size = data.size();
+	long n;
+
+	if (http_encoder_init(encoding, -1, &enc) < 0)
+		return out;
+
+	out.resize(http_encoder_bound(size, &enc));
+	n = http_encoder_append(data.data(), &size, 1, &out[0], out.size(), &enc);
+	out.resize(n > 0 && size == 0 ? n : 0);
+	http_encoder_deinit(&enc);
+	return out;
+}
+
+/* The server compresses with the coding the client accepts, and the
+ * client decodes while receiving. */
+TEST(http_unittest, ContentCodingRoundTrip)
+{
+	std::string body = __coding_body();
+	std::atomic<size_t> encoded(0);
+	WFHttpServer server([&](WFHttpTask *task) {
+		auto *resp = task->get_resp();
+
+		resp->set_compress_min_size(1024);
+		resp->append_output_body_nocopy(body.data(), body.size());
+	});
+
+	if (__encode(HTTP_ENCODING_GZIP, "x").empty() && errno == ENOSYS)
+		GTEST_SKIP() << "built without zlib";
+
+	EXPECT_TRUE(server.start("127.0.0.1", 8824) == 0) << "http server start failed";
+	for (const char *coding : { "gzip", "deflate", "gzip;q=0.5, deflate" })
+	{
+		WFFacilities::WaitGroup wait_group(1);
+		auto *task = WFTaskFactory::create_http_task("http://127.0.0.1:8824/", 0, 0, [&](WFHttpTask *task) {
+			auto *resp = task->get_resp();
+			protocol::HttpHeaderCursor cursor(resp);
+			std::string value;
+			const void *buf;
+			size_t size;
+
+			EXPECT_EQ(task->get_state(), WFT_STATE_SUCCESS);
+			EXPECT_TRUE(cursor.find("Content-Encoding", value));
+			EXPECT_EQ(value, strchr(coding, ';') ? "deflate" : coding);
+			EXPECT_TRUE(resp->get_parsed_body(&buf, &size));
+			EXPECT_TRUE(std::string((const char *)buf, size) == body);
+			wait_group.done();
+		});
+
+		task->get_req()->set_decompress_response(true);
+		task->get_req()->add_header_pair("Accept-Encoding", coding);
+		task->start();
+		wait_group.wait();
+	}
+
+	server.stop();
+}
+
+/* Answer one request with 'response', and close. */
+static void __raw_http_server(int listen_fd, const std::string& response)
+{
+	std::string request;
+	char buf[1024];
+	ssize_t n;
+	int fd = accept(listen_fd, NULL, NULL);
+
+	ASSERT_GE(fd, 0);
+	while (request.find("\r\n\r\n") == std::string::npos &&
+		   (n = read(fd, buf, sizeof buf)) > 0)
+	{
+		request.append(buf, n);
+	}
+
+	EXPECT_EQ(write(fd, response.data(), response.size()), (ssize_t)response.size());
+	close(fd);
+}
+
+static void __test_coded_body(const char *coding, const std::string& data,
+							  bool chunked, int state, int error)
+{
+	struct sockaddr_in addr = { };
+	socklen_t len = sizeof addr;
+	int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	std::string body = __coding_body();
+	std::string response = "HTTP/1.1 200 OK\r\nContent-Encoding: ";
+	char size[32];
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	ASSERT_EQ(bind(listen_fd, (struct sockaddr *)&addr, len), 0);
+	ASSERT_EQ(listen(listen_fd, 1), 0);
+	ASSERT_EQ(getsockname(listen_fd, (struct sockaddr *)&addr, &len), 0);
+
+	response += coding;
+	if (chunked)
+	{
+		response += "\r\nTransfer-Encoding: chunked\r\n\r\n";
+		for (size_t pos = 0; pos < data.size(); pos += 1000)
+		{
+			std::string chunk = data.substr(pos, 1000);
+
+			snprintf(size, sizeof size, "%zx\r\n", chunk.size());
+			response += size + chunk + "\r\n";
+		}
+
+		response += "0\r\n\r\n";
+	}
+	else
+		response += "\r\nContent-Length: " + std::to_string(data.size()) + "\r\n\r\n" + data;
+
+	std::thread server(__raw_http_server, listen_fd, response);
+	std::string url = "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/";
+	WFFacilities::WaitGroup wait_group(1);
+	auto *task = WFTaskFactory::create_http_task(url, 0, 0, [&](WFHttpTask *task) {
+		const void *buf;
+		size_t size;
+
+		EXPECT_EQ(task->get_state(), state);
+		EXPECT_EQ(task->get_error(), error);
+		if (state == WFT_STATE_SUCCESS)
+		{
+			EXPECT_TRUE(task->get_resp()->get_parsed_body(&buf, &size));
+			EXPECT_TRUE(std::string((const char *)buf, size) == body);
+		}
+
+		wait_group.done();
+	});
+
+	task->get_req()->set_decompress_response(true);
+	task->start();
+	wait_group.wait();
+	server.join();
+	close(listen_fd);
+}
+
+/* Coded bodies from a server, framed by Content-Length or chunked. Raw
+ * deflate data sent as "deflate" is decoded too. A stream cut short, or
+ * with bytes changed in the middle, fails the task with EBADMSG. */
+TEST(http_unittest, ContentCodingStreams)
+{
+	std::string body = __coding_body();
+	std::string gzip = __encode(HTTP_ENCODING_GZIP, body);
+	std::string deflate = __encode(HTTP_ENCODING_DEFLATE, body);
+	std::string corrupt;
+
+	if (gzip.empty() && errno == ENOSYS)
+		GTEST_SKIP() << "built without zlib";
+
+	ASSERT_FALSE(gzip.empty());
+	ASSERT_FALSE(deflate.empty());
+	for (bool chunked : { false, true })
+	{
+		__test_coded_body("gzip", gzip, chunked, WFT_STATE_SUCCESS, 0);
+		__test_coded_body("deflate", deflate, chunked, WFT_STATE_SUCCESS, 0);
+		__test_coded_body("deflate", deflate.substr(2, deflate.size() - 6),
+						  chunked, WFT_STATE_SUCCESS, 0);
+
+		__test_coded_body("gzip", gzip.substr(0, gzip.size() / 2), chunked,
+						  WFT_STATE_SYS_ERROR, EBADMSG);
+		__test_coded_body("gzip", gzip.substr(0, gzip.size() - 4), chunked,
+						  WFT_STATE_SYS_ERROR, EBADMSG);
+		__test_coded_body("deflate", deflate.substr(0, deflate.size() / 2),
+						  chunked, WFT_STATE_SYS_ERROR, EBADMSG);
+
+		corrupt = gzip;
+		for (size_t i = corrupt.size() / 2; i < corrupt.size() / 2 + 16; i++)
+			corrupt[i] ^= 0x55;
+		__test_coded_body("gzip", corrupt, chunked, WFT_STATE_SYS_ERROR, EBADMSG);
+
+		corrupt = deflate;
+		corrupt[corrupt.size() - 1] ^= 0x55;
+		__test_coded_body("deflate", corrupt, chunked, WFT_STATE_SYS_ERROR, EBADMSG);
+	}
+}
+
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L
 
 #include <openssl/ssl.h>
@@ -0,0 +1,300 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <errno.h>
+#include <stddef.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include "workflow/msgqueue.h"
+
+#define PRODUCERS_NUM	8
+#define CONSUMERS_NUM	4
+#define MESSAGES_NUM	20000
+#define QUEUE_MAXLEN	16
+
+typedef msgqueue_t *(*create_func_t)(size_t, int);
+
+struct queue_message
+{
+	int producer;
+	int seq;
+	void *link;
+};
+
+static std::vector<queue_message> __make_messages(int producer)
+{
+	std::vector<queue_message> msgs(MESSAGES_NUM);
+
+	for (int i = 0; i < MESSAGES_NUM; i++)
+	{
+		msgs[i].producer = producer;
+		msgs[i].seq = i;
+	}
+
+	return msgs;
+}
+
+/* One consumer sees the messages of every producer in the order put. */
+static void __test_producers(create_func_t create)
+{
+	msgqueue_t *queue = create(QUEUE_MAXLEN, offsetof(queue_message, link));
+	std::vector<std::vector<queue_message>> msgs;
+	std::vector<std::thread> threads;
+	int next[PRODUCERS_NUM] = { };
+	queue_message *msg;
+	int i;
+
+	ASSERT_TRUE(queue != NULL);
+	for (i = 0; i < PRODUCERS_NUM; i++)
+		msgs.push_back(__make_messages(i));
+
+	for (i = 0; i < PRODUCERS_NUM; i++)
+	{
+		threads.emplace_back([queue, &msgs, i]() {
+			for (queue_message& msg : msgs[i])
+				msgqueue_put(&msg, queue);
+		});
+	}
+
+	for (i = 0; i < PRODUCERS_NUM * MESSAGES_NUM; i++)
+	{
+		msg = (queue_message *)msgqueue_get(queue);
+		ASSERT_TRUE(msg != NULL);
+		EXPECT_EQ(msg->seq, next[msg->producer]);
+		next[msg->producer] = msg->seq + 1;
+	}
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	for (i = 0; i < PRODUCERS_NUM; i++)
+		EXPECT_EQ(next[i], MESSAGES_NUM);
+
+	msgqueue_destroy(queue);
+}
+
+/* With many consumers, every message is taken exactly once. Consumers are
+ * woken up by nonblock mode when all are taken. */
+static void __test_consumers(create_func_t create)
+{
+	msgqueue_t *queue = create(QUEUE_MAXLEN, offsetof(queue_message, link));
+	std::vector<std::vector<queue_message>> msgs;
+	std::vector<std::thread> threads;
+	std::vector<std::atomic<int>> taken(PRODUCERS_NUM * MESSAGES_NUM);
+	std::atomic<int> total(0);
+	int i;
+
+	ASSERT_TRUE(queue != NULL);
+	for (i = 0; i < PRODUCERS_NUM; i++)
+		msgs.push_back(__make_messages(i));
+
+	for (std::atomic<int>& n : taken)
+		n = 0;
+
+	for (i = 0; i < CONSUMERS_NUM; i++)
+	{
+		threads.emplace_back([queue, &taken, &total]() {
+			queue_message *msg;
+
+			while ((msg = (queue_message *)msgqueue_get(queue)) != NULL)
+			{
+				taken[msg->producer * MESSAGES_NUM + msg->seq]++;
+				total++;
+			}
+
+			EXPECT_EQ(errno, ENOENT);
+		});
+	}
+
+	for (i = 0; i < PRODUCERS_NUM; i++)
+	{
+		threads.emplace_back([queue, &msgs, i]() {
+			for (queue_message& msg : msgs[i])
+				msgqueue_put(&msg, queue);
+		});
+	}
+
+	for (i = CONSUMERS_NUM; i < CONSUMERS_NUM + PRODUCERS_NUM; i++)
+		threads[i].join();
+
+	while (total < PRODUCERS_NUM * MESSAGES_NUM)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	msgqueue_set_nonblock(queue);
+	for (i = 0; i < CONSUMERS_NUM; i++)
+		threads[i].join();
+
+	for (std::atomic<int>& n : taken)
+		EXPECT_EQ(n, 1);
+
+	msgqueue_destroy(queue);
+}
+
+/* A producer blocks once 'maxlen' messages are pending, and goes on as
+ * they are taken. */
+static void __test_bound(create_func_t create)
+{
+	msgqueue_t *queue = create(QUEUE_MAXLEN, offsetof(queue_message, link));
+	std::vector<queue_message> msgs = __make_messages(0);
+	std::atomic<int> put(0);
+	queue_message *msg;
+	int i;
+
+	ASSERT_TRUE(queue != NULL);
+	std::thread producer([queue, &msgs, &put]() {
+		for (int i = 0; i < 4 * QUEUE_MAXLEN; i++)
+		{
+			msgqueue_put(&msgs[i], queue);
+			put++;
+		}
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	EXPECT_EQ(put, QUEUE_MAXLEN);
+
+	for (i = 0; i < 4 * QUEUE_MAXLEN; i++)
+	{
+		msg = (queue_message *)msgqueue_get(queue);
+		ASSERT_TRUE(msg != NULL);
+		EXPECT_EQ(msg->seq, i);
+	}
+
+	producer.join();
+	EXPECT_EQ(put, 4 * QUEUE_MAXLEN);
+	msgqueue_destroy(queue);
+}
+
+/* Nonblock mode wakes up a consumer waiting on an empty queue, and a
+ * producer waiting on a full one. */
+static void __test_nonblock(create_func_t create)
+{
+	msgqueue_t *queue = create(QUEUE_MAXLEN, offsetof(queue_message, link));
+	std::vector<queue_message> msgs = __make_messages(0);
+	std::atomic<int> put(0);
+	int error = 0;
+	void *msg;
+	int i;
+
+	ASSERT_TRUE(queue != NULL);
+	std::thread consumer([queue, &msg, &error]() {
+		msg = msgqueue_get(queue);
+		error = errno;
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	msgqueue_set_nonblock(queue);
+	consumer.join();
+	EXPECT_TRUE(msg == NULL);
+	EXPECT_EQ(error, ENOENT);
+
+	msgqueue_set_block(queue);
+	std::thread producer([queue, &msgs, &put]() {
+		for (int i = 0; i < 2 * QUEUE_MAXLEN; i++)
+		{
+			msgqueue_put(&msgs[i], queue);
+			put++;
+		}
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	EXPECT_EQ(put, QUEUE_MAXLEN);
+	msgqueue_set_nonblock(queue);
+	producer.join();
+	EXPECT_EQ(put, 2 * QUEUE_MAXLEN);
+
+	for (i = 0; i < 2 * QUEUE_MAXLEN; i++)
+		EXPECT_EQ(msgqueue_get(queue), &msgs[i]);
+
+	EXPECT_TRUE(msgqueue_get(queue) == NULL);
+	msgqueue_destroy(queue);
+}
+
+/* msgqueue_try_get() never waits, even with another consumer waiting. */
+static void __test_try_get(create_func_t create)
+{
+	msgqueue_t *queue = create(QUEUE_MAXLEN, offsetof(queue_message, link));
+	std::vector<queue_message> msgs = __make_messages(0);
+	void *msg;
+
+	ASSERT_TRUE(queue != NULL);
+	EXPECT_TRUE(msgqueue_try_get(queue) == NULL);
+	msgqueue_put(&msgs[0], queue);
+	EXPECT_EQ(msgqueue_try_get(queue), &msgs[0]);
+
+	std::thread consumer([queue, &msg]() {
+		msg = msgqueue_get(queue);
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	EXPECT_TRUE(msgqueue_try_get(queue) == NULL);
+	msgqueue_put(&msgs[1], queue);
+	consumer.join();
+	EXPECT_EQ(msg, &msgs[1]);
+	msgqueue_destroy(queue);
+}
+
+TEST(msgqueue_unittest, Producers)
+{
+	__test_producers(msgqueue_create);
+}
+
+TEST(msgqueue_unittest, LockfreeProducers)
+{
+	__test_producers(msgqueue_create_lockfree);
+}
+
+TEST(msgqueue_unittest, Consumers)
+{
+	__test_consumers(msgqueue_create);
+}
+
+TEST(msgqueue_unittest, LockfreeConsumers)
+{
+	__test_consumers(msgqueue_create_lockfree);
+}
+
+TEST(msgqueue_unittest, Bound)
+{
+	__test_bound(msgqueue_create);
+}
+
+TEST(msgqueue_unittest, LockfreeBound)
+{
+	__test_bound(msgqueue_create_lockfree);
+}
+
+TEST(msgqueue_unittest, Nonblock)
+{
+	__test_nonblock(msgqueue_create);
+}
+
+TEST(msgqueue_unittest, LockfreeNonblock)
+{
+	__test_nonblock(msgqueue_create_lockfree);
+}
+
+TEST(msgqueue_unittest, TryGet)
+{
+	__test_try_get(msgqueue_create);
+}
+
+TEST(msgqueue_unittest, LockfreeTryGet)
+{
+	__test_try_get(msgqueue_create_lockfree);
+}
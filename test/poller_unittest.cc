@@ -0,0 +1,335 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <gtest/gtest.h>
+#include "workflow/poller.h"
+#include "workflow/WFGlobal.h"
+#include "workflow/WFTaskFactory.h"
+#include "workflow/WFFacilities.h"
+#include "workflow/WFHttpServer.h"
+
+/* More than the submission queue of the io_uring backend. */
+#define PIPES_NUM	300
+
+/* Under the connections to one host, with SQEs of both ends more than
+ * the submission queue. */
+#define TASKS_NUM	150
+
+struct poller_counter
+{
+	std::mutex mutex;
+	std::condition_variable cond;
+	int read;
+	int deleted;
+};
+
+static int __append(const void *buf, size_t *size, poller_message_t *msg)
+{
+	return 1;
+}
+
+static poller_message_t *__create_message(void *context)
+{
+	poller_message_t *msg = (poller_message_t *)malloc(sizeof *msg);
+
+	if (msg)
+	{
+		msg->append = __append;
+		msg->get_buffer = NULL;
+	}
+
+	return msg;
+}
+
+static void __callback(struct poller_result *res, void *context)
+{
+	poller_counter *counter = (poller_counter *)context;
+
+	std::lock_guard<std::mutex> lock(counter->mutex);
+	if (res->state == PR_ST_SUCCESS)
+	{
+		free(res->data.message);
+		counter->read++;
+	}
+	else if (res->state == PR_ST_DELETED)
+		counter->deleted++;
+
+	counter->cond.notify_one();
+	poller_free_result(res);
+}
+
+/* The fds are added by a thread that exits before any of them is ready.
+ * No poll may be lost with it, even when the ring is full. */
+static void __test_pipes(int backend)
+{
+	struct poller_params params = { };
+	poller_counter counter;
+	int fds[PIPES_NUM][2];
+	poller_t *poller;
+	bool done;
+	int i;
+
+	counter.read = 0;
+	counter.deleted = 0;
+	params.max_open_files = 65536;
+	params.create_message = __create_message;
+	params.callback = __callback;
+	params.context = &counter;
+	params.backend = backend;
+	poller = poller_create(&params);
+	ASSERT_TRUE(poller != NULL);
+	ASSERT_EQ(poller_start(poller), 0);
+
+	for (i = 0; i < PIPES_NUM; i++)
+	{
+		ASSERT_EQ(pipe(fds[i]), 0);
+		fcntl(fds[i][0], F_SETFL, O_NONBLOCK);
+	}
+
+	std::thread([poller, &fds]() {
+		struct poller_data data = { };
+
+		data.operation = PD_OP_READ;
+		for (int i = 0; i < PIPES_NUM; i++)
+		{
+			data.fd = fds[i][0];
+			EXPECT_EQ(poller_add(&data, -1, poller), 0);
+		}
+	}).join();
+
+	for (i = 0; i < PIPES_NUM; i++)
+		EXPECT_EQ(write(fds[i][1], "x", 1), 1);
+
+	{
+		std::unique_lock<std::mutex> lock(counter.mutex);
+		done = counter.cond.wait_for(lock, std::chrono::seconds(5), [&counter]() {
+			return counter.read == PIPES_NUM;
+		});
+		EXPECT_TRUE(done) << counter.read << " of " << PIPES_NUM << " read";
+	}
+
+	for (i = 0; i < PIPES_NUM; i++)
+		EXPECT_EQ(poller_del(fds[i][0], poller), 0);
+
+	{
+		std::unique_lock<std::mutex> lock(counter.mutex);
+		done = counter.cond.wait_for(lock, std::chrono::seconds(5), [&counter]() {
+			return counter.deleted == PIPES_NUM;
+		});
+		EXPECT_TRUE(done);
+	}
+
+	poller_stop(poller);
+	poller_destroy(poller);
+	for (i = 0; i < PIPES_NUM; i++)
+	{
+		close(fds[i][0]);
+		close(fds[i][1]);
+	}
+}
+
+TEST(poller_unittest, EpollPipes)
+{
+	__test_pipes(POLLER_BACKEND_DEFAULT);
+}
+
+TEST(poller_unittest, UringPipes)
+{
+	__test_pipes(POLLER_BACKEND_IO_URING);
+}
+
+struct wheel_record
+{
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::vector<int> fired;
+	std::vector<long long> fired_at;
+	int deleted;
+};
+
+static long long __monotonic_msec()
+{
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+static void __wheel_callback(struct poller_result *res, void *context)
+{
+	wheel_record *record = (wheel_record *)context;
+
+	std::lock_guard<std::mutex> lock(record->mutex);
+	if (res->state == PR_ST_ERROR && res->error == ETIMEDOUT)
+	{
+		record->fired.push_back((int)(intptr_t)res->data.context);
+		record->fired_at.push_back(__monotonic_msec());
+	}
+	else if (res->state == PR_ST_DELETED)
+		record->deleted++;
+
+	record->cond.notify_one();
+	poller_free_result(res);
+}
+
+/* Over 64 and 4096 ticks, the timeouts are cascaded from the upper levels
+ * of the wheel. */
+static const int __wheel_timeouts[] = {
+	5, 30, 62, 64, 66, 126, 128, 130, 250, 700, 1500, 4200
+};
+
+TEST(poller_unittest, TimerWheel)
+{
+	const int n = sizeof __wheel_timeouts / sizeof (int);
+	struct poller_params params = { };
+	struct poller_data data = { };
+	std::vector<int> expected;
+	wheel_record record;
+	int fds[n + 3][2];
+	long long start;
+	poller_t *poller;
+	bool done;
+	int i;
+
+	record.deleted = 0;
+	params.max_open_files = 65536;
+	params.create_message = __create_message;
+	params.callback = __wheel_callback;
+	params.context = &record;
+	params.timer_wheel = 1;
+	poller = poller_create(&params);
+	ASSERT_TRUE(poller != NULL);
+	ASSERT_EQ(poller_start(poller), 0);
+
+	for (i = 0; i < n + 3; i++)
+	{
+		ASSERT_EQ(pipe(fds[i]), 0);
+		fcntl(fds[i][0], F_SETFL, O_NONBLOCK);
+	}
+
+	start = __monotonic_msec();
+	data.operation = PD_OP_READ;
+	for (i = 0; i < n + 3; i++)
+	{
+		data.fd = fds[i][0];
+		data.context = (void *)(intptr_t)i;
+		EXPECT_EQ(poller_add(&data, i < n ? __wheel_timeouts[i] : 40, poller), 0);
+	}
+
+	/* One deleted, one with its timeout cancelled, and one put later. */
+	EXPECT_EQ(poller_del(fds[n][0], poller), 0);
+	EXPECT_EQ(poller_set_timeout(fds[n + 1][0], -1, poller), 0);
+	EXPECT_EQ(poller_set_timeout(fds[n + 2][0], 900, poller), 0);
+
+	for (i = 0; i < n; i++)
+	{
+		if (__wheel_timeouts[i] > 900 && expected.size() == (size_t)i)
+			expected.push_back(n + 2);
+
+		expected.push_back(i);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(record.mutex);
+		done = record.cond.wait_for(lock, std::chrono::seconds(10), [&]() {
+			return record.fired.size() == (size_t)n + 1;
+		});
+		EXPECT_TRUE(done) << record.fired.size() << " of " << n + 1 << " fired";
+	}
+
+	EXPECT_EQ(record.fired, expected);
+	for (i = 0; i < (int)record.fired.size(); i++)
+	{
+		int timeout = record.fired[i] < n ? __wheel_timeouts[record.fired[i]] : 900;
+
+		EXPECT_GE(record.fired_at[i] - start, timeout);
+		EXPECT_LT(record.fired_at[i] - start, timeout + 100);
+	}
+
+	EXPECT_EQ(poller_del(fds[n + 1][0], poller), 0);
+	{
+		std::unique_lock<std::mutex> lock(record.mutex);
+		done = record.cond.wait_for(lock, std::chrono::seconds(5), [&]() {
+			return record.deleted == 2;
+		});
+		EXPECT_TRUE(done);
+	}
+
+	EXPECT_EQ(record.fired.size(), (size_t)n + 1);
+	poller_stop(poller);
+	poller_destroy(poller);
+	for (i = 0; i < n + 3; i++)
+	{
+		close(fds[i][0]);
+		close(fds[i][1]);
+	}
+}
+
+/* The communicator on io_uring. Before any other use of the library in
+ * this process. */
+TEST(poller_unittest, UringHttp)
+{
+	struct WFGlobalSettings settings = GLOBAL_SETTINGS_DEFAULT;
+	WFFacilities::WaitGroup wait_group(TASKS_NUM);
+	int success = 0;
+	std::mutex mutex;
+	int i;
+
+	settings.poller_backend = POLLER_BACKEND_IO_URING;
+	WORKFLOW_library_init(&settings);
+
+	WFHttpServer server([](WFHttpTask *task) {
+		task->get_resp()->append_output_body("ok");
+	});
+
+	ASSERT_EQ(server.start("127.0.0.1", 8819), 0) << "http server start failed";
+
+	std::thread([&]() {
+		for (i = 0; i < TASKS_NUM; i++)
+		{
+			auto *task = WFTaskFactory::create_http_task("http://127.0.0.1:8819/",
+														 0, 0, [&](WFHttpTask *task) {
+				const void *body;
+				size_t size;
+
+				if (task->get_state() == WFT_STATE_SUCCESS &&
+					task->get_resp()->get_parsed_body(&body, &size) &&
+					std::string((const char *)body, size) == "ok")
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					success++;
+				}
+
+				wait_group.done();
+			});
+
+			task->start();
+		}
+	}).join();
+
+	wait_group.wait();
+	EXPECT_EQ(success, TASKS_NUM);
+	server.stop();
+}
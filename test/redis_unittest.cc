@@ -16,7 +16,16 @@
   Author: Wu Jiaxu (wujiaxu@sogou-inc.com)
 */
 
+#include <sys/socket.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
@@ -24,7 +33,11 @@
 #include <string>
 #include <gtest/gtest.h>
 #include "workflow/WFTaskFactory.h"
+#include "workflow/WFFacilities.h"
 #include "workflow/WFRedisServer.h"
+#include "workflow/WFRedisPipeline.h"
+#include "workflow/WFRedisCluster.h"
+#include "workflow/WFSingleFlight.h"
 #include "workflow/WFOperator.h"
 
 #define RETRY_MAX  3
@@ -167,3 +180,422 @@ TEST(redis_unittest, WFRedisTask2)
 	lock.unlock();
 }
 
+
+/* Take the command at 'pos' of 'buf', or return false if it is not all
+ * there: *<argc>\r\n, then $<len>\r\n<arg>\r\n for each argument. */
+static void __flight_process(WFRedisTask *task, std::atomic<int> *gets)
+{
+	std::string cmd;
+
+	task->get_req()->get_command(cmd);
+	if (strcasecmp(cmd.c_str(), "GET") == 0)
+	{
+		(*gets)++;
+		series_of(task)->push_back(WFTaskFactory::create_timer_task(200000, nullptr));
+	}
+
+	__redis_process(task);
+}
+
+/* The leader sends AUTH and SELECT before GET, and the others share its result. */
+TEST(redis_unittest, SingleFlight)
+{
+	std::atomic<int> gets(0);
+	WFRedisServer server(std::bind(__flight_process, std::placeholders::_1, &gets));
+	WFSingleFlight flight;
+	WFFacilities::WaitGroup wait_group(5);
+	EXPECT_TRUE(server.start("127.0.0.1", 6678) == 0) << "server start failed";
+
+	for (int i = 0; i < 5; i++)
+	{
+		auto *task = flight.create_redis_task("testkey", "redis://:testpass@127.0.0.1:6678/6",
+											  RETRY_MAX, [&wait_group](WFRedisTask *task) {
+			protocol::RedisValue val;
+
+			EXPECT_EQ(task->get_state(), WFT_STATE_SUCCESS);
+			task->get_resp()->get_result(val);
+			EXPECT_TRUE(val.is_string());
+			EXPECT_EQ(val.string_value(), "testvalue");
+			wait_group.done();
+		});
+
+		task->get_req()->set_request("GET", {"testkey"});
+		task->start();
+	}
+
+	wait_group.wait();
+	EXPECT_EQ(gets, 1);
+
+	struct WFSingleFlightStats stats = flight.get_stats();
+	EXPECT_EQ(stats.flights, 1);
+	EXPECT_EQ(stats.shared, 4);
+	server.stop();
+}
+
+static bool __next_command(const std::string& buf, size_t& pos,
+						   std::vector<std::string>& args)
+{
+	size_t p = pos;
+	size_t end = buf.find("\r\n", p);
+	size_t len;
+	int argc;
+
+	if (end == std::string::npos)
+		return false;
+
+	EXPECT_EQ(buf[p], '*');
+	argc = atoi(buf.c_str() + p + 1);
+	p = end + 2;
+	args.clear();
+	while (argc-- > 0)
+	{
+		end = buf.find("\r\n", p);
+		if (end == std::string::npos)
+			return false;
+
+		EXPECT_EQ(buf[p], '$');
+		len = atoi(buf.c_str() + p + 1);
+		if (buf.size() < end + 2 + len + 2)
+			return false;
+
+		args.emplace_back(buf, end + 2, len);
+		p = end + 2 + len + 2;
+	}
+
+	pos = p;
+	return true;
+}
+
+/* A stand-in server on one connection that replies to commands sent back
+ * to back, which WFRedisServer does not read while a reply is pending. */
+static void __batch_server(int listen_fd, int commands, std::string *input)
+{
+	std::vector<std::string> args;
+	std::string buf;
+	std::string out;
+	size_t pos = 0;
+	char tmp[4096];
+	ssize_t n;
+	int fd = accept(listen_fd, NULL, NULL);
+
+	ASSERT_GE(fd, 0);
+	while (commands > 0 && (n = read(fd, tmp, sizeof tmp)) > 0)
+	{
+		buf.append(tmp, n);
+		out.clear();
+		while (commands > 0 && __next_command(buf, pos, args))
+		{
+			if (strcasecmp(args[0].c_str(), "GET") == 0)
+				out += "$9\r\ntestvalue\r\n";
+			else
+				out += "+OK\r\n";
+
+			commands--;
+		}
+
+		EXPECT_EQ(write(fd, out.c_str(), out.size()), (ssize_t)out.size());
+	}
+
+	if (input)
+		*input = buf;
+
+	close(fd);
+}
+
+static int __listen(struct sockaddr_in *addr)
+{
+	socklen_t len = sizeof (struct sockaddr_in);
+	int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(addr, 0, len);
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = inet_addr("127.0.0.1");
+	EXPECT_EQ(bind(listen_fd, (struct sockaddr *)addr, len), 0);
+	EXPECT_EQ(listen(listen_fd, 1), 0);
+	EXPECT_EQ(getsockname(listen_fd, (struct sockaddr *)addr, &len), 0);
+	return listen_fd;
+}
+
+static void check_batch_result(const protocol::RedisValue& val)
+{
+	ASSERT_TRUE(val.is_array());
+	ASSERT_EQ(val.arr_size(), 3);
+	EXPECT_TRUE(val[0].is_ok());
+	EXPECT_TRUE(val[1].is_string());
+	EXPECT_TRUE(val[1].string_value() == "testvalue");
+	EXPECT_TRUE(val[2].is_ok());
+}
+
+TEST(redis_unittest, BatchRequest)
+{
+	WFFacilities::WaitGroup wait_group(1);
+	struct sockaddr_in addr;
+	int listen_fd = __listen(&addr);
+	std::string input;
+	std::thread server(__batch_server, listen_fd, 3, &input);
+	std::string url = "redis://127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+
+	auto *task = WFTaskFactory::create_redis_task(url, RETRY_MAX, [&](WFRedisTask *task) {
+		protocol::RedisValue val;
+
+		EXPECT_EQ(task->get_state(), WFT_STATE_SUCCESS);
+		task->get_resp()->get_result(val);
+		check_batch_result(val);
+		wait_group.done();
+	});
+
+	auto *req = task->get_req();
+	std::vector<std::string> params;
+	std::string cmd;
+
+	req->set_request("SET", {"testkey", "testvalue"});
+	req->add_request("GET", {"testkey"});
+	req->add_request("DEL", {"testkey"});
+	EXPECT_EQ(req->get_command_count(), 3);
+	EXPECT_TRUE(req->get_command(1, cmd) && cmd == "GET");
+	EXPECT_TRUE(req->get_params(0, params) && params.size() == 2);
+	EXPECT_FALSE(req->get_command(3, cmd));
+
+	task->start();
+	wait_group.wait();
+	server.join();
+	close(listen_fd);
+
+	EXPECT_EQ(input, "*3\r\n$3\r\nSET\r\n$7\r\ntestkey\r\n$9\r\ntestvalue\r\n"
+					 "*2\r\n$3\r\nGET\r\n$7\r\ntestkey\r\n"
+					 "*2\r\n$3\r\nDEL\r\n$7\r\ntestkey\r\n");
+}
+
+TEST(redis_unittest, Pipeline)
+{
+	WFFacilities::WaitGroup wait_group(1);
+	struct sockaddr_in addr;
+	int listen_fd = __listen(&addr);
+	/* AUTH, SELECT, then 10 GET, 10 SET and 10 SET, GET, DEL. */
+	std::thread server(__batch_server, listen_fd, 2 + 10 + 10 + 30, nullptr);
+	WFRedisPipeline pipeline(1);
+
+	EXPECT_EQ(pipeline.init("redis://:testpass@127.0.0.1:" +
+							std::to_string(ntohs(addr.sin_port)) + "/6"), 0);
+	ParallelWork *pwork = Workflow::create_parallel_work([&](const ParallelWork *) {
+		wait_group.done();
+	});
+
+	for (int i = 0; i < 30; i++)
+	{
+		auto *task = pipeline.create_redis_task([i](WFRedisTask *task) {
+			protocol::RedisValue val;
+
+			EXPECT_EQ(task->get_state(), WFT_STATE_SUCCESS);
+			task->get_resp()->get_result(val);
+			if (i % 3 == 1)
+			{
+				EXPECT_TRUE(val.is_string());
+				EXPECT_TRUE(val.string_value() == "testvalue");
+			}
+			else if (i % 3 == 2)
+				check_batch_result(val);
+			else
+				EXPECT_TRUE(val.is_ok());
+		});
+
+		auto *req = task->get_req();
+		if (i % 3 == 1)
+			req->set_request("GET", {"testkey"});
+		else
+		{
+			req->set_request("SET", {"testkey", "testvalue"});
+			if (i % 3 == 2)
+			{
+				req->add_request("GET", {"testkey"});
+				req->add_request("DEL", {"testkey"});
+			}
+		}
+
+		pwork->add_series(Workflow::create_series_work(task, nullptr));
+	}
+
+	/* A member without a command is refused. */
+	auto *task = pipeline.create_redis_task([](WFRedisTask *task) {
+		EXPECT_EQ(task->get_state(), WFT_STATE_SYS_ERROR);
+		EXPECT_EQ(task->get_error(), EINVAL);
+	});
+	pwork->add_series(Workflow::create_series_work(task, nullptr));
+
+	pwork->start();
+	wait_group.wait();
+	server.join();
+	close(listen_fd);
+}
+
+TEST(redis_unittest, ClusterSlot)
+{
+	protocol::RedisRequest req;
+
+	EXPECT_EQ(WFRedisCluster::get_slot("123456789"), 0x31c3);
+	EXPECT_EQ(WFRedisCluster::get_slot("foo"), 12182);
+	EXPECT_EQ(WFRedisCluster::get_slot("hello"), 866);
+	EXPECT_EQ(WFRedisCluster::get_slot("{user1000}.following"),
+			  WFRedisCluster::get_slot("user1000"));
+	EXPECT_EQ(WFRedisCluster::get_slot("{user1000}.followers"),
+			  WFRedisCluster::get_slot("user1000"));
+	/* An empty tag hashes the whole key, and only the first tag counts. */
+	EXPECT_EQ(WFRedisCluster::get_slot("foo{}{bar}"), 0xe0ab & 16383);
+	EXPECT_EQ(WFRedisCluster::get_slot("foo{{bar}}zap"),
+			  WFRedisCluster::get_slot("{bar"));
+
+	req.set_request("GET", {"foo"});
+	EXPECT_EQ(WFRedisCluster::get_slot(&req), 12182);
+	req.set_request("EVAL", {"return 1", "1", "hello", "foo"});
+	EXPECT_EQ(WFRedisCluster::get_slot(&req), 866);
+	req.set_request("EVAL", {"return 1", "0"});
+	EXPECT_EQ(WFRedisCluster::get_slot(&req), -1);
+	req.set_request("PING", {});
+	EXPECT_EQ(WFRedisCluster::get_slot(&req), -1);
+}
+
+struct __cluster_conn
+{
+	int fd;
+	int node;
+	bool asking;
+	size_t pos;
+	std::string buf;
+};
+
+/* A stand-in cluster of two nodes. Node 0 has all the slots, but moves
+ * "foo" to node 1 and sends "ask" to node 1 with ASK. */
+static void __cluster_server(const int listen_fds[2], const int ports[2],
+							 const std::atomic<bool> *stop,
+							 std::vector<std::string> *log)
+{
+	std::vector<__cluster_conn> conns;
+	std::vector<struct pollfd> pfds;
+	std::vector<std::string> args;
+	std::string out;
+	char tmp[4096];
+	ssize_t n;
+	size_t i;
+
+	while (!*stop)
+	{
+		pfds.clear();
+		for (i = 0; i < 2; i++)
+			pfds.push_back({listen_fds[i], POLLIN, 0});
+		for (const auto& conn : conns)
+			pfds.push_back({conn.fd, POLLIN, 0});
+
+		if (poll(pfds.data(), pfds.size(), 10) <= 0)
+			continue;
+
+		for (i = 0; i < 2; i++)
+		{
+			if (pfds[i].revents & POLLIN)
+				conns.push_back({accept(listen_fds[i], NULL, NULL), (int)i, false, 0, ""});
+		}
+
+		for (i = 2; i < pfds.size(); i++)
+		{
+			__cluster_conn& conn = conns[i - 2];
+
+			if (!(pfds[i].revents & (POLLIN | POLLHUP)))
+				continue;
+
+			n = read(conn.fd, tmp, sizeof tmp);
+			if (n <= 0)
+			{
+				close(conn.fd);
+				conn.fd = -1;
+				continue;
+			}
+
+			conn.buf.append(tmp, n);
+			out.clear();
+			while (__next_command(conn.buf, conn.pos, args))
+			{
+				std::string key = args.size() > 1 ? args[1] : "";
+				std::string other = "127.0.0.1:" + std::to_string(ports[!conn.node]);
+
+				log->push_back(std::to_string(conn.node) + " " + args[0] + " " + key);
+				if (strcasecmp(args[0].c_str(), "CLUSTER") == 0)
+				{
+					out += "*1\r\n*3\r\n:0\r\n:16383\r\n*2\r\n$0\r\n\r\n:" +
+						   std::to_string(ports[0]) + "\r\n";
+				}
+				else if (strcasecmp(args[0].c_str(), "ASKING") == 0)
+				{
+					conn.asking = true;
+					out += "+OK\r\n";
+				}
+				else if (conn.node == 0 && key == "foo")
+					out += "-MOVED 12182 " + other + "\r\n";
+				else if (conn.node == 0 && key == "ask")
+					out += "-ASK 11420 " + other + "\r\n";
+				else if (conn.node == 1 && key == "ask" && !conn.asking)
+					out += "-MOVED 11420 " + other + "\r\n";
+				else
+					out += "$" + std::to_string(key.size()) + "\r\n" + key + "\r\n";
+
+				if (strcasecmp(args[0].c_str(), "ASKING") != 0)
+					conn.asking = false;
+			}
+
+			EXPECT_EQ(write(conn.fd, out.c_str(), out.size()), (ssize_t)out.size());
+		}
+
+		for (i = conns.size(); i > 0; i--)
+		{
+			if (conns[i - 1].fd < 0)
+				conns.erase(conns.begin() + i - 1);
+		}
+	}
+
+	for (const auto& conn : conns)
+		close(conn.fd);
+}
+
+TEST(redis_unittest, ClusterRedirect)
+{
+	WFFacilities::WaitGroup wait_group(1);
+	struct sockaddr_in addr[2];
+	int listen_fds[2] = { __listen(&addr[0]), __listen(&addr[1]) };
+	int ports[2] = { ntohs(addr[0].sin_port), ntohs(addr[1].sin_port) };
+	std::atomic<bool> stop(false);
+	std::vector<std::string> log;
+	std::thread server(__cluster_server, listen_fds, ports, &stop, &log);
+	WFRedisCluster cluster;
+
+	EXPECT_EQ(cluster.init("redis://127.0.0.1:" + std::to_string(ports[0])), 0);
+	SeriesWork *series = Workflow::create_series_work(WFTaskFactory::create_empty_task(),
+		[&](const SeriesWork *) { wait_group.done(); });
+
+	for (const char *key : { "foo", "ask", "bar" })
+	{
+		auto *task = cluster.create_redis_task(RETRY_MAX, [key](WFRedisTask *task) {
+			protocol::RedisValue val;
+
+			EXPECT_EQ(task->get_state(), WFT_STATE_SUCCESS);
+			task->get_resp()->get_result(val);
+			EXPECT_TRUE(val.is_string());
+			EXPECT_EQ(val.string_value(), key);
+		});
+
+		task->get_req()->set_request("GET", {key});
+		series->push_back(task);
+	}
+
+	series->start();
+	wait_group.wait();
+	stop = true;
+	server.join();
+	close(listen_fds[0]);
+	close(listen_fds[1]);
+
+	/* ASKING goes right before the command, and is not sent again. */
+	auto asking = std::find(log.begin(), log.end(), "1 ASKING ");
+	ASSERT_TRUE(asking != log.end());
+	EXPECT_EQ(*(asking + 1), "1 GET ask");
+	EXPECT_EQ(std::count(log.begin(), log.end(), "1 ASKING "), 1);
+	EXPECT_EQ(std::count(log.begin(), log.end(), "1 GET foo"), 1);
+	EXPECT_EQ(std::count(log.begin(), log.end(), "0 GET bar"), 1);
+}
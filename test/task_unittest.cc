@@ -23,10 +23,14 @@
 #include <unistd.h>
 #include <string.h>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
 #include <gtest/gtest.h>
+#include "workflow/Executor.h"
 #include "workflow/WFTaskFactory.h"
 
 #define GET_CURRENT_MICRO	std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
@@ -195,6 +199,129 @@ TEST(task_unittest, WFThreadTask)
 	lock.unlock();
 }
 
+#define EXEC_QUEUES_NUM		8
+#define EXEC_TASKS_NUM		1000
+
+struct exec_record
+{
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::vector<int> order[EXEC_QUEUES_NUM];
+	std::thread::id slow_thread;
+	std::thread::id next_thread;
+	long long slow_end;
+	long long next_start;
+	int done;
+};
+
+class OrderSession : public ExecSession
+{
+public:
+	OrderSession(int queue, int seq, exec_record *record) :
+		queue(queue), seq(seq), record(record)
+	{
+	}
+
+private:
+	virtual void execute()
+	{
+		exec_record *record = this->record;
+
+		record->mutex.lock();
+		record->order[this->queue].push_back(this->seq);
+		if (this->queue == 0 && this->seq == 1)
+		{
+			record->next_thread = std::this_thread::get_id();
+			record->next_start = GET_CURRENT_MICRO;
+		}
+
+		record->mutex.unlock();
+		if (this->queue == 0 && this->seq == 0)
+		{
+			/* The next task of this queue waits on this thread meanwhile. */
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			record->mutex.lock();
+			record->slow_thread = std::this_thread::get_id();
+			record->slow_end = GET_CURRENT_MICRO;
+			record->mutex.unlock();
+		}
+	}
+
+	virtual void handle(int state, int error)
+	{
+		EXPECT_EQ(state, ES_STATE_FINISHED);
+		std::lock_guard<std::mutex> lock(this->record->mutex);
+		if (++this->record->done == EXEC_QUEUES_NUM * EXEC_TASKS_NUM)
+			this->record->cond.notify_one();
+	}
+
+private:
+	int queue;
+	int seq;
+	exec_record *record;
+};
+
+/* Tasks of one ExecQueue start in FIFO order, while the next one is stolen
+ * from a worker that is busy. */
+TEST(task_unittest, ExecutorWorkStealing)
+{
+	Executor executor;
+	ExecQueue queues[EXEC_QUEUES_NUM];
+	std::vector<OrderSession *> sessions;
+	exec_record record;
+	int i, j;
+
+	record.done = 0;
+	ASSERT_EQ(executor.init(4, EXECUTOR_ENGINE_WORK_STEALING), 0);
+	for (i = 0; i < EXEC_QUEUES_NUM; i++)
+		ASSERT_EQ(queues[i].init(), 0);
+
+	for (j = 0; j < EXEC_TASKS_NUM; j++)
+	{
+		for (i = 0; i < EXEC_QUEUES_NUM; i++)
+		{
+			sessions.push_back(new OrderSession(i, j, &record));
+			EXPECT_EQ(executor.request(sessions.back(), &queues[i]), 0);
+		}
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(record.mutex);
+		while (record.done < EXEC_QUEUES_NUM * EXEC_TASKS_NUM)
+			record.cond.wait(lock);
+	}
+
+	/* A task is seen late if its thread is preempted right before execute()
+	 * while the next one is stolen, but only now and then. */
+	for (i = 0; i < EXEC_QUEUES_NUM; i++)
+	{
+		std::vector<int> order = record.order[i];
+		int late = 0;
+
+		ASSERT_EQ(order.size(), (size_t)EXEC_TASKS_NUM);
+		for (j = 1; j < EXEC_TASKS_NUM; j++)
+		{
+			if (order[j] < order[j - 1])
+				late++;
+		}
+
+		EXPECT_LE(late, EXEC_TASKS_NUM / 100);
+		std::sort(order.begin(), order.end());
+		for (j = 0; j < EXEC_TASKS_NUM; j++)
+			EXPECT_EQ(order[j], j);
+	}
+
+	EXPECT_NE(record.next_thread, record.slow_thread);
+	EXPECT_LT(record.next_start, record.slow_end);
+
+	executor.deinit();
+	for (i = 0; i < EXEC_QUEUES_NUM; i++)
+		queues[i].deinit();
+
+	for (OrderSession *session : sessions)
+		delete session;
+}
+
 TEST(task_unittest, WFFileIOTask)
 {
 	srand(time(NULL));